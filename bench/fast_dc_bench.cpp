@@ -0,0 +1,565 @@
+//
+// Headless benchmark for the contouring & simplification pipeline
+// Public domain
+//
+// Sweeps every combination of the shapes, grid sizes, thread counts and simplification
+// presets given on the command line. Each combination is run for the warmup count
+// (discarded) and then the repetition count, and the median & 95th percentile of each
+// stage's time is reported along with the meshing's work counters. The shape is scaled with the grid so it always covers the
+// same fraction of it (as the demo's shapes do on its 128^3 grid).
+//
+// Usage:
+//
+//	fast_dc_bench -shapes cube,pill -sizes 64,128,256 -threads 1,4,0
+//		-simplify none,default -warmup 2 -reps 10 -csv results.csv -json results.json
+//
+//	-shapes		cube, cylinder, pill, corridor, torus (default all)
+//	-sizes		grid sizes in voxels (default 64,128)
+//	-threads	1 runs without a job system, 0 uses the hardware thread count (default 1,0)
+//	-simplify	none, default, demo, aggressive (default none,default)
+//	-warmup		runs discarded before timing each combination (default 1)
+//	-reps		timed runs for each combination (default 5)
+//	-csv, -json	write the results to a file as well as the summary to stdout
+//
+
+#include "fast_dc.h"
+#include "ng_job_system.h"
+#include "ng_mesh_simplify.h"
+
+#include <glm/glm.hpp>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+const char* SHAPE_NAMES[] = { "cube", "cylinder", "pill", "corridor", "torus" };
+const int NUM_SHAPES = sizeof(SHAPE_NAMES) / sizeof(SHAPE_NAMES[0]);
+
+enum BenchStage
+{
+	Stage_Scan,
+	Stage_Edge,
+	Stage_Intersection,
+	Stage_Normal,
+	Stage_Vertex,
+	Stage_Triangle,
+	Stage_Mesh,
+	Stage_SimplifyBuildEdges,
+	Stage_SimplifyFindCollapses,
+	Stage_SimplifyCollapse,
+	Stage_SimplifyRemove,
+	Stage_SimplifyCompact,
+	Stage_Simplify,
+	Stage_Total,
+	NUM_STAGES
+};
+
+const char* STAGE_NAMES[NUM_STAGES] =
+{
+	"scan", "edge", "intersection", "normal", "vertex", "triangle", "mesh",
+	"simplify_build_edges", "simplify_find_collapses", "simplify_collapse",
+	"simplify_remove", "simplify_compact", "simplify",
+	"total",
+};
+
+struct SimplifyPreset
+{
+	const char* name = nullptr;
+	bool enabled = false;
+	MeshSimplificationOptions options;
+};
+
+struct BenchOptions
+{
+	std::vector<int> shapes;
+	std::vector<int> sizes;
+	std::vector<int> threads;
+	std::vector<int> presets;
+
+	int warmup = 1;
+	int reps = 5;
+
+	const char* csvPath = nullptr;
+	const char* jsonPath = nullptr;
+};
+
+struct StageSummary
+{
+	double median = 0.0;
+	double p95 = 0.0;
+	double min = 0.0;
+	double max = 0.0;
+};
+
+struct BenchResult
+{
+	int shape = 0;
+	int gridSize = 0;
+	int threads = 0;
+	int preset = 0;
+
+	int numVertices = 0;
+	int numTriangles = 0;
+	int numSimplifiedTriangles = 0;
+
+	// the counters are the same for every run (other than the scratch memory, which
+	// varies with how the jobs are scheduled) so the last run's are kept
+	uint64_t densityEvaluations = 0;
+	uint64_t normalEvaluations = 0;
+	uint64_t hashProbes = 0;
+	uint64_t qefSolves = 0;
+	size_t peakScratchBytes = 0;
+
+	StageSummary stages[NUM_STAGES];
+};
+
+}
+
+// ----------------------------------------------------------------------------
+
+static std::vector<SimplifyPreset> SimplifyPresets()
+{
+	std::vector<SimplifyPreset> presets(4);
+
+	presets[0].name = "none";
+
+	presets[1].name = "default";
+	presets[1].enabled = true;
+
+	// the options the demo uses
+	presets[2].name = "demo";
+	presets[2].enabled = true;
+	presets[2].options.maxEdgeSize = 2.5f;
+
+	presets[3].name = "aggressive";
+	presets[3].enabled = true;
+	presets[3].options.edgeFraction = 0.25f;
+	presets[3].options.maxIterations = 20;
+	presets[3].options.targetPercentage = 0.01f;
+	presets[3].options.maxError = 5.f;
+	presets[3].options.maxEdgeSize = 8.f;
+	presets[3].options.minAngleCosine = 0.5f;
+
+	return presets;
+}
+
+// ----------------------------------------------------------------------------
+
+static int FindName(const char* name, const char* const* names, const int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (strcmp(name, names[i]) == 0)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+// ----------------------------------------------------------------------------
+
+// Parses a comma separated list of names (or integers when names is null). Returns
+// false if any entry isn't recognised.
+static bool ParseList(
+	const char* arg,
+	const char* const* names,
+	const int numNames,
+	std::vector<int>& values)
+{
+	values.clear();
+
+	std::string list(arg);
+	size_t start = 0;
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		end = end == std::string::npos ? list.size() : end;
+
+		const std::string item = list.substr(start, end - start);
+		start = end + 1;
+		if (item.empty())
+		{
+			continue;
+		}
+
+		if (names)
+		{
+			const int idx = FindName(item.c_str(), names, numNames);
+			if (idx == -1)
+			{
+				return false;
+			}
+
+			values.push_back(idx);
+		}
+		else
+		{
+			char* itemEnd = nullptr;
+			const long value = strtol(item.c_str(), &itemEnd, 10);
+			if (*itemEnd != '\0' || value < 0)
+			{
+				return false;
+			}
+
+			values.push_back((int)value);
+		}
+	}
+
+	return !values.empty();
+}
+
+// ----------------------------------------------------------------------------
+
+static bool ParseOptions(
+	const int argc,
+	char** argv,
+	const std::vector<SimplifyPreset>& presets,
+	BenchOptions& options)
+{
+	std::vector<const char*> presetNames;
+	for (const SimplifyPreset& preset: presets)
+	{
+		presetNames.push_back(preset.name);
+	}
+
+	for (int i = 0; i < NUM_SHAPES; i++)
+	{
+		options.shapes.push_back(i);
+	}
+
+	options.sizes = { 64, 128 };
+	options.threads = { 1, 0 };
+	options.presets = { 0, 1 };
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* option = argv[i];
+		const char* value = (i + 1) < argc ? argv[++i] : nullptr;
+		if (!value)
+		{
+			printf("Error: missing value for '%s'\n", option);
+			return false;
+		}
+
+		std::vector<int> values;
+		bool valid = true;
+		if (strcmp(option, "-shapes") == 0)
+		{
+			valid = ParseList(value, SHAPE_NAMES, NUM_SHAPES, options.shapes);
+		}
+		else if (strcmp(option, "-sizes") == 0)
+		{
+			valid = ParseList(value, nullptr, 0, options.sizes);
+		}
+		else if (strcmp(option, "-threads") == 0)
+		{
+			valid = ParseList(value, nullptr, 0, options.threads);
+		}
+		else if (strcmp(option, "-simplify") == 0)
+		{
+			valid = ParseList(value, presetNames.data(), (int)presetNames.size(), options.presets);
+		}
+		else if (strcmp(option, "-warmup") == 0)
+		{
+			valid = ParseList(value, nullptr, 0, values) && values.size() == 1;
+			options.warmup = valid ? values[0] : 0;
+		}
+		else if (strcmp(option, "-reps") == 0)
+		{
+			valid = ParseList(value, nullptr, 0, values) && values.size() == 1 && values[0] > 0;
+			options.reps = valid ? values[0] : 0;
+		}
+		else if (strcmp(option, "-csv") == 0)
+		{
+			options.csvPath = value;
+		}
+		else if (strcmp(option, "-json") == 0)
+		{
+			options.jsonPath = value;
+		}
+		else
+		{
+			printf("Error: unknown option '%s'\n", option);
+			return false;
+		}
+
+		if (!valid)
+		{
+			printf("Error: invalid value '%s' for '%s'\n", value, option);
+			return false;
+		}
+	}
+
+	for (const int size: options.sizes)
+	{
+		if (size < 8 || size > MAX_CHUNK_SIZE)
+		{
+			printf("Error: grid size %d is outside [8, %d]\n", size, MAX_CHUNK_SIZE);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+// Nearest rank percentile of the sorted times
+static double Percentile(const std::vector<double>& sorted, const double p)
+{
+	const int rank = (int)ceil(p * sorted.size());
+	return sorted[std::max(rank - 1, 0)];
+}
+
+// ----------------------------------------------------------------------------
+
+static StageSummary SummariseTimes(std::vector<double> times)
+{
+	std::sort(begin(times), end(times));
+
+	const size_t n = times.size();
+	StageSummary summary;
+	summary.median = (n & 1) ? times[n / 2] : (times[(n / 2) - 1] + times[n / 2]) * 0.5;
+	summary.p95 = Percentile(times, 0.95);
+	summary.min = times.front();
+	summary.max = times.back();
+	return summary;
+}
+
+// ----------------------------------------------------------------------------
+
+static void RunBenchmark(
+	const BenchOptions& options,
+	const SimplifyPreset& preset,
+	ngJobSystem* jobSystem,
+	BenchResult& result)
+{
+	// the shapes are 4 units across at most, so this matches the demo's scale of 32 on
+	// its 128^3 grid and keeps the shape centred in chunk (0, 0, 0)
+	const float scale = result.gridSize * 0.25f;
+	const float centre = result.gridSize * 0.5f;
+
+	CsgScene scene;
+	CsgAddPrimitive(scene, ConfigForShape((SuperPrimitiveConfig::Type)result.shape),
+		glm::mat4(scale, 0.f, 0.f, 0.f, 0.f, scale, 0.f, 0.f, 0.f, 0.f, scale, 0.f, centre, centre, centre, 1.f));
+	DensityProgram* density = CompileDensityProgram(scene);
+
+	std::vector<double> times[NUM_STAGES];
+	for (int run = 0; run < (options.warmup + options.reps); run++)
+	{
+		MeshingStats meshStats;
+		ChunkMesh chunk = GenerateChunkMesh(*density, glm::ivec3(0), result.gridSize, jobSystem, VertexPlacement(), &meshStats);
+
+		MeshSimplificationStats simplifyStats;
+		if (preset.enabled && chunk.mesh)
+		{
+			ngMeshSimplifier(chunk.mesh, vec4(0.f), preset.options, nullptr, &simplifyStats);
+		}
+
+		if (chunk.mesh)
+		{
+			result.numVertices = meshStats.numVertices;
+			result.numTriangles = meshStats.numTriangles;
+			result.numSimplifiedTriangles = chunk.mesh->numTriangles;
+		}
+
+		result.densityEvaluations = meshStats.densityEvaluations;
+		result.normalEvaluations = meshStats.normalEvaluations;
+		result.hashProbes = meshStats.hashProbes;
+		result.qefSolves = meshStats.qefSolves;
+		result.peakScratchBytes = meshStats.peakScratchBytes;
+
+		FreeChunkMesh(chunk);
+
+		if (run < options.warmup)
+		{
+			continue;
+		}
+
+		const double stageTimes[NUM_STAGES] =
+		{
+			meshStats.scanTime,
+			meshStats.edgeTime,
+			meshStats.intersectionTime,
+			meshStats.normalTime,
+			meshStats.vertexTime,
+			meshStats.triangleTime,
+			meshStats.totalTime,
+			simplifyStats.buildEdgesTime,
+			simplifyStats.findCollapsesTime,
+			simplifyStats.collapseTime,
+			simplifyStats.removeTime,
+			simplifyStats.compactTime,
+			simplifyStats.totalTime,
+			meshStats.totalTime + simplifyStats.totalTime,
+		};
+
+		for (int i = 0; i < NUM_STAGES; i++)
+		{
+			times[i].push_back(stageTimes[i]);
+		}
+	}
+
+	for (int i = 0; i < NUM_STAGES; i++)
+	{
+		result.stages[i] = SummariseTimes(times[i]);
+	}
+
+	DestroyDensityProgram(density);
+}
+
+// ----------------------------------------------------------------------------
+
+static bool WriteCsv(
+	const char* path,
+	const std::vector<BenchResult>& results,
+	const std::vector<SimplifyPreset>& presets,
+	const int reps)
+{
+	FILE* f = fopen(path, "w");
+	if (!f)
+	{
+		return false;
+	}
+
+	fprintf(f, "shape,grid_size,threads,simplify,vertices,triangles,simplified_triangles,"
+		"density_evaluations,normal_evaluations,hash_probes,qef_solves,peak_scratch_bytes,"
+		"stage,reps,median_ms,p95_ms,min_ms,max_ms\n");
+	for (const BenchResult& result: results)
+	for (int i = 0; i < NUM_STAGES; i++)
+	{
+		const StageSummary& stage = result.stages[i];
+		fprintf(f, "%s,%d,%d,%s,%d,%d,%d,%llu,%llu,%llu,%llu,%llu,%s,%d,%.4f,%.4f,%.4f,%.4f\n",
+			SHAPE_NAMES[result.shape], result.gridSize, result.threads, presets[result.preset].name,
+			result.numVertices, result.numTriangles, result.numSimplifiedTriangles,
+			(unsigned long long)result.densityEvaluations, (unsigned long long)result.normalEvaluations,
+			(unsigned long long)result.hashProbes, (unsigned long long)result.qefSolves,
+			(unsigned long long)result.peakScratchBytes,
+			STAGE_NAMES[i], reps, stage.median, stage.p95, stage.min, stage.max);
+	}
+
+	const bool ok = ferror(f) == 0;
+	fclose(f);
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool WriteJson(
+	const char* path,
+	const std::vector<BenchResult>& results,
+	const std::vector<SimplifyPreset>& presets,
+	const BenchOptions& options)
+{
+	FILE* f = fopen(path, "w");
+	if (!f)
+	{
+		return false;
+	}
+
+	fprintf(f, "{\n\t\"warmup\": %d,\n\t\"reps\": %d,\n\t\"results\": [\n", options.warmup, options.reps);
+	for (size_t r = 0; r < results.size(); r++)
+	{
+		const BenchResult& result = results[r];
+		fprintf(f, "\t\t{\n");
+		fprintf(f, "\t\t\t\"shape\": \"%s\",\n", SHAPE_NAMES[result.shape]);
+		fprintf(f, "\t\t\t\"gridSize\": %d,\n", result.gridSize);
+		fprintf(f, "\t\t\t\"threads\": %d,\n", result.threads);
+		fprintf(f, "\t\t\t\"simplify\": \"%s\",\n", presets[result.preset].name);
+		fprintf(f, "\t\t\t\"vertices\": %d,\n", result.numVertices);
+		fprintf(f, "\t\t\t\"triangles\": %d,\n", result.numTriangles);
+		fprintf(f, "\t\t\t\"simplifiedTriangles\": %d,\n", result.numSimplifiedTriangles);
+		fprintf(f, "\t\t\t\"densityEvaluations\": %llu,\n", (unsigned long long)result.densityEvaluations);
+		fprintf(f, "\t\t\t\"normalEvaluations\": %llu,\n", (unsigned long long)result.normalEvaluations);
+		fprintf(f, "\t\t\t\"hashProbes\": %llu,\n", (unsigned long long)result.hashProbes);
+		fprintf(f, "\t\t\t\"qefSolves\": %llu,\n", (unsigned long long)result.qefSolves);
+		fprintf(f, "\t\t\t\"peakScratchBytes\": %llu,\n", (unsigned long long)result.peakScratchBytes);
+		fprintf(f, "\t\t\t\"stages\": {\n");
+		for (int i = 0; i < NUM_STAGES; i++)
+		{
+			const StageSummary& stage = result.stages[i];
+			fprintf(f, "\t\t\t\t\"%s\": { \"median\": %.4f, \"p95\": %.4f, \"min\": %.4f, \"max\": %.4f }%s\n",
+				STAGE_NAMES[i], stage.median, stage.p95, stage.min, stage.max,
+				(i + 1) < NUM_STAGES ? "," : "");
+		}
+		fprintf(f, "\t\t\t}\n\t\t}%s\n", (r + 1) < results.size() ? "," : "");
+	}
+	fprintf(f, "\t]\n}\n");
+
+	const bool ok = ferror(f) == 0;
+	fclose(f);
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+	const std::vector<SimplifyPreset> presets = SimplifyPresets();
+
+	BenchOptions options;
+	if (!ParseOptions(argc, argv, presets, options))
+	{
+		return EXIT_FAILURE;
+	}
+
+	printf("%-9s %5s %7s %-10s %9s %9s %10s %10s %10s %10s\n",
+		"shape", "grid", "threads", "simplify", "tris", "simp tris",
+		"mesh med", "mesh p95", "total med", "total p95");
+
+	std::vector<BenchResult> results;
+	for (const int threads: options.threads)
+	{
+		ngJobSystem* jobSystem = threads == 1 ? nullptr : ngJobSystemCreate(threads);
+		const int numThreads = jobSystem ? ngJobSystemThreadCount(jobSystem) : 1;
+
+		for (const int shape: options.shapes)
+		for (const int size: options.sizes)
+		for (const int preset: options.presets)
+		{
+			BenchResult result;
+			result.shape = shape;
+			result.gridSize = size;
+			result.threads = numThreads;
+			result.preset = preset;
+			RunBenchmark(options, presets[preset], jobSystem, result);
+
+			printf("%-9s %5d %7d %-10s %9d %9d %10.2f %10.2f %10.2f %10.2f\n",
+				SHAPE_NAMES[shape], size, numThreads, presets[preset].name,
+				result.numTriangles, result.numSimplifiedTriangles,
+				result.stages[Stage_Mesh].median, result.stages[Stage_Mesh].p95,
+				result.stages[Stage_Total].median, result.stages[Stage_Total].p95);
+			fflush(stdout);
+
+			results.push_back(result);
+		}
+
+		ngJobSystemDestroy(jobSystem);
+	}
+
+	if (options.csvPath && !WriteCsv(options.csvPath, results, presets, options.reps))
+	{
+		printf("Error: failed to write '%s'\n", options.csvPath);
+		return EXIT_FAILURE;
+	}
+
+	if (options.jsonPath && !WriteJson(options.jsonPath, results, presets, options))
+	{
+		printf("Error: failed to write '%s'\n", options.jsonPath);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// ----------------------------------------------------------------------------
+
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <GL\glew.h>
 #include <SDL.h>
@@ -10,6 +11,7 @@
 #include "mesh.h"
 #include "qef_simd.h"
 #include "ng_mesh_simplify.h"
+#include "ng_trace.h"
 
 #include <imgui.h>
 #include "imgui_handlers.h"
@@ -200,53 +202,58 @@ void DrawFrame(
 
 // ----------------------------------------------------------------------------
 
-Mesh CreateGLMesh(MeshBuffer* buffer, const float meshScale, const MeshSimplificationOptions& options)
+static void PrintMeshCacheStats(const MeshCache* cache, const MeshBuffer* mesh, const double milliseconds)
 {
-	printf("Simplify iteration: error=%f\n", options.maxError);
+	MeshCacheStats stats;
+	GetMeshCacheStats(cache, &stats);
 
-	MeshBuffer* simplfiedMesh = new MeshBuffer;
-	simplfiedMesh->numVertices = buffer->numVertices;
-	simplfiedMesh->vertices = (MeshVertex*)malloc(sizeof(MeshVertex) * buffer->numVertices);
+	printf("mesh: %d %d (%.1f ms, cache: %d memory hits, %d disk hits, %d misses)\n",
+		mesh->numVertices, mesh->numTriangles, milliseconds, 
+		(int)stats.memoryHits, (int)stats.diskHits, (int)stats.misses);
+}
+
+// ----------------------------------------------------------------------------
+
+// The cached meshes are shared so the scaled copy is made here, the mesh is simplified
+// at its original size so maxEdgeSize is in voxels whatever the scale
+Mesh CreateGLMesh(const MeshBuffer* buffer, const float meshScale)
+{
+	MeshBuffer scaledMesh;
+	scaledMesh.numVertices = buffer->numVertices;
+	scaledMesh.vertices = (MeshVertex*)malloc(sizeof(MeshVertex) * glm::max(buffer->numVertices, 1));
 	for (int i = 0; i < buffer->numVertices; i++)
 	{
-		simplfiedMesh->vertices[i].xyz[0] = buffer->vertices[i].xyz[0];
-		simplfiedMesh->vertices[i].xyz[1] = buffer->vertices[i].xyz[1];
-		simplfiedMesh->vertices[i].xyz[2] = buffer->vertices[i].xyz[2];
-		simplfiedMesh->vertices[i].xyz[3] = 1.f;
-
-		simplfiedMesh->vertices[i].normal[0] = buffer->vertices[i].normal[0];
-		simplfiedMesh->vertices[i].normal[1] = buffer->vertices[i].normal[1];
-		simplfiedMesh->vertices[i].normal[2] = buffer->vertices[i].normal[2];
-		simplfiedMesh->vertices[i].normal[3] = 0.f;
-
-		simplfiedMesh->vertices[i].colour[0] = buffer->vertices[i].colour[0];
-		simplfiedMesh->vertices[i].colour[1] = buffer->vertices[i].colour[1];
-		simplfiedMesh->vertices[i].colour[2] = buffer->vertices[i].colour[2];
-		simplfiedMesh->vertices[i].colour[3] = buffer->vertices[i].colour[3];
-
-		simplfiedMesh->vertices[i].xyz[0] *= meshScale;
-		simplfiedMesh->vertices[i].xyz[1] *= meshScale;
-		simplfiedMesh->vertices[i].xyz[2] *= meshScale;
-		simplfiedMesh->vertices[i].xyz[3] = 1.f;
+		scaledMesh.vertices[i] = buffer->vertices[i];
+		scaledMesh.vertices[i].xyz = glm::vec4(glm::vec3(buffer->vertices[i].xyz) * meshScale, 1.f);
+		scaledMesh.vertices[i].normal.w = 0.f;
 	}
 
-	simplfiedMesh->numTriangles = buffer->numTriangles;
-	simplfiedMesh->triangles = (MeshTriangle*)malloc(sizeof(MeshTriangle) * buffer->numTriangles);
-	memcpy(&simplfiedMesh->triangles[0], &buffer->triangles[0], sizeof(buffer->triangles[0]) * buffer->numTriangles);
-
-	vec4 offset;
-	offset[0] = 0.f;
-	offset[1] = 0.f;
-	offset[2] = 0.f;
-	offset[3] = 0.f;
-
-	ngMeshSimplifier(simplfiedMesh, offset, options);
+	scaledMesh.numTriangles = buffer->numTriangles;
+	scaledMesh.triangles = buffer->triangles;
 
 	Mesh mesh;
 	mesh.initialise();
-	mesh.uploadData(simplfiedMesh);
+	mesh.uploadData(&scaledMesh);
+
+	free(scaledMesh.vertices);
+	return mesh;
+}
+
+// ----------------------------------------------------------------------------
+
+static MeshCacheResult GetMesh(MeshCache* cache, const SuperPrimitiveConfig& config, const MeshSimplificationOptions& options)
+{
+	MeshCacheRequest request;
+	request.config = config;
+	request.options = &options;
+
+	const Uint32 start = SDL_GetTicks();
+	MeshCacheResult mesh = GetMeshCacheMesh(cache, request);
+	if (mesh)
+	{
+		PrintMeshCacheStats(cache, mesh.get(), (double)(SDL_GetTicks() - start));
+	}
 
-	delete simplfiedMesh;
 	return mesh;
 }
 
@@ -330,10 +337,45 @@ int main(int argc, char** argv)
 	viewerOpts.meshScale = 1.f;
 	options.maxEdgeSize = 2.5f;
 
+	// "-trace file.json" records the first mesh's timeline for chrome://tracing and 
+	// "-cache dir" keeps the meshes in an existing directory between runs
+	const char* tracePath = nullptr;
+	const char* cacheDir = nullptr;
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (strcmp(argv[i], "-trace") == 0)
+		{
+			tracePath = argv[i + 1];
+		}
+		else if (strcmp(argv[i], "-cache") == 0)
+		{
+			cacheDir = argv[i + 1];
+		}
+	}
+
+	ngTraceEnable(tracePath != nullptr);
+
+	// the same shape & options are only meshed once
+	MeshCache* meshCache = CreateMeshCache(256 << 20, cacheDir);
+
 	SuperPrimitiveConfig primConfig = ConfigForShape(SuperPrimitiveConfig::Cube);
-	MeshBuffer* meshBuffer = GenerateMesh(primConfig);
+	MeshCacheResult meshBuffer = GetMesh(meshCache, primConfig, options);
+	if (!meshBuffer)
+	{
+		printf("Error: failed to generate the mesh\n");
+		return EXIT_FAILURE;
+	}
+
+	auto mesh = CreateGLMesh(meshBuffer.get(), viewerOpts.meshScale);
 
-	auto mesh = CreateGLMesh(meshBuffer, viewerOpts.meshScale, options);
+	if (tracePath)
+	{
+		ngTraceEnable(false);
+		if (!ngTraceWriteChromeJson(tracePath))
+		{
+			printf("Error: failed to write trace '%s'\n", tracePath);
+		}
+	}
 	std::vector<Mesh> meshes{mesh};
 
 	ImGui_ImplSdl_Init(window);
@@ -398,15 +440,20 @@ int main(int argc, char** argv)
 		{
 			viewerOpts.refreshModel = false;
 
-			free(meshBuffer->vertices);
-			free(meshBuffer->triangles);
-			delete meshBuffer;
+			MeshCacheResult refreshed = GetMesh(meshCache, primConfig, options);
+			if (refreshed)
+			{
+				for (auto& mesh: meshes)
+				{
+					mesh.destroy();
+				}
 
-			meshBuffer = GenerateMesh(primConfig);
-			mesh = CreateGLMesh(meshBuffer, viewerOpts.meshScale, options);
+				meshBuffer = refreshed;
+				mesh = CreateGLMesh(meshBuffer.get(), viewerOpts.meshScale);
 
-			meshes.clear();
-			meshes.push_back(mesh);
+				meshes.clear();
+				meshes.push_back(mesh);
+			}
 		}
 	}
 
@@ -415,6 +462,9 @@ int main(int argc, char** argv)
 		mesh.destroy();
 	}
 
+	meshBuffer.reset();
+	DestroyMeshCache(meshCache);
+
 	ImGui_ImplSdl_Shutdown();
 
 	SDL_GL_DeleteContext(context);
@@ -1,4 +1,5 @@
 #include	"mesh.h"
+#include	"ng_mesh_loader.h"
 
 #include	<stdio.h>
 #include	<algorithm>
@@ -63,3 +64,17 @@ void Mesh::destroy()
 	glDeleteVertexArrays(1, &vertexArrayObj_);
 }
 
+// ----------------------------------------------------------------------------
+
+MeshBuffer* LoadMeshFromFile(const std::string& filename)
+{
+	MeshBuffer* buffer = ngMeshLoadFromFile(filename.c_str());
+	if (!buffer)
+	{
+		printf("Error: failed to load mesh '%s'\n", filename.c_str());
+	}
+
+	return buffer;
+}
+
+// ----------------------------------------------------------------------------
@@ -3,24 +3,43 @@
 // Public Domain
 //
 
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_WARNINGS
+#endif
+
 #include "fast_dc.h"
+#include "fast_dc_internal.h"
 
+#include "ng_job_system.h"
+#include "ng_mapped_file.h"
 #include "ng_mesh_simplify.h"
+#include "ng_trace.h"
 #include "qef_simd.h"
 
 #include <glm/glm.hpp>
+#include <limits.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <unordered_map>
 
 // ----------------------------------------------------------------------------
 
-// TODO the winding field could be packed into the normal vec as the unused w component
+// The edge's axis and base lattice point are known from its key so only the intersection
+// parameter along the edge is stored, the normal is octahedral encoded and the winding 
+// is the low bit of the flags. See EncodeEdgeInfo and the decode functions below.
 struct EdgeInfo
 {
-	vec4 pos;
-	vec4 normal;
-	bool winding = false;
+	uint16_t t = 0;
+	int16_t normal[2] = { 0, 0 };
+	uint16_t flags = 0;
 };
 
+static_assert(sizeof(EdgeInfo) == 8, "EdgeInfo should be 8 bytes");
+
 // Ideally we'd use https://github.com/greg7mdp/sparsepp but fall back to STL
 #ifdef HAVE_SPARSEPP
 
@@ -43,6 +62,7 @@ struct EdgeInfo
 
 // ----------------------------------------------------------------------------
 
+using glm::ivec2;
 using glm::ivec4;
 using glm::vec4;
 using glm::vec3;
@@ -51,16 +71,125 @@ using glm::vec2;
 #ifdef _MSC_VER
 #define ALIGN16 __declspec(align(16))
 #else
-#define ALIGN16 __attribute__((aligned(16))
+#define ALIGN16 __attribute__((aligned(16)))
+#endif
+
+#ifdef _MSC_VER
+
+	#include <intrin.h>
+
+	static inline int CountTrailingZeros(const uint64_t v)
+	{
+		unsigned long idx = 0;
+		_BitScanForward64(&idx, v);
+		return (int)idx;
+	}
+
+	static inline int PopCount(const uint64_t v)
+	{
+		return (int)__popcnt64(v);
+	}
+
+#else
+
+	static inline int CountTrailingZeros(const uint64_t v)
+	{
+		return __builtin_ctzll(v);
+	}
+
+	static inline int PopCount(const uint64_t v)
+	{
+		return __builtin_popcountll(v);
+	}
+
 #endif
 
 // ----------------------------------------------------------------------------
 
-const int VOXEL_GRID_SIZE = 128;
+const int VOXEL_GRID_SIZE = MESH_GRID_SIZE;
 const float VOXEL_GRID_OFFSET = (float)VOXEL_GRID_SIZE / 2.f;
 
 // ----------------------------------------------------------------------------
 
+namespace {
+
+using MeshingClock = std::chrono::steady_clock;
+
+// The counts are gathered while the stages run as jobs, each job adds its counts once 
+// it's done so the atomics aren't contended. The stage times are measured on the calling
+// thread and written straight into the stats.
+struct MeshingCounters
+{
+	MeshingStats stats;
+	DensityCounters density;
+	std::atomic<uint64_t> hashProbes{ 0 };
+	std::atomic<uint64_t> qefSolves{ 0 };
+	std::atomic<uint64_t> intersectionTime{ 0 };
+	std::atomic<uint64_t> normalTime{ 0 };
+};
+
+// The time spent on a block of edges in nanoseconds
+struct EdgeTimes
+{
+	uint64_t intersection = 0;
+	uint64_t normal = 0;
+};
+
+}
+
+static inline uint64_t ElapsedNanoseconds(const MeshingClock::time_point& start, const MeshingClock::time_point& end)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+static inline void AddStageTime(
+	MeshingCounters* counters, 
+	double MeshingStats::*stage, 
+	const MeshingClock::time_point& start)
+{
+	if (counters)
+	{
+		counters->stats.*stage += ElapsedNanoseconds(start, MeshingClock::now()) / 1e6;
+	}
+}
+
+static inline void UpdatePeakScratch(MeshingCounters* counters, const size_t bytes)
+{
+	if (counters)
+	{
+		counters->stats.peakScratchBytes = std::max(counters->stats.peakScratchBytes, bytes);
+	}
+}
+
+// An estimate of a hash table's memory: the buckets plus a node for each entry
+template <typename Table>
+static size_t HashTableBytes(const Table& table)
+{
+	return 
+		(table.bucket_count() * sizeof(void*)) + 
+		(table.size() * (sizeof(typename Table::value_type) + (2 * sizeof(void*))));
+}
+
+static void FinishMeshingStats(
+	const MeshingCounters& counters, 
+	const MeshBuffer* mesh, 
+	const MeshingClock::time_point& start, 
+	MeshingStats* stats)
+{
+	*stats = counters.stats;
+	stats->intersectionTime = counters.intersectionTime / 1e6;
+	stats->normalTime = counters.normalTime / 1e6;
+	stats->totalTime = ElapsedNanoseconds(start, MeshingClock::now()) / 1e6;
+	stats->densityEvaluations = counters.density.points;
+	stats->normalEvaluations = counters.density.normals;
+	stats->hashProbes = counters.hashProbes;
+	stats->qefSolves = counters.qefSolves;
+	stats->numVertices = mesh ? mesh->numVertices : 0;
+	stats->numTriangles = mesh ? mesh->numTriangles : 0;
+}
+
+// ----------------------------------------------------------------------------
+
 static const vec4 AXIS_OFFSET[3] = 
 { 
 	vec4(1.f, 0.f, 0.f, 0.f),
@@ -118,31 +247,6 @@ const uint32_t ENCODED_EDGE_OFFSETS[12] =
 
 // ----------------------------------------------------------------------------
 
-// The "super primitve" -- use the parameters to configure different shapes from a single function
-// see https://www.shadertoy.com/view/MsVGWG
-
-float sdSuperprim(vec3 p, vec4 s, vec2 r) 
-{
-	const vec3 d = glm::abs(p) - vec3(s);
-
-	float q = glm::length(vec2(glm::max(d.x + r.x, 0.f), glm::max(d.y + r.x, 0.f)));
-	q += glm::min(-r.x, glm::max(d.x,d.y));
-    q = (glm::abs((q + s.w)) - s.w);
-
-    return glm::length(vec2(glm::max(q + r.y,0.f), 
-		glm::max(d.z + r.y, 0.f))) + glm::min(-r.y, glm::max(q, d.z));
-}
-
-// ----------------------------------------------------------------------------
-
-float Density(const SuperPrimitiveConfig& config, const vec4& p)
-{
-	const float scale = 32.f;
-	return sdSuperprim(vec3(p) / scale, vec4(config.s), vec2(config.r)) * scale;
-}
-
-// ----------------------------------------------------------------------------
-
 uint32_t EncodeVoxelUniqueID(const ivec4& idxPos)
 {
 	return idxPos.x | (idxPos.y << 10) | (idxPos.z << 20);
@@ -168,18 +272,70 @@ uint32_t EncodeAxisUniqueID(const int axis, const int x, const int y, const int
 
 // ----------------------------------------------------------------------------
 
-float FindIntersection(const SuperPrimitiveConfig& config, const vec4& p0, const vec4& p1)
+// The IDs keep their x|y|z layout so neighbours can be found with the offset tables above,
+// but the voxels and edges are processed in Z (Morton) order so that consecutive voxels 
+// are spatially close and share their edges, lattice values and output vertices
+
+static inline uint32_t SpreadMortonBits(uint32_t v)
+{
+	v &= 0x3ff;
+	v = (v | (v << 16)) & 0x030000ff;
+	v = (v | (v << 8)) & 0x0300f00f;
+	v = (v | (v << 4)) & 0x030c30c3;
+	v = (v | (v << 2)) & 0x09249249;
+	return v;
+}
+
+static inline uint32_t MortonCode(const uint32_t id)
+{
+	return 
+		(SpreadMortonBits(id) << 2) | 
+		(SpreadMortonBits(id >> 10) << 1) | 
+		(SpreadMortonBits(id >> 20) << 0);
+}
+
+// Sorts voxel or edge IDs into Z order, the edges on the same base voxel are ordered by axis
+static void SortByMortonOrder(std::vector<uint32_t>& ids)
+{
+	std::vector<uint64_t> keys(ids.size());
+	for (size_t i = 0; i < ids.size(); i++)
+	{
+		keys[i] = ((uint64_t)MortonCode(ids[i]) << 32) | ids[i];
+	}
+
+	std::sort(begin(keys), end(keys));
+
+	for (size_t i = 0; i < ids.size(); i++)
+	{
+		ids[i] = (uint32_t)keys[i];
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+float FindIntersection(const DensityProgram& density, const vec4& p0, const vec4& p1)
 {
 	const int FIND_EDGE_INFO_STEPS = 16;
 	const float FIND_EDGE_INFO_INCREMENT = 1.f / FIND_EDGE_INFO_STEPS;
 
-	float minValue = FLT_MAX;
+	vec4 points[FIND_EDGE_INFO_STEPS];
+	float densities[FIND_EDGE_INFO_STEPS];
+
 	float currentT = 0.f;
+	for (int i = 0; i < FIND_EDGE_INFO_STEPS; i++)
+	{
+		points[i] = glm::mix(p0, p1, currentT);
+		currentT += FIND_EDGE_INFO_INCREMENT;
+	}
+
+	EvaluateDensity(density, points, FIND_EDGE_INFO_STEPS, densities);
+
+	float minValue = FLT_MAX;
 	float t = 0.f;
+	currentT = 0.f;
 	for (int i = 0; i < FIND_EDGE_INFO_STEPS; i++)
 	{
-		const vec4 p = glm::mix(p0, p1, currentT);
-		const float	d = glm::abs(Density(config, p));
+		const float	d = glm::abs(densities[i]);
 		if (d < minValue)
 		{
 			t = currentT;
@@ -194,210 +350,2686 @@ float FindIntersection(const SuperPrimitiveConfig& config, const vec4& p0, const
 
 // ----------------------------------------------------------------------------
 
-static void FindActiveVoxels(
-	const SuperPrimitiveConfig& config,
-	VoxelIDSet& activeVoxels,
-	EdgeInfoMap& activeEdges)
+// Each chunk is sampled with a one voxel apron on its min faces and one extra layer of 
+// edges on its max faces. This means every voxel the chunk emits a quad for has all 12
+// of its edges available, and the apron voxels are calculated from exactly the same 
+// Hermite data as the matching voxels in the neighbouring chunk. The local lattice 
+// coords are offset by the apron so they are never negative when encoded.
+
+const int CHUNK_APRON = 1;
+
+static inline vec4 LatticeToWorld(const ivec4& chunkMin, const int x, const int y, const int z)
 {
-	for (int x = 0; x < VOXEL_GRID_SIZE; x++)
-	for (int y = 0; y < VOXEL_GRID_SIZE; y++)
-	for (int z = 0; z < VOXEL_GRID_SIZE; z++)
-	{
-		const ivec4 idxPos(x, y, z, 0);
-		const vec4 p = vec4(x - VOXEL_GRID_OFFSET, y - VOXEL_GRID_OFFSET, z - VOXEL_GRID_OFFSET, 1.f);
+	return vec4(
+		(float)(chunkMin.x + x - CHUNK_APRON), 
+		(float)(chunkMin.y + y - CHUNK_APRON), 
+		(float)(chunkMin.z + z - CHUNK_APRON), 
+		1.f);
+}
 
-		for (int axis = 0; axis < 3; axis++)
-		{
-			const vec4 q = p + AXIS_OFFSET[axis];
+// ----------------------------------------------------------------------------
+
+// Only the primitives near a region can affect the edges inside it. The margin keeps the 
+// density exact wherever it is within a voxel of the surface so the edge intersections &
+// normals are the same as with the whole scene.
+static DensityProgram* SpecialiseForRegion(const DensityProgram& density, const vec4& regionMin, const vec4& regionMax)
+{
+	return SpecialiseDensityProgram(density, vec3(regionMin) - vec3(1.f), vec3(regionMax) + vec3(1.f), 1.f);
+}
 
-			const float pDensity = Density(config, p);
-			const float qDensity = Density(config, q);
+// ----------------------------------------------------------------------------
 
-			const bool zeroCrossing = 
-				pDensity >= 0.f && qDensity < 0.f ||
-			    pDensity < 0.f && qDensity >= 0.f;
-			if (!zeroCrossing)
-			{
-				continue;
-			}
+static inline bool IsZeroCrossing(const float pDensity, const float qDensity)
+{
+	return 
+		pDensity >= 0.f && qDensity < 0.f ||
+		pDensity < 0.f && qDensity >= 0.f;
+}
 
-			const float t = FindIntersection(config, p, q);
-			const vec4 pos = vec4(glm::mix(glm::vec3(p), glm::vec3(q), t), 1.f);
+// ----------------------------------------------------------------------------
 
-			const float H = 0.001f;
-			const auto normal = glm::normalize(vec4(
-				Density(config, pos + vec4(H, 0.f, 0.f, 0.f)) - Density(config, pos - vec4(H, 0.f, 0.f, 0.f)), 
-				Density(config, pos + vec4(0.f, H, 0.f, 0.f)) - Density(config, pos - vec4(0.f, H, 0.f, 0.f)), 
-				Density(config, pos + vec4(0.f, 0.f, H, 0.f)) - Density(config, pos - vec4(0.f, 0.f, H, 0.f)), 
-				0.f));
+// The intersection is stored as a fraction of 2^16 so the steps FindIntersection uses 
+// (multiples of 1/16) are stored exactly and the positions are the same as unquantised
+const float EDGE_T_SCALE = 65536.f;
+const uint16_t EDGE_WINDING_FLAG = 1;
 
-			EdgeInfo info;
-			info.pos = pos;
-			info.normal = normal;
-			info.winding = pDensity >= 0.f;
+static inline vec4 EdgeInfoPosition(const EdgeInfo& info, const vec4& p, const int axis)
+{
+	const vec4 q = p + AXIS_OFFSET[axis];
+	return vec4(glm::mix(glm::vec3(p), glm::vec3(q), (float)info.t / EDGE_T_SCALE), 1.f);
+}
 
-			const auto code = EncodeAxisUniqueID(axis, x, y, z);
-			activeEdges[code] = info;
+// ----------------------------------------------------------------------------
 
-			const auto edgeNodes = EDGE_NODE_OFFSETS[axis];
-			for (int i = 0; i < 4; i++)
-			{
-				const auto nodeIdxPos = idxPos - edgeNodes[i];
-				const auto nodeID = EncodeVoxelUniqueID(nodeIdxPos);
-				activeVoxels.insert(nodeID);
-			}
-		}
+static inline vec4 EdgeInfoNormal(const EdgeInfo& info)
+{
+	const float x = (float)info.normal[0] / 32767.f;
+	const float y = (float)info.normal[1] / 32767.f;
+
+	vec3 n(x, y, 1.f - glm::abs(x) - glm::abs(y));
+	if (n.z < 0.f)
+	{
+		n.x = (1.f - glm::abs(y)) * (x >= 0.f ? 1.f : -1.f);
+		n.y = (1.f - glm::abs(x)) * (y >= 0.f ? 1.f : -1.f);
 	}
+
+	return vec4(glm::normalize(n), 0.f);
 }
 
 // ----------------------------------------------------------------------------
 
-static void GenerateVertexData(
-	const VoxelIDSet& voxels,
-	const EdgeInfoMap& edges,
-	VoxelIndexMap& vertexIndices,
-	MeshBuffer* buffer)
+static inline bool EdgeInfoWinding(const EdgeInfo& info)
 {
-	MeshVertex* vert = &buffer->vertices[0];
+	return (info.flags & EDGE_WINDING_FLAG) != 0;
+}
+
+// ----------------------------------------------------------------------------
 
-	int idxCounter = 0;
-	for (const auto& voxelID: voxels)
+static EdgeInfo EncodeEdgeInfo(const float t, const vec4& normal, const bool winding)
+{
+	EdgeInfo info;
+	info.t = (uint16_t)glm::min(t * EDGE_T_SCALE + 0.5f, 65535.f);
+	info.flags = winding ? EDGE_WINDING_FLAG : 0;
+
+	// project onto the octahedron and fold the lower half over the upper, a degenerate
+	// normal is stored as +z. The signed encoding keeps axis aligned normals exact.
+	const float l1 = glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+	vec2 oct = l1 > 0.f ? vec2(normal.x, normal.y) / l1 : vec2(0.f);
+	if (normal.z < 0.f)
 	{
-		ALIGN16 vec4 p[12];
-		ALIGN16 vec4 n[12];
+		oct = vec2(
+			(1.f - glm::abs(oct.y)) * (oct.x >= 0.f ? 1.f : -1.f),
+			(1.f - glm::abs(oct.x)) * (oct.y >= 0.f ? 1.f : -1.f));
+	}
 
-		int idx = 0;
-		for (int i = 0; i < 12; i++)
-		{
-			const auto edgeID = voxelID + ENCODED_EDGE_OFFSETS[i];				
-			const auto iter = edges.find(edgeID);
+	for (int i = 0; i < 2; i++)
+	{
+		info.normal[i] = (int16_t)glm::round(glm::clamp(oct[i], -1.f, 1.f) * 32767.f);
+	}
 
-			if (iter != end(edges))
-			{
-				const auto& info = iter->second;
-				const vec4 pos = info.pos;
-				const vec4 normal = info.normal;
+	return info;
+}
 
-				p[idx] = pos;
-				n[idx] = normal;
-				idx++;
-			}
-		}
+// ----------------------------------------------------------------------------
+
+// The two halves are timed separately when times is not null
+static EdgeInfo CalculateEdgeInfo(
+	const DensityProgram& density,
+	const vec4& p, 
+	const vec4& q, 
+	const float pDensity,
+	EdgeTimes* times)
+{
+	const auto start = times ? MeshingClock::now() : MeshingClock::time_point();
+
+	const float t = FindIntersection(density, p, q);
+	const vec4 pos = vec4(glm::mix(glm::vec3(p), glm::vec3(q), t), 1.f);
+
+	const auto found = times ? MeshingClock::now() : MeshingClock::time_point();
+	const vec4 normal = EvaluateDensityNormal(density, pos);
+
+	if (times)
+	{
+		const auto end = MeshingClock::now();
+		times->intersection += ElapsedNanoseconds(start, found);
+		times->normal += ElapsedNanoseconds(found, end);
+	}
+
+	return EncodeEdgeInfo(t, normal, pDensity >= 0.f);
+}
 
-		ALIGN16 vec4 nodePos;
-		qef_solve_from_points_4d(&p[0].x, &n[0].x, idx, &nodePos.x);
+// ----------------------------------------------------------------------------
+
+// The normals are unit length so when one is far from the average direction the voxel 
+// may contain a feature the QEF would preserve. Opposing normals (e.g. a thin sheet) 
+// have no average direction and always count as a feature.
+static bool HasDivergentNormals(const vec4* n, const int count, const vec4& average, const float featureCosine)
+{
+	const float length = glm::length(vec3(average));
+	if (length < 1e-6f)
+	{
+		return true;
+	}
 
-		vec4 nodeNormal;
-		for (int i = 0; i < idx; i++)
+	const vec3 direction = vec3(average) / length;
+	for (int i = 0; i < count; i++)
+	{
+		if (glm::dot(vec3(n[i]), direction) < featureCosine)
 		{
-			nodeNormal += n[i];
+			return true;
 		}
-		nodeNormal *= (1.f / (float)idx);
+	}
+
+	return false;
+}
+
+// ----------------------------------------------------------------------------
+
+// p and n must be 16 byte aligned, count is the number of active edges in the voxel. 
+// Returns true if the QEF was solved.
+static bool SolveVoxelVertex(
+	const VertexPlacement& placement, 
+	const vec4* p, 
+	const vec4* n, 
+	const int count, 
+	MeshVertex* vert)
+{
+	vec4 nodeNormal;
+	for (int i = 0; i < count; i++)
+	{
+		nodeNormal += n[i];
+	}
+	nodeNormal *= (1.f / (float)count);
 
-		vertexIndices[voxelID] = idxCounter++;
+	const bool solveQEF = 
+		placement.mode == VertexPlacement::QEF ||
+		(placement.mode == VertexPlacement::Auto && 
+			HasDivergentNormals(n, count, nodeNormal, placement.featureCosine));
 
-		buffer->numVertices++;
-		vert->xyz = nodePos;
-		vert->normal = nodeNormal;
-		vert++;
+	ALIGN16 vec4 nodePos;
+	if (solveQEF)
+	{
+		qef_solve_from_points_4d(&p[0].x, &n[0].x, count, &nodePos.x);
+	}
+	else
+	{
+		nodePos = vec4(0.f);
+		for (int i = 0; i < count; i++)
+		{
+			nodePos += p[i];
+		}
+		nodePos *= (1.f / (float)count);
 	}
 
+	// the buffer is malloc'd so every member is written, otherwise the output would differ
+	// from run to run
+	vert->xyz = nodePos;
+	vert->normal = nodeNormal;
+	vert->colour = vec4(0.f);
+	return solveQEF;
 }
 
 // ----------------------------------------------------------------------------
 
-static void GenerateTriangles(
-	const EdgeInfoMap& edges,
-	const VoxelIndexMap& vertexIndices,
-	MeshBuffer* buffer)
+// When the density is known to have the same sign over a whole block (e.g. the density at
+// the centre is further from the surface than the block's corners are from its centre) 
+// only the sign of the lattice values is used to find the active edges so these blocks 
+// are filled with that value instead of evaluating every point, and only the blocks which
+// may contain the surface are subdivided.
+
+const int LATTICE_BLOCK_SIZE = 32;
+const int LATTICE_LEAF_SIZE = 4;
+
+static void FillDensityBlock(
+	const DensityProgram& density,
+	const ivec4& chunkMin,
+	const int latticeSize,
+	const ivec4& blockMin,
+	const int blockSize,
+	std::vector<float>& lattice)
 {
-	MeshTriangle* tri = &buffer->triangles[0];
+	const ivec4 blockMax = glm::min(blockMin + ivec4(blockSize), ivec4(latticeSize));
 
-	for (const auto& pair: edges)
+	if (blockSize > LATTICE_LEAF_SIZE)
 	{
-		const auto& edge = pair.first;
-		const auto& info = pair.second;
+		const vec3 span = vec3(blockMax - blockMin - ivec4(1));
+		const vec4 blockOrigin = LatticeToWorld(chunkMin, blockMin.x, blockMin.y, blockMin.z);
 
-		const ivec4 basePos = DecodeVoxelUniqueID(edge);
-		const int axis = (edge >> 30) & 0xff;
+		// the block and its children only evaluate the primitives which can change the 
+		// sign of the density inside the block
+		DensityProgram* blockDensity = DensityProgramSize(density) > 1 ?
+			SpecialiseDensityProgram(density, vec3(blockOrigin), vec3(blockOrigin) + span, 0.f) : nullptr;
+		const DensityProgram* program = blockDensity ? blockDensity : &density;
 
-		const int nodeID = edge & ~0xc0000000;
-		const uint32_t voxelIDs[4] = 
+		float d = 0.f;
+		if (IsDensityUniform(*program, vec3(blockOrigin), vec3(blockOrigin) + span, &d))
 		{
-			nodeID - ENCODED_EDGE_NODE_OFFSETS[axis * 4 + 0],
-			nodeID - ENCODED_EDGE_NODE_OFFSETS[axis * 4 + 1],
-			nodeID - ENCODED_EDGE_NODE_OFFSETS[axis * 4 + 2],
-			nodeID - ENCODED_EDGE_NODE_OFFSETS[axis * 4 + 3],
-		};
+			for (int x = blockMin.x; x < blockMax.x; x++)
+			for (int y = blockMin.y; y < blockMax.y; y++)
+			{
+				float* row = &lattice[(x * latticeSize * latticeSize) + (y * latticeSize)];
+				for (int z = blockMin.z; z < blockMax.z; z++)
+				{
+					row[z] = d;
+				}
+			}
 
-		// attempt to find the 4 voxels which share this edge
-		int edgeVoxels[4];
-		int numFoundVoxels = 0;
-		for (int i = 0; i < 4; i++)
+			DestroyDensityProgram(blockDensity);
+			return;
+		}
+
+		const int childSize = blockSize / 2;
+		for (int i = 0; i < 8; i++)
 		{
-			const auto iter = vertexIndices.find(voxelIDs[i]);
-			if (iter != end(vertexIndices))
+			const ivec4 childMin = blockMin + ivec4(i & 1, (i >> 1) & 1, (i >> 2) & 1, 0) * childSize;
+			if (childMin.x < blockMax.x && childMin.y < blockMax.y && childMin.z < blockMax.z)
 			{
-				edgeVoxels[numFoundVoxels++] = iter->second;
+				FillDensityBlock(*program, chunkMin, latticeSize, childMin, childSize, lattice);
 			}
 		}
 
-		// we can only generate a quad (or two triangles) if all 4 are found
-		if (numFoundVoxels < 4)
+		DestroyDensityProgram(blockDensity);
+		return;
+	}
+
+	// the leaves are evaluated as a single batch
+	vec4 points[LATTICE_LEAF_SIZE * LATTICE_LEAF_SIZE * LATTICE_LEAF_SIZE];
+	float densities[LATTICE_LEAF_SIZE * LATTICE_LEAF_SIZE * LATTICE_LEAF_SIZE];
+
+	int count = 0;
+	for (int x = blockMin.x; x < blockMax.x; x++)
+	for (int y = blockMin.y; y < blockMax.y; y++)
+	for (int z = blockMin.z; z < blockMax.z; z++)
+	{
+		points[count++] = LatticeToWorld(chunkMin, x, y, z);
+	}
+
+	EvaluateDensity(density, points, count, densities);
+
+	count = 0;
+	for (int x = blockMin.x; x < blockMax.x; x++)
+	for (int y = blockMin.y; y < blockMax.y; y++)
+	for (int z = blockMin.z; z < blockMax.z; z++)
+	{
+		lattice[(x * latticeSize * latticeSize) + (y * latticeSize) + z] = densities[count++];
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void FillDensityLattice(
+	ngJobSystem* jobSystem,
+	const DensityProgram& density,
+	const ivec4& chunkMin,
+	const int latticeSize,
+	std::vector<float>& lattice)
+{
+	NG_TRACE_SCOPE("FillDensityLattice");
+
+	lattice.resize(latticeSize * latticeSize * latticeSize);
+
+	const int blockCount = (latticeSize + LATTICE_BLOCK_SIZE - 1) / LATTICE_BLOCK_SIZE;
+	ngJobParallelFor(jobSystem, blockCount * blockCount * blockCount, 1, [&](const int begin, const int end)
+	{
+		NG_TRACE_SCOPE("FillDensityBlocks");
+
+		for (int i = begin; i < end; i++)
 		{
-			continue;
+			const ivec4 block(i / (blockCount * blockCount), (i / blockCount) % blockCount, i % blockCount, 0);
+			FillDensityBlock(density, chunkMin, latticeSize, block * LATTICE_BLOCK_SIZE, LATTICE_BLOCK_SIZE, lattice);
 		}
+	});
+}
 
-		if (info.winding)
-		{
-			tri->indices_[0] = edgeVoxels[0];
-			tri->indices_[1] = edgeVoxels[1];
-			tri->indices_[2] = edgeVoxels[3];
-			tri++;
+// ----------------------------------------------------------------------------
 
-			tri->indices_[0] = edgeVoxels[0];
-			tri->indices_[1] = edgeVoxels[3];
-			tri->indices_[2] = edgeVoxels[2];
-			tri++;
-		}
-		else
-		{
-			tri->indices_[0] = edgeVoxels[0];
-			tri->indices_[1] = edgeVoxels[3];
-			tri->indices_[2] = edgeVoxels[1];
-			tri++;
+namespace {
 
-			tri->indices_[0] = edgeVoxels[0];
-			tri->indices_[1] = edgeVoxels[2];
-			tri->indices_[2] = edgeVoxels[3];
-			tri++;
-		}
+// The edges found in a single block of the lattice, the blocks are scanned in parallel
+// and then merged
+struct ActiveEdgeBlock
+{
+	std::vector<std::pair<uint32_t, EdgeInfo>> edges;
+	std::vector<uint32_t> voxels;
+};
 
-		buffer->numTriangles += 2;
+// The signs of the lattice packed one bit per sample along z (the lattice's contiguous 
+// axis), and for each axis a bit per edge which is set when the edge crosses the surface.
+// Each row of the lattice is rowWords words.
+struct SignLattice
+{
+	int size = 0;
+	int rowWords = 0;
+
+	std::vector<uint64_t> signs;
+	std::vector<uint64_t> crossings[3];
+
+	int rowIndex(const int x, const int y) const
+	{
+		return ((x * size) + y) * rowWords;
 	}
+};
+
 }
 
 // ----------------------------------------------------------------------------
 
-MeshBuffer* GenerateMesh(const SuperPrimitiveConfig& config)
+// An edge crosses the surface when its end points have different signs, so comparing 
+// whole rows finds 64 crossings at a time: the x & y edges XOR the row with the next row
+// along that axis, and the z edges XOR the row with itself shifted by one sample
+static void BuildSignLattice(
+	ngJobSystem* jobSystem,
+	const std::vector<float>& lattice,
+	const int latticeSize,
+	SignLattice& signLattice)
 {
-	VoxelIDSet activeVoxels;
-	EdgeInfoMap activeEdges;
+	NG_TRACE_SCOPE("BuildSignLattice");
 
-	FindActiveVoxels(config, activeVoxels, activeEdges);
-
-	MeshBuffer* buffer = new MeshBuffer;
-	buffer->vertices = (MeshVertex*)malloc(activeVoxels.size() * sizeof(MeshVertex));
-	buffer->numVertices = 0;
+	const int edgeCount = latticeSize - 1;
 
-	VoxelIndexMap vertexIndices;
-	GenerateVertexData(activeVoxels, activeEdges, vertexIndices, buffer);
+	signLattice.size = latticeSize;
+	signLattice.rowWords = (latticeSize + 63) / 64;
 
-	buffer->triangles = (MeshTriangle*)malloc(2 * activeEdges.size() * sizeof(MeshTriangle));
-	buffer->numTriangles = 0;
-	GenerateTriangles(activeEdges, vertexIndices, buffer);
+	const size_t numWords = (size_t)latticeSize * latticeSize * signLattice.rowWords;
+	signLattice.signs.assign(numWords, 0);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		signLattice.crossings[axis].assign(numWords, 0);
+	}
 
-	printf("mesh: %d %d\n", buffer->numVertices, buffer->numTriangles);
+	ngJobParallelFor(jobSystem, latticeSize, 4, [&](const int begin, const int end)
+	{
+		for (int x = begin; x < end; x++)
+		for (int y = 0; y < latticeSize; y++)
+		{
+			const float* densities = &lattice[(x * latticeSize * latticeSize) + (y * latticeSize)];
+			uint64_t* row = &signLattice.signs[signLattice.rowIndex(x, y)];
+			for (int z = 0; z < latticeSize; z++)
+			{
+				row[z >> 6] |= (uint64_t)(densities[z] < 0.f) << (z & 63);
+			}
+		}
+	});
+
+	ngJobParallelFor(jobSystem, edgeCount, 4, [&](const int begin, const int end)
+	{
+		for (int x = begin; x < end; x++)
+		for (int y = 0; y < edgeCount; y++)
+		{
+			const int rowIdx = signLattice.rowIndex(x, y);
+			const uint64_t* row = &signLattice.signs[rowIdx];
+			const uint64_t* rowX = &signLattice.signs[signLattice.rowIndex(x + 1, y)];
+			const uint64_t* rowY = &signLattice.signs[signLattice.rowIndex(x, y + 1)];
+
+			for (int w = 0; w < signLattice.rowWords; w++)
+			{
+				// only the edges which start inside the lattice exist
+				const int validBits = glm::min(64, edgeCount - (w * 64));
+				const uint64_t valid = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+
+				const uint64_t next = (w + 1) < signLattice.rowWords ? row[w + 1] : 0;
+				const uint64_t shifted = (row[w] >> 1) | (next << 63);
+
+				signLattice.crossings[0][rowIdx + w] = (row[w] ^ rowX[w]) & valid;
+				signLattice.crossings[1][rowIdx + w] = (row[w] ^ rowY[w]) & valid;
+				signLattice.crossings[2][rowIdx + w] = (row[w] ^ shifted) & valid;
+			}
+		}
+	});
+}
+
+// ----------------------------------------------------------------------------
+
+// The voxels which share the edge and have all their edges inside the lattice, only these
+// voxels get a vertex. Returns the number of voxels.
+static int FindEdgeVoxels(const int axis, const ivec4& idxPos, const int chunkSize, uint32_t* voxelIDs)
+{
+	int count = 0;
+
+	const auto edgeNodes = EDGE_NODE_OFFSETS[axis];
+	for (int i = 0; i < 4; i++)
+	{
+		const auto nodeIdxPos = idxPos - edgeNodes[i];
+		if (nodeIdxPos.x < 0 || nodeIdxPos.y < 0 || nodeIdxPos.z < 0 ||
+			nodeIdxPos.x > chunkSize || nodeIdxPos.y > chunkSize || nodeIdxPos.z > chunkSize)
+		{
+			continue;
+		}
+
+		voxelIDs[count++] = EncodeVoxelUniqueID(nodeIdxPos);
+	}
+
+	return count;
+}
+
+// ----------------------------------------------------------------------------
+
+// The edges are scanned in blocks so each block's part of a sign lattice row is a few bits
+// of one word, and each block which has any crossing edges gets its own program with only
+// the primitives near the block
+const int EDGE_BLOCK_SIZE = 8;
+
+static_assert((64 % EDGE_BLOCK_SIZE) == 0, "the blocks must not straddle the sign lattice words");
+
+static void FindActiveEdgesInBlock(
+	const DensityProgram& density,
+	const ivec4& chunkMin,
+	const int chunkSize,
+	const std::vector<float>& lattice,
+	const SignLattice& signLattice,
+	const ivec4& blockMin,
+	const ivec4& blockMax,
+	MeshingCounters* counters,
+	ActiveEdgeBlock& block)
+{
+	NG_TRACE_SCOPE("FindActiveEdgesInBlock");
+
+	const int edgeCount = chunkSize + 2;
+	const int latticeSize = edgeCount + 1;
+
+	// the block's part of each row is a few bits of a single word
+	const int word = blockMin.z >> 6;
+	const int shift = blockMin.z & 63;
+	const uint64_t mask = (1ull << (blockMax.z - blockMin.z)) - 1;
+
+	const auto rowCrossings = [&](const int axis, const int x, const int y)
+	{
+		return (signLattice.crossings[axis][signLattice.rowIndex(x, y) + word] >> shift) & mask;
+	};
+
+	// most blocks are empty space, count the crossings first so these are skipped 
+	// without touching the densities
+	int numCrossings = 0;
+	for (int x = blockMin.x; x < blockMax.x; x++)
+	for (int y = blockMin.y; y < blockMax.y; y++)
+	{
+		numCrossings += 
+			PopCount(rowCrossings(0, x, y)) + 
+			PopCount(rowCrossings(1, x, y)) + 
+			PopCount(rowCrossings(2, x, y));
+	}
+
+	if (numCrossings == 0)
+	{
+		return;
+	}
+
+	block.edges.reserve(numCrossings);
+
+	DensityProgram* blockDensity = nullptr;
+	if (DensityProgramSize(density) > 1)
+	{
+		blockDensity = SpecialiseForRegion(density, 
+			LatticeToWorld(chunkMin, blockMin.x, blockMin.y, blockMin.z), 
+			LatticeToWorld(chunkMin, blockMax.x, blockMax.y, blockMax.z));
+	}
+
+	const DensityProgram* program = blockDensity ? blockDensity : &density;
+
+	EdgeTimes times;
+	for (int x = blockMin.x; x < blockMax.x; x++)
+	for (int y = blockMin.y; y < blockMax.y; y++)
+	{
+		const uint64_t rowBits[3] = { rowCrossings(0, x, y), rowCrossings(1, x, y), rowCrossings(2, x, y) };
+
+		uint64_t active = rowBits[0] | rowBits[1] | rowBits[2];
+		while (active)
+		{
+			const int bit = CountTrailingZeros(active);
+			active &= active - 1;
+
+			const int z = blockMin.z + bit;
+			const ivec4 idxPos(x, y, z, 0);
+			const vec4 p = LatticeToWorld(chunkMin, x, y, z);
+			const float pDensity = lattice[(x * latticeSize * latticeSize) + (y * latticeSize) + z];
+
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (((rowBits[axis] >> bit) & 1) == 0)
+				{
+					continue;
+				}
+
+				const vec4 q = p + AXIS_OFFSET[axis];
+				const EdgeInfo info = CalculateEdgeInfo(*program, p, q, pDensity, counters ? &times : nullptr);
+
+				const auto code = EncodeAxisUniqueID(axis, x, y, z);
+				block.edges.push_back(std::make_pair(code, info));
+
+				uint32_t voxelIDs[4];
+				const int numVoxels = FindEdgeVoxels(axis, idxPos, chunkSize, voxelIDs);
+				block.voxels.insert(end(block.voxels), voxelIDs, voxelIDs + numVoxels);
+			}
+		}
+	}
+
+	if (counters)
+	{
+		counters->intersectionTime += times.intersection;
+		counters->normalTime += times.normal;
+	}
+
+	DestroyDensityProgram(blockDensity);
+}
+
+// ----------------------------------------------------------------------------
+
+static void FindActiveVoxels(
+	ngJobSystem* jobSystem,
+	const DensityProgram& density,
+	const ivec4& chunkMin,
+	const int chunkSize,
+	MeshingCounters* counters,
+	VoxelIDSet& activeVoxels,
+	EdgeInfoMap& activeEdges)
+{
+	NG_TRACE_SCOPE("FindActiveVoxels");
+
+	// edges are needed for the apron and the chunk's voxels, and the edges need the 
+	// density at both ends
+	const int edgeCount = chunkSize + 2;
+	const int latticeSize = edgeCount + 1;
+
+	const auto scanStart = MeshingClock::now();
+
+	std::vector<float> lattice;
+	FillDensityLattice(jobSystem, density, chunkMin, latticeSize, lattice);
+
+	SignLattice signLattice;
+	BuildSignLattice(jobSystem, lattice, latticeSize, signLattice);
+
+	AddStageTime(counters, &MeshingStats::scanTime, scanStart);
+	const auto edgeStart = MeshingClock::now();
+
+	// the blocks are visited in Z order so the merged edges & voxels are inserted in 
+	// spatially coherent batches
+	const int blockCount = (edgeCount + EDGE_BLOCK_SIZE - 1) / EDGE_BLOCK_SIZE;
+	std::vector<uint32_t> blockIDs;
+	blockIDs.reserve(blockCount * blockCount * blockCount);
+	for (int x = 0; x < blockCount; x++)
+	for (int y = 0; y < blockCount; y++)
+	for (int z = 0; z < blockCount; z++)
+	{
+		blockIDs.push_back(EncodeVoxelUniqueID(ivec4(x, y, z, 0)));
+	}
+
+	SortByMortonOrder(blockIDs);
+
+	std::vector<ActiveEdgeBlock> blocks(blockIDs.size());
+	ngJobParallelFor(jobSystem, (int)blockIDs.size(), 1, [&](const int begin, const int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			const ivec4 blockMin = DecodeVoxelUniqueID(blockIDs[i]) * EDGE_BLOCK_SIZE;
+			const ivec4 blockMax = glm::min(blockMin + ivec4(EDGE_BLOCK_SIZE), ivec4(edgeCount));
+			FindActiveEdgesInBlock(density, chunkMin, chunkSize, lattice, signLattice, blockMin, blockMax, counters, blocks[i]);
+		}
+	});
+
+	size_t blockBytes = blocks.size() * sizeof(ActiveEdgeBlock);
+	for (const ActiveEdgeBlock& block: blocks)
+	{
+		blockBytes += 
+			(block.edges.capacity() * sizeof(block.edges[0])) + 
+			(block.voxels.capacity() * sizeof(uint32_t));
+
+		for (const auto& pair: block.edges)
+		{
+			activeEdges[pair.first] = pair.second;
+		}
+
+		for (const uint32_t voxelID: block.voxels)
+		{
+			activeVoxels.insert(voxelID);
+		}
+
+		if (counters)
+		{
+			counters->hashProbes += block.edges.size() + block.voxels.size();
+		}
+	}
+
+	AddStageTime(counters, &MeshingStats::edgeTime, edgeStart);
+
+	size_t signBytes = signLattice.signs.capacity() * sizeof(uint64_t);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		signBytes += signLattice.crossings[axis].capacity() * sizeof(uint64_t);
+	}
+
+	UpdatePeakScratch(counters, 
+		(lattice.capacity() * sizeof(float)) + signBytes + blockBytes + 
+		HashTableBytes(activeEdges) + HashTableBytes(activeVoxels));
+}
+
+// ----------------------------------------------------------------------------
+
+// Instead of scanning the whole lattice follow the surface from the seed voxels: every
+// crossing edge of an active voxel is found, and the voxels which share that edge are 
+// visited in turn, so every surface component which contains a seed is found in full at 
+// a cost proportional to its area. Components without a seed can't be detected this way
+// so the search gives up (and the caller falls back to a full scan) if a seed no longer 
+// has any active voxel in its neighbourhood, i.e. the surface moved too far or vanished.
+static bool FindActiveVoxelsFromSeeds(
+	ngJobSystem* jobSystem,
+	const DensityProgram& density,
+	const ivec4& chunkMin,
+	const int chunkSize,
+	const ivec4* seedVoxels,
+	const int numSeeds,
+	VoxelIDSet& activeVoxels,
+	EdgeInfoMap& activeEdges)
+{
+	NG_TRACE_SCOPE("FindActiveVoxelsFromSeeds");
+
+	const ivec4 apron(CHUNK_APRON, CHUNK_APRON, CHUNK_APRON, 0);
+	const auto inChunk = [&](const ivec4& v)
+	{
+		return 
+			v.x >= 0 && v.y >= 0 && v.z >= 0 &&
+			v.x <= chunkSize && v.y <= chunkSize && v.z <= chunkSize;
+	};
+
+	// lattice points are shared by up to 8 voxels so cache the densities
+	std::unordered_map<uint32_t, float> densities;
+	const auto latticeDensity = [&](const ivec4& l)
+	{
+		const uint32_t key = EncodeVoxelUniqueID(l);
+		const auto iter = densities.find(key);
+		if (iter != densities.end())
+		{
+			return iter->second;
+		}
+
+		const float d = EvaluateDensity(density, LatticeToWorld(chunkMin, l.x, l.y, l.z));
+		densities[key] = d;
+		return d;
+	};
+
+	std::vector<uint32_t> stack;
+	for (int i = 0; i < numSeeds; i++)
+	{
+		const ivec4 seed = seedVoxels[i] - chunkMin + apron;
+		if (inChunk(seed))
+		{
+			stack.push_back(EncodeVoxelUniqueID(seed));
+		}
+	}
+
+	if (stack.empty())
+	{
+		return false;
+	}
+
+	VoxelIDSet visited;
+	std::vector<std::pair<uint32_t, float>> crossingEdges;
+	std::unordered_set<uint32_t> foundEdges;
+
+	while (!stack.empty())
+	{
+		const uint32_t voxelID = stack.back();
+		stack.pop_back();
+
+		if (!visited.insert(voxelID).second)
+		{
+			continue;
+		}
+
+		const ivec4 voxel = DecodeVoxelUniqueID(voxelID);
+		for (int i = 0; i < 12; i++)
+		{
+			const int axis = ENCODED_EDGE_OFFSETS[i] >> 30;
+			const ivec4 l = voxel + DecodeVoxelUniqueID(ENCODED_EDGE_OFFSETS[i]);
+
+			const float pDensity = latticeDensity(l);
+			const float qDensity = latticeDensity(l + ivec4(AXIS_OFFSET[axis]));
+			if (!IsZeroCrossing(pDensity, qDensity))
+			{
+				continue;
+			}
+
+			activeVoxels.insert(voxelID);
+
+			const uint32_t code = voxelID + ENCODED_EDGE_OFFSETS[i];
+			if (!foundEdges.insert(code).second)
+			{
+				continue;
+			}
+
+			crossingEdges.push_back(std::make_pair(code, pDensity));
+			for (int j = 0; j < 4; j++)
+			{
+				const ivec4 node = l - EDGE_NODE_OFFSETS[axis][j];
+				if (inChunk(node))
+				{
+					stack.push_back(EncodeVoxelUniqueID(node));
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < numSeeds; i++)
+	{
+		const ivec4 seed = seedVoxels[i] - chunkMin + apron;
+		if (!inChunk(seed) || activeVoxels.find(EncodeVoxelUniqueID(seed)) != activeVoxels.end())
+		{
+			continue;
+		}
+
+		bool anchored = false;
+		for (int n = 0; n < 27 && !anchored; n++)
+		{
+			const ivec4 neighbour = seed + ivec4((n % 3) - 1, ((n / 3) % 3) - 1, (n / 9) - 1, 0);
+			anchored = inChunk(neighbour) && activeVoxels.find(EncodeVoxelUniqueID(neighbour)) != activeVoxels.end();
+		}
+
+		if (!anchored)
+		{
+			activeVoxels.clear();
+			return false;
+		}
+	}
+
+	std::vector<EdgeInfo> infos(crossingEdges.size());
+	ngJobParallelFor(jobSystem, (int)crossingEdges.size(), 256, [&](const int begin, const int end)
+	{
+		NG_TRACE_SCOPE("CalculateSeedEdges");
+
+		for (int e = begin; e < end; e++)
+		{
+			const uint32_t code = crossingEdges[e].first;
+			const int axis = code >> 30;
+			const ivec4 l = DecodeVoxelUniqueID(code);
+			const vec4 p = LatticeToWorld(chunkMin, l.x, l.y, l.z);
+			infos[e] = CalculateEdgeInfo(density, p, p + AXIS_OFFSET[axis], crossingEdges[e].second, nullptr);
+		}
+	});
+
+	for (size_t e = 0; e < crossingEdges.size(); e++)
+	{
+		activeEdges[crossingEdges[e].first] = infos[e];
+	}
+
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+static void GenerateVertexData(
+	ngJobSystem* jobSystem,
+	const VertexPlacement& placement,
+	const ivec4& chunkMin,
+	const VoxelIDSet& voxels,
+	const EdgeInfoMap& edges,
+	MeshingCounters* counters,
+	VoxelIndexMap& vertexIndices,
+	MeshBuffer* buffer)
+{
+	NG_TRACE_SCOPE("GenerateVertexData");
+
+	const auto start = MeshingClock::now();
+
+	// the indices are assigned up front so the QEFs can be solved in any order, the Z 
+	// order means neighbouring voxels solve together and get nearby vertex indices
+	std::vector<uint32_t> voxelIDs(begin(voxels), end(voxels));
+	SortByMortonOrder(voxelIDs);
+
+	for (int i = 0; i < (int)voxelIDs.size(); i++)
+	{
+		vertexIndices[voxelIDs[i]] = i;
+	}
+
+	ngJobParallelFor(jobSystem, (int)voxelIDs.size(), 256, [&](const int begin, const int end)
+	{
+		NG_TRACE_SCOPE("SolveVoxelVertices");
+
+		uint64_t qefSolves = 0;
+		for (int v = begin; v < end; v++)
+		{
+			const uint32_t voxelID = voxelIDs[v];
+
+			ALIGN16 vec4 p[12];
+			ALIGN16 vec4 n[12];
+
+			int idx = 0;
+			for (int i = 0; i < 12; i++)
+			{
+				const auto edgeID = voxelID + ENCODED_EDGE_OFFSETS[i];				
+				const auto iter = edges.find(edgeID);
+
+				if (iter != edges.end())
+				{
+					const ivec4 l = DecodeVoxelUniqueID(edgeID);
+					const vec4 base = LatticeToWorld(chunkMin, l.x, l.y, l.z);
+
+					p[idx] = EdgeInfoPosition(iter->second, base, edgeID >> 30);
+					n[idx] = EdgeInfoNormal(iter->second);
+					idx++;
+				}
+			}
+
+			qefSolves += SolveVoxelVertex(placement, p, n, idx, &buffer->vertices[v]) ? 1 : 0;
+		}
+
+		if (counters)
+		{
+			counters->hashProbes += 12 * (end - begin);
+			counters->qefSolves += qefSolves;
+		}
+	});
+
+	buffer->numVertices = (int)voxelIDs.size();
+
+	if (counters)
+	{
+		counters->hashProbes += voxelIDs.size();
+	}
+
+	AddStageTime(counters, &MeshingStats::vertexTime, start);
+}
+
+// ----------------------------------------------------------------------------
+
+static void GenerateTriangles(
+	ngJobSystem* jobSystem,
+	const int chunkSize,
+	const EdgeInfoMap& edges,
+	const VoxelIndexMap& vertexIndices,
+	MeshingCounters* counters,
+	MeshBuffer* buffer)
+{
+	NG_TRACE_SCOPE("GenerateTriangles");
+
+	const auto start = MeshingClock::now();
+
+	// the triangles are emitted in Z order so each quad's vertices were recently used
+	std::vector<std::pair<uint64_t, const EdgeInfoMap::value_type*>> sortedEdges;
+	sortedEdges.reserve(edges.size());
+	for (const auto& pair: edges)
+	{
+		sortedEdges.push_back(std::make_pair(((uint64_t)MortonCode(pair.first) << 32) | pair.first, &pair));
+	}
+
+	std::sort(begin(sortedEdges), end(sortedEdges), [](const auto& a, const auto& b)
+	{
+		return a.first < b.first;
+	});
+
+	std::vector<const EdgeInfoMap::value_type*> edgeList(sortedEdges.size());
+	for (size_t i = 0; i < sortedEdges.size(); i++)
+	{
+		edgeList[i] = sortedEdges[i].second;
+	}
+
+	// the voxel lookups are done in parallel, a quad with x == -1 was not generated
+	std::vector<ivec4> edgeQuads(edgeList.size());
+	ngJobParallelFor(jobSystem, (int)edgeList.size(), 1024, [&](const int begin, const int end)
+	{
+		NG_TRACE_SCOPE("FindEdgeQuads");
+
+		uint64_t probes = 0;
+		for (int e = begin; e < end; e++)
+		{
+			const auto& edge = edgeList[e]->first;
+			edgeQuads[e] = ivec4(-1);
+
+			const ivec4 basePos = DecodeVoxelUniqueID(edge);
+			const int axis = (edge >> 30) & 0xff;
+
+			// the edges in the apron and on the max faces belong to the neighbouring chunks
+			if (basePos.x < CHUNK_APRON || basePos.y < CHUNK_APRON || basePos.z < CHUNK_APRON ||
+				basePos.x >= (chunkSize + CHUNK_APRON) || 
+				basePos.y >= (chunkSize + CHUNK_APRON) || 
+				basePos.z >= (chunkSize + CHUNK_APRON))
+			{
+				continue;
+			}
+
+			const int nodeID = edge & ~0xc0000000;
+			const uint32_t voxelIDs[4] = 
+			{
+				nodeID - ENCODED_EDGE_NODE_OFFSETS[axis * 4 + 0],
+				nodeID - ENCODED_EDGE_NODE_OFFSETS[axis * 4 + 1],
+				nodeID - ENCODED_EDGE_NODE_OFFSETS[axis * 4 + 2],
+				nodeID - ENCODED_EDGE_NODE_OFFSETS[axis * 4 + 3],
+			};
+
+			// attempt to find the 4 voxels which share this edge
+			int edgeVoxels[4];
+			int numFoundVoxels = 0;
+			probes += 4;
+			for (int i = 0; i < 4; i++)
+			{
+				const auto iter = vertexIndices.find(voxelIDs[i]);
+				if (iter != vertexIndices.end())
+				{
+					edgeVoxels[numFoundVoxels++] = iter->second;
+				}
+			}
+
+			// we can only generate a quad (or two triangles) if all 4 are found
+			if (numFoundVoxels == 4)
+			{
+				edgeQuads[e] = ivec4(edgeVoxels[0], edgeVoxels[1], edgeVoxels[2], edgeVoxels[3]);
+			}
+		}
+
+		if (counters)
+		{
+			counters->hashProbes += probes;
+		}
+	});
+
+	MeshTriangle* tri = &buffer->triangles[0];
+
+	for (int e = 0; e < (int)edgeList.size(); e++)
+	{
+		const auto& info = edgeList[e]->second;
+		const ivec4& edgeVoxels = edgeQuads[e];
+		if (edgeVoxels.x == -1)
+		{
+			continue;
+		}
+
+		if (EdgeInfoWinding(info))
+		{
+			tri->indices_[0] = edgeVoxels[0];
+			tri->indices_[1] = edgeVoxels[1];
+			tri->indices_[2] = edgeVoxels[3];
+			tri++;
+
+			tri->indices_[0] = edgeVoxels[0];
+			tri->indices_[1] = edgeVoxels[3];
+			tri->indices_[2] = edgeVoxels[2];
+			tri++;
+		}
+		else
+		{
+			tri->indices_[0] = edgeVoxels[0];
+			tri->indices_[1] = edgeVoxels[3];
+			tri->indices_[2] = edgeVoxels[1];
+			tri++;
+
+			tri->indices_[0] = edgeVoxels[0];
+			tri->indices_[1] = edgeVoxels[2];
+			tri->indices_[2] = edgeVoxels[3];
+			tri++;
+		}
+
+		buffer->numTriangles += 2;
+	}
+
+	AddStageTime(counters, &MeshingStats::triangleTime, start);
+	UpdatePeakScratch(counters, 
+		HashTableBytes(edges) + HashTableBytes(vertexIndices) + 
+		(edgeList.size() * (sizeof(sortedEdges[0]) + sizeof(edgeList[0]) + sizeof(edgeQuads[0]))));
+}
+
+// ----------------------------------------------------------------------------
+
+// Find the active voxels & edges, i.e. the Hermite data
+static void FindChunkEdges(
+	ngJobSystem* jobSystem,
+	const DensityProgram& density,
+	const ivec4& chunkMin,
+	const int chunkSize,
+	const ivec4* seedVoxels,
+	const int numSeeds,
+	MeshingCounters* counters,
+	VoxelIDSet& activeVoxels,
+	EdgeInfoMap& activeEdges)
+{
+	const int latticeEnd = chunkSize + 2;
+	DensityProgram* chunkDensity = SpecialiseForRegion(density, 
+		LatticeToWorld(chunkMin, 0, 0, 0), LatticeToWorld(chunkMin, latticeEnd, latticeEnd, latticeEnd));
+
+	// every program used for the chunk is specialised from this one
+	if (counters)
+	{
+		SetDensityProgramCounters(chunkDensity, &counters->density);
+	}
+
+	if (!seedVoxels || 
+		!FindActiveVoxelsFromSeeds(jobSystem, *chunkDensity, chunkMin, chunkSize, seedVoxels, numSeeds, activeVoxels, activeEdges))
+	{
+		FindActiveVoxels(jobSystem, *chunkDensity, chunkMin, chunkSize, counters, activeVoxels, activeEdges);
+	}
+
+	DestroyDensityProgram(chunkDensity);
+}
+
+// ----------------------------------------------------------------------------
+
+// Solve the vertices & generate the triangles from the Hermite data
+static MeshBuffer* BuildMeshFromEdges(
+	ngJobSystem* jobSystem,
+	const VertexPlacement& placement,
+	const ivec4& chunkMin,
+	const int chunkSize,
+	const VoxelIDSet& activeVoxels,
+	const EdgeInfoMap& activeEdges,
+	MeshingCounters* counters,
+	VoxelIndexMap& vertexIndices)
+{
+	MeshBuffer* buffer = new MeshBuffer;
+	buffer->vertices = (MeshVertex*)malloc(activeVoxels.size() * sizeof(MeshVertex));
+	buffer->numVertices = 0;
+
+	GenerateVertexData(jobSystem, placement, chunkMin, activeVoxels, activeEdges, counters, vertexIndices, buffer);
+
+	buffer->triangles = (MeshTriangle*)malloc(2 * activeEdges.size() * sizeof(MeshTriangle));
+	buffer->numTriangles = 0;
+	GenerateTriangles(jobSystem, chunkSize, activeEdges, vertexIndices, counters, buffer);
+
+	return buffer;
+}
+
+// ----------------------------------------------------------------------------
+
+static MeshBuffer* GenerateMeshForChunk(
+	ngJobSystem* jobSystem,
+	const VertexPlacement& placement,
+	const DensityProgram& density,
+	const ivec4& chunkMin,
+	const int chunkSize,
+	const ivec4* seedVoxels,
+	const int numSeeds,
+	MeshingCounters* counters,
+	VoxelIndexMap& vertexIndices)
+{
+	VoxelIDSet activeVoxels;
+	EdgeInfoMap activeEdges;
+	FindChunkEdges(jobSystem, density, chunkMin, chunkSize, seedVoxels, numSeeds, counters, activeVoxels, activeEdges);
+
+	return BuildMeshFromEdges(jobSystem, placement, chunkMin, chunkSize, activeVoxels, activeEdges, counters, vertexIndices);
+}
+
+// ----------------------------------------------------------------------------
+
+MeshBuffer* GenerateMesh(
+	const DensityProgram& density, 
+	ngJobSystem* jobSystem, 
+	const VertexPlacement& placement, 
+	MeshingStats* stats)
+{
+	NG_TRACE_SCOPE("GenerateMesh");
+
+	const auto start = MeshingClock::now();
+	const ivec4 gridMin(-(int)VOXEL_GRID_OFFSET);
+
+	MeshingCounters counters;
+	VoxelIndexMap vertexIndices;
+	MeshBuffer* buffer = GenerateMeshForChunk(jobSystem, placement, density, gridMin, VOXEL_GRID_SIZE, 
+		nullptr, 0, stats ? &counters : nullptr, vertexIndices);
+
+	if (stats)
+	{
+		FinishMeshingStats(counters, buffer, start, stats);
+	}
+
+	return buffer;
+}
+
+// ----------------------------------------------------------------------------
+
+MeshBuffer* GenerateMesh(
+	const SuperPrimitiveConfig& config, 
+	ngJobSystem* jobSystem, 
+	const VertexPlacement& placement, 
+	MeshingStats* stats)
+{
+	DensityProgram* density = CompileSuperPrimitive(config);
+	if (!density)
+	{
+		return nullptr;
+	}
+
+	MeshBuffer* buffer = GenerateMesh(*density, jobSystem, placement, stats);
+	DestroyDensityProgram(density);
+	return buffer;
+}
+
+// ----------------------------------------------------------------------------
+
+void FreeMeshBuffer(MeshBuffer* mesh)
+{
+	if (mesh)
+	{
+		free(mesh->vertices);
+		free(mesh->triangles);
+		delete mesh;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+// All the edges with their base on a single lattice plane (i.e. the x edges between this
+// plane and the next, and the y & z edges in the plane). Index is -1 for inactive edges.
+struct StreamingEdgePlane
+{
+	std::vector<int> index[3];
+	std::vector<EdgeInfo> edges;
+};
+
+struct StreamingGrid
+{
+	ivec4 min;
+	ivec4 size;
+
+	int planeIndex(const int y, const int z) const
+	{
+		return (y * (size.z + 1)) + z;
+	}
+
+	vec4 worldPos(const int x, const int y, const int z) const
+	{
+		return vec4((float)(min.x + x), (float)(min.y + y), (float)(min.z + z), 1.f);
+	}
+};
+
+// The slab between two lattice planes is split into tiles and each tile gets its own
+// program with only the primitives near it, created when the tile is first needed
+struct StreamingSlabDensity
+{
+	const DensityProgram* density = nullptr;
+	int x0 = 0;
+	int x1 = 0;
+	int tilesPerRow = 0;
+	std::vector<DensityProgram*> tiles;
+};
+
+}
+
+// ----------------------------------------------------------------------------
+
+const int STREAMING_TILE_SIZE = 16;
+
+static void FreeSlabDensity(StreamingSlabDensity& slab)
+{
+	for (DensityProgram* program: slab.tiles)
+	{
+		DestroyDensityProgram(program);
+	}
+
+	slab.tiles.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+static void ResetSlabDensity(
+	const DensityProgram& density, 
+	const StreamingGrid& grid, 
+	const int x0, 
+	const int x1, 
+	StreamingSlabDensity& slab)
+{
+	FreeSlabDensity(slab);
+
+	slab.density = &density;
+	slab.x0 = x0;
+	slab.x1 = x1;
+	slab.tilesPerRow = (grid.size.z / STREAMING_TILE_SIZE) + 1;
+	slab.tiles.assign(((grid.size.y / STREAMING_TILE_SIZE) + 1) * slab.tilesPerRow, nullptr);
+}
+
+// ----------------------------------------------------------------------------
+
+static const DensityProgram& SlabTileDensity(
+	const StreamingGrid& grid, 
+	StreamingSlabDensity& slab, 
+	const int y, 
+	const int z)
+{
+	if (DensityProgramSize(*slab.density) <= 1)
+	{
+		return *slab.density;
+	}
+
+	const int tileY = y / STREAMING_TILE_SIZE;
+	const int tileZ = z / STREAMING_TILE_SIZE;
+	DensityProgram*& program = slab.tiles[(tileY * slab.tilesPerRow) + tileZ];
+	if (!program)
+	{
+		const int y0 = tileY * STREAMING_TILE_SIZE;
+		const int z0 = tileZ * STREAMING_TILE_SIZE;
+		program = SpecialiseForRegion(*slab.density, 
+			grid.worldPos(slab.x0, y0, z0), 
+			grid.worldPos(slab.x1, y0 + STREAMING_TILE_SIZE, z0 + STREAMING_TILE_SIZE));
+	}
+
+	return *program;
+}
+
+// ----------------------------------------------------------------------------
+
+static void FillDensityPlane(
+	StreamingSlabDensity& density,
+	const StreamingGrid& grid,
+	const int x,
+	std::vector<float>& plane)
+{
+	NG_TRACE_SCOPE("FillDensityPlane");
+
+	vec4 points[STREAMING_TILE_SIZE];
+	for (int y = 0; y <= grid.size.y; y++)
+	for (int z0 = 0; z0 <= grid.size.z; z0 += STREAMING_TILE_SIZE)
+	{
+		const int count = glm::min(STREAMING_TILE_SIZE, grid.size.z + 1 - z0);
+		for (int i = 0; i < count; i++)
+		{
+			points[i] = grid.worldPos(x, y, z0 + i);
+		}
+
+		EvaluateDensity(SlabTileDensity(grid, density, y, z0), points, count, &plane[grid.planeIndex(y, z0)]);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void FindPlaneEdges(
+	StreamingSlabDensity& density,
+	const StreamingGrid& grid,
+	const int x,
+	const int axis,
+	const std::vector<float>& plane,
+	const std::vector<float>& nextPlane,
+	StreamingEdgePlane& edges)
+{
+	NG_TRACE_SCOPE("FindPlaneEdges");
+
+	std::vector<int>& index = edges.index[axis];
+	for (int y = 0; y <= grid.size.y; y++)
+	for (int z = 0; z <= grid.size.z; z++)
+	{
+		const int idx = grid.planeIndex(y, z);
+		index[idx] = -1;
+
+		float qDensity = 0.f;
+		if (axis == 0)
+		{
+			qDensity = nextPlane[idx];
+		}
+		else if (axis == 1 && y < grid.size.y)
+		{
+			qDensity = plane[grid.planeIndex(y + 1, z)];
+		}
+		else if (axis == 2 && z < grid.size.z)
+		{
+			qDensity = plane[grid.planeIndex(y, z + 1)];
+		}
+		else
+		{
+			continue;
+		}
+
+		const float pDensity = plane[idx];
+		if (!IsZeroCrossing(pDensity, qDensity))
+		{
+			continue;
+		}
+
+		const vec4 p = grid.worldPos(x, y, z);
+		index[idx] = (int)edges.edges.size();
+		edges.edges.push_back(CalculateEdgeInfo(SlabTileDensity(grid, density, y, z), p, p + AXIS_OFFSET[axis], pDensity, nullptr));
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+// Solve the vertices for the layer of voxels between two edge planes, the vertex indices
+// are written to layerIndices
+static void SolveVoxelLayer(
+	const VertexPlacement& placement,
+	const StreamingGrid& grid,
+	const int x,
+	const StreamingEdgePlane& edges,
+	const StreamingEdgePlane& nextEdges,
+	int& vertexCount,
+	std::vector<int>& layerIndices,
+	std::vector<MeshVertex>& vertices)
+{
+	NG_TRACE_SCOPE("SolveVoxelLayer");
+
+	vertices.clear();
+
+	for (int y = 0; y < grid.size.y; y++)
+	for (int z = 0; z < grid.size.z; z++)
+	{
+		ALIGN16 vec4 p[12];
+		ALIGN16 vec4 n[12];
+
+		// same order as ENCODED_EDGE_OFFSETS so the solved vertex is identical to the
+		// non-streaming path
+		int idx = 0;
+		for (int i = 0; i < 12; i++)
+		{
+			const int axis = ENCODED_EDGE_OFFSETS[i] >> 30;
+			const ivec4 offset = DecodeVoxelUniqueID(ENCODED_EDGE_OFFSETS[i]);
+
+			const StreamingEdgePlane& plane = offset.x ? nextEdges : edges;
+			const int edgeIdx = plane.index[axis][grid.planeIndex(y + offset.y, z + offset.z)];
+			if (edgeIdx != -1)
+			{
+				const vec4 base = grid.worldPos(x + offset.x, y + offset.y, z + offset.z);
+				p[idx] = EdgeInfoPosition(plane.edges[edgeIdx], base, axis);
+				n[idx] = EdgeInfoNormal(plane.edges[edgeIdx]);
+				idx++;
+			}
+		}
+
+		const int layerIdx = (y * grid.size.z) + z;
+		if (idx == 0)
+		{
+			layerIndices[layerIdx] = -1;
+			continue;
+		}
+
+		MeshVertex vert;
+		SolveVoxelVertex(placement, p, n, idx, &vert);
+		vertices.push_back(vert);
+
+		layerIndices[layerIdx] = vertexCount++;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void EmitPlaneQuads(
+	const StreamingGrid& grid,
+	const int x,
+	const int axis,
+	const StreamingEdgePlane& edges,
+	const std::vector<int>* layerIndices[2],
+	std::vector<MeshTriangle>& triangles)
+{
+	NG_TRACE_SCOPE("EmitPlaneQuads");
+
+	const std::vector<int>& index = edges.index[axis];
+	for (int y = 0; y <= grid.size.y; y++)
+	for (int z = 0; z <= grid.size.z; z++)
+	{
+		const int edgeIdx = index[grid.planeIndex(y, z)];
+		if (edgeIdx == -1)
+		{
+			continue;
+		}
+
+		int edgeVoxels[4];
+		int numFoundVoxels = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			const ivec4 voxel = ivec4(x, y, z, 0) - EDGE_NODE_OFFSETS[axis][i];
+			if (voxel.x < 0 || voxel.y < 0 || voxel.z < 0 ||
+				voxel.x >= grid.size.x || voxel.y >= grid.size.y || voxel.z >= grid.size.z)
+			{
+				break;
+			}
+
+			// layerIndices[1] is the layer at x, layerIndices[0] the layer before it
+			const std::vector<int>* layer = layerIndices[voxel.x - x + 1];
+			const int vertexIdx = layer ? (*layer)[(voxel.y * grid.size.z) + voxel.z] : -1;
+			if (vertexIdx == -1)
+			{
+				break;
+			}
+
+			edgeVoxels[numFoundVoxels++] = vertexIdx;
+		}
+
+		if (numFoundVoxels < 4)
+		{
+			continue;
+		}
+
+		MeshTriangle tri[2];
+		if (EdgeInfoWinding(edges.edges[edgeIdx]))
+		{
+			tri[0].indices_[0] = edgeVoxels[0];
+			tri[0].indices_[1] = edgeVoxels[1];
+			tri[0].indices_[2] = edgeVoxels[3];
+
+			tri[1].indices_[0] = edgeVoxels[0];
+			tri[1].indices_[1] = edgeVoxels[3];
+			tri[1].indices_[2] = edgeVoxels[2];
+		}
+		else
+		{
+			tri[0].indices_[0] = edgeVoxels[0];
+			tri[0].indices_[1] = edgeVoxels[3];
+			tri[0].indices_[2] = edgeVoxels[1];
+
+			tri[1].indices_[0] = edgeVoxels[0];
+			tri[1].indices_[1] = edgeVoxels[2];
+			tri[1].indices_[2] = edgeVoxels[3];
+		}
+
+		triangles.push_back(tri[0]);
+		triangles.push_back(tri[1]);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+void GenerateMeshStreaming(
+	const DensityProgram& density,
+	const glm::ivec3& gridMin,
+	const glm::ivec3& gridSize,
+	const MeshStream& stream,
+	const VertexPlacement& placement)
+{
+	NG_TRACE_SCOPE("GenerateMeshStreaming");
+
+	if (gridSize.x < 1 || gridSize.y < 1 || gridSize.z < 1)
+	{
+		return;
+	}
+
+	StreamingGrid grid;
+	grid.min = ivec4(gridMin, 0);
+	grid.size = ivec4(gridSize, 0);
+
+	// two of everything: the densities and edges for the current plane and the next, and 
+	// the vertex indices for the previous voxel layer and the current one
+	const int planeSize = (grid.size.y + 1) * (grid.size.z + 1);
+	std::vector<float> densities[2];
+	StreamingEdgePlane edgePlanes[2];
+	for (int i = 0; i < 2; i++)
+	{
+		densities[i].resize(planeSize);
+		for (int axis = 0; axis < 3; axis++)
+		{
+			edgePlanes[i].index[axis].resize(planeSize, -1);
+		}
+	}
+
+	std::vector<int> layerIndices[2];
+	layerIndices[0].resize(grid.size.y * grid.size.z, -1);
+	layerIndices[1].resize(grid.size.y * grid.size.z, -1);
+
+	std::vector<MeshVertex> vertices;
+	std::vector<MeshTriangle> triangles;
+	int vertexCount = 0;
+
+	int curr = 0;
+	StreamingSlabDensity slabDensity;
+	ResetSlabDensity(density, grid, 0, 0, slabDensity);
+	FillDensityPlane(slabDensity, grid, 0, densities[curr]);
+	FindPlaneEdges(slabDensity, grid, 0, 1, densities[curr], densities[curr], edgePlanes[curr]);
+	FindPlaneEdges(slabDensity, grid, 0, 2, densities[curr], densities[curr], edgePlanes[curr]);
+
+	for (int x = 0; x < grid.size.x; x++)
+	{
+		const int next = curr ^ 1;
+
+		ResetSlabDensity(density, grid, x, x + 1, slabDensity);
+		FillDensityPlane(slabDensity, grid, x + 1, densities[next]);
+		FindPlaneEdges(slabDensity, grid, x, 0, densities[curr], densities[next], edgePlanes[curr]);
+
+		edgePlanes[next].edges.clear();
+		FindPlaneEdges(slabDensity, grid, x + 1, 1, densities[next], densities[next], edgePlanes[next]);
+		FindPlaneEdges(slabDensity, grid, x + 1, 2, densities[next], densities[next], edgePlanes[next]);
+
+		// the voxel layer between this plane and the next is now complete
+		std::swap(layerIndices[0], layerIndices[1]);
+		SolveVoxelLayer(placement, grid, x, edgePlanes[curr], edgePlanes[next], vertexCount, layerIndices[1], vertices);
+
+		if (!vertices.empty() && stream.addVertices)
+		{
+			stream.addVertices(stream.userData, &vertices[0], (int)vertices.size());
+		}
+
+		// the x edges only touch this layer, the y & z edges in this plane also touch the 
+		// previous layer
+		const std::vector<int>* layers[2] = { x > 0 ? &layerIndices[0] : nullptr, &layerIndices[1] };
+
+		triangles.clear();
+		EmitPlaneQuads(grid, x, 0, edgePlanes[curr], layers, triangles);
+		EmitPlaneQuads(grid, x, 1, edgePlanes[curr], layers, triangles);
+		EmitPlaneQuads(grid, x, 2, edgePlanes[curr], layers, triangles);
+
+		if (!triangles.empty() && stream.addTriangles)
+		{
+			stream.addTriangles(stream.userData, &triangles[0], (int)triangles.size());
+		}
+
+		curr = next;
+	}
+
+	FreeSlabDensity(slabDensity);
+}
+
+// ----------------------------------------------------------------------------
+
+static void FillVertexVoxels(const ivec4& chunkMin, const VoxelIndexMap& vertexIndices, ChunkMesh& chunk)
+{
+	chunk.vertexVoxels = (ivec4*)malloc(chunk.mesh->numVertices * sizeof(ivec4));
+	for (const auto& pair: vertexIndices)
+	{
+		chunk.vertexVoxels[pair.second] = chunkMin + DecodeVoxelUniqueID(pair.first) - ivec4(CHUNK_APRON, CHUNK_APRON, CHUNK_APRON, 0);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static ChunkMesh BuildChunkMesh(
+	ngJobSystem* jobSystem,
+	const VertexPlacement& placement,
+	const DensityProgram& density,
+	const glm::ivec3& chunkCoord, 
+	const int chunkSize,
+	const ivec4* seedVoxels,
+	const int numSeeds,
+	MeshingStats* stats)
+{
+	ChunkMesh chunk;
+	if (chunkSize < 1 || chunkSize > MAX_CHUNK_SIZE)
+	{
+		return chunk;
+	}
+
+	const auto start = MeshingClock::now();
+	const ivec4 chunkMin(chunkCoord * chunkSize, 0);
+
+	MeshingCounters counters;
+	VoxelIndexMap vertexIndices;
+	chunk.mesh = GenerateMeshForChunk(jobSystem, placement, density, chunkMin, chunkSize, 
+		seedVoxels, numSeeds, stats ? &counters : nullptr, vertexIndices);
+	FillVertexVoxels(chunkMin, vertexIndices, chunk);
+
+	if (stats)
+	{
+		FinishMeshingStats(counters, chunk.mesh, start, stats);
+	}
+
+	return chunk;
+}
+
+// ----------------------------------------------------------------------------
+
+ChunkMesh GenerateChunkMesh(
+	const DensityProgram& density,
+	const glm::ivec3& chunkCoord, 
+	const int chunkSize,
+	ngJobSystem* jobSystem,
+	const VertexPlacement& placement,
+	MeshingStats* stats)
+{
+	return BuildChunkMesh(jobSystem, placement, density, chunkCoord, chunkSize, nullptr, 0, stats);
+}
+
+// ----------------------------------------------------------------------------
+
+ChunkMesh GenerateChunkMeshFromSeeds(
+	const DensityProgram& density,
+	const glm::ivec3& chunkCoord, 
+	const int chunkSize,
+	const glm::ivec4* seedVoxels,
+	const int numSeeds,
+	ngJobSystem* jobSystem,
+	const VertexPlacement& placement)
+{
+	return BuildChunkMesh(jobSystem, placement, density, chunkCoord, chunkSize, seedVoxels, numSeeds, nullptr);
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+struct ChunkMeshJob
+{
+	ngJobSystem* jobSystem;
+	const DensityProgram* density;
+	const MeshSimplificationOptions* options;
+	VertexPlacement placement;
+	glm::ivec3 chunkCoord;
+	int chunkSize;
+	ChunkMesh* chunk;
+};
+
+}
+
+// ----------------------------------------------------------------------------
+
+// The seam vertices are on the boundary of the chunk mesh so the simplifier never moves or
+// removes them, the surviving vertices keep their voxel coords
+static void SimplifyChunkMesh(const MeshSimplificationOptions& options, ChunkMesh& chunk)
+{
+	NG_TRACE_SCOPE("SimplifyChunkMesh");
+
+	std::vector<int> vertexRemap(chunk.mesh->numVertices);
+	ngMeshSimplifier(chunk.mesh, vec4(0.f), options, vertexRemap.data());
+
+	for (int i = 0; i < (int)vertexRemap.size(); i++)
+	{
+		if (vertexRemap[i] != -1)
+		{
+			chunk.vertexVoxels[vertexRemap[i]] = chunk.vertexVoxels[i];
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+// Each chunk job runs the stages in order, the stages themselves spawn nested jobs
+static void RunChunkMeshJob(void* data)
+{
+	NG_TRACE_SCOPE("RunChunkMeshJob");
+
+	const ChunkMeshJob& job = *static_cast<ChunkMeshJob*>(data);
+
+	ChunkMesh& chunk = *job.chunk;
+	chunk = GenerateChunkMesh(*job.density, job.chunkCoord, job.chunkSize, job.jobSystem, job.placement);
+	if (chunk.mesh && job.options)
+	{
+		SimplifyChunkMesh(*job.options, chunk);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+void GenerateChunkMeshes(
+	ngJobSystem* jobSystem,
+	const DensityProgram& density,
+	const glm::ivec3* chunkCoords,
+	const int count,
+	const int chunkSize,
+	const MeshSimplificationOptions* options,
+	ChunkMesh* chunks,
+	const VertexPlacement& placement)
+{
+	std::vector<ChunkMeshJob> jobs(count);
+	std::vector<ngJobDecl> decls(count);
+	for (int i = 0; i < count; i++)
+	{
+		jobs[i].jobSystem = jobSystem;
+		jobs[i].density = &density;
+		jobs[i].options = options;
+		jobs[i].placement = placement;
+		jobs[i].chunkCoord = chunkCoords[i];
+		jobs[i].chunkSize = chunkSize;
+		jobs[i].chunk = &chunks[i];
+
+		decls[i].function = RunChunkMeshJob;
+		decls[i].data = &jobs[i];
+	}
+
+	if (!jobSystem)
+	{
+		for (const ngJobDecl& decl: decls)
+		{
+			decl.function(decl.data);
+		}
+
+		return;
+	}
+
+	ngJobCounter counter;
+	ngJobRun(jobSystem, decls.data(), count, &counter);
+	ngJobWait(jobSystem, &counter);
+}
+
+// ----------------------------------------------------------------------------
+
+void FreeChunkMesh(ChunkMesh& chunk)
+{
+	FreeMeshBuffer(chunk.mesh);
+	free(chunk.vertexVoxels);
+	chunk = ChunkMesh();
+}
+
+// ----------------------------------------------------------------------------
+
+MeshBuffer* WeldChunkMeshes(const ChunkMesh* chunks, const int count)
+{
+	NG_TRACE_SCOPE("WeldChunkMeshes");
+
+	int totalVertices = 0, totalTriangles = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (chunks[i].mesh)
+		{
+			totalVertices += chunks[i].mesh->numVertices;
+			totalTriangles += chunks[i].mesh->numTriangles;
+		}
+	}
+
+	MeshBuffer* buffer = new MeshBuffer;
+	buffer->vertices = (MeshVertex*)malloc(totalVertices * sizeof(MeshVertex));
+	buffer->triangles = (MeshTriangle*)malloc(totalTriangles * sizeof(MeshTriangle));
+
+	// the seam vertices were generated by the same voxel in both chunks
+	std::unordered_map<ivec4, int, VoxelKeyHash> weldedIndices;
+	std::vector<int> remap;
+
+	for (int i = 0; i < count; i++)
+	{
+		const MeshBuffer* mesh = chunks[i].mesh;
+		if (!mesh)
+		{
+			continue;
+		}
+
+		remap.resize(mesh->numVertices);
+		for (int j = 0; j < mesh->numVertices; j++)
+		{
+			const ivec4& voxel = chunks[i].vertexVoxels[j];
+
+			const auto iter = weldedIndices.find(voxel);
+			if (iter != end(weldedIndices))
+			{
+				remap[j] = iter->second;
+				continue;
+			}
+
+			remap[j] = buffer->numVertices;
+			weldedIndices[voxel] = buffer->numVertices;
+			buffer->vertices[buffer->numVertices++] = mesh->vertices[j];
+		}
+
+		for (int j = 0; j < mesh->numTriangles; j++)
+		{
+			MeshTriangle& tri = buffer->triangles[buffer->numTriangles++];
+			tri.indices_[0] = remap[mesh->triangles[j].indices_[0]];
+			tri.indices_[1] = remap[mesh->triangles[j].indices_[1]];
+			tri.indices_[2] = remap[mesh->triangles[j].indices_[2]];
+		}
+	}
+
+	return buffer;
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+// The Hermite data is a header followed by the active edges sorted by ID, each edge is
+// stored with its key in the chunk's local lattice coords and the compact EdgeInfo
+const uint32_t HERMITE_MAGIC = 0x4448474e;		// "NGHD"
+const uint32_t HERMITE_VERSION = 2;
+
+struct HermiteHeader
+{
+	uint32_t magic = HERMITE_MAGIC;
+	uint32_t version = HERMITE_VERSION;
+	int32_t chunkMin[3] = { 0, 0, 0 };
+	int32_t chunkSize = 0;
+	uint32_t numEdges = 0;
+	uint32_t reserved = 0;
+};
+
+struct HermiteEdge
+{
+	uint32_t edgeID = 0;
+	EdgeInfo info;
+};
+
+static_assert(sizeof(HermiteEdge) == 12, "HermiteEdge should be 12 bytes");
+
+}
+
+// ----------------------------------------------------------------------------
+
+// Generated data owns its edges, opened data points into the mapped file
+class HermiteData
+{
+public:
+
+	ivec4 chunkMin;
+	int chunkSize = 0;
+
+	std::vector<HermiteEdge> storage;
+	ngMappedFile* file = nullptr;
+
+	const HermiteEdge* edges = nullptr;
+	int numEdges = 0;
+};
+
+// ----------------------------------------------------------------------------
+
+static HermiteData* CreateHermiteData(
+	ngJobSystem* jobSystem,
+	const DensityProgram& density,
+	const ivec4& chunkMin,
+	const int chunkSize)
+{
+	NG_TRACE_SCOPE("CreateHermiteData");
+
+	VoxelIDSet activeVoxels;
+	EdgeInfoMap activeEdges;
+	FindChunkEdges(jobSystem, density, chunkMin, chunkSize, nullptr, 0, nullptr, activeVoxels, activeEdges);
+
+	HermiteData* data = new HermiteData;
+	data->chunkMin = chunkMin;
+	data->chunkSize = chunkSize;
+	data->storage.reserve(activeEdges.size());
+
+	for (const auto& pair: activeEdges)
+	{
+		HermiteEdge edge;
+		edge.edgeID = pair.first;
+		edge.info = pair.second;
+		data->storage.push_back(edge);
+	}
+
+	// the map's order depends on its history, sorting makes the files deterministic
+	std::sort(begin(data->storage), end(data->storage), [](const HermiteEdge& a, const HermiteEdge& b)
+	{
+		return a.edgeID < b.edgeID;
+	});
+
+	data->edges = data->storage.data();
+	data->numEdges = (int)data->storage.size();
+	return data;
+}
+
+// ----------------------------------------------------------------------------
+
+HermiteData* GenerateHermiteData(const DensityProgram& density, ngJobSystem* jobSystem)
+{
+	return CreateHermiteData(jobSystem, density, ivec4(glm::ivec3(-(int)VOXEL_GRID_OFFSET), 0), VOXEL_GRID_SIZE);
+}
+
+// ----------------------------------------------------------------------------
+
+HermiteData* GenerateChunkHermiteData(
+	const DensityProgram& density,
+	const glm::ivec3& chunkCoord,
+	const int chunkSize,
+	ngJobSystem* jobSystem)
+{
+	if (chunkSize < 1 || chunkSize > MAX_CHUNK_SIZE)
+	{
+		return nullptr;
+	}
+
+	return CreateHermiteData(jobSystem, density, ivec4(chunkCoord * chunkSize, 0), chunkSize);
+}
+
+// ----------------------------------------------------------------------------
+
+bool WriteHermiteData(const char* path, const HermiteData& data)
+{
+	FILE* f = path ? fopen(path, "wb") : nullptr;
+	if (!f)
+	{
+		return false;
+	}
+
+	HermiteHeader header;
+	header.chunkMin[0] = data.chunkMin.x;
+	header.chunkMin[1] = data.chunkMin.y;
+	header.chunkMin[2] = data.chunkMin.z;
+	header.chunkSize = data.chunkSize;
+	header.numEdges = (uint32_t)data.numEdges;
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	if (data.numEdges > 0)
+	{
+		ok = ok && fwrite(data.edges, sizeof(HermiteEdge), data.numEdges, f) == (size_t)data.numEdges;
+	}
+
+	ok = (fclose(f) == 0) && ok;
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+
+HermiteData* OpenHermiteData(const char* path)
+{
+	// the edges are read in order when the mesh is generated
+	ngMappedFile* file = ngMappedFileOpen(path, false);
+	if (!file || ngMappedFileSize(file) < sizeof(HermiteHeader))
+	{
+		ngMappedFileClose(file);
+		return nullptr;
+	}
+
+	const uint8_t* bytes = ngMappedFileData(file);
+
+	HermiteHeader header;
+	memcpy(&header, bytes, sizeof(header));
+
+	if (header.magic != HERMITE_MAGIC || 
+		header.version != HERMITE_VERSION ||
+		header.chunkSize < 1 || header.chunkSize > MAX_CHUNK_SIZE ||
+		ngMappedFileSize(file) < sizeof(HermiteHeader) + ((size_t)header.numEdges * sizeof(HermiteEdge)))
+	{
+		ngMappedFileClose(file);
+		return nullptr;
+	}
+
+	HermiteData* data = new HermiteData;
+	data->chunkMin = ivec4(header.chunkMin[0], header.chunkMin[1], header.chunkMin[2], 0);
+	data->chunkSize = header.chunkSize;
+	data->file = file;
+	data->edges = (const HermiteEdge*)(bytes + sizeof(HermiteHeader));
+	data->numEdges = (int)header.numEdges;
+	return data;
+}
+
+// ----------------------------------------------------------------------------
+
+void DestroyHermiteData(HermiteData* data)
+{
+	if (!data)
+	{
+		return;
+	}
+
+	ngMappedFileClose(data->file);
+	delete data;
+}
+
+// ----------------------------------------------------------------------------
+
+ChunkMesh GenerateChunkMeshFromHermiteData(
+	const HermiteData& data,
+	const MeshSimplificationOptions* options,
+	ngJobSystem* jobSystem,
+	const VertexPlacement& placement)
+{
+	NG_TRACE_SCOPE("GenerateChunkMeshFromHermiteData");
+
+	VoxelIDSet activeVoxels;
+	EdgeInfoMap activeEdges;
+
+	// edges outside the lattice can only come from a corrupt file, skip them rather than 
+	// letting their IDs alias other edges
+	const int edgeCount = data.chunkSize + 2;
+	for (int i = 0; i < data.numEdges; i++)
+	{
+		const HermiteEdge& edge = data.edges[i];
+		const int axis = edge.edgeID >> 30;
+		const ivec4 idxPos = DecodeVoxelUniqueID(edge.edgeID);
+		if (axis > 2 || idxPos.x >= edgeCount || idxPos.y >= edgeCount || idxPos.z >= edgeCount)
+		{
+			continue;
+		}
+
+		activeEdges[edge.edgeID] = edge.info;
+
+		uint32_t voxelIDs[4];
+		const int numVoxels = FindEdgeVoxels(axis, idxPos, data.chunkSize, voxelIDs);
+		activeVoxels.insert(voxelIDs, voxelIDs + numVoxels);
+	}
+
+	VoxelIndexMap vertexIndices;
+
+	ChunkMesh chunk;
+	chunk.mesh = BuildMeshFromEdges(jobSystem, placement, data.chunkMin, data.chunkSize, activeVoxels, activeEdges, nullptr, vertexIndices);
+	FillVertexVoxels(data.chunkMin, vertexIndices, chunk);
+
+	if (options)
+	{
+		SimplifyChunkMesh(*options, chunk);
+	}
+
+	return chunk;
+}
+
+// ----------------------------------------------------------------------------
+
+// Adaptive dual contouring. The active voxels are the leaves of an octree over the chunk's
+// local lattice coords which is built bottom up one level at a time: a node whose children
+// are all leaves is collapsed into a single (pseudo) leaf when the sum of the children's
+// QEFs can be solved with a small enough error. The tree is contoured with the cell, face
+// & edge procs of the original algorithm, the child & corner indices are x*4 + y*2 + z.
+
+namespace {
+
+enum OctreeNodeType
+{
+	Octree_Internal,
+	Octree_Pseudo,
+	Octree_Leaf,
+};
+
+// The QEF is accumulated in double precision, the positions are in voxel units and the
+// sums over large nodes would otherwise lose the small errors the threshold is tested with
+struct OctreeQef
+{
+	double ATA[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+	double ATb[3] = { 0.0, 0.0, 0.0 };
+	double btb = 0.0;
+	double massPoint[3] = { 0.0, 0.0, 0.0 };
+	int numPoints = 0;
+};
+
+struct OctreeNode
+{
+	OctreeNodeType type = Octree_Internal;
+	ivec4 min;
+	int size = 0;
+	int children[8] = { -1, -1, -1, -1, -1, -1, -1, -1 };
+
+	// leaves only, the corner bits are set for corners inside the surface
+	int index = -1;
+	int corners = 0;
+	MeshVertex vertex;
+	OctreeQef qef;
+};
+
+struct Octree
+{
+	std::vector<OctreeNode> nodes;
+	std::vector<MeshVertex> vertices;
+	std::vector<MeshTriangle> triangles;
+};
+
+}
+
+// ----------------------------------------------------------------------------
+
+// The corners at either end of each edge, in the same order as ENCODED_EDGE_OFFSETS
+const int OCTREE_EDGE_CORNERS[12][2] =
+{
+	{ 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 },
+	{ 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+	{ 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+};
+
+const int CELL_PROC_FACE_MASK[12][3] = 
+{
+	{ 0, 4, 0 }, { 1, 5, 0 }, { 2, 6, 0 }, { 3, 7, 0 }, 
+	{ 0, 2, 1 }, { 4, 6, 1 }, { 1, 3, 1 }, { 5, 7, 1 }, 
+	{ 0, 1, 2 }, { 2, 3, 2 }, { 4, 5, 2 }, { 6, 7, 2 },
+};
+
+const int CELL_PROC_EDGE_MASK[6][5] = 
+{
+	{ 0, 1, 2, 3, 0 }, { 4, 5, 6, 7, 0 }, 
+	{ 0, 4, 1, 5, 1 }, { 2, 6, 3, 7, 1 }, 
+	{ 0, 2, 4, 6, 2 }, { 1, 3, 5, 7, 2 },
+};
+
+const int FACE_PROC_FACE_MASK[3][4][3] = 
+{
+	{ { 4, 0, 0 }, { 5, 1, 0 }, { 6, 2, 0 }, { 7, 3, 0 } },
+	{ { 2, 0, 1 }, { 6, 4, 1 }, { 3, 1, 1 }, { 7, 5, 1 } },
+	{ { 1, 0, 2 }, { 3, 2, 2 }, { 5, 4, 2 }, { 7, 6, 2 } },
+};
+
+const int FACE_PROC_EDGE_MASK[3][4][6] = 
+{
+	{ { 1, 4, 0, 5, 1, 1 }, { 1, 6, 2, 7, 3, 1 }, { 0, 4, 6, 0, 2, 2 }, { 0, 5, 7, 1, 3, 2 } },
+	{ { 0, 2, 3, 0, 1, 0 }, { 0, 6, 7, 4, 5, 0 }, { 1, 2, 0, 6, 4, 2 }, { 1, 3, 1, 7, 5, 2 } },
+	{ { 1, 1, 0, 3, 2, 0 }, { 1, 5, 4, 7, 6, 0 }, { 0, 1, 5, 0, 4, 1 }, { 0, 3, 7, 2, 6, 1 } },
+};
+
+const int EDGE_PROC_EDGE_MASK[3][2][5] = 
+{
+	{ { 3, 2, 1, 0, 0 }, { 7, 6, 5, 4, 0 } },
+	{ { 5, 1, 4, 0, 1 }, { 7, 3, 6, 2, 1 } },
+	{ { 6, 4, 2, 0, 2 }, { 7, 5, 3, 1, 2 } },
+};
+
+const int PROCESS_EDGE_MASK[3][4] = 
+{
+	{ 3, 2, 1, 0 }, { 7, 5, 6, 4 }, { 11, 10, 9, 8 },
+};
+
+// ----------------------------------------------------------------------------
+
+static void AddToOctreeQef(OctreeQef& qef, const vec4& p, const vec4& n)
+{
+	const double nx = n.x, ny = n.y, nz = n.z;
+	const double d = (nx * p.x) + (ny * p.y) + (nz * p.z);
+
+	qef.ATA[0] += nx * nx;
+	qef.ATA[1] += nx * ny;
+	qef.ATA[2] += nx * nz;
+	qef.ATA[3] += ny * ny;
+	qef.ATA[4] += ny * nz;
+	qef.ATA[5] += nz * nz;
+
+	qef.ATb[0] += nx * d;
+	qef.ATb[1] += ny * d;
+	qef.ATb[2] += nz * d;
+	qef.btb += d * d;
+
+	qef.massPoint[0] += p.x;
+	qef.massPoint[1] += p.y;
+	qef.massPoint[2] += p.z;
+	qef.numPoints++;
+}
+
+// ----------------------------------------------------------------------------
+
+static void MergeOctreeQef(OctreeQef& qef, const OctreeQef& other)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		qef.ATA[i] += other.ATA[i];
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		qef.ATb[i] += other.ATb[i];
+		qef.massPoint[i] += other.massPoint[i];
+	}
+
+	qef.btb += other.btb;
+	qef.numPoints += other.numPoints;
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns the error, i.e. the sum of the squared distances from the solved position to 
+// the planes of the edge intersections
+static double SolveOctreeQef(const OctreeQef& qef, vec4& position)
+{
+	const double* A = qef.ATA;
+	const double m[3] = 
+	{ 
+		qef.massPoint[0] / qef.numPoints, 
+		qef.massPoint[1] / qef.numPoints, 
+		qef.massPoint[2] / qef.numPoints,
+	};
+
+	const float ATA[6] = { (float)A[0], (float)A[1], (float)A[2], (float)A[3], (float)A[4], (float)A[5] };
+	const float ATb[3] = 
+	{
+		(float)(qef.ATb[0] - ((A[0] * m[0]) + (A[1] * m[1]) + (A[2] * m[2]))),
+		(float)(qef.ATb[1] - ((A[1] * m[0]) + (A[3] * m[1]) + (A[4] * m[2]))),
+		(float)(qef.ATb[2] - ((A[2] * m[0]) + (A[4] * m[1]) + (A[5] * m[2]))),
+	};
+
+	float solved[3];
+	qef_solve_from_ata_atb(ATA, ATb, solved);
+
+	const double x[3] = { m[0] + solved[0], m[1] + solved[1], m[2] + solved[2] };
+	const double Ax[3] = 
+	{
+		(A[0] * x[0]) + (A[1] * x[1]) + (A[2] * x[2]),
+		(A[1] * x[0]) + (A[3] * x[1]) + (A[4] * x[2]),
+		(A[2] * x[0]) + (A[4] * x[1]) + (A[5] * x[2]),
+	};
+
+	position = vec4((float)x[0], (float)x[1], (float)x[2], 1.f);
+
+	double error = qef.btb;
+	for (int i = 0; i < 3; i++)
+	{
+		error += (x[i] * Ax[i]) - (2.0 * x[i] * qef.ATb[i]);
+	}
+
+	return std::max(error, 0.0);
+}
+
+// ----------------------------------------------------------------------------
+
+// The vertex is placed as in GenerateMesh, the QEF is kept for merging the leaves.
+// Returns true if the vertex was solved with the QEF.
+static bool BuildOctreeLeaf(
+	const VertexPlacement& placement,
+	const ivec4& chunkMin,
+	const uint32_t voxelID,
+	const EdgeInfoMap& edges,
+	OctreeNode& leaf)
+{
+	ALIGN16 vec4 p[12];
+	ALIGN16 vec4 n[12];
+
+	// the corners at the ends of the crossing edges are known from the winding, the others
+	// are found by following the voxel's edges out from the known corners
+	int known = 0;
+	int crossings = 0;
+
+	int idx = 0;
+	for (int i = 0; i < 12; i++)
+	{
+		const auto edgeID = voxelID + ENCODED_EDGE_OFFSETS[i];				
+		const auto iter = edges.find(edgeID);
+
+		if (iter != edges.end())
+		{
+			const ivec4 l = DecodeVoxelUniqueID(edgeID);
+			const vec4 base = LatticeToWorld(chunkMin, l.x, l.y, l.z);
+
+			p[idx] = EdgeInfoPosition(iter->second, base, edgeID >> 30);
+			n[idx] = EdgeInfoNormal(iter->second);
+			AddToOctreeQef(leaf.qef, p[idx], n[idx]);
+			idx++;
+
+			crossings |= 1 << i;
+			if (!known)
+			{
+				known = (1 << OCTREE_EDGE_CORNERS[i][0]) | (1 << OCTREE_EDGE_CORNERS[i][1]);
+				leaf.corners = 1 << OCTREE_EDGE_CORNERS[i][EdgeInfoWinding(iter->second) ? 1 : 0];
+			}
+		}
+	}
+
+	while (known != 0xff)
+	{
+		for (int i = 0; i < 12; i++)
+		{
+			const int c0 = OCTREE_EDGE_CORNERS[i][0];
+			const int c1 = OCTREE_EDGE_CORNERS[i][1];
+			if (((known >> c0) & 1) == ((known >> c1) & 1))
+			{
+				continue;
+			}
+
+			const int from = (known >> c0) & 1 ? c0 : c1;
+			const int to = from == c0 ? c1 : c0;
+			const int sign = ((leaf.corners >> from) & 1) ^ ((crossings >> i) & 1);
+
+			known |= 1 << to;
+			leaf.corners |= sign << to;
+		}
+	}
+
+	leaf.type = Octree_Leaf;
+	leaf.min = DecodeVoxelUniqueID(voxelID);
+	leaf.size = 1;
+	return SolveVoxelVertex(placement, p, n, idx, &leaf.vertex);
+}
+
+// ----------------------------------------------------------------------------
+
+// Collapse the node when all its children are leaves & their combined QEF can be solved 
+// within the threshold. The corners of the missing children take the sign of the centre.
+// Returns true if the QEF was solved.
+static bool CollapseOctreeNode(Octree& octree, const ivec4& chunkMin, const float threshold, OctreeNode& node)
+{
+	OctreeQef qef;
+	vec4 normal(0.f);
+
+	int midSign = 0;
+	int corners = 0;
+	int missing = 0;
+
+	for (int i = 0; i < 8; i++)
+	{
+		if (node.children[i] == -1)
+		{
+			missing |= 1 << i;
+			continue;
+		}
+
+		const OctreeNode& child = octree.nodes[node.children[i]];
+		if (child.type == Octree_Internal)
+		{
+			return false;
+		}
+
+		MergeOctreeQef(qef, child.qef);
+		normal += child.vertex.normal * (float)child.qef.numPoints;
+		midSign = (child.corners >> (7 - i)) & 1;
+		corners |= child.corners & (1 << i);
+	}
+
+	vec4 position;
+	if (SolveOctreeQef(qef, position) > threshold)
+	{
+		return true;
+	}
+
+	// the solution can leave the node where the planes are close to parallel
+	const vec4 nodeMin = LatticeToWorld(chunkMin, node.min.x, node.min.y, node.min.z);
+	bool outside = false;
+	for (int i = 0; i < 3; i++)
+	{
+		outside = outside || position[i] < nodeMin[i] || position[i] > (nodeMin[i] + node.size);
+	}
+
+	if (outside)
+	{
+		position = vec4(
+			(float)(qef.massPoint[0] / qef.numPoints),
+			(float)(qef.massPoint[1] / qef.numPoints),
+			(float)(qef.massPoint[2] / qef.numPoints),
+			1.f);
+	}
+
+	node.type = Octree_Pseudo;
+	node.corners = corners | (midSign ? missing : 0);
+	node.qef = qef;
+	node.vertex.xyz = position;
+	node.vertex.normal = normal * (1.f / (float)qef.numPoints);
+
+	for (int i = 0; i < 8; i++)
+	{
+		node.children[i] = -1;
+	}
+
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+// The leaves are in Z order so siblings are always consecutive, each pass creates the 
+// parents of the previous level's nodes (in Z order too) until only the root is left.
+// Returns the root's index or -1 if there are no leaves.
+static int BuildOctree(
+	Octree& octree,
+	const ivec4& chunkMin,
+	const int rootSize,
+	const float threshold,
+	MeshingCounters* counters)
+{
+	NG_TRACE_SCOPE("BuildOctree");
+
+	std::vector<int> level(octree.nodes.size());
+	for (int i = 0; i < (int)level.size(); i++)
+	{
+		level[i] = i;
+	}
+
+	for (int size = 1; size < rootSize && !level.empty(); size *= 2)
+	{
+		const int parentSize = size * 2;
+
+		std::vector<int> parents;
+		for (const int childIdx: level)
+		{
+			const ivec4 childMin = octree.nodes[childIdx].min;
+			const ivec4 parentMin = (childMin / parentSize) * parentSize;
+			if (parents.empty() || octree.nodes[parents.back()].min != parentMin)
+			{
+				OctreeNode parent;
+				parent.min = parentMin;
+				parent.size = parentSize;
+
+				parents.push_back((int)octree.nodes.size());
+				octree.nodes.push_back(parent);
+			}
+
+			const ivec4 offset = (childMin - parentMin) / size;
+			octree.nodes[parents.back()].children[(offset.x * 4) + (offset.y * 2) + offset.z] = childIdx;
+		}
+
+		if (threshold >= 0.f)
+		{
+			uint64_t qefSolves = 0;
+			for (const int parentIdx: parents)
+			{
+				qefSolves += CollapseOctreeNode(octree, chunkMin, threshold, octree.nodes[parentIdx]) ? 1 : 0;
+			}
+
+			if (counters)
+			{
+				counters->qefSolves += qefSolves;
+			}
+		}
+
+		level.swap(parents);
+	}
+
+	return level.empty() ? -1 : level[0];
+}
+
+// ----------------------------------------------------------------------------
+
+// Depth first from the root so the vertices are in Z order as with GenerateMesh
+static void AssignOctreeVertices(Octree& octree, const int nodeIdx)
+{
+	OctreeNode& node = octree.nodes[nodeIdx];
+	if (node.type != Octree_Internal)
+	{
+		node.index = (int)octree.vertices.size();
+		octree.vertices.push_back(node.vertex);
+		return;
+	}
+
+	for (int i = 0; i < 8; i++)
+	{
+		if (node.children[i] != -1)
+		{
+			AssignOctreeVertices(octree, node.children[i]);
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+// Leaves are their own children, so the procs can descend into nodes of different sizes
+static inline int OctreeChild(const Octree& octree, const int nodeIdx, const int child)
+{
+	const OctreeNode& node = octree.nodes[nodeIdx];
+	return node.type == Octree_Internal ? node.children[child] : nodeIdx;
+}
+
+// ----------------------------------------------------------------------------
+
+// The sign change is taken from the smallest of the nodes, i.e. the minimal edge. The 
+// nodes are in the reverse of the EDGE_NODE_OFFSETS order so the triangles are the same.
+static void ContourProcessEdge(Octree& octree, const int* nodeIdx, const int dir)
+{
+	int minSize = INT_MAX;
+	int minIndex = 0;
+	bool flip = false;
+	bool signChange[4] = { false, false, false, false };
+	int indices[4];
+
+	for (int i = 0; i < 4; i++)
+	{
+		const OctreeNode& node = octree.nodes[nodeIdx[i]];
+		const int edge = PROCESS_EDGE_MASK[dir][i];
+		const int m0 = (node.corners >> OCTREE_EDGE_CORNERS[edge][0]) & 1;
+		const int m1 = (node.corners >> OCTREE_EDGE_CORNERS[edge][1]) & 1;
+
+		if (node.size < minSize)
+		{
+			minSize = node.size;
+			minIndex = i;
+			flip = m0 != 0;
+		}
+
+		indices[i] = node.index;
+		signChange[i] = m0 != m1;
+	}
+
+	if (!signChange[minIndex])
+	{
+		return;
+	}
+
+	MeshTriangle tri[2];
+	if (!flip)
+	{
+		tri[0] = { { indices[0], indices[1], indices[3] } };
+		tri[1] = { { indices[0], indices[3], indices[2] } };
+	}
+	else
+	{
+		tri[0] = { { indices[0], indices[3], indices[1] } };
+		tri[1] = { { indices[0], indices[2], indices[3] } };
+	}
+
+	// a leaf next to smaller nodes takes up two of the edge's places, so one of the 
+	// triangles collapses to a line
+	for (int i = 0; i < 2; i++)
+	{
+		const int* t = tri[i].indices_;
+		if (t[0] != t[1] && t[1] != t[2] && t[2] != t[0])
+		{
+			octree.triangles.push_back(tri[i]);
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void ContourEdgeProc(Octree& octree, const int* nodeIdx, const int dir)
+{
+	if (nodeIdx[0] == -1 || nodeIdx[1] == -1 || nodeIdx[2] == -1 || nodeIdx[3] == -1)
+	{
+		return;
+	}
+
+	bool internal = false;
+	for (int i = 0; i < 4; i++)
+	{
+		internal = internal || octree.nodes[nodeIdx[i]].type == Octree_Internal;
+	}
+
+	if (!internal)
+	{
+		ContourProcessEdge(octree, nodeIdx, dir);
+		return;
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		const int* mask = EDGE_PROC_EDGE_MASK[dir][i];
+		const int edgeNodes[4] = 
+		{
+			OctreeChild(octree, nodeIdx[0], mask[0]),
+			OctreeChild(octree, nodeIdx[1], mask[1]),
+			OctreeChild(octree, nodeIdx[2], mask[2]),
+			OctreeChild(octree, nodeIdx[3], mask[3]),
+		};
+
+		ContourEdgeProc(octree, edgeNodes, mask[4]);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void ContourFaceProc(Octree& octree, const int* nodeIdx, const int dir)
+{
+	if (nodeIdx[0] == -1 || nodeIdx[1] == -1)
+	{
+		return;
+	}
+
+	if (octree.nodes[nodeIdx[0]].type != Octree_Internal && 
+		octree.nodes[nodeIdx[1]].type != Octree_Internal)
+	{
+		return;
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		const int* mask = FACE_PROC_FACE_MASK[dir][i];
+		const int faceNodes[2] = 
+		{
+			OctreeChild(octree, nodeIdx[0], mask[0]),
+			OctreeChild(octree, nodeIdx[1], mask[1]),
+		};
+
+		ContourFaceProc(octree, faceNodes, mask[2]);
+	}
+
+	const int orders[2][4] = { { 0, 0, 1, 1 }, { 0, 1, 0, 1 } };
+	for (int i = 0; i < 4; i++)
+	{
+		const int* mask = FACE_PROC_EDGE_MASK[dir][i];
+		const int* order = orders[mask[0]];
+		const int edgeNodes[4] = 
+		{
+			OctreeChild(octree, nodeIdx[order[0]], mask[1]),
+			OctreeChild(octree, nodeIdx[order[1]], mask[2]),
+			OctreeChild(octree, nodeIdx[order[2]], mask[3]),
+			OctreeChild(octree, nodeIdx[order[3]], mask[4]),
+		};
+
+		ContourEdgeProc(octree, edgeNodes, mask[5]);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void ContourCellProc(Octree& octree, const int nodeIdx)
+{
+	if (nodeIdx == -1 || octree.nodes[nodeIdx].type != Octree_Internal)
+	{
+		return;
+	}
+
+	const int* children = octree.nodes[nodeIdx].children;
+
+	for (int i = 0; i < 8; i++)
+	{
+		ContourCellProc(octree, children[i]);
+	}
+
+	for (int i = 0; i < 12; i++)
+	{
+		const int faceNodes[2] = { children[CELL_PROC_FACE_MASK[i][0]], children[CELL_PROC_FACE_MASK[i][1]] };
+		ContourFaceProc(octree, faceNodes, CELL_PROC_FACE_MASK[i][2]);
+	}
+
+	for (int i = 0; i < 6; i++)
+	{
+		const int* mask = CELL_PROC_EDGE_MASK[i];
+		const int edgeNodes[4] = { children[mask[0]], children[mask[1]], children[mask[2]], children[mask[3]] };
+		ContourEdgeProc(octree, edgeNodes, mask[4]);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+MeshBuffer* GenerateOctreeMesh(
+	const DensityProgram& density,
+	const float errorThreshold,
+	ngJobSystem* jobSystem,
+	const VertexPlacement& placement,
+	MeshingStats* stats)
+{
+	NG_TRACE_SCOPE("GenerateOctreeMesh");
+
+	const auto start = MeshingClock::now();
+	const ivec4 chunkMin(glm::ivec3(-(int)VOXEL_GRID_OFFSET), 0);
+	const int chunkSize = VOXEL_GRID_SIZE;
+
+	MeshingCounters counterData;
+	MeshingCounters* counters = stats ? &counterData : nullptr;
+
+	VoxelIDSet activeVoxels;
+	EdgeInfoMap activeEdges;
+	FindChunkEdges(jobSystem, density, chunkMin, chunkSize, nullptr, 0, counters, activeVoxels, activeEdges);
+
+	const auto vertexStart = MeshingClock::now();
+
+	std::vector<uint32_t> voxelIDs(begin(activeVoxels), end(activeVoxels));
+	SortByMortonOrder(voxelIDs);
+
+	Octree octree;
+	octree.nodes.resize(voxelIDs.size());
+	ngJobParallelFor(jobSystem, (int)voxelIDs.size(), 256, [&](const int begin, const int end)
+	{
+		NG_TRACE_SCOPE("BuildOctreeLeaves");
+
+		uint64_t qefSolves = 0;
+		for (int v = begin; v < end; v++)
+		{
+			qefSolves += BuildOctreeLeaf(placement, chunkMin, voxelIDs[v], activeEdges, octree.nodes[v]) ? 1 : 0;
+		}
+
+		if (counters)
+		{
+			counters->hashProbes += 12 * (end - begin);
+			counters->qefSolves += qefSolves;
+		}
+	});
+
+	// the voxels (including the apron) are all in [0, chunkSize] 
+	int rootSize = 1;
+	while (rootSize <= chunkSize)
+	{
+		rootSize *= 2;
+	}
+
+	const int root = BuildOctree(octree, chunkMin, rootSize, errorThreshold, counters);
+	if (root != -1)
+	{
+		AssignOctreeVertices(octree, root);
+	}
+
+	AddStageTime(counters, &MeshingStats::vertexTime, vertexStart);
+	const auto triangleStart = MeshingClock::now();
+
+	if (root != -1)
+	{
+		NG_TRACE_SCOPE("ContourOctree");
+		ContourCellProc(octree, root);
+	}
+
+	AddStageTime(counters, &MeshingStats::triangleTime, triangleStart);
+	UpdatePeakScratch(counters, 
+		HashTableBytes(activeEdges) + HashTableBytes(activeVoxels) + 
+		(octree.nodes.capacity() * sizeof(OctreeNode)) + 
+		(octree.vertices.capacity() * sizeof(MeshVertex)) + 
+		(octree.triangles.capacity() * sizeof(MeshTriangle)));
+
+	MeshBuffer* buffer = new MeshBuffer;
+	buffer->numVertices = (int)octree.vertices.size();
+	buffer->vertices = (MeshVertex*)malloc(glm::max(buffer->numVertices, 1) * sizeof(MeshVertex));
+	memcpy(buffer->vertices, octree.vertices.data(), buffer->numVertices * sizeof(MeshVertex));
+
+	buffer->numTriangles = (int)octree.triangles.size();
+	buffer->triangles = (MeshTriangle*)malloc(glm::max(buffer->numTriangles, 1) * sizeof(MeshTriangle));
+	memcpy(buffer->triangles, octree.triangles.data(), buffer->numTriangles * sizeof(MeshTriangle));
+
+	if (stats)
+	{
+		FinishMeshingStats(counterData, buffer, start, stats);
+	}
 
 	return buffer;
 }
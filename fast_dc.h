@@ -3,6 +3,13 @@
 
 #include	"ng_mesh_simplify.h"
 
+#include	<stdint.h>
+#include	<atomic>
+#include	<memory>
+#include	<vector>
+
+class ngJobSystem;
+
 struct SuperPrimitiveConfig
 {
 	enum Type
@@ -19,6 +26,544 @@ struct SuperPrimitiveConfig
 };
 
 SuperPrimitiveConfig ConfigForShape(const SuperPrimitiveConfig::Type& type);
-MeshBuffer* GenerateMesh(const SuperPrimitiveConfig& config);
+
+// ----------------------------------------------------------------------------
+
+// A scene is a tree of CSG operations with super primitives at the leaves. Each primitive 
+// has an affine transform from the shape's space to the voxel grid, so a shape with the 
+// default ConfigForShape params and a transform scaling by 16 is 32 voxels across.
+struct CsgPrimitive
+{
+	SuperPrimitiveConfig config;
+	glm::mat4 transform;
+};
+
+struct CsgNode
+{
+	enum Type
+	{
+		Primitive,
+		Union,
+		Subtract,
+		Intersect,
+		SmoothUnion,
+		SmoothSubtract,
+		SmoothIntersect,
+	};
+
+	Type type = Primitive;
+	int primitive = -1;
+	int children[2] = { -1, -1 };
+
+	// the radius (in voxels) the smooth operations blend over
+	float blend = 0.f;
+};
+
+struct CsgScene
+{
+	std::vector<CsgPrimitive> primitives;
+	std::vector<CsgNode> nodes;
+	int root = -1;
+};
+
+// Both return the index of the new node and make it the scene's root. Subtract removes 
+// the second child from the first.
+int CsgAddPrimitive(CsgScene& scene, const SuperPrimitiveConfig& config, const glm::mat4& transform);
+int CsgAddOperation(CsgScene& scene, const CsgNode::Type type, const int lhs, const int rhs, const float blend = 0.f);
+
+// The scene is compiled into a flat list of instructions which evaluates a batch of points
+// at a time, each instruction is applied to the whole batch before moving on to the next.
+// The density is a distance bound (transforms which don't preserve distances are 
+// corrected for) which the meshing relies on to skip empty space.
+class DensityProgram;
+
+// Returns null if the scene is malformed (invalid indices, cycles, singular transforms)
+DensityProgram* CompileDensityProgram(const CsgScene& scene);
+void DestroyDensityProgram(DensityProgram* program);
+
+// A single super primitive at the scale the demo uses, 64 voxels across by default
+DensityProgram* CompileSuperPrimitive(const SuperPrimitiveConfig& config);
+
+// Evaluates the program at the points multiplied by scale with the density divided by it
+// so it is still a distance bound, i.e. the same surface contoured with voxels scale 
+// times larger. Works with any program (scenes & volumes), which must outlive it.
+DensityProgram* CompileScaledDensity(const DensityProgram& program, const float scale);
+
+void EvaluateDensity(const DensityProgram& program, const glm::vec4* points, const int count, float* densities);
+float EvaluateDensity(const DensityProgram& program, const glm::vec4& point);
+
+// The unions in the scene are rebuilt as a BVH over the primitives' bounds. Specialising
+// the program for a box walks the BVH and drops every subtree which can't change the sign 
+// of the density inside the box, or change the density where it is within margin of zero.
+// The cost is proportional to the number of primitives near the box rather than in the 
+// scene. Where every primitive is dropped the program evaluates to FLT_MAX. 
+// The result shares the compiled scene with the program it was created from (and is the 
+// same as specialising that program) so it must not outlive it.
+DensityProgram* SpecialiseDensityProgram(
+	const DensityProgram& program,
+	const glm::vec3& boundsMin,
+	const glm::vec3& boundsMax,
+	const float margin);
+
+// The number of primitives evaluated for each point
+int DensityProgramSize(const DensityProgram& program);
+
+// Returns true if the density is known to have the same sign everywhere in the box without
+// sampling it, density is then set to a value with that sign. Scenes use the distance 
+// bound from the centre of the box, dense volumes never know.
+bool IsDensityUniform(
+	const DensityProgram& program, 
+	const glm::vec3& boundsMin, 
+	const glm::vec3& boundsMax, 
+	float* density);
+
+// The surface normal (the normalised gradient of the density) at the point
+glm::vec4 EvaluateDensityNormal(const DensityProgram& program, const glm::vec4& point);
+
+// The work done by a program: the points evaluated and the normals calculated (a normal
+// is only counted as a normal, not as the samples it took). Programs specialised from a 
+// counted program count into the same counters, so counting the program a mesh starts 
+// from counts every evaluation made for the mesh.
+struct DensityCounters
+{
+	std::atomic<uint64_t> points{ 0 };
+	std::atomic<uint64_t> normals{ 0 };
+};
+
+// The counters must outlive the program (and the programs specialised from it), null
+// stops counting
+void SetDensityProgramCounters(DensityProgram* program, DensityCounters* counters);
+
+// ----------------------------------------------------------------------------
+
+// A volume of raw samples on disk (e.g. scanned or simulated data) used as the density 
+// instead of a scene. The file is memory mapped rather than read so only the pages around
+// the region being contoured are loaded, e.g. meshing a chunk or a streaming sub-grid of 
+// a volume much larger than memory only touches that brick of the file.
+struct DenseVolumeDesc
+{
+	enum Format
+	{
+		Float32,
+		UInt16,
+	};
+
+	const char* path = nullptr;
+	Format format = Float32;
+
+	// bytes to skip at the start of the file
+	size_t headerSize = 0;
+
+	// the number of samples along each axis, stored with x varying fastest
+	glm::ivec3 size;
+
+	// the voxel the first sample is placed at, the samples are one voxel apart
+	glm::ivec3 origin;
+
+	// density = (sample - isoValue) * scale, use a negative scale for data which is 
+	// higher inside the surface (e.g. CT scans)
+	float isoValue = 0.f;
+	float scale = 1.f;
+};
+
+class DenseVolume;
+
+// Returns null if the file can't be mapped or is too small for the size & format
+DenseVolume* OpenDenseVolume(const DenseVolumeDesc& desc);
+void CloseDenseVolume(DenseVolume* volume);
+
+// The volume is sampled with trilinear interpolation and the normals interpolate the 
+// central differences at the samples, points outside the volume are clamped to its edge.
+void SampleDenseVolume(const DenseVolume& volume, const glm::vec4* points, const int count, float* densities);
+glm::vec4 SampleDenseVolumeNormal(const DenseVolume& volume, const glm::vec4& point);
+
+// A program which samples the volume, the volume must outlive it
+DensityProgram* CompileVolumeDensity(const DenseVolume& volume);
+
+// ----------------------------------------------------------------------------
+
+// Sparse volumes only store the samples near the surface, in bricks of 8^3 samples found
+// through a two level table of pages of 8^3 bricks. Bricks (and whole pages) where every 
+// sample within two samples of the brick has the same sign are only stored as inside or
+// outside, so they take up no space in the file and are skipped when filling the lattice
+// without touching the file. Beyond the volume the density is outside.
+class SparseVolume;
+
+// Sample the density on gridSize voxels from gridMin and write it as a sparse volume, the 
+// uint16 format quantises the density in [-range, range]. Only the bricks near the surface
+// are fully sampled when the density can rule out the others (i.e. scenes), so large grids
+// of mostly empty space are cheap to convert.
+bool WriteSparseVolume(
+	const char* path,
+	const DensityProgram& density,
+	const glm::ivec3& gridMin,
+	const glm::ivec3& gridSize,
+	const DenseVolumeDesc::Format format,
+	const float range = 1.f);
+
+// Returns null if the file can't be mapped or isn't a valid sparse volume
+SparseVolume* OpenSparseVolume(const char* path);
+void CloseSparseVolume(SparseVolume* volume);
+
+void SampleSparseVolume(const SparseVolume& volume, const glm::vec4* points, const int count, float* densities);
+glm::vec4 SampleSparseVolumeNormal(const SparseVolume& volume, const glm::vec4& point);
+
+// As IsDensityUniform, true if every brick the box samples is uniform with the same sign
+bool IsSparseVolumeUniform(
+	const SparseVolume& volume,
+	const glm::vec3& boundsMin,
+	const glm::vec3& boundsMax,
+	float* density);
+
+// The chunks which may contain any of the surface, i.e. the input for GenerateChunkMeshes
+// so only the stored bricks are ever read (sorted by z, y then x)
+void FindSparseVolumeChunks(const SparseVolume& volume, const int chunkSize, std::vector<glm::ivec3>& chunkCoords);
+
+// A program which samples the volume, the volume must outlive it
+DensityProgram* CompileSparseVolumeDensity(const SparseVolume& volume);
+
+// ----------------------------------------------------------------------------
+
+// How the vertex in each active voxel is placed. QEF is full dual contouring which keeps
+// sharp features. MassPoint is the average of the voxel's edge intersections (as in naive
+// surface nets) which skips the QEF solve and rounds off the features, good enough for 
+// distant LODs & collision meshes. Auto only solves the QEF where a voxel's edge normals
+// diverge, i.e. where there may be a feature to keep.
+struct VertexPlacement
+{
+	enum Mode
+	{
+		QEF,
+		MassPoint,
+		Auto,
+	};
+
+	Mode mode = QEF;
+
+	// used by Auto, a voxel is solved when any of its normals is further than this from 
+	// the average direction (the cosine of the angle)
+	float featureCosine = 0.95f;
+};
+
+// Where the time went and how much work was done, filled in by the meshing calls when 
+// a stats pointer is supplied. Times are in milliseconds of wall time, except for the 
+// intersections & normals which are found together for each edge inside the edge stage's
+// jobs, so these are the time summed over the jobs.
+struct MeshingStats
+{
+	// filling the density lattice and finding the edges which cross the surface
+	double scanTime = 0.0;
+
+	// finding the crossing edges' intersections & normals (i.e. the Hermite data)
+	double edgeTime = 0.0;
+	double intersectionTime = 0.0;
+	double normalTime = 0.0;
+
+	double vertexTime = 0.0;
+	double triangleTime = 0.0;
+	double totalTime = 0.0;
+
+	// see DensityCounters
+	uint64_t densityEvaluations = 0;
+	uint64_t normalEvaluations = 0;
+
+	// lookups & insertions in the edge, voxel and vertex index hash tables
+	uint64_t hashProbes = 0;
+
+	// the vertices solved with a QEF rather than placed at the mass point
+	uint64_t qefSolves = 0;
+
+	// the most working memory (lattice, sign bits, hash tables etc.) held at once
+	size_t peakScratchBytes = 0;
+
+	int numVertices = 0;
+	int numTriangles = 0;
+};
+
+// GenerateMesh contours the MESH_GRID_SIZE^3 voxels centred on the origin
+const int MESH_GRID_SIZE = 128;
+
+// The job system is optional, when supplied each stage is split into jobs. The vertices 
+// & triangles are emitted in Morton order of their voxels & edges rather than the order 
+// the jobs complete in (or any hash table's iteration order) so the mesh is bit for bit 
+// the same for every thread count, with or without a job system.
+MeshBuffer* GenerateMesh(
+	const DensityProgram& density, 
+	ngJobSystem* jobSystem = nullptr,
+	const VertexPlacement& placement = VertexPlacement(),
+	MeshingStats* stats = nullptr);
+
+// Compiles the config with CompileSuperPrimitive and contours it, null if it doesn't compile
+MeshBuffer* GenerateMesh(
+	const SuperPrimitiveConfig& config, 
+	ngJobSystem* jobSystem = nullptr,
+	const VertexPlacement& placement = VertexPlacement(),
+	MeshingStats* stats = nullptr);
+
+// Frees a mesh returned by any of the Generate functions, null is ignored
+void FreeMeshBuffer(MeshBuffer* mesh);
+
+// ----------------------------------------------------------------------------
+
+// Adaptive dual contouring of the same grid as GenerateMesh. The active voxels are the 
+// leaves of an octree and, working up from the leaves, each node whose children are all
+// leaves is merged into a single vertex when the QEF of all their edges can be solved 
+// with an error (the sum of the squared distances, in voxels, from the vertex to the 
+// planes of the edges) no more than errorThreshold. The tree is then contoured so flat 
+// regions get large polygons without generating & simplifying the full mesh. The nodes 
+// are merged on the error alone so features smaller than a merged node may be lost. A 
+// negative threshold merges nothing and produces the same triangles as GenerateMesh.
+// The stats' vertexTime includes building & merging the tree and the qefSolves include 
+// the merged nodes.
+MeshBuffer* GenerateOctreeMesh(
+	const DensityProgram& density,
+	const float errorThreshold,
+	ngJobSystem* jobSystem = nullptr,
+	const VertexPlacement& placement = VertexPlacement(),
+	MeshingStats* stats = nullptr);
+
+// ----------------------------------------------------------------------------
+
+// Receives the output of GenerateMeshStreaming as each slice of the grid is completed.
+// The triangle indices refer to the total number of vertices emitted so far.
+struct MeshStream
+{
+	void* userData = nullptr;
+	void (*addVertices)(void* userData, const MeshVertex* vertices, const int count) = nullptr;
+	void (*addTriangles)(void* userData, const MeshTriangle* triangles, const int count) = nullptr;
+};
+
+// Contour the gridSize voxels starting at gridMin one slice at a time. Only two slices of 
+// densities, edges and vertex indices are kept at any point so the working memory is 
+// proportional to the area of a slice rather than the whole surface. The vertices are
+// solved from the same data as GenerateMesh so the results only differ in their order.
+void GenerateMeshStreaming(
+	const DensityProgram& density,
+	const glm::ivec3& gridMin,
+	const glm::ivec3& gridSize,
+	const MeshStream& stream,
+	const VertexPlacement& placement = VertexPlacement());
+
+// ----------------------------------------------------------------------------
+
+// Voxel IDs use 10 bits per axis, the chunk's apron voxels take up one of the values
+const int MAX_CHUNK_SIZE = 1022;
+
+// A chunk's mesh along with the global voxel coordinate each vertex was generated for, 
+// both arrays are allocated with malloc and owned by the caller, see FreeChunkMesh
+struct ChunkMesh
+{
+	MeshBuffer* mesh = nullptr;
+	glm::ivec4* vertexVoxels = nullptr;
+};
+
+// Chunks are cubes of chunkSize voxels, chunk (0, 0, 0) has its min corner at the origin.
+// The voxels on the chunk's faces are generated from the same data as the matching voxels 
+// in the neighbouring chunks so the vertices along the seams are identical, and each edge 
+// only generates a quad in the chunk which owns it. Returns an empty ChunkMesh for invalid sizes.
+ChunkMesh GenerateChunkMesh(
+	const DensityProgram& density, 
+	const glm::ivec3& chunkCoord, 
+	const int chunkSize,
+	ngJobSystem* jobSystem = nullptr,
+	const VertexPlacement& placement = VertexPlacement(),
+	MeshingStats* stats = nullptr);
+
+// As GenerateChunkMesh but the active voxels are found by following the surface from the
+// seed voxels (e.g. the vertexVoxels of the chunk's previous mesh) rather than scanning 
+// the whole chunk, so the cost is proportional to the surface area rather than the volume.
+// Only the surface components which contain a seed are found, if any seed is too far 
+// from the surface (or there are no seeds in the chunk) the whole chunk is scanned.
+// Edits which can create new surfaces (e.g. a separate shape appearing) should not use this.
+ChunkMesh GenerateChunkMeshFromSeeds(
+	const DensityProgram& density, 
+	const glm::ivec3& chunkCoord, 
+	const int chunkSize,
+	const glm::ivec4* seedVoxels,
+	const int numSeeds,
+	ngJobSystem* jobSystem = nullptr,
+	const VertexPlacement& placement = VertexPlacement());
+
+// Generate the meshes for a batch of chunks, each chunk is a job and each stage within 
+// the chunk spawns its own jobs so empty & dense chunks balance out. When options is 
+// not null the chunk meshes are also simplified, the simplifier never touches the 
+// boundary of a mesh so the seams can still be welded afterwards.
+void GenerateChunkMeshes(
+	ngJobSystem* jobSystem,
+	const DensityProgram& density,
+	const glm::ivec3* chunkCoords,
+	const int count,
+	const int chunkSize,
+	const MeshSimplificationOptions* options,
+	ChunkMesh* chunks,
+	const VertexPlacement& placement = VertexPlacement());
+
+// Merge a set of chunk meshes into a single mesh, welding the vertices shared along the seams
+MeshBuffer* WeldChunkMeshes(const ChunkMesh* chunks, const int count);
+
+// Frees both of the chunk's arrays and resets it to an empty ChunkMesh
+void FreeChunkMesh(ChunkMesh& chunk);
+
+// ----------------------------------------------------------------------------
+
+// The Hermite data is the output of the expensive half of the pipeline: the position, 
+// normal and winding of every edge which crosses the surface. Saving it means the 
+// vertices, triangles and simplification can be regenerated with different options 
+// without evaluating the density again. Opened files are memory mapped.
+class HermiteData;
+
+// For the same grid as GenerateMesh, or for a single chunk (null for invalid sizes)
+HermiteData* GenerateHermiteData(const DensityProgram& density, ngJobSystem* jobSystem = nullptr);
+HermiteData* GenerateChunkHermiteData(
+	const DensityProgram& density,
+	const glm::ivec3& chunkCoord,
+	const int chunkSize,
+	ngJobSystem* jobSystem = nullptr);
+
+bool WriteHermiteData(const char* path, const HermiteData& data);
+
+// Returns null if the file can't be mapped or isn't valid Hermite data
+HermiteData* OpenHermiteData(const char* path);
+void DestroyHermiteData(HermiteData* data);
+
+// Generate the mesh the data was generated for, simplified when options is not null. The
+// result is the same as GenerateChunkMesh (or GenerateMesh) with the vertices in a 
+// different order, e.g. a single set of data can produce both a full quality mesh and
+// a MassPoint mesh for collision.
+ChunkMesh GenerateChunkMeshFromHermiteData(
+	const HermiteData& data,
+	const MeshSimplificationOptions* options,
+	ngJobSystem* jobSystem = nullptr,
+	const VertexPlacement& placement = VertexPlacement());
+
+// ----------------------------------------------------------------------------
+
+// Persistent meshing state for a fixed box of chunks, used to remesh a volume after local
+// edits without regenerating the whole thing. Each chunk's mesh is kept and the output
+// mesh is the welded result of all the chunks, when a chunk is regenerated its triangles
+// & vertices are spliced out of the output and the new ones spliced in.
+class MeshingState;
+
+// Returns null for invalid sizes. All the chunks start dirty so the first update
+// generates the whole volume. The density program must outlive the state.
+MeshingState* CreateMeshingState(
+	const DensityProgram& density,
+	const glm::ivec3& firstChunk,
+	const glm::ivec3& numChunks,
+	const int chunkSize);
+
+void DestroyMeshingState(MeshingState* state);
+
+// Mark the chunks affected by a change to the density between dirtyMin and dirtyMax 
+// (inclusive voxel coordinates). A change at one voxel can move the vertices of its
+// neighbours so the chunks which sample the region through their apron are marked too.
+void MarkMeshingStateDirty(
+	MeshingState* state,
+	const glm::ivec3& dirtyMin,
+	const glm::ivec3& dirtyMax);
+
+// Replace the density used for any further updates. The caller supplies the bounds of the
+// region where the density changes, e.g. the old & new bounds of a moved brush.
+void UpdateMeshingStateDensity(
+	MeshingState* state,
+	const DensityProgram& density,
+	const glm::ivec3& dirtyMin,
+	const glm::ivec3& dirtyMax);
+
+// Regenerate the dirty chunks and splice them into the output mesh, returns the number 
+// of chunks which were regenerated
+int UpdateMeshingState(MeshingState* state, ngJobSystem* jobSystem = nullptr);
+
+// The output mesh is owned by the state and is only valid until the next update. Removed
+// vertices leave unreferenced gaps in the vertex array which are reused by later updates
+// so the indices of the unchanged vertices are stable.
+const MeshBuffer* GetMeshingStateMesh(const MeshingState* state);
+
+// ----------------------------------------------------------------------------
+
+// Multi-resolution meshing around a focus point (e.g. the camera). Each level is a box of
+// levelChunks^3 chunks centred on the focus with voxels twice the size of the level 
+// inside it, and each level's mesh covers its box minus the box of the level inside it.
+// The level boxes snap to every other chunk of their level so the inner box always 
+// covers whole chunks of the outer level. The seams are stitched as in octree DC: each
+// crossing edge on the surface of an inner box generates a polygon between the voxels of
+// both levels which share the edge, so the levels meet without cracks. A feature smaller
+// than the outer level's voxels has no vertex there, the seam places one at the mass 
+// point of the inner level's crossings so the feature is closed off where it ends.
+class LodClipmap;
+
+const int MAX_LOD_LEVELS = 12;
+
+// Returns null for invalid params, levelChunks must be a multiple of 4 and at least 8 so
+// there is always a chunk of the outer level around the inner box. The density program
+// must outlive the clipmap.
+LodClipmap* CreateLodClipmap(
+	const DensityProgram& density,
+	const int numLevels,
+	const int chunkSize,
+	const int levelChunks,
+	const VertexPlacement& placement = VertexPlacement());
+
+void DestroyLodClipmap(LodClipmap* clipmap);
+
+// Move the levels to the new focus. Only the chunks which entered a level's box are 
+// generated and only the levels whose boxes (or inner boxes) moved are rebuilt, returns 
+// the number of levels which were rebuilt.
+int UpdateLodClipmap(LodClipmap* clipmap, const glm::vec3& focus, ngJobSystem* jobSystem = nullptr);
+
+// The level's mesh (in voxel units of level 0) including the seam with the level inside 
+// it. Owned by the clipmap and only valid until the next update.
+const MeshBuffer* GetLodClipmapMesh(const LodClipmap* clipmap, const int level);
+
+// ----------------------------------------------------------------------------
+
+// A cache of finished super primitive meshes, so requesting a configuration again (e.g. 
+// the demo's Refresh, or a service where most requests are for a few shapes) returns the
+// earlier result rather than meshing & simplifying it again. Results are keyed by a hash
+// of everything which changes the output: the config, the grid, the vertex placement and
+// the simplification options. The memory tier keeps the most recently used results up to
+// maxBytes of vertices & triangles. With a directory each result is also written to a 
+// file named after its key, and a result which isn't in memory (evicted, or made by an 
+// earlier run) is memory mapped from its file instead of being regenerated. This relies 
+// on the output being deterministic, a cached mesh is exactly the mesh which would have
+// been generated. The cache can be used from several threads, a miss is generated 
+// outside the lock so concurrent misses for the same key may both generate it.
+class MeshCache;
+
+struct MeshCacheRequest
+{
+	SuperPrimitiveConfig config;
+	VertexPlacement placement;
+
+	// the unsimplified mesh when null
+	const MeshSimplificationOptions* options = nullptr;
+};
+
+// Results are shared & immutable, each stays valid while a reference to it is held even 
+// after it is evicted or the cache is destroyed
+using MeshCacheResult = std::shared_ptr<const MeshBuffer>;
+
+struct MeshCacheStats
+{
+	uint64_t memoryHits = 0;
+	uint64_t diskHits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+
+	int numEntries = 0;
+	size_t numBytes = 0;
+};
+
+// The directory (which must already exist) is optional, null keeps the results in memory
+MeshCache* CreateMeshCache(const size_t maxBytes, const char* directory = nullptr);
+void DestroyMeshCache(MeshCache* cache);
+
+// Returns null if the mesh can't be generated
+MeshCacheResult GetMeshCacheMesh(MeshCache* cache, const MeshCacheRequest& request, ngJobSystem* jobSystem = nullptr);
+
+// The key of a request, the disk tier's files are named "<key as 16 hex digits>.mesh"
+uint64_t MeshCacheKey(const MeshCacheRequest& request);
+
+void GetMeshCacheStats(const MeshCache* cache, MeshCacheStats* stats);
 
 #endif //	HAS_DC_H_BEEN_INCLUDED
\ No newline at end of file
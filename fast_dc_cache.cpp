@@ -0,0 +1,480 @@
+//
+// Public domain
+//
+
+#include "fast_dc.h"
+#include "ng_mapped_file.h"
+#include "ng_trace.h"
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+// ----------------------------------------------------------------------------
+
+// Part of every key, bump it when a change to the meshing or simplification changes the
+// output for the same request (or e.g. CompileSuperPrimitive's scale changes) so the files
+// written by older builds are regenerated rather than used
+const uint32_t MESH_CACHE_VERSION = 1;
+
+const uint32_t MESH_CACHE_MAGIC = 0x434d474e;	// "NGMC"
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+// The file is the header, the words the key was hashed from (so a collision is detected
+// rather than returning the wrong mesh), then the vertices & triangles. The vertices are
+// 16 byte aligned so they can be used straight from the mapping.
+struct MeshCacheHeader
+{
+	uint32_t magic = MESH_CACHE_MAGIC;
+	uint32_t version = MESH_CACHE_VERSION;
+	uint64_t key = 0;
+	uint32_t numKeyWords = 0;
+	uint32_t numVertices = 0;
+	uint32_t numTriangles = 0;
+	uint32_t pad = 0;
+};
+
+struct MeshCacheEntry
+{
+	uint64_t key = 0;
+	std::vector<uint32_t> keyWords;
+	MeshCacheResult mesh;
+	size_t numBytes = 0;
+};
+
+using MeshCacheList = std::list<MeshCacheEntry>;
+
+}
+
+// ----------------------------------------------------------------------------
+
+class MeshCache
+{
+public:
+
+	size_t maxBytes = 0;
+	std::string directory;
+
+	mutable std::mutex mutex;
+
+	// the most recently used entry is at the front
+	MeshCacheList entries;
+	std::unordered_map<uint64_t, MeshCacheList::iterator> lookup;
+
+	MeshCacheStats stats;
+};
+
+// ----------------------------------------------------------------------------
+
+static void AppendKeyFloat(std::vector<uint32_t>& words, const float value)
+{
+	uint32_t word = 0;
+	memcpy(&word, &value, sizeof(word));
+	words.push_back(word);
+}
+
+// ----------------------------------------------------------------------------
+
+// Each field is added separately so the struct padding never ends up in the key
+static std::vector<uint32_t> MeshCacheKeyWords(const MeshCacheRequest& request)
+{
+	std::vector<uint32_t> words;
+	words.push_back(MESH_CACHE_VERSION);
+	words.push_back((uint32_t)MESH_GRID_SIZE);
+
+	for (int i = 0; i < 4; i++)
+	{
+		AppendKeyFloat(words, request.config.s[i]);
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		AppendKeyFloat(words, request.config.r[i]);
+	}
+
+	// the feature cosine is only used by Auto, other modes share their results
+	words.push_back((uint32_t)request.placement.mode);
+	if (request.placement.mode == VertexPlacement::Auto)
+	{
+		AppendKeyFloat(words, request.placement.featureCosine);
+	}
+
+	words.push_back(request.options ? 1 : 0);
+	if (request.options)
+	{
+		const MeshSimplificationOptions& options = *request.options;
+		AppendKeyFloat(words, options.edgeFraction);
+		words.push_back((uint32_t)options.maxIterations);
+		AppendKeyFloat(words, options.targetPercentage);
+		AppendKeyFloat(words, options.maxError);
+		AppendKeyFloat(words, options.maxEdgeSize);
+		AppendKeyFloat(words, options.minAngleCosine);
+	}
+
+	return words;
+}
+
+// ----------------------------------------------------------------------------
+
+// 64 bit FNV-1a
+static uint64_t HashKeyWords(const std::vector<uint32_t>& words)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (const uint32_t word: words)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			hash ^= (word >> (i * 8)) & 0xff;
+			hash *= 0x100000001b3ull;
+		}
+	}
+
+	return hash;
+}
+
+// ----------------------------------------------------------------------------
+
+uint64_t MeshCacheKey(const MeshCacheRequest& request)
+{
+	return HashKeyWords(MeshCacheKeyWords(request));
+}
+
+// ----------------------------------------------------------------------------
+
+static size_t MeshBytes(const MeshBuffer& mesh)
+{
+	return ((size_t)mesh.numVertices * sizeof(MeshVertex)) + ((size_t)mesh.numTriangles * sizeof(MeshTriangle));
+}
+
+// ----------------------------------------------------------------------------
+
+static size_t MeshCacheVerticesOffset(const uint32_t numKeyWords)
+{
+	const size_t end = sizeof(MeshCacheHeader) + (numKeyWords * sizeof(uint32_t));
+	return (end + 15) & ~(size_t)15;
+}
+
+// ----------------------------------------------------------------------------
+
+static std::string MeshCachePath(const MeshCache& cache, const uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.mesh", (unsigned long long)key);
+	return cache.directory + "/" + name;
+}
+
+// ----------------------------------------------------------------------------
+
+// Unique to the writer: the process, the thread & a count of the files it has written
+static std::string MeshCacheTempPath(const std::string& path)
+{
+	static std::atomic<uint32_t> counter(0);
+
+#ifdef _WIN32
+	const unsigned pid = (unsigned)_getpid();
+#else
+	const unsigned pid = (unsigned)getpid();
+#endif
+	const size_t thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+
+	char suffix[64];
+	snprintf(suffix, sizeof(suffix), ".%x.%llx.%x.tmp",
+		pid, (unsigned long long)thread, (unsigned)counter++);
+	return path + suffix;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool WriteMeshCacheFile(
+	const std::string& path,
+	const uint64_t key,
+	const std::vector<uint32_t>& keyWords,
+	const MeshBuffer& mesh)
+{
+	// written under a name no other writer uses and renamed so the file is never seen half
+	// written, even when other threads or processes miss on the same key at the same time.
+	// The "x" mode fails rather than truncating a file that somehow already exists.
+	const std::string tempPath = MeshCacheTempPath(path);
+	FILE* f = fopen(tempPath.c_str(), "wbx");
+	if (!f)
+	{
+		return false;
+	}
+
+	MeshCacheHeader header;
+	header.key = key;
+	header.numKeyWords = (uint32_t)keyWords.size();
+	header.numVertices = (uint32_t)mesh.numVertices;
+	header.numTriangles = (uint32_t)mesh.numTriangles;
+
+	const uint8_t padding[16] = {};
+	const size_t paddingSize = MeshCacheVerticesOffset(header.numKeyWords) -
+		(sizeof(MeshCacheHeader) + (keyWords.size() * sizeof(uint32_t)));
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+	ok = ok && fwrite(keyWords.data(), sizeof(uint32_t), keyWords.size(), f) == keyWords.size();
+	ok = ok && (paddingSize == 0 || fwrite(padding, paddingSize, 1, f) == 1);
+	if (mesh.numVertices > 0)
+	{
+		ok = ok && fwrite(mesh.vertices, sizeof(MeshVertex), mesh.numVertices, f) == (size_t)mesh.numVertices;
+	}
+	if (mesh.numTriangles > 0)
+	{
+		ok = ok && fwrite(mesh.triangles, sizeof(MeshTriangle), mesh.numTriangles, f) == (size_t)mesh.numTriangles;
+	}
+
+	ok = (fclose(f) == 0) && ok;
+
+	// rename fails on Windows when the file exists, i.e. when another writer got there first
+	if (!ok || rename(tempPath.c_str(), path.c_str()) != 0)
+	{
+		remove(tempPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns null if there is no file for the key or it isn't valid
+static MeshCacheResult OpenMeshCacheFile(
+	const std::string& path,
+	const uint64_t key,
+	const std::vector<uint32_t>& keyWords)
+{
+	// the whole mesh is read when it's used
+	ngMappedFile* file = ngMappedFileOpen(path.c_str(), false);
+	if (!file || ngMappedFileSize(file) < sizeof(MeshCacheHeader))
+	{
+		ngMappedFileClose(file);
+		return nullptr;
+	}
+
+	const uint8_t* bytes = ngMappedFileData(file);
+	const size_t fileSize = ngMappedFileSize(file);
+
+	MeshCacheHeader header;
+	memcpy(&header, bytes, sizeof(header));
+
+	const size_t verticesOffset = MeshCacheVerticesOffset(header.numKeyWords);
+	const size_t trianglesOffset = verticesOffset + ((size_t)header.numVertices * sizeof(MeshVertex));
+
+	if (header.magic != MESH_CACHE_MAGIC ||
+		header.version != MESH_CACHE_VERSION ||
+		header.key != key ||
+		header.numKeyWords != keyWords.size() ||
+		header.numVertices > INT32_MAX || header.numTriangles > INT32_MAX ||
+		fileSize < trianglesOffset + ((size_t)header.numTriangles * sizeof(MeshTriangle)) ||
+		memcmp(bytes + sizeof(MeshCacheHeader), keyWords.data(), keyWords.size() * sizeof(uint32_t)) != 0)
+	{
+		ngMappedFileClose(file);
+		return nullptr;
+	}
+
+	MeshBuffer* mesh = new MeshBuffer;
+	mesh->vertices = (MeshVertex*)(bytes + verticesOffset);
+	mesh->numVertices = (int)header.numVertices;
+	mesh->triangles = (MeshTriangle*)(bytes + trianglesOffset);
+	mesh->numTriangles = (int)header.numTriangles;
+
+	// a corrupt index would only be found when the mesh is drawn
+	for (int i = 0; i < mesh->numTriangles; i++)
+	{
+		const int* indices = mesh->triangles[i].indices_;
+		for (int j = 0; j < 3; j++)
+		{
+			if (indices[j] < 0 || indices[j] >= mesh->numVertices)
+			{
+				delete mesh;
+				ngMappedFileClose(file);
+				return nullptr;
+			}
+		}
+	}
+
+	return MeshCacheResult(mesh, [file](const MeshBuffer* buffer)
+	{
+		delete buffer;
+		ngMappedFileClose(file);
+	});
+}
+
+// ----------------------------------------------------------------------------
+
+static MeshCacheResult GenerateCachedMesh(const MeshCacheRequest& request, ngJobSystem* jobSystem)
+{
+	MeshBuffer* mesh = GenerateMesh(request.config, jobSystem, request.placement);
+	if (!mesh)
+	{
+		return nullptr;
+	}
+
+	if (request.options)
+	{
+		ngMeshSimplifier(mesh, vec4(0.f), *request.options);
+	}
+
+	return MeshCacheResult(mesh, FreeMeshBuffer);
+}
+
+// ----------------------------------------------------------------------------
+
+// The caller must hold the lock. Returns the result to use, which is the cached one if
+// another thread inserted the key first.
+static MeshCacheResult InsertMeshCacheEntry(
+	MeshCache* cache,
+	const uint64_t key,
+	std::vector<uint32_t>& keyWords,
+	const MeshCacheResult& mesh)
+{
+	const auto iter = cache->lookup.find(key);
+	if (iter != end(cache->lookup))
+	{
+		if (iter->second->keyWords == keyWords)
+		{
+			cache->entries.splice(begin(cache->entries), cache->entries, iter->second);
+			return iter->second->mesh;
+		}
+
+		// a collision, the newer request replaces the older
+		cache->stats.numBytes -= iter->second->numBytes;
+		cache->entries.erase(iter->second);
+		cache->lookup.erase(iter);
+	}
+
+	// a mesh bigger than the whole cache is returned without evicting everything else
+	MeshCacheEntry entry;
+	entry.numBytes = MeshBytes(*mesh);
+	if (entry.numBytes > cache->maxBytes)
+	{
+		return mesh;
+	}
+
+	while (!cache->entries.empty() && cache->stats.numBytes + entry.numBytes > cache->maxBytes)
+	{
+		const MeshCacheEntry& oldest = cache->entries.back();
+		cache->stats.numBytes -= oldest.numBytes;
+		cache->stats.evictions++;
+		cache->lookup.erase(oldest.key);
+		cache->entries.pop_back();
+	}
+
+	entry.key = key;
+	entry.keyWords.swap(keyWords);
+	entry.mesh = mesh;
+
+	cache->stats.numBytes += entry.numBytes;
+	cache->entries.push_front(std::move(entry));
+	cache->lookup[key] = begin(cache->entries);
+	return mesh;
+}
+
+// ----------------------------------------------------------------------------
+
+MeshCache* CreateMeshCache(const size_t maxBytes, const char* directory)
+{
+	MeshCache* cache = new MeshCache;
+	cache->maxBytes = maxBytes;
+	cache->directory = directory ? directory : "";
+	return cache;
+}
+
+// ----------------------------------------------------------------------------
+
+void DestroyMeshCache(MeshCache* cache)
+{
+	delete cache;
+}
+
+// ----------------------------------------------------------------------------
+
+MeshCacheResult GetMeshCacheMesh(MeshCache* cache, const MeshCacheRequest& request, ngJobSystem* jobSystem)
+{
+	NG_TRACE_SCOPE("GetMeshCacheMesh");
+
+	if (!cache)
+	{
+		return nullptr;
+	}
+
+	std::vector<uint32_t> keyWords = MeshCacheKeyWords(request);
+	const uint64_t key = HashKeyWords(keyWords);
+
+	{
+		std::lock_guard<std::mutex> lock(cache->mutex);
+		const auto iter = cache->lookup.find(key);
+		if (iter != end(cache->lookup) && iter->second->keyWords == keyWords)
+		{
+			cache->stats.memoryHits++;
+			cache->entries.splice(begin(cache->entries), cache->entries, iter->second);
+			return iter->second->mesh;
+		}
+	}
+
+	// the file is read & the mesh generated without holding the lock
+	const std::string path = cache->directory.empty() ? std::string() : MeshCachePath(*cache, key);
+	MeshCacheResult mesh = path.empty() ? nullptr : OpenMeshCacheFile(path, key, keyWords);
+	const bool fromDisk = mesh != nullptr;
+
+	if (!mesh)
+	{
+		mesh = GenerateCachedMesh(request, jobSystem);
+		if (!mesh)
+		{
+			return nullptr;
+		}
+
+		if (!path.empty())
+		{
+			WriteMeshCacheFile(path, key, keyWords, *mesh);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(cache->mutex);
+	if (fromDisk)
+	{
+		cache->stats.diskHits++;
+	}
+	else
+	{
+		cache->stats.misses++;
+	}
+
+	return InsertMeshCacheEntry(cache, key, keyWords, mesh);
+}
+
+// ----------------------------------------------------------------------------
+
+void GetMeshCacheStats(const MeshCache* cache, MeshCacheStats* stats)
+{
+	if (!cache || !stats)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(cache->mutex);
+	*stats = cache->stats;
+	stats->numEntries = (int)cache->entries.size();
+}
+
+// ----------------------------------------------------------------------------
+
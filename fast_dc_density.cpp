@@ -0,0 +1,982 @@
+//
+// Public domain
+//
+
+#include "fast_dc.h"
+
+#include <glm/glm.hpp>
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+using glm::vec4;
+using glm::vec3;
+using glm::vec2;
+using glm::mat4;
+using glm::mat3;
+
+// ----------------------------------------------------------------------------
+
+// The "super primitve" -- use the parameters to configure different shapes from a single function
+// see https://www.shadertoy.com/view/MsVGWG
+
+static float sdSuperprim(vec3 p, vec4 s, vec2 r)
+{
+	const vec3 d = glm::abs(p) - vec3(s);
+
+	float q = glm::length(vec2(glm::max(d.x + r.x, 0.f), glm::max(d.y + r.x, 0.f)));
+	q += glm::min(-r.x, glm::max(d.x,d.y));
+    q = (glm::abs((q + s.w)) - s.w);
+
+    return glm::length(vec2(glm::max(q + r.y,0.f),
+		glm::max(d.z + r.y, 0.f))) + glm::min(-r.y, glm::max(q, d.z));
+}
+
+// ----------------------------------------------------------------------------
+
+// The points are evaluated in batches, each instruction reads & writes whole batches on
+// a stack so the dispatch cost is paid once per batch rather than once per point
+const int DENSITY_BATCH_SIZE = 64;
+const int DENSITY_MAX_STACK_DEPTH = 32;
+
+namespace {
+
+struct DensityPrimitive
+{
+	// the rows of the world to shape space transform
+	vec4 inverse[3];
+
+	// converts the shape space distance back to a world space distance bound
+	float scale = 1.f;
+
+	vec4 s;
+	vec2 r;
+};
+
+struct DensityInstruction
+{
+	enum Op
+	{
+		Primitive,
+		Union,
+		Subtract,
+		Intersect,
+		SmoothUnion,
+		SmoothSubtract,
+		SmoothIntersect,
+	};
+
+	Op op = Primitive;
+	int primitive = -1;
+	float blend = 0.f;
+
+	// the operands are on the stack in the opposite order, i.e. the second child was
+	// evaluated first since it needed the deeper stack
+	bool swapped = false;
+};
+
+// The compiled scene. Outside a node's bounds its density is at least slope * the distance
+// to the bounds, a slope of zero only guarantees the density is positive there. 
+struct DensityNode
+{
+	DensityInstruction::Op op = DensityInstruction::Primitive;
+	int primitive = -1;
+	int children[2] = { -1, -1 };
+	float blend = 0.f;
+
+	vec3 boundsMin;
+	vec3 boundsMax;
+	float slope = 0.f;
+};
+
+struct DensityTree
+{
+	std::vector<DensityPrimitive> primitives;
+	std::vector<DensityNode> nodes;
+	int root = -1;
+};
+
+}
+
+// Specialised programs share the tree of the program they were created from. Programs
+// compiled from a volume just sample it and have no tree.
+class DensityProgram
+{
+public:
+
+	const DensityTree* tree = nullptr;
+	bool ownsTree = false;
+
+	const DenseVolume* volume = nullptr;
+	const SparseVolume* sparseVolume = nullptr;
+
+	// evaluates another program at the points multiplied by scale
+	const DensityProgram* scaled = nullptr;
+	bool ownsScaled = false;
+	float scale = 1.f;
+
+	std::vector<DensityInstruction> instructions;
+	int stackDepth = 0;
+	int numPrimitives = 0;
+
+	DensityCounters* counters = nullptr;
+};
+
+// ----------------------------------------------------------------------------
+
+int CsgAddPrimitive(CsgScene& scene, const SuperPrimitiveConfig& config, const glm::mat4& transform)
+{
+	CsgPrimitive primitive;
+	primitive.config = config;
+	primitive.transform = transform;
+	scene.primitives.push_back(primitive);
+
+	CsgNode node;
+	node.type = CsgNode::Primitive;
+	node.primitive = (int)scene.primitives.size() - 1;
+	scene.nodes.push_back(node);
+
+	scene.root = (int)scene.nodes.size() - 1;
+	return scene.root;
+}
+
+// ----------------------------------------------------------------------------
+
+int CsgAddOperation(CsgScene& scene, const CsgNode::Type type, const int lhs, const int rhs, const float blend)
+{
+	CsgNode node;
+	node.type = type;
+	node.children[0] = lhs;
+	node.children[1] = rhs;
+	node.blend = blend;
+	scene.nodes.push_back(node);
+
+	scene.root = (int)scene.nodes.size() - 1;
+	return scene.root;
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns 1 / the largest singular value of m, found by power iteration on m^T * m. In
+// double precision so the uniform scales come out exact.
+static float ReciprocalNorm(const mat3& m)
+{
+	const glm::dmat3 mtm = glm::transpose(glm::dmat3(m)) * glm::dmat3(m);
+
+	glm::dvec3 v(1.0, 1.0, 1.0);
+	double lambda = 0.0;
+	for (int i = 0; i < 32; i++)
+	{
+		const glm::dvec3 mv = mtm * v;
+		lambda = glm::length(mv);
+		if (lambda <= 0.0)
+		{
+			return 0.f;
+		}
+
+		v = mv / lambda;
+	}
+
+	return (float)(1.0 / glm::sqrt(lambda));
+}
+
+// ----------------------------------------------------------------------------
+
+static int AddPrimitiveNode(
+	const CsgScene& scene, 
+	const int primitiveIdx, 
+	std::vector<int>& primitiveMap, 
+	DensityTree* tree)
+{
+	const CsgPrimitive& src = scene.primitives[primitiveIdx];
+	if (glm::determinant(mat3(src.transform)) == 0.f)
+	{
+		return -1;
+	}
+
+	// the density is evaluated in shape space, a transform with a non-uniform scale or a
+	// shear would stretch the distances so the shape space distance is scaled by the 
+	// smallest singular value of the transform, i.e. 1 / the largest of the inverse
+	const mat4 inverse = glm::inverse(src.transform);
+	const float scale = ReciprocalNorm(mat3(inverse));
+
+	if (primitiveMap[primitiveIdx] == -1)
+	{
+		const mat4 rows = glm::transpose(inverse);
+
+		DensityPrimitive primitive;
+		primitive.inverse[0] = rows[0];
+		primitive.inverse[1] = rows[1];
+		primitive.inverse[2] = rows[2];
+		primitive.scale = scale;
+		primitive.s = src.config.s;
+		primitive.r = src.config.r;
+
+		primitiveMap[primitiveIdx] = (int)tree->primitives.size();
+		tree->primitives.push_back(primitive);
+	}
+
+	// the super primitive is inside the box |p| <= s and its density outside the box is at
+	// least the shape space distance to it, which is at least the world space distance 
+	// divided by the transform's largest singular value
+	DensityNode node;
+	node.op = DensityInstruction::Primitive;
+	node.primitive = primitiveMap[primitiveIdx];
+	node.boundsMin = vec3(FLT_MAX);
+	node.boundsMax = vec3(-FLT_MAX);
+	node.slope = scale * ReciprocalNorm(mat3(src.transform));
+
+	const vec3 extents = glm::abs(vec3(src.config.s));
+	for (int i = 0; i < 8; i++)
+	{
+		const vec4 corner((i & 1) ? extents.x : -extents.x, (i & 2) ? extents.y : -extents.y, (i & 4) ? extents.z : -extents.z, 1.f);
+		const vec3 p = vec3(src.transform * corner);
+		node.boundsMin = glm::min(node.boundsMin, p);
+		node.boundsMax = glm::max(node.boundsMax, p);
+	}
+
+	tree->nodes.push_back(node);
+	return (int)tree->nodes.size() - 1;
+}
+
+// ----------------------------------------------------------------------------
+
+static int AddOperationNode(
+	const DensityInstruction::Op op, 
+	const int lhs, 
+	const int rhs, 
+	const float blend,
+	DensityTree* tree)
+{
+	const DensityNode& a = tree->nodes[lhs];
+	const DensityNode& b = tree->nodes[rhs];
+
+	DensityNode node;
+	node.op = op;
+	node.children[0] = lhs;
+	node.children[1] = rhs;
+	node.blend = blend;
+
+	switch (op)
+	{
+		case DensityInstruction::Union:
+			node.boundsMin = glm::min(a.boundsMin, b.boundsMin);
+			node.boundsMax = glm::max(a.boundsMax, b.boundsMax);
+			node.slope = glm::min(a.slope, b.slope);
+			break;
+
+		case DensityInstruction::SmoothUnion:
+		{
+			// the smooth min is at most blend / 4 below the min, expanding the bounds by
+			// that distance over the slope keeps the bound
+			node.slope = glm::min(a.slope, b.slope);
+			const float expand = node.slope > 0.f ? blend / (4.f * node.slope) : FLT_MAX;
+			node.boundsMin = glm::max(glm::min(a.boundsMin, b.boundsMin) - vec3(expand), vec3(-FLT_MAX));
+			node.boundsMax = glm::min(glm::max(a.boundsMax, b.boundsMax) + vec3(expand), vec3(FLT_MAX));
+			break;
+		}
+
+		case DensityInstruction::Subtract:
+		case DensityInstruction::SmoothSubtract:
+			node.boundsMin = a.boundsMin;
+			node.boundsMax = a.boundsMax;
+			node.slope = a.slope;
+			break;
+
+		case DensityInstruction::Intersect:
+		case DensityInstruction::SmoothIntersect:
+			node.boundsMin = glm::max(a.boundsMin, b.boundsMin);
+			node.boundsMax = glm::min(a.boundsMax, b.boundsMax);
+			node.slope = 0.f;
+			break;
+
+		default:
+			break;
+	}
+
+	tree->nodes.push_back(node);
+	return (int)tree->nodes.size() - 1;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool IsHardUnion(const CsgNode& node)
+{
+	return node.type == CsgNode::Union || (node.type == CsgNode::SmoothUnion && node.blend <= 0.f);
+}
+
+// ----------------------------------------------------------------------------
+
+static int ConvertNode(
+	const CsgScene& scene,
+	const int nodeIdx,
+	const int depth,
+	std::vector<int>& primitiveMap,
+	DensityTree* tree);
+
+// Collect the operands of a run of (hard) unions, the order doesn't change the result
+static bool GatherUnionOperands(
+	const CsgScene& scene, 
+	const int nodeIdx, 
+	const int depth,
+	std::vector<std::pair<int, int>>& operands)
+{
+	// a cycle would recurse forever, no valid tree is deeper than the number of nodes
+	if (nodeIdx < 0 || nodeIdx >= (int)scene.nodes.size() || depth > (int)scene.nodes.size())
+	{
+		return false;
+	}
+
+	const CsgNode& node = scene.nodes[nodeIdx];
+	if (!IsHardUnion(node))
+	{
+		operands.push_back(std::make_pair(nodeIdx, depth));
+		return true;
+	}
+
+	return 
+		GatherUnionOperands(scene, node.children[0], depth + 1, operands) && 
+		GatherUnionOperands(scene, node.children[1], depth + 1, operands);
+}
+
+// ----------------------------------------------------------------------------
+
+// The operands of a union are rebuilt as a BVH: each level splits the operands at the 
+// median of their centres along the longest axis, and each BVH node is a union node with 
+// the combined bounds, so a block of samples can skip whole subtrees of the scene
+static int BuildUnionTree(std::vector<int>& operands, const int first, const int last, DensityTree* tree)
+{
+	if ((last - first) == 1)
+	{
+		return operands[first];
+	}
+
+	vec3 centreMin(FLT_MAX), centreMax(-FLT_MAX);
+	for (int i = first; i < last; i++)
+	{
+		const DensityNode& node = tree->nodes[operands[i]];
+		const vec3 centre = (glm::clamp(node.boundsMin, vec3(-1e6f), vec3(1e6f)) + glm::clamp(node.boundsMax, vec3(-1e6f), vec3(1e6f))) * 0.5f;
+		centreMin = glm::min(centreMin, centre);
+		centreMax = glm::max(centreMax, centre);
+	}
+
+	const vec3 size = centreMax - centreMin;
+	const int axis = size.x >= size.y && size.x >= size.z ? 0 : (size.y >= size.z ? 1 : 2);
+
+	// ties are broken by the node index so the split (and so the tree) doesn't depend on
+	// the standard library's nth_element
+	const int mid = first + ((last - first) / 2);
+	std::nth_element(begin(operands) + first, begin(operands) + mid, begin(operands) + last, [&](const int lhs, const int rhs)
+	{
+		const DensityNode& a = tree->nodes[lhs];
+		const DensityNode& b = tree->nodes[rhs];
+		const float centreA = glm::clamp(a.boundsMin[axis], -1e6f, 1e6f) + glm::clamp(a.boundsMax[axis], -1e6f, 1e6f);
+		const float centreB = glm::clamp(b.boundsMin[axis], -1e6f, 1e6f) + glm::clamp(b.boundsMax[axis], -1e6f, 1e6f);
+		return centreA != centreB ? centreA < centreB : lhs < rhs;
+	});
+
+	const int lhs = BuildUnionTree(operands, first, mid, tree);
+	const int rhs = BuildUnionTree(operands, mid, last, tree);
+	return AddOperationNode(DensityInstruction::Union, lhs, rhs, 0.f, tree);
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns the index of the node in the tree, or -1 if the scene node is invalid
+static int ConvertNode(
+	const CsgScene& scene,
+	const int nodeIdx,
+	const int depth,
+	std::vector<int>& primitiveMap,
+	DensityTree* tree)
+{
+	if (nodeIdx < 0 || nodeIdx >= (int)scene.nodes.size() || depth > (int)scene.nodes.size())
+	{
+		return -1;
+	}
+
+	const CsgNode& node = scene.nodes[nodeIdx];
+	if (node.type == CsgNode::Primitive)
+	{
+		if (node.primitive < 0 || node.primitive >= (int)scene.primitives.size())
+		{
+			return -1;
+		}
+
+		return AddPrimitiveNode(scene, node.primitive, primitiveMap, tree);
+	}
+
+	if (IsHardUnion(node))
+	{
+		std::vector<std::pair<int, int>> sceneOperands;
+		if (!GatherUnionOperands(scene, nodeIdx, depth, sceneOperands))
+		{
+			return -1;
+		}
+
+		std::vector<int> operands;
+		for (const auto& operand: sceneOperands)
+		{
+			const int idx = ConvertNode(scene, operand.first, operand.second, primitiveMap, tree);
+			if (idx == -1)
+			{
+				return -1;
+			}
+
+			operands.push_back(idx);
+		}
+
+		return BuildUnionTree(operands, 0, (int)operands.size(), tree);
+	}
+
+	const int lhs = ConvertNode(scene, node.children[0], depth + 1, primitiveMap, tree);
+	const int rhs = ConvertNode(scene, node.children[1], depth + 1, primitiveMap, tree);
+	if (lhs == -1 || rhs == -1)
+	{
+		return -1;
+	}
+
+	// a blend radius of zero is the same as the hard operation
+	const bool smooth = node.blend > 0.f;
+	switch (node.type)
+	{
+		case CsgNode::SmoothUnion:
+			return AddOperationNode(DensityInstruction::SmoothUnion, lhs, rhs, node.blend, tree);
+
+		case CsgNode::Subtract:
+		case CsgNode::SmoothSubtract:
+			return AddOperationNode(smooth && node.type == CsgNode::SmoothSubtract ?
+				DensityInstruction::SmoothSubtract : DensityInstruction::Subtract, lhs, rhs, node.blend, tree);
+
+		case CsgNode::Intersect:
+		case CsgNode::SmoothIntersect:
+			return AddOperationNode(smooth && node.type == CsgNode::SmoothIntersect ?
+				DensityInstruction::SmoothIntersect : DensityInstruction::Intersect, lhs, rhs, node.blend, tree);
+
+		default:
+			return -1;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static float BoundsDistance(const DensityNode& node, const vec3& boundsMin, const vec3& boundsMax)
+{
+	const vec3 gap = glm::max(glm::max(node.boundsMin - boundsMax, boundsMin - node.boundsMax), vec3(0.f));
+	return glm::length(gap);
+}
+
+// ----------------------------------------------------------------------------
+
+// Emit the instructions for the node, skipping any subtree which is provably at least 
+// margin (or, for a margin of 0, strictly positive) everywhere inside the box. Such a 
+// subtree can't change the sign of a union or difference it's part of, and makes an 
+// intersection entirely positive. Removing it only changes the density where both the 
+// old and new values are beyond the margin with the same sign. 
+// The smooth operations blend values within the blend radius k and the smooth min is up
+// to k / 4 below the min, so their children need a margin of margin + k + k / 4. When one
+// child of a smooth union or difference is skipped the result is the other child (beyond
+// the margin) so it only needs the original margin.
+// Returns the stack depth needed, or 0 if the whole node was skipped.
+static int EmitNode(
+	const DensityTree& tree,
+	const int nodeIdx,
+	const vec3& boundsMin,
+	const vec3& boundsMax,
+	const float margin,
+	std::vector<DensityInstruction>& instructions)
+{
+	const DensityNode& node = tree.nodes[nodeIdx];
+
+	const float distance = BoundsDistance(node, boundsMin, boundsMax);
+	if (distance > 0.f && (node.slope * distance) >= margin)
+	{
+		return 0;
+	}
+
+	if (node.op == DensityInstruction::Primitive)
+	{
+		DensityInstruction instruction;
+		instruction.op = DensityInstruction::Primitive;
+		instruction.primitive = node.primitive;
+		instructions.push_back(instruction);
+		return 1;
+	}
+
+	const bool smooth = 
+		node.op == DensityInstruction::SmoothUnion || 
+		node.op == DensityInstruction::SmoothSubtract || 
+		node.op == DensityInstruction::SmoothIntersect;
+	const bool isUnion = node.op == DensityInstruction::Union || node.op == DensityInstruction::SmoothUnion;
+	const bool isIntersect = node.op == DensityInstruction::Intersect || node.op == DensityInstruction::SmoothIntersect;
+	const float childMargin = smooth ? margin + (1.25f * node.blend) : margin;
+
+	const size_t start = instructions.size();
+	const int lhsDepth = EmitNode(tree, node.children[0], boundsMin, boundsMax, childMargin, instructions);
+	if (lhsDepth == 0 && !isUnion)
+	{
+		return 0;
+	}
+
+	const size_t lhsEnd = instructions.size();
+	const int rhsDepth = EmitNode(tree, node.children[1], boundsMin, boundsMax, childMargin, instructions);
+	if (rhsDepth == 0)
+	{
+		if (isIntersect)
+		{
+			instructions.resize(start);
+			return 0;
+		}
+
+		if (smooth && lhsDepth != 0)
+		{
+			instructions.resize(start);
+			return EmitNode(tree, node.children[0], boundsMin, boundsMax, margin, instructions);
+		}
+
+		return lhsDepth;
+	}
+
+	if (lhsDepth == 0)
+	{
+		if (smooth)
+		{
+			instructions.resize(start);
+			return EmitNode(tree, node.children[1], boundsMin, boundsMax, margin, instructions);
+		}
+
+		return rhsDepth;
+	}
+
+	// emit the child needing the deeper stack first so the program's stack depth only 
+	// grows with the log of the number of primitives for a balanced tree (Sethi-Ullman)
+	const bool swapped = rhsDepth > lhsDepth;
+	if (swapped)
+	{
+		std::rotate(begin(instructions) + start, begin(instructions) + lhsEnd, end(instructions));
+	}
+
+	DensityInstruction instruction;
+	instruction.op = node.op;
+	instruction.blend = node.blend;
+	instruction.swapped = swapped;
+	instructions.push_back(instruction);
+
+	const int first = swapped ? rhsDepth : lhsDepth;
+	const int second = swapped ? lhsDepth : rhsDepth;
+	return glm::max(first, second + 1);
+}
+
+// ----------------------------------------------------------------------------
+
+static DensityProgram* EmitProgram(
+	const DensityTree* tree, 
+	const vec3& boundsMin, 
+	const vec3& boundsMax, 
+	const float margin)
+{
+	DensityProgram* program = new DensityProgram;
+	program->tree = tree;
+	program->stackDepth = EmitNode(*tree, tree->root, boundsMin, boundsMax, margin, program->instructions);
+
+	for (const DensityInstruction& instruction: program->instructions)
+	{
+		program->numPrimitives += instruction.op == DensityInstruction::Primitive ? 1 : 0;
+	}
+
+	return program;
+}
+
+// ----------------------------------------------------------------------------
+
+DensityProgram* CompileDensityProgram(const CsgScene& scene)
+{
+	DensityTree* tree = new DensityTree;
+
+	std::vector<int> primitiveMap(scene.primitives.size(), -1);
+	tree->root = ConvertNode(scene, scene.root, 0, primitiveMap, tree);
+	if (tree->root == -1)
+	{
+		delete tree;
+		return nullptr;
+	}
+
+	DensityProgram* program = EmitProgram(tree, vec3(-FLT_MAX), vec3(FLT_MAX), 0.f);
+	program->ownsTree = true;
+
+	if (program->stackDepth < 1 || program->stackDepth > DENSITY_MAX_STACK_DEPTH)
+	{
+		DestroyDensityProgram(program);
+		return nullptr;
+	}
+
+	return program;
+}
+
+// ----------------------------------------------------------------------------
+
+DensityProgram* SpecialiseDensityProgram(
+	const DensityProgram& program,
+	const glm::vec3& boundsMin,
+	const glm::vec3& boundsMax,
+	const float margin)
+{
+	DensityProgram* specialised = nullptr;
+	if (program.volume)
+	{
+		specialised = CompileVolumeDensity(*program.volume);
+	}
+	else if (program.sparseVolume)
+	{
+		specialised = CompileSparseVolumeDensity(*program.sparseVolume);
+	}
+	else if (program.scaled)
+	{
+		DensityProgram* inner = SpecialiseDensityProgram(*program.scaled, 
+			boundsMin * program.scale, boundsMax * program.scale, margin * program.scale);
+		if (!inner)
+		{
+			return nullptr;
+		}
+
+		specialised = CompileScaledDensity(*inner, program.scale);
+		specialised->ownsScaled = true;
+	}
+	else
+	{
+		specialised = EmitProgram(program.tree, boundsMin, boundsMax, margin);
+	}
+
+	specialised->counters = program.counters;
+	return specialised;
+}
+
+// ----------------------------------------------------------------------------
+
+int DensityProgramSize(const DensityProgram& program)
+{
+	return program.scaled ? DensityProgramSize(*program.scaled) : program.numPrimitives;
+}
+
+// ----------------------------------------------------------------------------
+
+void DestroyDensityProgram(DensityProgram* program)
+{
+	if (program && program->ownsTree)
+	{
+		delete program->tree;
+	}
+
+	if (program && program->ownsScaled)
+	{
+		DestroyDensityProgram(const_cast<DensityProgram*>(program->scaled));
+	}
+
+	delete program;
+}
+
+// ----------------------------------------------------------------------------
+
+DensityProgram* CompileSuperPrimitive(const SuperPrimitiveConfig& config)
+{
+	CsgScene scene;
+	CsgAddPrimitive(scene, config, glm::mat4(32.f, 0.f, 0.f, 0.f, 0.f, 32.f, 0.f, 0.f, 0.f, 0.f, 32.f, 0.f, 0.f, 0.f, 0.f, 1.f));
+	return CompileDensityProgram(scene);
+}
+
+// ----------------------------------------------------------------------------
+
+DensityProgram* CompileVolumeDensity(const DenseVolume& volume)
+{
+	DensityProgram* program = new DensityProgram;
+	program->volume = &volume;
+	return program;
+}
+
+// ----------------------------------------------------------------------------
+
+DensityProgram* CompileSparseVolumeDensity(const SparseVolume& volume)
+{
+	DensityProgram* program = new DensityProgram;
+	program->sparseVolume = &volume;
+	return program;
+}
+
+// ----------------------------------------------------------------------------
+
+DensityProgram* CompileScaledDensity(const DensityProgram& program, const float scale)
+{
+	DensityProgram* scaled = new DensityProgram;
+	scaled->scaled = &program;
+	scaled->scale = scale;
+	return scaled;
+}
+
+// ----------------------------------------------------------------------------
+
+void SetDensityProgramCounters(DensityProgram* program, DensityCounters* counters)
+{
+	program->counters = counters;
+}
+
+// ----------------------------------------------------------------------------
+
+static void EvaluatePrimitive(
+	const DensityPrimitive& primitive,
+	const vec4* points,
+	const int count,
+	float* out)
+{
+	for (int i = 0; i < count; i++)
+	{
+		const vec3 p(
+			glm::dot(primitive.inverse[0], points[i]),
+			glm::dot(primitive.inverse[1], points[i]),
+			glm::dot(primitive.inverse[2], points[i]));
+
+		out[i] = sdSuperprim(p, primitive.s, primitive.r) * primitive.scale;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void EvaluateBatch(
+	const DensityProgram& program,
+	const vec4* points,
+	const int count,
+	float stack[DENSITY_MAX_STACK_DEPTH][DENSITY_BATCH_SIZE])
+{
+	int top = 0;
+	for (const DensityInstruction& instruction: program.instructions)
+	{
+		if (instruction.op == DensityInstruction::Primitive)
+		{
+			EvaluatePrimitive(program.tree->primitives[instruction.primitive], points, count, stack[top++]);
+			continue;
+		}
+
+		float* a = stack[top - 2];
+		float* b = stack[top - 1];
+		float* out = stack[top - 2];
+		if (instruction.swapped)
+		{
+			std::swap(a, b);
+		}
+
+		const float k = instruction.blend;
+		switch (instruction.op)
+		{
+			case DensityInstruction::Union:
+				for (int i = 0; i < count; i++)
+				{
+					out[i] = glm::min(a[i], b[i]);
+				}
+				break;
+
+			case DensityInstruction::Subtract:
+				for (int i = 0; i < count; i++)
+				{
+					out[i] = glm::max(a[i], -b[i]);
+				}
+				break;
+
+			case DensityInstruction::Intersect:
+				for (int i = 0; i < count; i++)
+				{
+					out[i] = glm::max(a[i], b[i]);
+				}
+				break;
+
+			// polynomial smooth min/max, see http://iquilezles.org/www/articles/smin/smin.htm
+			// Written out rather than using mix so that outside the blend radius the result
+			// is exactly one of the operands, and dropping the other one for a block of 
+			// samples doesn't change the value.
+			case DensityInstruction::SmoothUnion:
+				for (int i = 0; i < count; i++)
+				{
+					const float h = glm::clamp(0.5f + (0.5f * (b[i] - a[i]) / k), 0.f, 1.f);
+					out[i] = (a[i] * h) + (b[i] * (1.f - h)) - (k * h * (1.f - h));
+				}
+				break;
+
+			case DensityInstruction::SmoothSubtract:
+				for (int i = 0; i < count; i++)
+				{
+					const float h = glm::clamp(0.5f - (0.5f * (a[i] + b[i]) / k), 0.f, 1.f);
+					out[i] = (a[i] * (1.f - h)) - (b[i] * h) + (k * h * (1.f - h));
+				}
+				break;
+
+			case DensityInstruction::SmoothIntersect:
+				for (int i = 0; i < count; i++)
+				{
+					const float h = glm::clamp(0.5f - (0.5f * (b[i] - a[i]) / k), 0.f, 1.f);
+					out[i] = (a[i] * h) + (b[i] * (1.f - h)) + (k * h * (1.f - h));
+				}
+				break;
+
+			default:
+				break;
+		}
+
+		top--;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void EvaluateProgram(const DensityProgram& program, const glm::vec4* points, const int count, float* densities)
+{
+	if (program.volume)
+	{
+		SampleDenseVolume(*program.volume, points, count, densities);
+		return;
+	}
+	else if (program.sparseVolume)
+	{
+		SampleSparseVolume(*program.sparseVolume, points, count, densities);
+		return;
+	}
+	else if (program.scaled)
+	{
+		// dividing by the scale keeps the density a distance bound in the scaled space
+		vec4 scaledPoints[DENSITY_BATCH_SIZE];
+		for (int base = 0; base < count; base += DENSITY_BATCH_SIZE)
+		{
+			const int batchCount = glm::min(DENSITY_BATCH_SIZE, count - base);
+			for (int i = 0; i < batchCount; i++)
+			{
+				scaledPoints[i] = vec4(vec3(points[base + i]) * program.scale, 1.f);
+			}
+
+			EvaluateDensity(*program.scaled, scaledPoints, batchCount, &densities[base]);
+
+			for (int i = 0; i < batchCount; i++)
+			{
+				densities[base + i] /= program.scale;
+			}
+		}
+
+		return;
+	}
+
+	// every primitive was skipped so the points are all outside
+	if (program.instructions.empty())
+	{
+		for (int i = 0; i < count; i++)
+		{
+			densities[i] = FLT_MAX;
+		}
+
+		return;
+	}
+
+	float stack[DENSITY_MAX_STACK_DEPTH][DENSITY_BATCH_SIZE];
+
+	for (int base = 0; base < count; base += DENSITY_BATCH_SIZE)
+	{
+		const int batchCount = glm::min(DENSITY_BATCH_SIZE, count - base);
+		EvaluateBatch(program, &points[base], batchCount, stack);
+		memcpy(&densities[base], stack[0], batchCount * sizeof(float));
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+void EvaluateDensity(const DensityProgram& program, const glm::vec4* points, const int count, float* densities)
+{
+	if (program.counters)
+	{
+		program.counters->points.fetch_add(count, std::memory_order_relaxed);
+	}
+
+	EvaluateProgram(program, points, count, densities);
+}
+
+// ----------------------------------------------------------------------------
+
+float EvaluateDensity(const DensityProgram& program, const glm::vec4& point)
+{
+	float density = 0.f;
+	EvaluateDensity(program, &point, 1, &density);
+	return density;
+}
+
+// ----------------------------------------------------------------------------
+
+bool IsDensityUniform(
+	const DensityProgram& program, 
+	const glm::vec3& boundsMin, 
+	const glm::vec3& boundsMax, 
+	float* density)
+{
+	// nothing is known about the values between a dense volume's samples without reading them
+	if (program.volume)
+	{
+		return false;
+	}
+	else if (program.sparseVolume)
+	{
+		return IsSparseVolumeUniform(*program.sparseVolume, boundsMin, boundsMax, density);
+	}
+	else if (program.scaled)
+	{
+		if (!IsDensityUniform(*program.scaled, boundsMin * program.scale, boundsMax * program.scale, density))
+		{
+			return false;
+		}
+
+		*density /= program.scale;
+		return true;
+	}
+
+	// the density is a distance bound, so when the density at the centre of the box is 
+	// further from the surface than the corners are from the centre the whole box must 
+	// have the same sign
+	const vec3 span = boundsMax - boundsMin;
+	const float d = EvaluateDensity(program, vec4(boundsMin + (span * 0.5f), 1.f));
+
+	*density = d;
+	return glm::abs(d) > (0.5f * glm::length(span));
+}
+
+// ----------------------------------------------------------------------------
+
+glm::vec4 EvaluateDensityNormal(const DensityProgram& program, const glm::vec4& point)
+{
+	if (program.counters)
+	{
+		program.counters->normals.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (program.volume)
+	{
+		return SampleDenseVolumeNormal(*program.volume, point);
+	}
+	else if (program.sparseVolume)
+	{
+		return SampleSparseVolumeNormal(*program.sparseVolume, point);
+	}
+	else if (program.scaled)
+	{
+		return EvaluateDensityNormal(*program.scaled, vec4(vec3(point) * program.scale, 1.f));
+	}
+
+	// central differences of the density
+	const float H = 0.001f;
+	const vec4 samples[6] =
+	{
+		point + vec4(H, 0.f, 0.f, 0.f), point - vec4(H, 0.f, 0.f, 0.f),
+		point + vec4(0.f, H, 0.f, 0.f), point - vec4(0.f, H, 0.f, 0.f),
+		point + vec4(0.f, 0.f, H, 0.f), point - vec4(0.f, 0.f, H, 0.f),
+	};
+
+	float d[6];
+	EvaluateProgram(program, samples, 6, d);
+
+	return glm::normalize(vec4(d[0] - d[1], d[2] - d[3], d[4] - d[5], 0.f));
+}
+
+// ----------------------------------------------------------------------------
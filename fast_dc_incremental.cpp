@@ -0,0 +1,319 @@
+//
+// Public domain
+//
+
+#include "fast_dc.h"
+#include "fast_dc_internal.h"
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+
+using glm::ivec2;
+using glm::ivec3;
+using glm::ivec4;
+
+// ----------------------------------------------------------------------------
+
+// The chunk's apron and the extra layer of edges on its max faces mean a chunk samples
+// the density from (min - 1) to (min + size + 1), and the edge intersections & normals
+// sample just outside the lattice points
+const int DIRTY_REGION_PADDING = 2;
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+// The seam vertices are shared by several chunks so the output vertices are refcounted
+struct OutputVertex
+{
+	int index = -1;
+	int refs = 0;
+};
+
+}
+
+// ----------------------------------------------------------------------------
+
+class MeshingState
+{
+public:
+
+	const DensityProgram* density = nullptr;
+	ivec3 firstChunk;
+	ivec3 numChunks;
+	int chunkSize = 0;
+
+	std::vector<ChunkMesh> chunks;
+	std::vector<bool> dirty;
+
+	// the output triangle indices of each chunk's triangles
+	std::vector<std::vector<int>> chunkTriangles;
+
+	std::vector<MeshVertex> vertices;
+	std::vector<int> freeVertices;
+	std::unordered_map<ivec4, OutputVertex, VoxelKeyHash> vertexTable;
+
+	// the chunk & position in that chunk's list of each output triangle, used to move
+	// the last triangle into the gap when a triangle is removed
+	std::vector<MeshTriangle> triangles;
+	std::vector<ivec2> triangleOwners;
+
+	MeshBuffer mesh;
+};
+
+// ----------------------------------------------------------------------------
+
+static int AcquireVertex(MeshingState* state, const ivec4& voxel, const MeshVertex& vertex)
+{
+	OutputVertex& output = state->vertexTable[voxel];
+	if (output.refs++ == 0)
+	{
+		if (!state->freeVertices.empty())
+		{
+			output.index = state->freeVertices.back();
+			state->freeVertices.pop_back();
+		}
+		else
+		{
+			output.index = (int)state->vertices.size();
+			state->vertices.push_back(vertex);
+		}
+	}
+
+	// a rebuilt chunk replaces the data for the vertices it shares, they are generated
+	// from the same Hermite data as the neighbour's so only changed vertices differ
+	state->vertices[output.index] = vertex;
+	return output.index;
+}
+
+// ----------------------------------------------------------------------------
+
+static void ReleaseVertex(MeshingState* state, const ivec4& voxel)
+{
+	const auto iter = state->vertexTable.find(voxel);
+	if (iter == end(state->vertexTable))
+	{
+		return;
+	}
+
+	if (--iter->second.refs == 0)
+	{
+		state->freeVertices.push_back(iter->second.index);
+		state->vertexTable.erase(iter);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void RemoveChunkTriangles(MeshingState* state, const int chunkIdx)
+{
+	std::vector<int>& chunkTris = state->chunkTriangles[chunkIdx];
+
+	// remove from the highest index down so the triangle moved into each gap is never
+	// one of the triangles still waiting to be removed
+	std::sort(begin(chunkTris), end(chunkTris));
+	for (int i = (int)chunkTris.size() - 1; i >= 0; i--)
+	{
+		const int removeIdx = chunkTris[i];
+		const int lastIdx = (int)state->triangles.size() - 1;
+
+		if (removeIdx != lastIdx)
+		{
+			const ivec2 owner = state->triangleOwners[lastIdx];
+			state->triangles[removeIdx] = state->triangles[lastIdx];
+			state->triangleOwners[removeIdx] = owner;
+			state->chunkTriangles[owner.x][owner.y] = removeIdx;
+		}
+
+		state->triangles.pop_back();
+		state->triangleOwners.pop_back();
+	}
+
+	chunkTris.clear();
+}
+
+// ----------------------------------------------------------------------------
+
+static void SpliceChunk(MeshingState* state, const int chunkIdx, ChunkMesh& chunk)
+{
+	ChunkMesh& previous = state->chunks[chunkIdx];
+
+	std::vector<int> remap;
+	if (chunk.mesh)
+	{
+		remap.resize(chunk.mesh->numVertices);
+		for (int i = 0; i < chunk.mesh->numVertices; i++)
+		{
+			remap[i] = AcquireVertex(state, chunk.vertexVoxels[i], chunk.mesh->vertices[i]);
+		}
+	}
+
+	RemoveChunkTriangles(state, chunkIdx);
+
+	if (previous.mesh)
+	{
+		for (int i = 0; i < previous.mesh->numVertices; i++)
+		{
+			ReleaseVertex(state, previous.vertexVoxels[i]);
+		}
+	}
+
+	if (chunk.mesh)
+	{
+		std::vector<int>& chunkTris = state->chunkTriangles[chunkIdx];
+		for (int i = 0; i < chunk.mesh->numTriangles; i++)
+		{
+			const MeshTriangle& src = chunk.mesh->triangles[i];
+
+			MeshTriangle tri;
+			tri.indices_[0] = remap[src.indices_[0]];
+			tri.indices_[1] = remap[src.indices_[1]];
+			tri.indices_[2] = remap[src.indices_[2]];
+
+			state->triangleOwners.push_back(ivec2(chunkIdx, (int)chunkTris.size()));
+			chunkTris.push_back((int)state->triangles.size());
+			state->triangles.push_back(tri);
+		}
+	}
+
+	FreeChunkMesh(previous);
+	previous = chunk;
+}
+
+// ----------------------------------------------------------------------------
+
+MeshingState* CreateMeshingState(
+	const DensityProgram& density,
+	const glm::ivec3& firstChunk,
+	const glm::ivec3& numChunks,
+	const int chunkSize)
+{
+	if (chunkSize < 1 || chunkSize > MAX_CHUNK_SIZE ||
+		numChunks.x < 1 || numChunks.y < 1 || numChunks.z < 1)
+	{
+		return nullptr;
+	}
+
+	const int count = numChunks.x * numChunks.y * numChunks.z;
+
+	MeshingState* state = new MeshingState;
+	state->density = &density;
+	state->firstChunk = firstChunk;
+	state->numChunks = numChunks;
+	state->chunkSize = chunkSize;
+	state->chunks.resize(count);
+	state->chunkTriangles.resize(count);
+	state->dirty.resize(count, true);
+	return state;
+}
+
+// ----------------------------------------------------------------------------
+
+void DestroyMeshingState(MeshingState* state)
+{
+	if (!state)
+	{
+		return;
+	}
+
+	for (ChunkMesh& chunk: state->chunks)
+	{
+		FreeChunkMesh(chunk);
+	}
+
+	delete state;
+}
+
+// ----------------------------------------------------------------------------
+
+void MarkMeshingStateDirty(
+	MeshingState* state,
+	const glm::ivec3& dirtyMin,
+	const glm::ivec3& dirtyMax)
+{
+	const ivec3 regionMin = dirtyMin - ivec3(DIRTY_REGION_PADDING);
+	const ivec3 regionMax = dirtyMax + ivec3(DIRTY_REGION_PADDING);
+
+	for (int x = 0; x < state->numChunks.x; x++)
+	for (int y = 0; y < state->numChunks.y; y++)
+	for (int z = 0; z < state->numChunks.z; z++)
+	{
+		const ivec3 chunkMin = (state->firstChunk + ivec3(x, y, z)) * state->chunkSize;
+		const ivec3 chunkMax = chunkMin + ivec3(state->chunkSize);
+
+		if (chunkMin.x <= regionMax.x && chunkMax.x >= regionMin.x &&
+			chunkMin.y <= regionMax.y && chunkMax.y >= regionMin.y &&
+			chunkMin.z <= regionMax.z && chunkMax.z >= regionMin.z)
+		{
+			state->dirty[(x * state->numChunks.y * state->numChunks.z) + (y * state->numChunks.z) + z] = true;
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+void UpdateMeshingStateDensity(
+	MeshingState* state,
+	const DensityProgram& density,
+	const glm::ivec3& dirtyMin,
+	const glm::ivec3& dirtyMax)
+{
+	state->density = &density;
+	MarkMeshingStateDirty(state, dirtyMin, dirtyMax);
+}
+
+// ----------------------------------------------------------------------------
+
+int UpdateMeshingState(MeshingState* state, ngJobSystem* jobSystem)
+{
+	std::vector<int> dirtyChunks;
+	std::vector<ivec3> chunkCoords;
+	for (int i = 0; i < (int)state->dirty.size(); i++)
+	{
+		if (!state->dirty[i])
+		{
+			continue;
+		}
+
+		const int x = i / (state->numChunks.y * state->numChunks.z);
+		const int y = (i / state->numChunks.z) % state->numChunks.y;
+		const int z = i % state->numChunks.z;
+
+		dirtyChunks.push_back(i);
+		chunkCoords.push_back(state->firstChunk + ivec3(x, y, z));
+		state->dirty[i] = false;
+	}
+
+	if (dirtyChunks.empty())
+	{
+		return 0;
+	}
+
+	std::vector<ChunkMesh> rebuilt(dirtyChunks.size());
+	GenerateChunkMeshes(jobSystem, *state->density, chunkCoords.data(), (int)chunkCoords.size(),
+		state->chunkSize, nullptr, rebuilt.data());
+
+	for (int i = 0; i < (int)dirtyChunks.size(); i++)
+	{
+		SpliceChunk(state, dirtyChunks[i], rebuilt[i]);
+	}
+
+	state->mesh.vertices = state->vertices.empty() ? nullptr : &state->vertices[0];
+	state->mesh.numVertices = (int)state->vertices.size();
+	state->mesh.triangles = state->triangles.empty() ? nullptr : &state->triangles[0];
+	state->mesh.numTriangles = (int)state->triangles.size();
+
+	return (int)dirtyChunks.size();
+}
+
+// ----------------------------------------------------------------------------
+
+const MeshBuffer* GetMeshingStateMesh(const MeshingState* state)
+{
+	return &state->mesh;
+}
+
+// ----------------------------------------------------------------------------
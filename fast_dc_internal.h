@@ -0,0 +1,32 @@
+#ifndef		HAS_FAST_DC_INTERNAL_H_BEEN_INCLUDED
+#define		HAS_FAST_DC_INTERNAL_H_BEEN_INCLUDED
+
+//
+// Helpers shared by the fast_dc translation units, not part of the public API
+// Public domain
+//
+
+#include	<glm/glm.hpp>
+#include	<stddef.h>
+#include	<stdint.h>
+
+// ----------------------------------------------------------------------------
+
+// Hashes voxel & chunk coordinates for the unordered_maps keyed on them, the w component
+// of a voxel key isn't hashed
+struct VoxelKeyHash
+{
+	size_t operator()(const glm::ivec3& key) const
+	{
+		return ((uint32_t)key.x * 73856093u) ^ ((uint32_t)key.y * 19349663u) ^ ((uint32_t)key.z * 83492791u);
+	}
+
+	size_t operator()(const glm::ivec4& key) const
+	{
+		return (*this)(glm::ivec3(key));
+	}
+};
+
+// ----------------------------------------------------------------------------
+
+#endif	//	HAS_FAST_DC_INTERNAL_H_BEEN_INCLUDED
@@ -0,0 +1,622 @@
+//
+// Public domain
+//
+
+#include "fast_dc.h"
+#include "fast_dc_internal.h"
+#include "ng_trace.h"
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+
+using glm::ivec3;
+using glm::ivec4;
+using glm::vec3;
+using glm::vec4;
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+using LodChunkTable = std::unordered_map<ivec3, ChunkMesh, VoxelKeyHash>;
+using LodVertexTable = std::unordered_map<ivec3, MeshVertex, VoxelKeyHash>;
+using LodIndexTable = std::unordered_map<ivec3, int, VoxelKeyHash>;
+
+// The boxes are in the level's chunk coords with exclusive max corners, the hole is the
+// box of the level inside this one (empty for level 0)
+struct LodLevel
+{
+	DensityProgram* program = nullptr;
+	float scale = 1.f;
+
+	bool valid = false;
+	ivec3 boxMin, boxMax;
+	ivec3 holeMin, holeMax;
+
+	LodChunkTable chunks;
+
+	// every vertex of the level's chunks by voxel (in the level's units), the seam with
+	// the next level looks up the vertices along this level's boundary
+	LodVertexTable voxelVertices;
+
+	std::vector<MeshVertex> vertices;
+	std::vector<MeshTriangle> triangles;
+	MeshBuffer mesh;
+};
+
+// The voxels which share an edge in the same order as the contouring uses so the seam
+// polygons are wound the same way as the level meshes
+const ivec3 EDGE_VOXEL_OFFSETS[3][4] =
+{
+	{ ivec3(0), ivec3(0, 0, 1), ivec3(0, 1, 0), ivec3(0, 1, 1) },
+	{ ivec3(0), ivec3(1, 0, 0), ivec3(0, 0, 1), ivec3(1, 0, 1) },
+	{ ivec3(0), ivec3(0, 1, 0), ivec3(1, 0, 0), ivec3(1, 1, 0) },
+};
+
+}
+
+// ----------------------------------------------------------------------------
+
+class LodClipmap
+{
+public:
+
+	const DensityProgram* density = nullptr;
+	int chunkSize = 0;
+	int levelChunks = 0;
+	VertexPlacement placement;
+
+	std::vector<LodLevel> levels;
+};
+
+// ----------------------------------------------------------------------------
+
+static inline bool InsideBox(const ivec3& p, const ivec3& boxMin, const ivec3& boxMax)
+{
+	return
+		p.x >= boxMin.x && p.y >= boxMin.y && p.z >= boxMin.z &&
+		p.x < boxMax.x && p.y < boxMax.y && p.z < boxMax.z;
+}
+
+// ----------------------------------------------------------------------------
+
+static inline ivec3 FloorHalf(const ivec3& p)
+{
+	const auto floorHalf = [](const int v) { return v >= 0 ? v / 2 : -((1 - v) / 2); };
+	return ivec3(floorHalf(p.x), floorHalf(p.y), floorHalf(p.z));
+}
+
+// ----------------------------------------------------------------------------
+
+static const DensityProgram& LevelDensity(const LodClipmap* clipmap, const LodLevel& level)
+{
+	const DensityProgram* program = level.program ? level.program : clipmap->density;
+	return *program;
+}
+
+// ----------------------------------------------------------------------------
+
+LodClipmap* CreateLodClipmap(
+	const DensityProgram& density,
+	const int numLevels,
+	const int chunkSize,
+	const int levelChunks,
+	const VertexPlacement& placement)
+{
+	if (numLevels < 1 || numLevels > MAX_LOD_LEVELS ||
+		chunkSize < 1 || chunkSize > MAX_CHUNK_SIZE ||
+		levelChunks < 8 || (levelChunks % 4) != 0)
+	{
+		return nullptr;
+	}
+
+	LodClipmap* clipmap = new LodClipmap;
+	clipmap->density = &density;
+	clipmap->chunkSize = chunkSize;
+	clipmap->levelChunks = levelChunks;
+	clipmap->placement = placement;
+	clipmap->levels.resize(numLevels);
+
+	for (int i = 0; i < numLevels; i++)
+	{
+		LodLevel& level = clipmap->levels[i];
+		level.scale = (float)(1 << i);
+		level.program = i > 0 ? CompileScaledDensity(density, level.scale) : nullptr;
+	}
+
+	return clipmap;
+}
+
+// ----------------------------------------------------------------------------
+
+void DestroyLodClipmap(LodClipmap* clipmap)
+{
+	if (!clipmap)
+	{
+		return;
+	}
+
+	for (LodLevel& level: clipmap->levels)
+	{
+		for (auto& pair: level.chunks)
+		{
+			FreeChunkMesh(pair.second);
+		}
+
+		DestroyDensityProgram(level.program);
+	}
+
+	delete clipmap;
+}
+
+// ----------------------------------------------------------------------------
+
+// Drop the chunks which left the level's box or are now covered by the inner level and
+// generate the ones which are missing
+static void UpdateLevelChunks(LodClipmap* clipmap, LodLevel& level, ngJobSystem* jobSystem)
+{
+	NG_TRACE_SCOPE("UpdateLevelChunks");
+
+	for (auto iter = begin(level.chunks); iter != end(level.chunks); )
+	{
+		if (!InsideBox(iter->first, level.boxMin, level.boxMax) ||
+			InsideBox(iter->first, level.holeMin, level.holeMax))
+		{
+			FreeChunkMesh(iter->second);
+			iter = level.chunks.erase(iter);
+		}
+		else
+		{
+			++iter;
+		}
+	}
+
+	std::vector<ivec3> chunkCoords;
+	for (int x = level.boxMin.x; x < level.boxMax.x; x++)
+	for (int y = level.boxMin.y; y < level.boxMax.y; y++)
+	for (int z = level.boxMin.z; z < level.boxMax.z; z++)
+	{
+		const ivec3 coord(x, y, z);
+		if (!InsideBox(coord, level.holeMin, level.holeMax) && level.chunks.find(coord) == end(level.chunks))
+		{
+			chunkCoords.push_back(coord);
+		}
+	}
+
+	if (!chunkCoords.empty())
+	{
+		std::vector<ChunkMesh> generated(chunkCoords.size());
+		GenerateChunkMeshes(jobSystem, LevelDensity(clipmap, level), chunkCoords.data(), (int)chunkCoords.size(),
+			clipmap->chunkSize, nullptr, generated.data(), clipmap->placement);
+
+		for (size_t i = 0; i < chunkCoords.size(); i++)
+		{
+			level.chunks[chunkCoords[i]] = generated[i];
+		}
+	}
+
+	level.voxelVertices.clear();
+	for (const auto& pair: level.chunks)
+	{
+		const ChunkMesh& chunk = pair.second;
+		for (int i = 0; chunk.mesh && i < chunk.mesh->numVertices; i++)
+		{
+			level.voxelVertices[ivec3(chunk.vertexVoxels[i])] = chunk.mesh->vertices[i];
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns the index of the voxel's vertex in the output mesh, adding it (scaled to level
+// 0's units) the first time it is used, or -1 if the voxel has no vertex
+static int AcquireLevelVertex(
+	LodLevel& output,
+	LodIndexTable& indices,
+	const LodLevel& source,
+	const ivec3& voxel)
+{
+	const auto iter = indices.find(voxel);
+	if (iter != end(indices))
+	{
+		return iter->second;
+	}
+
+	const auto vertexIter = source.voxelVertices.find(voxel);
+	if (vertexIter == end(source.voxelVertices))
+	{
+		return -1;
+	}
+
+	MeshVertex vertex = vertexIter->second;
+	vertex.xyz = vec4(vec3(vertex.xyz) * source.scale, vertex.xyz.w);
+
+	const int index = (int)output.vertices.size();
+	output.vertices.push_back(vertex);
+	indices[voxel] = index;
+	return index;
+}
+
+// ----------------------------------------------------------------------------
+
+// The seam needs a vertex for a coarse voxel which has none when the fine surface passes
+// through it without crossing any of the coarse edges (a feature smaller than the coarse
+// voxels). The vertex is placed at the mass point of the fine edges inside the coarse 
+// voxel which cross the surface, there is always at least one as the seam's edge is one.
+static int AcquireSeamFallbackVertex(
+	LodLevel& coarse,
+	LodIndexTable& coarseIndices,
+	const LodLevel& fine,
+	const DensityProgram& fineDensity,
+	const ivec3& coarseVoxel)
+{
+	// the coarse voxel covers 2^3 fine voxels, i.e. 3^3 fine samples
+	vec4 points[27];
+	float densities[27];
+	for (int z = 0; z < 3; z++)
+	for (int y = 0; y < 3; y++)
+	for (int x = 0; x < 3; x++)
+	{
+		points[x + (3 * (y + (3 * z)))] = vec4(vec3((coarseVoxel * 2) + ivec3(x, y, z)), 1.f);
+	}
+
+	EvaluateDensity(fineDensity, points, 27, densities);
+
+	const int strides[3] = { 1, 3, 9 };
+	vec3 position(0.f);
+	vec4 normal(0.f);
+	int count = 0;
+
+	for (int i = 0; i < 27; i++)
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const int j = i + strides[axis];
+		if (((i / strides[axis]) % 3) == 2 || (densities[i] < 0.f) == (densities[j] < 0.f))
+		{
+			continue;
+		}
+
+		const float t = densities[i] / (densities[i] - densities[j]);
+		const vec4 p = vec4(glm::mix(vec3(points[i]), vec3(points[j]), t), 1.f);
+		position += vec3(p);
+		normal += EvaluateDensityNormal(fineDensity, p);
+		count++;
+	}
+
+	if (count == 0)
+	{
+		return -1;
+	}
+
+	MeshVertex vertex;
+	vertex.xyz = vec4((position / (float)count) * fine.scale, 1.f);
+	vertex.normal = normal / (float)count;
+	vertex.colour = vec4(0.f);
+
+	const int index = (int)coarse.vertices.size();
+	coarse.vertices.push_back(vertex);
+	coarseIndices[coarseVoxel] = index;
+	return index;
+}
+
+// ----------------------------------------------------------------------------
+
+static void EmitSeamPolygon(LodLevel& output, const int indices[4], const bool winding)
+{
+	int tris[2][3];
+	if (winding)
+	{
+		tris[0][0] = indices[0]; tris[0][1] = indices[1]; tris[0][2] = indices[3];
+		tris[1][0] = indices[0]; tris[1][1] = indices[3]; tris[1][2] = indices[2];
+	}
+	else
+	{
+		tris[0][0] = indices[0]; tris[0][1] = indices[3]; tris[0][2] = indices[1];
+		tris[1][0] = indices[0]; tris[1][1] = indices[2]; tris[1][2] = indices[3];
+	}
+
+	// where two of the voxels are the same coarse voxel the quad is a triangle
+	for (int i = 0; i < 2; i++)
+	{
+		if (tris[i][0] == tris[i][1] || tris[i][1] == tris[i][2] || tris[i][0] == tris[i][2])
+		{
+			continue;
+		}
+
+		MeshTriangle tri;
+		tri.indices_[0] = tris[i][0];
+		tri.indices_[1] = tris[i][1];
+		tri.indices_[2] = tris[i][2];
+		output.triangles.push_back(tri);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+// The edges of the inner level which lie on the surface of its box are shared by voxels
+// of both levels, the inner voxels have their own vertices and each outer voxel is the
+// coarse voxel which covers it. The density is sampled over the box's faces in tiles
+// and the tiles which are known to have a uniform sign are skipped.
+static void StitchLevelSeam(
+	const LodClipmap* clipmap,
+	const LodLevel& fine,
+	LodLevel& coarse,
+	LodIndexTable& coarseIndices)
+{
+	NG_TRACE_SCOPE("StitchLevelSeam");
+
+	const int chunkSize = clipmap->chunkSize;
+	const ivec3 boxMin = fine.boxMin * chunkSize;
+	const ivec3 boxMax = fine.boxMax * chunkSize;
+	const DensityProgram& density = LevelDensity(clipmap, fine);
+
+	LodIndexTable fineIndices;
+	std::vector<float> densities((chunkSize + 1) * (chunkSize + 1));
+	std::vector<vec4> points((chunkSize + 1) * (chunkSize + 1));
+
+	for (int f = 0; f < 3; f++)
+	for (int side = 0; side < 2; side++)
+	{
+		const int u = (f + 1) % 3;
+		const int v = (f + 2) % 3;
+		const int plane = side ? boxMax[f] : boxMin[f];
+
+		for (int tileU = boxMin[u]; tileU < boxMax[u]; tileU += chunkSize)
+		for (int tileV = boxMin[v]; tileV < boxMax[v]; tileV += chunkSize)
+		{
+			ivec3 tileMin, tileMax;
+			tileMin[f] = tileMax[f] = plane;
+			tileMin[u] = tileU;
+			tileMax[u] = tileU + chunkSize;
+			tileMin[v] = tileV;
+			tileMax[v] = tileV + chunkSize;
+
+			DensityProgram* tileDensity = DensityProgramSize(density) > 1 ?
+				SpecialiseDensityProgram(density, vec3(tileMin), vec3(tileMax), 0.f) : nullptr;
+			const DensityProgram* program = tileDensity ? tileDensity : &density;
+
+			float d = 0.f;
+			if (IsDensityUniform(*program, vec3(tileMin), vec3(tileMax), &d))
+			{
+				DestroyDensityProgram(tileDensity);
+				continue;
+			}
+
+			const auto tilePoint = [&](const int i, const int j)
+			{
+				ivec3 p;
+				p[f] = plane;
+				p[u] = tileU + i;
+				p[v] = tileV + j;
+				return p;
+			};
+
+			for (int i = 0; i <= chunkSize; i++)
+			for (int j = 0; j <= chunkSize; j++)
+			{
+				points[(i * (chunkSize + 1)) + j] = vec4(vec3(tilePoint(i, j)), 1.f);
+			}
+
+			EvaluateDensity(*program, points.data(), (int)points.size(), densities.data());
+			DestroyDensityProgram(tileDensity);
+
+			for (int i = 0; i <= chunkSize; i++)
+			for (int j = 0; j <= chunkSize; j++)
+			{
+				const ivec3 base = tilePoint(i, j);
+				const float baseDensity = densities[(i * (chunkSize + 1)) + j];
+
+				for (int dir = 0; dir < 2; dir++)
+				{
+					// the edge runs along the first axis, the tiles share their last row
+					// along the second axis with the next tile
+					const int along = dir == 0 ? u : v;
+					const int across = dir == 0 ? v : u;
+					const int alongIdx = dir == 0 ? i : j;
+					const int acrossIdx = dir == 0 ? j : i;
+					const int acrossTile = dir == 0 ? tileV : tileU;
+
+					if (alongIdx == chunkSize ||
+						(acrossIdx == chunkSize && (acrossTile + chunkSize) != boxMax[across]))
+					{
+						continue;
+					}
+
+					// edges on the box's edges lie on two faces, the face with the lower
+					// axis owns them
+					const bool onOtherFace = base[across] == boxMin[across] || base[across] == boxMax[across];
+					if (onOtherFace && across < f)
+					{
+						continue;
+					}
+
+					const float endDensity = dir == 0 ?
+						densities[((i + 1) * (chunkSize + 1)) + j] :
+						densities[(i * (chunkSize + 1)) + j + 1];
+					if ((baseDensity < 0.f) == (endDensity < 0.f))
+					{
+						continue;
+					}
+
+					int indices[4];
+					bool complete = true;
+					for (int k = 0; k < 4 && complete; k++)
+					{
+						const ivec3 voxel = base - EDGE_VOXEL_OFFSETS[along][k];
+						if (InsideBox(voxel, boxMin, boxMax))
+						{
+							indices[k] = AcquireLevelVertex(coarse, fineIndices, fine, voxel);
+						}
+						else
+						{
+							const ivec3 coarseVoxel = FloorHalf(voxel);
+							indices[k] = AcquireLevelVertex(coarse, coarseIndices, coarse, coarseVoxel);
+							if (indices[k] == -1)
+							{
+								indices[k] = AcquireSeamFallbackVertex(coarse, coarseIndices, fine, density, coarseVoxel);
+							}
+						}
+
+						complete = indices[k] != -1;
+					}
+
+					if (complete)
+					{
+						EmitSeamPolygon(coarse, indices, baseDensity >= 0.f);
+					}
+				}
+			}
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+// The chunk meshes aren't simplified so each quad is a pair of consecutive triangles,
+// the quads are kept when all four voxels are inside the level's box and outside the
+// hole. The quads dropped along the hole are replaced by the seam.
+static void BuildLevelMesh(LodClipmap* clipmap, const int levelIdx)
+{
+	NG_TRACE_SCOPE("BuildLevelMesh");
+
+	LodLevel& level = clipmap->levels[levelIdx];
+	level.vertices.clear();
+	level.triangles.clear();
+
+	const int chunkSize = clipmap->chunkSize;
+	const ivec3 boxMin = level.boxMin * chunkSize;
+	const ivec3 boxMax = level.boxMax * chunkSize;
+	const ivec3 holeMin = level.holeMin * chunkSize;
+	const ivec3 holeMax = level.holeMax * chunkSize;
+
+	LodIndexTable indices;
+
+	for (int x = level.boxMin.x; x < level.boxMax.x; x++)
+	for (int y = level.boxMin.y; y < level.boxMax.y; y++)
+	for (int z = level.boxMin.z; z < level.boxMax.z; z++)
+	{
+		const auto iter = level.chunks.find(ivec3(x, y, z));
+		if (iter == end(level.chunks) || !iter->second.mesh)
+		{
+			continue;
+		}
+
+		const ChunkMesh& chunk = iter->second;
+		for (int t = 0; (t + 1) < chunk.mesh->numTriangles; t += 2)
+		{
+			const MeshTriangle* quad = &chunk.mesh->triangles[t];
+
+			bool keep = true;
+			for (int i = 0; i < 6 && keep; i++)
+			{
+				const ivec3 voxel(chunk.vertexVoxels[quad[i / 3].indices_[i % 3]]);
+				keep = InsideBox(voxel, boxMin, boxMax) && !InsideBox(voxel, holeMin, holeMax);
+			}
+
+			if (!keep)
+			{
+				continue;
+			}
+
+			for (int i = 0; i < 2; i++)
+			{
+				MeshTriangle tri;
+				for (int j = 0; j < 3; j++)
+				{
+					const ivec3 voxel(chunk.vertexVoxels[quad[i].indices_[j]]);
+					tri.indices_[j] = AcquireLevelVertex(level, indices, level, voxel);
+				}
+
+				level.triangles.push_back(tri);
+			}
+		}
+	}
+
+	if (levelIdx > 0)
+	{
+		StitchLevelSeam(clipmap, clipmap->levels[levelIdx - 1], level, indices);
+	}
+
+	level.mesh.vertices = level.vertices.empty() ? nullptr : &level.vertices[0];
+	level.mesh.numVertices = (int)level.vertices.size();
+	level.mesh.triangles = level.triangles.empty() ? nullptr : &level.triangles[0];
+	level.mesh.numTriangles = (int)level.triangles.size();
+}
+
+// ----------------------------------------------------------------------------
+
+int UpdateLodClipmap(LodClipmap* clipmap, const glm::vec3& focus, ngJobSystem* jobSystem)
+{
+	NG_TRACE_SCOPE("UpdateLodClipmap");
+
+	const int halfChunks = clipmap->levelChunks / 2;
+	const int numLevels = (int)clipmap->levels.size();
+
+	// the centres are snapped to even chunk coords so the inner box is whole chunks of
+	// this level, the inner box's centre is at most a chunk from this one
+	std::vector<bool> moved(numLevels, false);
+	for (int i = 0; i < numLevels; i++)
+	{
+		LodLevel& level = clipmap->levels[i];
+
+		const float levelChunkSize = clipmap->chunkSize * level.scale;
+		const ivec3 centre = 2 * ivec3(glm::floor((focus / (2.f * levelChunkSize)) + vec3(0.5f)));
+		const ivec3 boxMin = centre - ivec3(halfChunks);
+		const ivec3 boxMax = centre + ivec3(halfChunks);
+
+		ivec3 holeMin(0), holeMax(0);
+		if (i > 0)
+		{
+			holeMin = clipmap->levels[i - 1].boxMin / 2;
+			holeMax = clipmap->levels[i - 1].boxMax / 2;
+		}
+
+		moved[i] = !level.valid ||
+			boxMin != level.boxMin || boxMax != level.boxMax ||
+			holeMin != level.holeMin || holeMax != level.holeMax;
+
+		level.valid = true;
+		level.boxMin = boxMin;
+		level.boxMax = boxMax;
+		level.holeMin = holeMin;
+		level.holeMax = holeMax;
+	}
+
+	int rebuilt = 0;
+	for (int i = 0; i < numLevels; i++)
+	{
+		if (moved[i])
+		{
+			UpdateLevelChunks(clipmap, clipmap->levels[i], jobSystem);
+		}
+	}
+
+	// a level's seam uses the vertices of the level inside it, which only change when
+	// that level moves and so moves this level's hole too
+	for (int i = 0; i < numLevels; i++)
+	{
+		if (moved[i])
+		{
+			BuildLevelMesh(clipmap, i);
+			rebuilt++;
+		}
+	}
+
+	return rebuilt;
+}
+
+// ----------------------------------------------------------------------------
+
+const MeshBuffer* GetLodClipmapMesh(const LodClipmap* clipmap, const int level)
+{
+	if (level < 0 || level >= (int)clipmap->levels.size())
+	{
+		return nullptr;
+	}
+
+	return &clipmap->levels[level].mesh;
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,752 @@
+//
+// Public domain
+//
+
+#ifdef _WIN32
+	#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include "fast_dc.h"
+
+#include "ng_mapped_file.h"
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+using glm::ivec3;
+using glm::vec4;
+using glm::vec3;
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+// The sparse volume's samples are stored in bricks, and the bricks are grouped into pages
+// of SPARSE_PAGE_BRICKS^3 bricks. The page table has an entry for every page and each
+// page which isn't uniform has a table with an entry for each of its bricks. An entry is
+// either SPARSE_UNIFORM_OUTSIDE, SPARSE_UNIFORM_INSIDE or the index of the brick's (or
+// page's table's) data + SPARSE_FIRST_INDEX.
+// All values are little endian, the tables are written after the bricks since their size
+// isn't known until every brick has been classified.
+const uint32_t SPARSE_MAGIC = 0x5653474e;		// "NGSV"
+const uint32_t SPARSE_VERSION = 1;
+
+const int SPARSE_BRICK_SIZE = 8;
+const int SPARSE_BRICK_SAMPLES = SPARSE_BRICK_SIZE * SPARSE_BRICK_SIZE * SPARSE_BRICK_SIZE;
+const int SPARSE_PAGE_BRICKS = 8;
+const int SPARSE_PAGE_ENTRIES = SPARSE_PAGE_BRICKS * SPARSE_PAGE_BRICKS * SPARSE_PAGE_BRICKS;
+
+const uint32_t SPARSE_UNIFORM_OUTSIDE = 0;
+const uint32_t SPARSE_UNIFORM_INSIDE = 1;
+const uint32_t SPARSE_FIRST_INDEX = 2;
+
+// A brick is only uniform when every sample within this many samples of it has the same
+// sign, so the samples around every crossing & the gradients at them are stored exactly
+const int SPARSE_UNIFORM_BORDER = 2;
+
+// The density the uniform bricks are sampled with
+const float SPARSE_UNIFORM_DENSITY = (float)SPARSE_UNIFORM_BORDER;
+
+// Limits on the bricks along each axis & the origin so the sample coordinates always fit
+// in an int and the number of pages can't overflow when the header is corrupt
+const int SPARSE_MAX_BRICKS = 1 << 20;
+const int SPARSE_MAX_ORIGIN = 1 << 28;
+
+struct SparseVolumeHeader
+{
+	uint64_t brickDataOffset = 0;
+	uint64_t pageTableOffset = 0;
+	uint64_t brickTablesOffset = 0;
+
+	uint32_t magic = SPARSE_MAGIC;
+	uint32_t version = SPARSE_VERSION;
+	uint32_t format = DenseVolumeDesc::Float32;
+	int32_t origin[3] = { 0, 0, 0 };
+	int32_t numBricks[3] = { 0, 0, 0 };
+	float isoValue = 0.f;
+	float scale = 1.f;
+
+	// the raw sample values for the outside & inside uniform bricks
+	float uniformValues[2] = { 0.f, 0.f };
+
+	uint32_t numDataBricks = 0;
+	uint32_t numPageTables = 0;
+	uint32_t reserved = 0;
+};
+
+}
+
+// ----------------------------------------------------------------------------
+
+class DenseVolume
+{
+public:
+
+	DenseVolumeDesc desc;
+	ngMappedFile* file = nullptr;
+	const uint8_t* samples = nullptr;
+};
+
+// ----------------------------------------------------------------------------
+
+class SparseVolume
+{
+public:
+
+	SparseVolumeHeader header;
+	ngMappedFile* file = nullptr;
+
+	ivec3 origin;
+	ivec3 numBricks;
+	ivec3 numPages;
+	size_t sampleSize = 0;
+
+	const uint8_t* bricks = nullptr;
+	const uint32_t* pageTable = nullptr;
+	const uint32_t* brickTables = nullptr;
+};
+
+// ----------------------------------------------------------------------------
+
+static inline size_t SampleSize(const uint32_t format)
+{
+	return format == DenseVolumeDesc::UInt16 ? sizeof(uint16_t) : sizeof(float);
+}
+
+// ----------------------------------------------------------------------------
+
+static inline float DecodeSample(const uint8_t* samples, const uint32_t format, const size_t idx)
+{
+	if (format == DenseVolumeDesc::UInt16)
+	{
+		return (float)((const uint16_t*)samples)[idx];
+	}
+
+	return ((const float*)samples)[idx];
+}
+
+// ----------------------------------------------------------------------------
+
+static inline int FloorDiv(const int value, const int divisor)
+{
+	return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+// ----------------------------------------------------------------------------
+
+// The raw sample at any integer coordinate relative to the first sample, the dense
+// volumes are clamped to their edge and the sparse volumes are outside beyond theirs
+static inline float ReadSample(const DenseVolume& volume, const int x, const int y, const int z)
+{
+	const ivec3 size = volume.desc.size;
+	const ivec3 p = glm::clamp(ivec3(x, y, z), ivec3(0), size - ivec3(1));
+	const size_t idx = (size_t)p.x + ((size_t)size.x * ((size_t)p.y + ((size_t)size.y * (size_t)p.z)));
+
+	return DecodeSample(volume.samples, volume.desc.format, idx);
+}
+
+// ----------------------------------------------------------------------------
+
+static inline uint32_t BrickEntry(const SparseVolume& volume, const ivec3& brick)
+{
+	if (brick.x < 0 || brick.y < 0 || brick.z < 0 ||
+		brick.x >= volume.numBricks.x || brick.y >= volume.numBricks.y || brick.z >= volume.numBricks.z)
+	{
+		return SPARSE_UNIFORM_OUTSIDE;
+	}
+
+	const ivec3 page = brick / SPARSE_PAGE_BRICKS;
+	const size_t pageIdx = (size_t)page.x + ((size_t)volume.numPages.x * ((size_t)page.y + ((size_t)volume.numPages.y * (size_t)page.z)));
+	const uint32_t pageEntry = volume.pageTable[pageIdx];
+	if (pageEntry < SPARSE_FIRST_INDEX)
+	{
+		return pageEntry;
+	}
+
+	const ivec3 local = brick % SPARSE_PAGE_BRICKS;
+	const int localIdx = local.x + (SPARSE_PAGE_BRICKS * (local.y + (SPARSE_PAGE_BRICKS * local.z)));
+	return volume.brickTables[((size_t)(pageEntry - SPARSE_FIRST_INDEX) * SPARSE_PAGE_ENTRIES) + localIdx];
+}
+
+// ----------------------------------------------------------------------------
+
+static inline float ReadSample(const SparseVolume& volume, const int x, const int y, const int z)
+{
+	const ivec3 brick(FloorDiv(x, SPARSE_BRICK_SIZE), FloorDiv(y, SPARSE_BRICK_SIZE), FloorDiv(z, SPARSE_BRICK_SIZE));
+	const uint32_t entry = BrickEntry(volume, brick);
+	if (entry < SPARSE_FIRST_INDEX)
+	{
+		return volume.header.uniformValues[entry];
+	}
+
+	const ivec3 local = ivec3(x, y, z) - (brick * SPARSE_BRICK_SIZE);
+	const size_t idx = ((size_t)(entry - SPARSE_FIRST_INDEX) * SPARSE_BRICK_SAMPLES) +
+		local.x + (SPARSE_BRICK_SIZE * (local.y + (SPARSE_BRICK_SIZE * local.z)));
+
+	return DecodeSample(volume.bricks, volume.header.format, idx);
+}
+
+// ----------------------------------------------------------------------------
+
+// Trilinear interpolation of the samples, the point is relative to the first sample
+template <typename Volume>
+static float InterpolateSamples(const Volume& volume, const vec3& p)
+{
+	const vec3 cellMin = glm::floor(p);
+	const ivec3 c = ivec3(cellMin);
+	const vec3 t = p - cellMin;
+
+	const float c00 = glm::mix(ReadSample(volume, c.x, c.y, c.z), ReadSample(volume, c.x + 1, c.y, c.z), t.x);
+	const float c10 = glm::mix(ReadSample(volume, c.x, c.y + 1, c.z), ReadSample(volume, c.x + 1, c.y + 1, c.z), t.x);
+	const float c01 = glm::mix(ReadSample(volume, c.x, c.y, c.z + 1), ReadSample(volume, c.x + 1, c.y, c.z + 1), t.x);
+	const float c11 = glm::mix(ReadSample(volume, c.x, c.y + 1, c.z + 1), ReadSample(volume, c.x + 1, c.y + 1, c.z + 1), t.x);
+
+	return glm::mix(glm::mix(c00, c10, t.y), glm::mix(c01, c11, t.y), t.z);
+}
+
+// ----------------------------------------------------------------------------
+
+template <typename Volume>
+static vec3 SampleGradient(const Volume& volume, const int x, const int y, const int z)
+{
+	return 0.5f * vec3(
+		ReadSample(volume, x + 1, y, z) - ReadSample(volume, x - 1, y, z),
+		ReadSample(volume, x, y + 1, z) - ReadSample(volume, x, y - 1, z),
+		ReadSample(volume, x, y, z + 1) - ReadSample(volume, x, y, z - 1));
+}
+
+// ----------------------------------------------------------------------------
+
+// The gradient of the trilinear interpolation is discontinuous across the cell faces,
+// interpolating the central differences at the samples instead gives smooth normals
+template <typename Volume>
+static vec4 InterpolateNormal(const Volume& volume, const vec3& p, const float scale)
+{
+	const vec3 cellMin = glm::floor(p);
+	const ivec3 c = ivec3(cellMin);
+	const vec3 t = p - cellMin;
+
+	const vec3 g00 = glm::mix(SampleGradient(volume, c.x, c.y, c.z), SampleGradient(volume, c.x + 1, c.y, c.z), t.x);
+	const vec3 g10 = glm::mix(SampleGradient(volume, c.x, c.y + 1, c.z), SampleGradient(volume, c.x + 1, c.y + 1, c.z), t.x);
+	const vec3 g01 = glm::mix(SampleGradient(volume, c.x, c.y, c.z + 1), SampleGradient(volume, c.x + 1, c.y, c.z + 1), t.x);
+	const vec3 g11 = glm::mix(SampleGradient(volume, c.x, c.y + 1, c.z + 1), SampleGradient(volume, c.x + 1, c.y + 1, c.z + 1), t.x);
+
+	const vec3 gradient = glm::mix(glm::mix(g00, g10, t.y), glm::mix(g01, g11, t.y), t.z) * scale;
+	const float length = glm::length(gradient);
+	if (length <= 0.f)
+	{
+		return vec4(0.f);
+	}
+
+	return vec4(gradient / length, 0.f);
+}
+
+// ----------------------------------------------------------------------------
+
+DenseVolume* OpenDenseVolume(const DenseVolumeDesc& desc)
+{
+	if (!desc.path || desc.size.x < 1 || desc.size.y < 1 || desc.size.z < 1)
+	{
+		return nullptr;
+	}
+
+	const size_t requiredSize = desc.headerSize +
+		((size_t)desc.size.x * (size_t)desc.size.y * (size_t)desc.size.z * SampleSize(desc.format));
+
+	DenseVolume* volume = new DenseVolume;
+	volume->desc = desc;
+
+	// chunks only touch a brick of the volume, so reading ahead along the file mostly
+	// loads samples which aren't needed
+	volume->file = ngMappedFileOpen(desc.path, true);
+	if (!volume->file || ngMappedFileSize(volume->file) < requiredSize)
+	{
+		CloseDenseVolume(volume);
+		return nullptr;
+	}
+
+	volume->samples = ngMappedFileData(volume->file) + desc.headerSize;
+	return volume;
+}
+
+// ----------------------------------------------------------------------------
+
+void CloseDenseVolume(DenseVolume* volume)
+{
+	if (!volume)
+	{
+		return;
+	}
+
+	ngMappedFileClose(volume->file);
+	delete volume;
+}
+
+// ----------------------------------------------------------------------------
+
+void SampleDenseVolume(const DenseVolume& volume, const glm::vec4* points, const int count, float* densities)
+{
+	const DenseVolumeDesc& desc = volume.desc;
+
+	for (int i = 0; i < count; i++)
+	{
+		const float value = InterpolateSamples(volume, vec3(points[i]) - vec3(desc.origin));
+		densities[i] = (value - desc.isoValue) * desc.scale;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+glm::vec4 SampleDenseVolumeNormal(const DenseVolume& volume, const glm::vec4& point)
+{
+	return InterpolateNormal(volume, vec3(point) - vec3(volume.desc.origin), volume.desc.scale);
+}
+
+// ----------------------------------------------------------------------------
+
+static bool WriteBytes(FILE* f, const void* data, const size_t size)
+{
+	return size == 0 || fwrite(data, size, 1, f) == 1;
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+struct SparseVolumeWriter
+{
+	FILE* file = nullptr;
+	SparseVolumeHeader header;
+	ivec3 gridMin;
+
+	// the uint16 samples map [-range, range] to the whole range of values
+	float quantise = 1.f;
+
+	std::vector<vec4> points;
+	std::vector<float> densities;
+	std::vector<uint8_t> brickData;
+};
+
+}
+
+// ----------------------------------------------------------------------------
+
+static float EncodeSample(const SparseVolumeWriter& writer, const float density)
+{
+	if (writer.header.format == DenseVolumeDesc::UInt16)
+	{
+		// densities closer to zero than the quantisation still keep their sign, otherwise
+		// the lattice could have crossings which weren't in the input
+		const float value = glm::round(glm::clamp((density * writer.quantise) + 32768.f, 0.f, 65535.f));
+		return density < 0.f ? glm::min(value, 32767.f) : glm::max(value, 32768.f);
+	}
+
+	return density;
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns the brick's table entry, the samples of bricks which aren't uniform are written
+// to the file
+static uint32_t WriteSparseBrick(const DensityProgram& density, const ivec3& brick, SparseVolumeWriter& writer)
+{
+	// the brick is sampled along with its border to check the signs
+	const int borderedSize = SPARSE_BRICK_SIZE + (2 * SPARSE_UNIFORM_BORDER);
+	const ivec3 borderMin = writer.gridMin + (brick * SPARSE_BRICK_SIZE) - ivec3(SPARSE_UNIFORM_BORDER);
+	const ivec3 borderMax = borderMin + ivec3(borderedSize - 1);
+
+	float d = 0.f;
+	if (IsDensityUniform(density, vec3(borderMin), vec3(borderMax), &d))
+	{
+		return d >= 0.f ? SPARSE_UNIFORM_OUTSIDE : SPARSE_UNIFORM_INSIDE;
+	}
+
+	int count = 0;
+	for (int z = 0; z < borderedSize; z++)
+	for (int y = 0; y < borderedSize; y++)
+	for (int x = 0; x < borderedSize; x++)
+	{
+		writer.points[count++] = vec4(vec3(borderMin + ivec3(x, y, z)), 1.f);
+	}
+
+	EvaluateDensity(density, writer.points.data(), count, writer.densities.data());
+
+	int numInside = 0;
+	for (int i = 0; i < count; i++)
+	{
+		numInside += writer.densities[i] < 0.f ? 1 : 0;
+	}
+
+	if (numInside == 0)
+	{
+		return SPARSE_UNIFORM_OUTSIDE;
+	}
+	else if (numInside == count)
+	{
+		return SPARSE_UNIFORM_INSIDE;
+	}
+
+	int sampleIdx = 0;
+	for (int z = SPARSE_UNIFORM_BORDER; z < SPARSE_UNIFORM_BORDER + SPARSE_BRICK_SIZE; z++)
+	for (int y = SPARSE_UNIFORM_BORDER; y < SPARSE_UNIFORM_BORDER + SPARSE_BRICK_SIZE; y++)
+	for (int x = SPARSE_UNIFORM_BORDER; x < SPARSE_UNIFORM_BORDER + SPARSE_BRICK_SIZE; x++)
+	{
+		const float value = EncodeSample(writer, writer.densities[x + (borderedSize * (y + (borderedSize * z)))]);
+		if (writer.header.format == DenseVolumeDesc::UInt16)
+		{
+			((uint16_t*)writer.brickData.data())[sampleIdx++] = (uint16_t)value;
+		}
+		else
+		{
+			((float*)writer.brickData.data())[sampleIdx++] = value;
+		}
+	}
+
+	if (!WriteBytes(writer.file, writer.brickData.data(), writer.brickData.size()))
+	{
+		fclose(writer.file);
+		writer.file = nullptr;
+		return SPARSE_UNIFORM_OUTSIDE;
+	}
+
+	return writer.header.numDataBricks++ + SPARSE_FIRST_INDEX;
+}
+
+// ----------------------------------------------------------------------------
+
+bool WriteSparseVolume(
+	const char* path,
+	const DensityProgram& density,
+	const glm::ivec3& gridMin,
+	const glm::ivec3& gridSize,
+	const DenseVolumeDesc::Format format,
+	const float range)
+{
+	if (!path || gridSize.x < 1 || gridSize.y < 1 || gridSize.z < 1 || range <= 0.f)
+	{
+		return false;
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		if (gridSize[i] > SPARSE_MAX_BRICKS * SPARSE_BRICK_SIZE || gridMin[i] < -SPARSE_MAX_ORIGIN || gridMin[i] > SPARSE_MAX_ORIGIN)
+		{
+			return false;
+		}
+	}
+
+	SparseVolumeWriter writer;
+	writer.file = fopen(path, "wb");
+	if (!writer.file)
+	{
+		return false;
+	}
+
+	SparseVolumeHeader& header = writer.header;
+	header.format = format;
+	header.brickDataOffset = sizeof(SparseVolumeHeader);
+	for (int i = 0; i < 3; i++)
+	{
+		header.origin[i] = gridMin[i];
+		header.numBricks[i] = (gridSize[i] + SPARSE_BRICK_SIZE - 1) / SPARSE_BRICK_SIZE;
+	}
+
+	if (format == DenseVolumeDesc::UInt16)
+	{
+		writer.quantise = 32767.f / range;
+		header.isoValue = 32768.f;
+		header.scale = 1.f / writer.quantise;
+	}
+
+	header.uniformValues[SPARSE_UNIFORM_OUTSIDE] = EncodeSample(writer, SPARSE_UNIFORM_DENSITY);
+	header.uniformValues[SPARSE_UNIFORM_INSIDE] = EncodeSample(writer, -SPARSE_UNIFORM_DENSITY);
+
+	const int borderedSize = SPARSE_BRICK_SIZE + (2 * SPARSE_UNIFORM_BORDER);
+	writer.gridMin = gridMin;
+	writer.points.resize(borderedSize * borderedSize * borderedSize);
+	writer.densities.resize(writer.points.size());
+	writer.brickData.resize(SPARSE_BRICK_SAMPLES * SampleSize(format));
+
+	// the header is written again once the tables' offsets are known
+	if (!WriteBytes(writer.file, &header, sizeof(header)))
+	{
+		fclose(writer.file);
+		return false;
+	}
+
+	const ivec3 numBricks(header.numBricks[0], header.numBricks[1], header.numBricks[2]);
+	const ivec3 numPages = (numBricks + ivec3(SPARSE_PAGE_BRICKS - 1)) / SPARSE_PAGE_BRICKS;
+
+	std::vector<uint32_t> pageTable;
+	std::vector<uint32_t> brickTables;
+	std::vector<uint32_t> brickTable(SPARSE_PAGE_ENTRIES);
+
+	for (int pz = 0; pz < numPages.z; pz++)
+	for (int py = 0; py < numPages.y; py++)
+	for (int px = 0; px < numPages.x; px++)
+	{
+		bool pageUniform = true;
+		for (int i = 0; i < SPARSE_PAGE_ENTRIES; i++)
+		{
+			const ivec3 local(i % SPARSE_PAGE_BRICKS, (i / SPARSE_PAGE_BRICKS) % SPARSE_PAGE_BRICKS, i / (SPARSE_PAGE_BRICKS * SPARSE_PAGE_BRICKS));
+			const ivec3 brick = (ivec3(px, py, pz) * SPARSE_PAGE_BRICKS) + local;
+
+			brickTable[i] = SPARSE_UNIFORM_OUTSIDE;
+			if (brick.x < numBricks.x && brick.y < numBricks.y && brick.z < numBricks.z)
+			{
+				brickTable[i] = WriteSparseBrick(density, brick, writer);
+				if (!writer.file)
+				{
+					return false;
+				}
+			}
+
+			pageUniform = pageUniform && brickTable[i] == brickTable[0] && brickTable[i] < SPARSE_FIRST_INDEX;
+		}
+
+		if (pageUniform)
+		{
+			pageTable.push_back(brickTable[0]);
+		}
+		else
+		{
+			pageTable.push_back(header.numPageTables++ + SPARSE_FIRST_INDEX);
+			brickTables.insert(end(brickTables), begin(brickTable), end(brickTable));
+		}
+	}
+
+	header.pageTableOffset = header.brickDataOffset + ((uint64_t)header.numDataBricks * writer.brickData.size());
+	header.brickTablesOffset = header.pageTableOffset + (pageTable.size() * sizeof(uint32_t));
+
+	bool ok = WriteBytes(writer.file, pageTable.data(), pageTable.size() * sizeof(uint32_t));
+	ok = ok && WriteBytes(writer.file, brickTables.data(), brickTables.size() * sizeof(uint32_t));
+	ok = ok && fseek(writer.file, 0, SEEK_SET) == 0 && WriteBytes(writer.file, &header, sizeof(header));
+	ok = (fclose(writer.file) == 0) && ok;
+
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+
+// True if count elements of elementSize bytes from offset are inside the file, without
+// the end overflowing when the header is corrupt
+static bool IsSparseRangeValid(const uint64_t offset, const uint64_t count, const uint64_t elementSize, const uint64_t fileSize)
+{
+	return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+}
+
+// ----------------------------------------------------------------------------
+
+SparseVolume* OpenSparseVolume(const char* path)
+{
+	SparseVolume* volume = new SparseVolume;
+	volume->file = ngMappedFileOpen(path, true);
+	if (!volume->file || ngMappedFileSize(volume->file) < sizeof(SparseVolumeHeader))
+	{
+		CloseSparseVolume(volume);
+		return nullptr;
+	}
+
+	const uint8_t* data = ngMappedFileData(volume->file);
+
+	SparseVolumeHeader& header = volume->header;
+	memcpy(&header, data, sizeof(header));
+
+	bool valid =
+		header.magic == SPARSE_MAGIC &&
+		header.version == SPARSE_VERSION &&
+		(header.format == DenseVolumeDesc::Float32 || header.format == DenseVolumeDesc::UInt16);
+
+	for (int i = 0; i < 3; i++)
+	{
+		valid = valid &&
+			header.numBricks[i] > 0 && header.numBricks[i] <= SPARSE_MAX_BRICKS &&
+			header.origin[i] >= -SPARSE_MAX_ORIGIN && header.origin[i] <= SPARSE_MAX_ORIGIN;
+	}
+
+	if (!valid)
+	{
+		CloseSparseVolume(volume);
+		return nullptr;
+	}
+
+	volume->origin = ivec3(header.origin[0], header.origin[1], header.origin[2]);
+	volume->numBricks = ivec3(header.numBricks[0], header.numBricks[1], header.numBricks[2]);
+	volume->numPages = (volume->numBricks + ivec3(SPARSE_PAGE_BRICKS - 1)) / SPARSE_PAGE_BRICKS;
+	volume->sampleSize = SampleSize(header.format);
+
+	const uint64_t numPages = (uint64_t)volume->numPages.x * (uint64_t)volume->numPages.y * (uint64_t)volume->numPages.z;
+	const uint64_t fileSize = ngMappedFileSize(volume->file);
+
+	// every offset & size has to be inside the file before anything is read from it
+	valid =
+		IsSparseRangeValid(header.brickDataOffset, (uint64_t)header.numDataBricks * SPARSE_BRICK_SAMPLES, volume->sampleSize, fileSize) &&
+		IsSparseRangeValid(header.pageTableOffset, numPages, sizeof(uint32_t), fileSize) &&
+		IsSparseRangeValid(header.brickTablesOffset, (uint64_t)header.numPageTables * SPARSE_PAGE_ENTRIES, sizeof(uint32_t), fileSize) &&
+		(header.pageTableOffset % sizeof(uint32_t)) == 0 &&
+		(header.brickTablesOffset % sizeof(uint32_t)) == 0;
+
+	if (!valid)
+	{
+		CloseSparseVolume(volume);
+		return nullptr;
+	}
+
+	volume->bricks = data + header.brickDataOffset;
+	volume->pageTable = (const uint32_t*)(data + header.pageTableOffset);
+	volume->brickTables = (const uint32_t*)(data + header.brickTablesOffset);
+
+	// and every table entry has to refer to data which exists
+	for (uint64_t i = 0; i < numPages; i++)
+	{
+		if (volume->pageTable[i] >= SPARSE_FIRST_INDEX + header.numPageTables)
+		{
+			CloseSparseVolume(volume);
+			return nullptr;
+		}
+	}
+
+	for (uint64_t i = 0; i < (uint64_t)header.numPageTables * SPARSE_PAGE_ENTRIES; i++)
+	{
+		if (volume->brickTables[i] >= SPARSE_FIRST_INDEX + header.numDataBricks)
+		{
+			CloseSparseVolume(volume);
+			return nullptr;
+		}
+	}
+
+	return volume;
+}
+
+// ----------------------------------------------------------------------------
+
+void CloseSparseVolume(SparseVolume* volume)
+{
+	if (!volume)
+	{
+		return;
+	}
+
+	ngMappedFileClose(volume->file);
+	delete volume;
+}
+
+// ----------------------------------------------------------------------------
+
+void SampleSparseVolume(const SparseVolume& volume, const glm::vec4* points, const int count, float* densities)
+{
+	const SparseVolumeHeader& header = volume.header;
+
+	for (int i = 0; i < count; i++)
+	{
+		const float value = InterpolateSamples(volume, vec3(points[i]) - vec3(volume.origin));
+		densities[i] = (value - header.isoValue) * header.scale;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+glm::vec4 SampleSparseVolumeNormal(const SparseVolume& volume, const glm::vec4& point)
+{
+	return InterpolateNormal(volume, vec3(point) - vec3(volume.origin), volume.header.scale);
+}
+
+// ----------------------------------------------------------------------------
+
+bool IsSparseVolumeUniform(
+	const SparseVolume& volume,
+	const glm::vec3& boundsMin,
+	const glm::vec3& boundsMax,
+	float* density)
+{
+	// the samples the points in the box are interpolated from
+	const ivec3 sampleMin = ivec3(glm::floor(boundsMin - vec3(volume.origin)));
+	const ivec3 sampleMax = ivec3(glm::floor(boundsMax - vec3(volume.origin))) + ivec3(1);
+
+	const ivec3 brickMin(
+		FloorDiv(sampleMin.x, SPARSE_BRICK_SIZE),
+		FloorDiv(sampleMin.y, SPARSE_BRICK_SIZE),
+		FloorDiv(sampleMin.z, SPARSE_BRICK_SIZE));
+	const ivec3 brickMax(
+		FloorDiv(sampleMax.x, SPARSE_BRICK_SIZE),
+		FloorDiv(sampleMax.y, SPARSE_BRICK_SIZE),
+		FloorDiv(sampleMax.z, SPARSE_BRICK_SIZE));
+
+	const uint32_t first = BrickEntry(volume, brickMin);
+	if (first >= SPARSE_FIRST_INDEX)
+	{
+		return false;
+	}
+
+	for (int z = brickMin.z; z <= brickMax.z; z++)
+	for (int y = brickMin.y; y <= brickMax.y; y++)
+	for (int x = brickMin.x; x <= brickMax.x; x++)
+	{
+		if (BrickEntry(volume, ivec3(x, y, z)) != first)
+		{
+			return false;
+		}
+	}
+
+	*density = (volume.header.uniformValues[first] - volume.header.isoValue) * volume.header.scale;
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+void FindSparseVolumeChunks(const SparseVolume& volume, const int chunkSize, std::vector<glm::ivec3>& chunkCoords)
+{
+	chunkCoords.clear();
+	if (chunkSize < 1)
+	{
+		return;
+	}
+
+	// the uniform bricks have a border of samples with the same sign around them so every
+	// crossing edge is in a cell touching one of the stored bricks' samples
+	for (int pz = 0; pz < volume.numPages.z; pz++)
+	for (int py = 0; py < volume.numPages.y; py++)
+	for (int px = 0; px < volume.numPages.x; px++)
+	{
+		const ivec3 page(px, py, pz);
+		const size_t pageIdx = (size_t)px + ((size_t)volume.numPages.x * ((size_t)py + ((size_t)volume.numPages.y * (size_t)pz)));
+		if (volume.pageTable[pageIdx] < SPARSE_FIRST_INDEX)
+		{
+			continue;
+		}
+
+		for (int i = 0; i < SPARSE_PAGE_ENTRIES; i++)
+		{
+			const ivec3 local(i % SPARSE_PAGE_BRICKS, (i / SPARSE_PAGE_BRICKS) % SPARSE_PAGE_BRICKS, i / (SPARSE_PAGE_BRICKS * SPARSE_PAGE_BRICKS));
+			const ivec3 brick = (page * SPARSE_PAGE_BRICKS) + local;
+			if (BrickEntry(volume, brick) < SPARSE_FIRST_INDEX)
+			{
+				continue;
+			}
+
+			// the chunks whose lattice (which includes the apron) overlaps those cells
+			const ivec3 cellMin = volume.origin + (brick * SPARSE_BRICK_SIZE) - ivec3(1);
+			const ivec3 cellMax = cellMin + ivec3(SPARSE_BRICK_SIZE + 1);
+
+			for (int cz = FloorDiv(cellMin.z - 2, chunkSize); cz <= FloorDiv(cellMax.z + 1, chunkSize); cz++)
+			for (int cy = FloorDiv(cellMin.y - 2, chunkSize); cy <= FloorDiv(cellMax.y + 1, chunkSize); cy++)
+			for (int cx = FloorDiv(cellMin.x - 2, chunkSize); cx <= FloorDiv(cellMax.x + 1, chunkSize); cx++)
+			{
+				chunkCoords.push_back(ivec3(cx, cy, cz));
+			}
+		}
+	}
+
+	std::sort(begin(chunkCoords), end(chunkCoords), [](const ivec3& a, const ivec3& b)
+	{
+		return a.z != b.z ? a.z < b.z : a.y != b.y ? a.y < b.y : a.x < b.x;
+	});
+
+	chunkCoords.erase(std::unique(begin(chunkCoords), end(chunkCoords)), end(chunkCoords));
+}
+
+// ----------------------------------------------------------------------------
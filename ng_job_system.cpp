@@ -0,0 +1,444 @@
+
+//
+// Public domain
+//
+
+#include	"ng_job_system.h"
+#include	"ng_trace.h"
+
+#include	<stdint.h>
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<new>
+#include	<thread>
+#include	<mutex>
+#include	<condition_variable>
+#include	<chrono>
+#include	<vector>
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+const int JOB_DEQUE_CAPACITY = 4096;
+const int JOB_IDLE_SPIN_COUNT = 64;
+
+// The slot fields are atomic so a thief reading a slot the owner is overwriting is
+// not a data race, the thief's CAS on top will fail and the values are discarded
+struct JobSlot
+{
+	std::atomic<ngJobFunction> function;
+	std::atomic<void*> data;
+	std::atomic<ngJobCounter*> counter;
+};
+
+struct Job
+{
+	ngJobFunction function = nullptr;
+	void* data = nullptr;
+	ngJobCounter* counter = nullptr;
+};
+
+// Chase-Lev deque, see "Correct and Efficient Work-Stealing for Weak Memory Models"
+// (Le, Pop, Cohen, Zappa Nardelli 2013). Fixed capacity, a failed push means the
+// caller has to run the job itself.
+class JobDeque
+{
+public:
+
+	JobDeque()
+	{
+		top_.store(0);
+		bottom_.store(0);
+	}
+
+	bool push(const Job& job)
+	{
+		const int64_t b = bottom_.load(std::memory_order_relaxed);
+		const int64_t t = top_.load(std::memory_order_acquire);
+		if ((b - t) >= JOB_DEQUE_CAPACITY)
+		{
+			return false;
+		}
+
+		store(b, job);
+		bottom_.store(b + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(Job& job)
+	{
+		// the store to bottom must be visible before top is read, otherwise a thief and
+		// the owner can both take the last job
+		const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+		bottom_.store(b, std::memory_order_seq_cst);
+		int64_t t = top_.load(std::memory_order_seq_cst);
+
+		if (t > b)
+		{
+			bottom_.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		load(b, job);
+		if (t == b)
+		{
+			// last job, race any thieves for it
+			const bool won = top_.compare_exchange_strong(t, t + 1,
+				std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom_.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+
+		return true;
+	}
+
+	bool steal(Job& job)
+	{
+		int64_t t = top_.load(std::memory_order_seq_cst);
+		const int64_t b = bottom_.load(std::memory_order_seq_cst);
+		if (t >= b)
+		{
+			return false;
+		}
+
+		load(t, job);
+		return top_.compare_exchange_strong(t, t + 1,
+			std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+private:
+
+	void store(const int64_t idx, const Job& job)
+	{
+		JobSlot& slot = slots_[idx & (JOB_DEQUE_CAPACITY - 1)];
+		slot.function.store(job.function, std::memory_order_relaxed);
+		slot.data.store(job.data, std::memory_order_relaxed);
+		slot.counter.store(job.counter, std::memory_order_relaxed);
+	}
+
+	void load(const int64_t idx, Job& job)
+	{
+		JobSlot& slot = slots_[idx & (JOB_DEQUE_CAPACITY - 1)];
+		job.function = slot.function.load(std::memory_order_relaxed);
+		job.data = slot.data.load(std::memory_order_relaxed);
+		job.counter = slot.counter.load(std::memory_order_relaxed);
+	}
+
+	alignas(64) std::atomic<int64_t> top_;
+	alignas(64) std::atomic<int64_t> bottom_;
+	JobSlot slots_[JOB_DEQUE_CAPACITY];
+};
+
+struct Worker
+{
+	ngJobSystem* system = nullptr;
+	int index = 0;
+	uint32_t rng = 0;
+	JobDeque deque;
+
+	// The deque's indices are on their own cache lines, before C++17 plain new only 
+	// aligns to alignof(max_align_t) so the block is over-allocated and aligned here,
+	// with the pointer to free stored just before the object
+	static void* operator new(const size_t size)
+	{
+		void* block = malloc(size + alignof(Worker) + sizeof(void*));
+		if (!block)
+		{
+			throw std::bad_alloc();
+		}
+
+		const uintptr_t start = (uintptr_t)block + sizeof(void*);
+		void** aligned = (void**)((start + alignof(Worker) - 1) & ~(uintptr_t)(alignof(Worker) - 1));
+		aligned[-1] = block;
+		return aligned;
+	}
+
+	static void operator delete(void* ptr)
+	{
+		if (ptr)
+		{
+			free(((void**)ptr)[-1]);
+		}
+	}
+};
+
+thread_local Worker* t_worker = nullptr;
+
+}
+
+// ----------------------------------------------------------------------------
+
+class ngJobSystem
+{
+public:
+
+	std::vector<Worker*> workers;
+	std::vector<std::thread> threads;
+
+	// the thread which created the system, which uses worker 0's deque
+	std::thread::id creator;
+
+	std::atomic<bool> quit { false };
+
+	// only touched when a worker goes to sleep or a thread without a deque submits work
+	std::mutex idleMutex;
+	std::condition_variable idleCondition;
+	std::atomic<int> numSleeping { 0 };
+
+	std::mutex injectMutex;
+	std::vector<Job> injected;
+	std::atomic<int> numInjected { 0 };
+};
+
+// ----------------------------------------------------------------------------
+
+// The worker whose deque the calling thread owns, or null for threads outside the system.
+// The creator isn't bound through t_worker so it can create several systems, each with
+// its own worker 0.
+static Worker* CallingWorker(ngJobSystem* system)
+{
+	if (t_worker && t_worker->system == system)
+	{
+		return t_worker;
+	}
+
+	return std::this_thread::get_id() == system->creator ? system->workers[0] : nullptr;
+}
+
+// ----------------------------------------------------------------------------
+
+static void ExecuteJob(const Job& job)
+{
+	NG_TRACE_SCOPE("ngJob");
+	job.function(job.data);
+	job.counter->value.fetch_sub(1, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+
+static bool TakeInjectedJob(ngJobSystem* system, Job& job)
+{
+	if (system->numInjected.load(std::memory_order_acquire) == 0)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(system->injectMutex);
+	if (system->injected.empty())
+	{
+		return false;
+	}
+
+	job = system->injected.back();
+	system->injected.pop_back();
+	system->numInjected.fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool FindJob(ngJobSystem* system, Worker* self, Job& job)
+{
+	if (self && self->deque.pop(job))
+	{
+		return true;
+	}
+
+	if (TakeInjectedJob(system, job))
+	{
+		return true;
+	}
+
+	// start from a random victim so the thieves don't all hammer the same deque
+	const int numWorkers = (int)system->workers.size();
+	uint32_t start = 0;
+	if (self)
+	{
+		self->rng ^= self->rng << 13;
+		self->rng ^= self->rng >> 17;
+		self->rng ^= self->rng << 5;
+		start = self->rng;
+	}
+
+	for (int i = 0; i < numWorkers; i++)
+	{
+		Worker* victim = system->workers[(start + i) % numWorkers];
+		if (victim != self && victim->deque.steal(job))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// ----------------------------------------------------------------------------
+
+static void WakeWorkers(ngJobSystem* system)
+{
+	if (system->numSleeping.load(std::memory_order_acquire) > 0)
+	{
+		std::lock_guard<std::mutex> lock(system->idleMutex);
+		system->idleCondition.notify_all();
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void WorkerThread(ngJobSystem* system, Worker* self)
+{
+	t_worker = self;
+
+	char name[32];
+	snprintf(name, sizeof(name), "ngJobSystem worker %d", self->index);
+	ngTraceSetThreadName(name);
+
+	int idleCount = 0;
+	while (!system->quit.load(std::memory_order_acquire))
+	{
+		Job job;
+		if (FindJob(system, self, job))
+		{
+			ExecuteJob(job);
+			idleCount = 0;
+			continue;
+		}
+
+		if (++idleCount < JOB_IDLE_SPIN_COUNT)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		// the timeout covers a job being pushed between the failed search and the sleep
+		std::unique_lock<std::mutex> lock(system->idleMutex);
+		system->numSleeping.fetch_add(1, std::memory_order_acq_rel);
+		system->idleCondition.wait_for(lock, std::chrono::milliseconds(1));
+		system->numSleeping.fetch_sub(1, std::memory_order_acq_rel);
+		idleCount = 0;
+	}
+
+	t_worker = nullptr;
+}
+
+// ----------------------------------------------------------------------------
+
+ngJobSystem* ngJobSystemCreate(const int numThreads)
+{
+	int count = numThreads;
+	if (count <= 0)
+	{
+		count = (int)std::thread::hardware_concurrency();
+		count = count > 0 ? count : 1;
+	}
+
+	ngJobSystem* system = new ngJobSystem;
+	for (int i = 0; i < count; i++)
+	{
+		Worker* worker = new Worker;
+		worker->system = system;
+		worker->index = i;
+		worker->rng = 0x9e3779b9u * (i + 1);
+		system->workers.push_back(worker);
+	}
+
+	system->creator = std::this_thread::get_id();
+	for (int i = 1; i < count; i++)
+	{
+		system->threads.emplace_back(WorkerThread, system, system->workers[i]);
+	}
+
+	return system;
+}
+
+// ----------------------------------------------------------------------------
+
+void ngJobSystemDestroy(ngJobSystem* system)
+{
+	if (!system)
+	{
+		return;
+	}
+
+	system->quit.store(true, std::memory_order_release);
+	{
+		std::lock_guard<std::mutex> lock(system->idleMutex);
+		system->idleCondition.notify_all();
+	}
+
+	for (auto& thread: system->threads)
+	{
+		thread.join();
+	}
+
+	for (Worker* worker: system->workers)
+	{
+		delete worker;
+	}
+
+	delete system;
+}
+
+// ----------------------------------------------------------------------------
+
+int ngJobSystemThreadCount(const ngJobSystem* system)
+{
+	return system ? (int)system->workers.size() : 1;
+}
+
+// ----------------------------------------------------------------------------
+
+void ngJobRun(ngJobSystem* system, const ngJobDecl* jobs, const int count, ngJobCounter* counter)
+{
+	counter->value.fetch_add(count, std::memory_order_relaxed);
+
+	Worker* self = CallingWorker(system);
+	for (int i = 0; i < count; i++)
+	{
+		Job job;
+		job.function = jobs[i].function;
+		job.data = jobs[i].data;
+		job.counter = counter;
+
+		if (self)
+		{
+			if (!self->deque.push(job))
+			{
+				ExecuteJob(job);
+			}
+
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(system->injectMutex);
+		system->injected.push_back(job);
+		system->numInjected.fetch_add(1, std::memory_order_release);
+	}
+
+	WakeWorkers(system);
+}
+
+// ----------------------------------------------------------------------------
+
+void ngJobWait(ngJobSystem* system, ngJobCounter* counter)
+{
+	// any time inside the wait which isn't covered by a job is the thread stalling
+	NG_TRACE_SCOPE("ngJobWait");
+
+	Worker* self = CallingWorker(system);
+	while (counter->value.load(std::memory_order_acquire) > 0)
+	{
+		Job job;
+		if (FindJob(system, self, job))
+		{
+			ExecuteJob(job);
+		}
+		else
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+// ----------------------------------------------------------------------------
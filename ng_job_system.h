@@ -0,0 +1,131 @@
+#ifndef		HAS_NG_JOB_SYSTEM_H_BEEN_INCLUDED
+#define		HAS_NG_JOB_SYSTEM_H_BEEN_INCLUDED
+
+//
+// Work stealing job system
+// Public domain
+//
+// Each worker thread owns a fixed size Chase-Lev deque: jobs are pushed and popped at
+// the bottom by the owning thread and stolen from the top by any other thread, so there
+// is no lock involved in running or stealing jobs. The thread which creates the system
+// is treated as worker 0 and only executes jobs while waiting on a counter. A thread can
+// create several systems, it is worker 0 of each of them.
+//
+// Completion is tracked with counters rather than job handles, waiting on a counter
+// executes other jobs until it reaches zero so jobs can safely spawn & wait on nested
+// jobs without blocking a worker.
+//
+// Usage:
+//
+//	ngJobSystem* jobs = ngJobSystemCreate(0);
+//
+//	ngJobDecl decls[2] = { { DoWork, &data[0] }, { DoWork, &data[1] } };
+//	ngJobCounter counter;
+//	ngJobRun(jobs, decls, 2, &counter);
+//	ngJobWait(jobs, &counter);
+//
+//	ngJobParallelFor(jobs, count, 64, [&](const int begin, const int end) { ... });
+//
+//	ngJobSystemDestroy(jobs);
+//
+
+#include	<atomic>
+
+// ----------------------------------------------------------------------------
+
+class ngJobSystem;
+
+typedef void (*ngJobFunction)(void* data);
+
+struct ngJobDecl
+{
+	ngJobFunction function = nullptr;
+	void* data = nullptr;
+};
+
+struct ngJobCounter
+{
+	std::atomic<int> value { 0 };
+};
+
+// ----------------------------------------------------------------------------
+
+// numThreads includes the calling thread, 0 uses the hardware thread count
+ngJobSystem* ngJobSystemCreate(const int numThreads);
+void ngJobSystemDestroy(ngJobSystem* system);
+
+int ngJobSystemThreadCount(const ngJobSystem* system);
+
+// Queue the jobs on the calling thread's deque. The counter is incremented by count
+// and decremented as each job completes. The data pointers must stay valid until then.
+void ngJobRun(ngJobSystem* system, const ngJobDecl* jobs, const int count, ngJobCounter* counter);
+
+// Execute queued (or stolen) jobs until the counter reaches zero
+void ngJobWait(ngJobSystem* system, ngJobCounter* counter);
+
+// ----------------------------------------------------------------------------
+
+namespace ng_job_detail {
+
+template <typename Fn>
+struct ParallelForRange
+{
+	ngJobSystem* system;
+	const Fn* fn;
+	int begin, end, batchSize;
+};
+
+// Ranges are split in half recursively so the only allocation is on the stack of the
+// job which is waiting for the halves to complete
+template <typename Fn>
+void ParallelForJob(void* data)
+{
+	const ParallelForRange<Fn>& range = *static_cast<ParallelForRange<Fn>*>(data);
+	if ((range.end - range.begin) <= range.batchSize)
+	{
+		(*range.fn)(range.begin, range.end);
+		return;
+	}
+
+	const int mid = range.begin + ((range.end - range.begin) / 2);
+	ParallelForRange<Fn> halves[2] =
+	{
+		{ range.system, range.fn, range.begin, mid, range.batchSize },
+		{ range.system, range.fn, mid, range.end, range.batchSize },
+	};
+
+	ngJobDecl decl;
+	decl.function = ParallelForJob<Fn>;
+	decl.data = &halves[1];
+
+	ngJobCounter counter;
+	ngJobRun(range.system, &decl, 1, &counter);
+	ParallelForJob<Fn>(&halves[0]);
+	ngJobWait(range.system, &counter);
+}
+
+}
+
+// Calls fn(begin, end) for batches of at most batchSize covering [0, count) and waits
+// for all of them to complete. Runs inline when system is null.
+template <typename Fn>
+void ngJobParallelFor(ngJobSystem* system, const int count, const int batchSize, const Fn& fn)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	if (!system || count <= batchSize)
+	{
+		fn(0, count);
+		return;
+	}
+
+	ng_job_detail::ParallelForRange<Fn> range = { system, &fn, 0, count, batchSize < 1 ? 1 : batchSize };
+	ng_job_detail::ParallelForJob<Fn>(&range);
+}
+
+// ----------------------------------------------------------------------------
+
+#endif	//	HAS_NG_JOB_SYSTEM_H_BEEN_INCLUDED
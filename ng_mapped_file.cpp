@@ -0,0 +1,157 @@
+
+//
+// Public domain
+//
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+#include	"ng_mapped_file.h"
+
+// ----------------------------------------------------------------------------
+
+class ngMappedFile
+{
+public:
+
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+// ----------------------------------------------------------------------------
+
+ngMappedFile* ngMappedFileOpen(const char* path, const bool randomAccess)
+{
+	if (!path)
+	{
+		return nullptr;
+	}
+
+	ngMappedFile* file = new ngMappedFile;
+
+#ifdef _WIN32
+	const DWORD flags = FILE_ATTRIBUTE_NORMAL | (randomAccess ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN);
+	file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+	if (file->file == INVALID_HANDLE_VALUE)
+	{
+		ngMappedFileClose(file);
+		return nullptr;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file->file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		ngMappedFileClose(file);
+		return nullptr;
+	}
+
+	file->mapping = CreateFileMappingA(file->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!file->mapping)
+	{
+		ngMappedFileClose(file);
+		return nullptr;
+	}
+
+	file->data = (const uint8_t*)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+	file->size = (size_t)fileSize.QuadPart;
+	if (!file->data)
+	{
+		ngMappedFileClose(file);
+		return nullptr;
+	}
+#else
+	const int fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		delete file;
+		return nullptr;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		delete file;
+		return nullptr;
+	}
+
+	// the mapping keeps the file open
+	void* mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		delete file;
+		return nullptr;
+	}
+
+	madvise(mapping, (size_t)info.st_size, randomAccess ? MADV_RANDOM : MADV_SEQUENTIAL);
+
+	file->data = (const uint8_t*)mapping;
+	file->size = (size_t)info.st_size;
+#endif
+
+	return file;
+}
+
+// ----------------------------------------------------------------------------
+
+void ngMappedFileClose(ngMappedFile* file)
+{
+	if (!file)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	if (file->data)
+	{
+		UnmapViewOfFile(file->data);
+	}
+
+	if (file->mapping)
+	{
+		CloseHandle(file->mapping);
+	}
+
+	if (file->file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(file->file);
+	}
+#else
+	if (file->data)
+	{
+		munmap((void*)file->data, file->size);
+	}
+#endif
+
+	delete file;
+}
+
+// ----------------------------------------------------------------------------
+
+const uint8_t* ngMappedFileData(const ngMappedFile* file)
+{
+	return file->data;
+}
+
+// ----------------------------------------------------------------------------
+
+size_t ngMappedFileSize(const ngMappedFile* file)
+{
+	return file->size;
+}
+
+// ----------------------------------------------------------------------------
@@ -0,0 +1,36 @@
+#ifndef		HAS_NG_MAPPED_FILE_H_BEEN_INCLUDED
+#define		HAS_NG_MAPPED_FILE_H_BEEN_INCLUDED
+
+//
+// Read only memory mapped files
+// Public domain
+//
+// The whole file is mapped and the pages are only loaded as they are touched, so a small
+// part of a very large file can be read without reading the rest.
+//
+// Usage:
+//
+//	ngMappedFile* file = ngMappedFileOpen("volume.raw", true);
+//	const uint8_t* data = ngMappedFileData(file);
+//	...
+//	ngMappedFileClose(file);
+//
+
+#include	<stddef.h>
+#include	<stdint.h>
+
+// ----------------------------------------------------------------------------
+
+class ngMappedFile;
+
+// Returns null if the file doesn't exist, is empty or can't be mapped. Random access 
+// files aren't read ahead of the pages which are touched.
+ngMappedFile* ngMappedFileOpen(const char* path, const bool randomAccess);
+void ngMappedFileClose(ngMappedFile* file);
+
+const uint8_t* ngMappedFileData(const ngMappedFile* file);
+size_t ngMappedFileSize(const ngMappedFile* file);
+
+// ----------------------------------------------------------------------------
+
+#endif	//	HAS_NG_MAPPED_FILE_H_BEEN_INCLUDED
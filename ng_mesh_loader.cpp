@@ -0,0 +1,1188 @@
+//
+// Public domain
+//
+
+#include	"ng_mesh_loader.h"
+#include	"ng_job_system.h"
+#include	"ng_mapped_file.h"
+#include	"ng_trace.h"
+
+#include	<limits.h>
+#include	<math.h>
+#include	<stdint.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<atomic>
+#include	<string>
+#include	<vector>
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+// An OBJ is split into batches of about this many bytes, each ending at the end of a line
+const size_t OBJ_BATCH_BYTES = 1 << 20;
+
+// PLY vertices & faces are decoded in batches of this many
+const int PLY_BATCH_SIZE = 1 << 16;
+
+const double POWERS_OF_TEN[] =
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+struct ObjBatch
+{
+	const char* begin = nullptr;
+	const char* end = nullptr;
+
+	// counted by the first pass, then the first vertex & triangle of the batch
+	int64_t numVertices = 0;
+	int64_t numTriangles = 0;
+	int64_t firstVertex = 0;
+	int64_t firstTriangle = 0;
+};
+
+enum PlyType
+{
+	PLY_INVALID,
+	PLY_INT8,
+	PLY_UINT8,
+	PLY_INT16,
+	PLY_UINT16,
+	PLY_INT32,
+	PLY_UINT32,
+	PLY_FLOAT32,
+	PLY_FLOAT64,
+};
+
+struct PlyProperty
+{
+	std::string name;
+
+	// for a list the type is the type of the items
+	PlyType type = PLY_INVALID;
+	PlyType countType = PLY_INVALID;
+
+	// the offset within the record, only used when the record has a fixed size
+	size_t offset = 0;
+};
+
+struct PlyElement
+{
+	std::string name;
+	int64_t count = 0;
+	std::vector<PlyProperty> properties;
+
+	// the size of a record when there are no lists, otherwise zero
+	size_t stride = 0;
+};
+
+}
+
+// ----------------------------------------------------------------------------
+
+static bool IsSpace(const char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+// ----------------------------------------------------------------------------
+
+static bool IsDigit(const char c)
+{
+	return (unsigned)(c - '0') < 10;
+}
+
+// ----------------------------------------------------------------------------
+
+static const char* SkipSpace(const char* p, const char* end)
+{
+	while (p < end && IsSpace(*p))
+	{
+		p++;
+	}
+
+	return p;
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns null if there isn't a number at p. The first 19 significant digits are kept
+// as an integer which is scaled by an exact power of ten, so the value is within an ulp
+// of strtof's for the number of digits meshes are written with.
+static const char* ParseFloat(const char* p, const char* end, float* value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	bool hasDigits = false;
+
+	for (; p < end && IsDigit(*p); p++)
+	{
+		hasDigits = true;
+		if (mantissa < 1000000000000000000ull)
+		{
+			mantissa = (mantissa * 10) + (*p - '0');
+		}
+		else
+		{
+			exponent++;
+		}
+	}
+
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && IsDigit(*p); p++)
+		{
+			hasDigits = true;
+			if (mantissa < 1000000000000000000ull)
+			{
+				mantissa = (mantissa * 10) + (*p - '0');
+				exponent--;
+			}
+		}
+	}
+
+	if (!hasDigits)
+	{
+		return nullptr;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* e = p + 1;
+		bool negativeExponent = false;
+		if (e < end && (*e == '-' || *e == '+'))
+		{
+			negativeExponent = *e == '-';
+			e++;
+		}
+
+		if (e < end && IsDigit(*e))
+		{
+			int digitsExponent = 0;
+			for (; e < end && IsDigit(*e); e++)
+			{
+				digitsExponent = digitsExponent < 10000 ? (digitsExponent * 10) + (*e - '0') : digitsExponent;
+			}
+
+			exponent += negativeExponent ? -digitsExponent : digitsExponent;
+			p = e;
+		}
+	}
+
+	double result = (double)mantissa;
+	for (; exponent < -22; exponent += 22)
+	{
+		result /= 1e22;
+	}
+
+	for (; exponent > 22; exponent -= 22)
+	{
+		result *= 1e22;
+	}
+
+	result = exponent < 0 ? result / POWERS_OF_TEN[-exponent] : result * POWERS_OF_TEN[exponent];
+	*value = (float)(negative ? -result : result);
+	return p;
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns null if there isn't an integer at p
+static const char* ParseInt(const char* p, const char* end, int64_t* value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	if (p >= end || !IsDigit(*p))
+	{
+		return nullptr;
+	}
+
+	// clamped well beyond INT_MAX so an overflow is still out of range
+	int64_t result = 0;
+	for (; p < end && IsDigit(*p); p++)
+	{
+		result = result < ((int64_t)1 << 40) ? (result * 10) + (*p - '0') : result;
+	}
+
+	*value = negative ? -result : result;
+	return p;
+}
+
+// ----------------------------------------------------------------------------
+
+static MeshBuffer* AllocateMesh(const int64_t numVertices, const int64_t numTriangles)
+{
+	if (numVertices > INT_MAX || numTriangles > INT_MAX)
+	{
+		return nullptr;
+	}
+
+	// at least one element of each so an empty mesh still has valid arrays
+	MeshBuffer* mesh = new MeshBuffer;
+	mesh->vertices = (MeshVertex*)ng_alloc(sizeof(MeshVertex) * (size_t)(numVertices > 0 ? numVertices : 1));
+	mesh->triangles = (MeshTriangle*)ng_alloc(sizeof(MeshTriangle) * (size_t)(numTriangles > 0 ? numTriangles : 1));
+	if (!mesh->vertices || !mesh->triangles)
+	{
+		ng_free(mesh->vertices);
+		ng_free(mesh->triangles);
+		delete mesh;
+		return nullptr;
+	}
+
+	mesh->numVertices = (int)numVertices;
+	mesh->numTriangles = (int)numTriangles;
+	return mesh;
+}
+
+// ----------------------------------------------------------------------------
+
+static void DestroyMesh(MeshBuffer* mesh)
+{
+	if (mesh)
+	{
+		ng_free(mesh->vertices);
+		ng_free(mesh->triangles);
+		delete mesh;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+// The area weighted average of the normals of the triangles using each vertex. The sums
+// are made in triangle order so the result doesn't depend on the number of threads.
+static void CalculateVertexNormals(MeshBuffer* mesh, ngJobSystem* jobSystem)
+{
+	NG_TRACE_SCOPE("CalculateVertexNormals");
+
+	ngJobParallelFor(jobSystem, mesh->numVertices, PLY_BATCH_SIZE, [&](const int begin, const int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			mesh->vertices[i].normal = vec4(0.f);
+		}
+	});
+
+	for (int i = 0; i < mesh->numTriangles; i++)
+	{
+		const int* indices = mesh->triangles[i].indices_;
+		const glm::vec3 p0(mesh->vertices[indices[0]].xyz);
+		const glm::vec3 p1(mesh->vertices[indices[1]].xyz);
+		const glm::vec3 p2(mesh->vertices[indices[2]].xyz);
+
+		// the length of the cross product is twice the area
+		const vec4 normal(glm::cross(p1 - p0, p2 - p0), 0.f);
+		mesh->vertices[indices[0]].normal += normal;
+		mesh->vertices[indices[1]].normal += normal;
+		mesh->vertices[indices[2]].normal += normal;
+	}
+
+	ngJobParallelFor(jobSystem, mesh->numVertices, PLY_BATCH_SIZE, [&](const int begin, const int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			vec4& normal = mesh->vertices[i].normal;
+			const float length = glm::length(normal);
+			normal = length > 0.f ? normal / length : vec4(0.f);
+		}
+	});
+}
+
+// ----------------------------------------------------------------------------
+
+// Counts the number of corners of the face on the line (after the "f")
+static int CountObjFaceCorners(const char* p, const char* end)
+{
+	int count = 0;
+	for (p = SkipSpace(p, end); p < end && *p != '#'; p = SkipSpace(p, end))
+	{
+		count++;
+		while (p < end && !IsSpace(*p))
+		{
+			p++;
+		}
+	}
+
+	return count;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool CountObjBatch(ObjBatch& batch)
+{
+	for (const char* line = batch.begin; line < batch.end; )
+	{
+		const char* lineEnd = (const char*)memchr(line, '\n', batch.end - line);
+		lineEnd = lineEnd ? lineEnd : batch.end;
+
+		const char* p = SkipSpace(line, lineEnd);
+		if (lineEnd - p > 1 && IsSpace(p[1]))
+		{
+			if (p[0] == 'v')
+			{
+				batch.numVertices++;
+			}
+			else if (p[0] == 'f')
+			{
+				const int corners = CountObjFaceCorners(p + 1, lineEnd);
+				if (corners < 3)
+				{
+					return false;
+				}
+
+				batch.numTriangles += corners - 2;
+			}
+		}
+
+		line = lineEnd + 1;
+	}
+
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool ParseObjVertex(const char* p, const char* end, MeshVertex* vertex)
+{
+	// x y z, optionally followed by w or by r g b (with or without the w)
+	float values[7];
+	int count = 0;
+	for (p = SkipSpace(p, end); count < 7 && p < end && *p != '#'; p = SkipSpace(p, end))
+	{
+		p = ParseFloat(p, end, &values[count++]);
+		if (!p)
+		{
+			return false;
+		}
+	}
+
+	if (count < 3)
+	{
+		return false;
+	}
+
+	vertex->xyz = vec4(values[0], values[1], values[2], 1.f);
+	vertex->normal = vec4(0.f);
+	vertex->colour = count >= 6 ? vec4(values[count - 3], values[count - 2], values[count - 1], 1.f) : vec4(0.f);
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+// Each corner is v, v/vt, v//vn or v/vt/vn and only the v is used. Negative indices are
+// relative to the vertices before the face. Returns the number of triangles, or -1 if 
+// the face isn't valid.
+static int ParseObjFace(
+	const char* p,
+	const char* end,
+	const int64_t verticesBefore,
+	const int64_t numVertices,
+	MeshTriangle* triangles)
+{
+	int first = -1, previous = -1;
+	int numCorners = 0;
+	for (p = SkipSpace(p, end); p < end && *p != '#'; p = SkipSpace(p, end))
+	{
+		int64_t index = 0;
+		p = ParseInt(p, end, &index);
+		if (!p)
+		{
+			return -1;
+		}
+
+		index = index < 0 ? verticesBefore + index : index - 1;
+		if (index < 0 || index >= numVertices)
+		{
+			return -1;
+		}
+
+		while (p < end && !IsSpace(*p))
+		{
+			p++;
+		}
+
+		if (numCorners == 0)
+		{
+			first = (int)index;
+		}
+		else if (numCorners >= 2)
+		{
+			MeshTriangle& triangle = triangles[numCorners - 2];
+			triangle.indices_[0] = first;
+			triangle.indices_[1] = previous;
+			triangle.indices_[2] = (int)index;
+		}
+
+		previous = (int)index;
+		numCorners++;
+	}
+
+	return numCorners - 2;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool ParseObjBatch(const ObjBatch& batch, const int64_t numVertices, MeshBuffer* mesh)
+{
+	int64_t vertex = batch.firstVertex;
+	int64_t triangle = batch.firstTriangle;
+
+	for (const char* line = batch.begin; line < batch.end; )
+	{
+		const char* lineEnd = (const char*)memchr(line, '\n', batch.end - line);
+		lineEnd = lineEnd ? lineEnd : batch.end;
+
+		const char* p = SkipSpace(line, lineEnd);
+		if (lineEnd - p > 1 && IsSpace(p[1]))
+		{
+			if (p[0] == 'v')
+			{
+				if (!ParseObjVertex(p + 1, lineEnd, &mesh->vertices[vertex++]))
+				{
+					return false;
+				}
+			}
+			else if (p[0] == 'f')
+			{
+				// the first pass has already checked there are at least 3 corners
+				const int numTriangles = ParseObjFace(p + 1, lineEnd, vertex, numVertices, &mesh->triangles[triangle]);
+				if (numTriangles < 0)
+				{
+					return false;
+				}
+
+				triangle += numTriangles;
+			}
+		}
+
+		line = lineEnd + 1;
+	}
+
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+// The lines are counted to size the mesh, then parsed into it. Both passes work on the
+// same batches so each batch knows where its vertices & triangles start.
+static MeshBuffer* LoadObj(const char* data, const size_t size, ngJobSystem* jobSystem)
+{
+	NG_TRACE_SCOPE("LoadObj");
+
+	std::vector<ObjBatch> batches;
+	for (size_t offset = 0; offset < size; )
+	{
+		size_t end = offset + OBJ_BATCH_BYTES < size ? offset + OBJ_BATCH_BYTES : size;
+		const char* lineEnd = (const char*)memchr(data + end - 1, '\n', size - (end - 1));
+		end = lineEnd ? (size_t)(lineEnd - data) + 1 : size;
+
+		ObjBatch batch;
+		batch.begin = data + offset;
+		batch.end = data + end;
+		batches.push_back(batch);
+		offset = end;
+	}
+
+	if (batches.size() > INT_MAX)
+	{
+		return nullptr;
+	}
+
+	std::atomic<bool> valid { true };
+	ngJobParallelFor(jobSystem, (int)batches.size(), 1, [&](const int begin, const int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			if (!CountObjBatch(batches[i]))
+			{
+				valid = false;
+			}
+		}
+	});
+
+	if (!valid)
+	{
+		return nullptr;
+	}
+
+	int64_t numVertices = 0, numTriangles = 0;
+	for (ObjBatch& batch: batches)
+	{
+		batch.firstVertex = numVertices;
+		batch.firstTriangle = numTriangles;
+		numVertices += batch.numVertices;
+		numTriangles += batch.numTriangles;
+	}
+
+	MeshBuffer* mesh = AllocateMesh(numVertices, numTriangles);
+	if (!mesh)
+	{
+		return nullptr;
+	}
+
+	ngJobParallelFor(jobSystem, (int)batches.size(), 1, [&](const int begin, const int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			if (!ParseObjBatch(batches[i], numVertices, mesh))
+			{
+				valid = false;
+			}
+		}
+	});
+
+	if (!valid)
+	{
+		DestroyMesh(mesh);
+		return nullptr;
+	}
+
+	CalculateVertexNormals(mesh, jobSystem);
+	return mesh;
+}
+
+// ----------------------------------------------------------------------------
+
+static PlyType PlyTypeFromName(const std::string& name)
+{
+	if (name == "char" || name == "int8") return PLY_INT8;
+	if (name == "uchar" || name == "uint8") return PLY_UINT8;
+	if (name == "short" || name == "int16") return PLY_INT16;
+	if (name == "ushort" || name == "uint16") return PLY_UINT16;
+	if (name == "int" || name == "int32") return PLY_INT32;
+	if (name == "uint" || name == "uint32") return PLY_UINT32;
+	if (name == "float" || name == "float32") return PLY_FLOAT32;
+	if (name == "double" || name == "float64") return PLY_FLOAT64;
+	return PLY_INVALID;
+}
+
+// ----------------------------------------------------------------------------
+
+static size_t PlyTypeSize(const PlyType type)
+{
+	switch (type)
+	{
+	case PLY_INT8: case PLY_UINT8: return 1;
+	case PLY_INT16: case PLY_UINT16: return 2;
+	case PLY_INT32: case PLY_UINT32: case PLY_FLOAT32: return 4;
+	case PLY_FLOAT64: return 8;
+	default: return 0;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+// Big endian files are swapped, the host is assumed to be little endian
+static double ReadPlyValue(const uint8_t* p, const PlyType type, const bool swap)
+{
+	// the common case of little endian floats & int indices is read directly
+	if (!swap && type == PLY_FLOAT32)
+	{
+		float v;
+		memcpy(&v, p, 4);
+		return v;
+	}
+	else if (!swap && type == PLY_INT32)
+	{
+		int32_t v;
+		memcpy(&v, p, 4);
+		return v;
+	}
+
+	uint8_t bytes[8];
+	const size_t size = PlyTypeSize(type);
+	for (size_t i = 0; i < size; i++)
+	{
+		bytes[i] = swap ? p[size - 1 - i] : p[i];
+	}
+
+	switch (type)
+	{
+	case PLY_INT8: { int8_t v; memcpy(&v, bytes, 1); return v; }
+	case PLY_UINT8: { uint8_t v; memcpy(&v, bytes, 1); return v; }
+	case PLY_INT16: { int16_t v; memcpy(&v, bytes, 2); return v; }
+	case PLY_UINT16: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+	case PLY_INT32: { int32_t v; memcpy(&v, bytes, 4); return v; }
+	case PLY_UINT32: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+	case PLY_FLOAT32: { float v; memcpy(&v, bytes, 4); return v; }
+	case PLY_FLOAT64: { double v; memcpy(&v, bytes, 8); return v; }
+	default: return 0.0;
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns the size of the record at p, or zero if it runs past the end of the data
+static size_t PlyRecordSize(const PlyElement& element, const uint8_t* p, const uint8_t* end, const bool swap)
+{
+	size_t size = 0;
+	for (const PlyProperty& property: element.properties)
+	{
+		if (property.countType == PLY_INVALID)
+		{
+			size += PlyTypeSize(property.type);
+			continue;
+		}
+
+		const size_t countSize = PlyTypeSize(property.countType);
+		if ((size_t)(end - p) < size + countSize)
+		{
+			return 0;
+		}
+
+		const double count = ReadPlyValue(p + size, property.countType, swap);
+		if (count < 0.0)
+		{
+			return 0;
+		}
+
+		size += countSize + ((size_t)count * PlyTypeSize(property.type));
+	}
+
+	return (size_t)(end - p) < size ? 0 : size;
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns the offset of the data, or zero if the header isn't valid
+static size_t ParsePlyHeader(const char* data, const size_t size, std::vector<PlyElement>& elements, bool* bigEndian)
+{
+	bool hasFormat = false;
+	for (size_t offset = 0; offset < size; )
+	{
+		const char* lineEnd = (const char*)memchr(data + offset, '\n', size - offset);
+		if (!lineEnd)
+		{
+			return 0;
+		}
+
+		// the header is small so it's split into words rather than parsed in place
+		std::vector<std::string> words;
+		for (const char* p = SkipSpace(data + offset, lineEnd); p < lineEnd; p = SkipSpace(p, lineEnd))
+		{
+			const char* word = p;
+			while (p < lineEnd && !IsSpace(*p))
+			{
+				p++;
+			}
+
+			words.push_back(std::string(word, p));
+		}
+
+		offset = (size_t)(lineEnd - data) + 1;
+
+		if (words.empty() || words[0] == "ply" || words[0] == "comment" || words[0] == "obj_info")
+		{
+			continue;
+		}
+		else if (words[0] == "end_header")
+		{
+			return hasFormat ? offset : 0;
+		}
+		else if (words[0] == "format" && words.size() >= 2)
+		{
+			// ASCII files aren't supported
+			if (words[1] != "binary_little_endian" && words[1] != "binary_big_endian")
+			{
+				return 0;
+			}
+
+			*bigEndian = words[1] == "binary_big_endian";
+			hasFormat = true;
+		}
+		else if (words[0] == "element" && words.size() == 3)
+		{
+			PlyElement element;
+			element.name = words[1];
+			element.count = strtoll(words[2].c_str(), nullptr, 10);
+			if (element.count < 0)
+			{
+				return 0;
+			}
+
+			elements.push_back(element);
+		}
+		else if (words[0] == "property" && !elements.empty())
+		{
+			PlyProperty property;
+			if (words.size() == 5 && words[1] == "list")
+			{
+				property.countType = PlyTypeFromName(words[2]);
+				property.type = PlyTypeFromName(words[3]);
+				property.name = words[4];
+
+				if (property.countType == PLY_INVALID || property.countType == PLY_FLOAT32 || property.countType == PLY_FLOAT64)
+				{
+					return 0;
+				}
+			}
+			else if (words.size() == 3)
+			{
+				property.type = PlyTypeFromName(words[1]);
+				property.name = words[2];
+			}
+
+			if (property.type == PLY_INVALID)
+			{
+				return 0;
+			}
+
+			elements.back().properties.push_back(property);
+		}
+		else
+		{
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+// ----------------------------------------------------------------------------
+
+static const PlyProperty* FindPlyProperty(const PlyElement& element, const char* name)
+{
+	for (const PlyProperty& property: element.properties)
+	{
+		if (property.name == name && property.countType == PLY_INVALID)
+		{
+			return &property;
+		}
+	}
+
+	return nullptr;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool ReadPlyVertices(
+	const PlyElement& element,
+	const uint8_t* data,
+	const bool swap,
+	MeshBuffer* mesh,
+	ngJobSystem* jobSystem,
+	bool* hasNormals)
+{
+	NG_TRACE_SCOPE("ReadPlyVertices");
+
+	const PlyProperty* position[3] = { FindPlyProperty(element, "x"), FindPlyProperty(element, "y"), FindPlyProperty(element, "z") };
+	const PlyProperty* normal[3] = { FindPlyProperty(element, "nx"), FindPlyProperty(element, "ny"), FindPlyProperty(element, "nz") };
+	const PlyProperty* colour[3] = { FindPlyProperty(element, "red"), FindPlyProperty(element, "green"), FindPlyProperty(element, "blue") };
+
+	if (!position[0] || !position[1] || !position[2] || element.stride == 0)
+	{
+		return false;
+	}
+
+	*hasNormals = normal[0] && normal[1] && normal[2];
+	const bool hasColours = colour[0] && colour[1] && colour[2];
+
+	// integer colours are 0 to 255 (or 65535 for ushort)
+	const float colourRange = hasColours && colour[0]->type == PLY_UINT8 ? 255.f :
+		(hasColours && colour[0]->type == PLY_UINT16 ? 65535.f : 1.f);
+
+	const int numBatches = (int)((element.count + PLY_BATCH_SIZE - 1) / PLY_BATCH_SIZE);
+	ngJobParallelFor(jobSystem, numBatches, 1, [&](const int beginBatch, const int endBatch)
+	{
+		const int begin = beginBatch * PLY_BATCH_SIZE;
+		const int end = (int)(endBatch * (int64_t)PLY_BATCH_SIZE < element.count ? endBatch * PLY_BATCH_SIZE : element.count);
+		for (int i = begin; i < end; i++)
+		{
+			const uint8_t* record = data + ((size_t)i * element.stride);
+			MeshVertex& vertex = mesh->vertices[i];
+
+			vertex.xyz = vec4(0.f, 0.f, 0.f, 1.f);
+			vertex.normal = vec4(0.f);
+			vertex.colour = vec4(0.f);
+
+			for (int j = 0; j < 3; j++)
+			{
+				vertex.xyz[j] = (float)ReadPlyValue(record + position[j]->offset, position[j]->type, swap);
+			}
+
+			if (*hasNormals)
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					vertex.normal[j] = (float)ReadPlyValue(record + normal[j]->offset, normal[j]->type, swap);
+				}
+
+				const float length = glm::length(vertex.normal);
+				vertex.normal = length > 0.f ? vertex.normal / length : vec4(0.f);
+			}
+
+			if (hasColours)
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					vertex.colour[j] = (float)ReadPlyValue(record + colour[j]->offset, colour[j]->type, swap) / colourRange;
+				}
+
+				vertex.colour.w = 1.f;
+			}
+		}
+	});
+
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+// The index of the faces' list of vertex indices, or -1
+static int FindPlyFaceIndices(const PlyElement& element)
+{
+	for (size_t i = 0; i < element.properties.size(); i++)
+	{
+		const PlyProperty& property = element.properties[i];
+		if (property.countType != PLY_INVALID && property.type != PLY_FLOAT32 && property.type != PLY_FLOAT64 &&
+			(property.name == "vertex_indices" || property.name == "vertex_index"))
+		{
+			return (int)i;
+		}
+	}
+
+	return -1;
+}
+
+// ----------------------------------------------------------------------------
+
+// True when the indices are the only list and every face is a triangle, so every record
+// has the same size and the faces can be read in parallel. Sets the size of a record and
+// the offset of the indices' count within it.
+static bool IsPlyTriangleList(
+	const PlyElement& element,
+	const int indicesProperty,
+	const uint8_t* data,
+	const uint8_t* dataEnd,
+	const bool swap,
+	ngJobSystem* jobSystem,
+	size_t* stride,
+	size_t* countOffset)
+{
+	size_t size = 0, offset = 0;
+	for (size_t i = 0; i < element.properties.size(); i++)
+	{
+		const PlyProperty& property = element.properties[i];
+		if ((int)i == indicesProperty)
+		{
+			offset = size;
+			size += PlyTypeSize(property.countType) + (3 * PlyTypeSize(property.type));
+		}
+		else if (property.countType != PLY_INVALID)
+		{
+			return false;
+		}
+		else
+		{
+			size += PlyTypeSize(property.type);
+		}
+	}
+
+	if ((size_t)(dataEnd - data) / size < (size_t)element.count)
+	{
+		return false;
+	}
+
+	const PlyType countType = element.properties[indicesProperty].countType;
+	const int numBatches = (int)((element.count + PLY_BATCH_SIZE - 1) / PLY_BATCH_SIZE);
+	std::atomic<bool> triangles { true };
+	ngJobParallelFor(jobSystem, numBatches, 1, [&](const int beginBatch, const int endBatch)
+	{
+		const int64_t begin = beginBatch * (int64_t)PLY_BATCH_SIZE;
+		const int64_t end = endBatch * (int64_t)PLY_BATCH_SIZE < element.count ? endBatch * (int64_t)PLY_BATCH_SIZE : element.count;
+		for (int64_t i = begin; i < end && triangles; i++)
+		{
+			if (ReadPlyValue(data + ((size_t)i * size) + offset, countType, swap) != 3.0)
+			{
+				triangles = false;
+			}
+		}
+	});
+
+	*stride = size;
+	*countOffset = offset;
+	return triangles;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool ReadPlyTriangleList(
+	const PlyElement& element,
+	const PlyProperty& indices,
+	const uint8_t* data,
+	const size_t stride,
+	const size_t countOffset,
+	const bool swap,
+	MeshBuffer* mesh,
+	ngJobSystem* jobSystem)
+{
+	NG_TRACE_SCOPE("ReadPlyTriangleList");
+
+	const size_t indexOffset = countOffset + PlyTypeSize(indices.countType);
+	const size_t indexSize = PlyTypeSize(indices.type);
+	const int numBatches = (int)((element.count + PLY_BATCH_SIZE - 1) / PLY_BATCH_SIZE);
+
+	std::atomic<bool> valid { true };
+	ngJobParallelFor(jobSystem, numBatches, 1, [&](const int beginBatch, const int endBatch)
+	{
+		const int begin = beginBatch * PLY_BATCH_SIZE;
+		const int end = (int)(endBatch * (int64_t)PLY_BATCH_SIZE < element.count ? endBatch * PLY_BATCH_SIZE : element.count);
+		for (int i = begin; i < end; i++)
+		{
+			const uint8_t* record = data + ((size_t)i * stride) + indexOffset;
+			for (int j = 0; j < 3; j++)
+			{
+				const double index = ReadPlyValue(record + (j * indexSize), indices.type, swap);
+				if (index < 0.0 || index >= (double)mesh->numVertices)
+				{
+					valid = false;
+					return;
+				}
+
+				mesh->triangles[i].indices_[j] = (int)index;
+			}
+		}
+	});
+
+	return valid;
+}
+
+// ----------------------------------------------------------------------------
+
+// Walks the faces one at a time, counting the triangles when mesh is null and reading 
+// them into it otherwise. Returns the end of the faces or null if they aren't valid.
+static const uint8_t* WalkPlyFaces(
+	const PlyElement& element,
+	const int indicesProperty,
+	const uint8_t* data,
+	const uint8_t* dataEnd,
+	const bool swap,
+	int64_t* numTriangles,
+	MeshBuffer* mesh)
+{
+	NG_TRACE_SCOPE("WalkPlyFaces");
+
+	const PlyProperty& indices = element.properties[indicesProperty];
+	const size_t indexSize = PlyTypeSize(indices.type);
+
+	int64_t triangle = 0;
+	const uint8_t* record = data;
+	for (int64_t i = 0; i < element.count; i++)
+	{
+		const size_t recordSize = PlyRecordSize(element, record, dataEnd, swap);
+		if (recordSize == 0)
+		{
+			return nullptr;
+		}
+
+		// the size has been checked so the offsets of the properties are within the record
+		const uint8_t* p = record;
+		for (int j = 0; j < indicesProperty; j++)
+		{
+			const PlyProperty& property = element.properties[j];
+			p += property.countType == PLY_INVALID ? PlyTypeSize(property.type) :
+				PlyTypeSize(property.countType) + ((size_t)ReadPlyValue(p, property.countType, swap) * PlyTypeSize(property.type));
+		}
+
+		const int64_t numCorners = (int64_t)ReadPlyValue(p, indices.countType, swap);
+		p += PlyTypeSize(indices.countType);
+
+		// anything less than a triangle is skipped, the rest are fans
+		for (int64_t j = 0; mesh && j < numCorners; j++)
+		{
+			const double index = ReadPlyValue(p + (j * indexSize), indices.type, swap);
+			if (index < 0.0 || index >= (double)mesh->numVertices)
+			{
+				return nullptr;
+			}
+
+			if (j >= 2)
+			{
+				MeshTriangle& t = mesh->triangles[triangle + j - 2];
+				t.indices_[0] = (int)ReadPlyValue(p, indices.type, swap);
+				t.indices_[1] = (int)ReadPlyValue(p + ((j - 1) * indexSize), indices.type, swap);
+				t.indices_[2] = (int)index;
+			}
+		}
+
+		triangle += numCorners >= 3 ? numCorners - 2 : 0;
+		record += recordSize;
+	}
+
+	*numTriangles = triangle;
+	return record;
+}
+
+// ----------------------------------------------------------------------------
+
+static MeshBuffer* LoadPly(const uint8_t* data, const size_t size, ngJobSystem* jobSystem)
+{
+	NG_TRACE_SCOPE("LoadPly");
+
+	std::vector<PlyElement> elements;
+	bool bigEndian = false;
+	const size_t headerSize = ParsePlyHeader((const char*)data, size, elements, &bigEndian);
+	if (headerSize == 0)
+	{
+		return nullptr;
+	}
+
+	// the records of elements without lists are all the same size
+	for (PlyElement& element: elements)
+	{
+		size_t stride = 0;
+		for (PlyProperty& property: element.properties)
+		{
+			property.offset = stride;
+			stride = property.countType == PLY_INVALID && stride != SIZE_MAX ? stride + PlyTypeSize(property.type) : SIZE_MAX;
+		}
+
+		element.stride = stride == SIZE_MAX ? 0 : stride;
+	}
+
+	// find where the vertices & faces are, the other elements are skipped
+	const PlyElement* vertices = nullptr;
+	const PlyElement* faces = nullptr;
+	const uint8_t* vertexData = nullptr;
+	const uint8_t* faceData = nullptr;
+	const uint8_t* dataEnd = data + size;
+
+	int indicesProperty = -1;
+	bool triangleList = false;
+	size_t faceStride = 0, countOffset = 0;
+	int64_t numTriangles = 0;
+
+	const uint8_t* p = data + headerSize;
+	for (const PlyElement& element: elements)
+	{
+		if (element.name == "vertex" && !vertices)
+		{
+			vertices = &element;
+			vertexData = p;
+		}
+		else if (element.name == "face" && !faces)
+		{
+			indicesProperty = FindPlyFaceIndices(element);
+			if (indicesProperty < 0)
+			{
+				return nullptr;
+			}
+
+			faces = &element;
+			faceData = p;
+
+			triangleList = IsPlyTriangleList(element, indicesProperty, p, dataEnd, bigEndian, jobSystem, &faceStride, &countOffset);
+			if (triangleList)
+			{
+				numTriangles = element.count;
+				p += (size_t)element.count * faceStride;
+			}
+			else
+			{
+				p = WalkPlyFaces(element, indicesProperty, p, dataEnd, bigEndian, &numTriangles, nullptr);
+				if (!p)
+				{
+					return nullptr;
+				}
+			}
+
+			continue;
+		}
+
+		if (element.stride > 0)
+		{
+			if ((size_t)(dataEnd - p) / element.stride < (size_t)element.count)
+			{
+				return nullptr;
+			}
+
+			p += (size_t)element.count * element.stride;
+		}
+		else
+		{
+			for (int64_t i = 0; i < element.count; i++)
+			{
+				const size_t recordSize = PlyRecordSize(element, p, dataEnd, bigEndian);
+				if (recordSize == 0)
+				{
+					return nullptr;
+				}
+
+				p += recordSize;
+			}
+		}
+	}
+
+	if (!vertices)
+	{
+		return nullptr;
+	}
+
+	MeshBuffer* mesh = AllocateMesh(vertices->count, numTriangles);
+	if (!mesh)
+	{
+		return nullptr;
+	}
+
+	bool hasNormals = false;
+	bool valid = ReadPlyVertices(*vertices, vertexData, bigEndian, mesh, jobSystem, &hasNormals);
+	if (valid && faces)
+	{
+		valid = triangleList ?
+			ReadPlyTriangleList(*faces, faces->properties[indicesProperty], faceData, faceStride, countOffset, bigEndian, mesh, jobSystem) :
+			WalkPlyFaces(*faces, indicesProperty, faceData, dataEnd, bigEndian, &numTriangles, mesh) != nullptr;
+	}
+
+	if (!valid)
+	{
+		DestroyMesh(mesh);
+		return nullptr;
+	}
+
+	if (!hasNormals)
+	{
+		CalculateVertexNormals(mesh, jobSystem);
+	}
+
+	return mesh;
+}
+
+// ----------------------------------------------------------------------------
+
+MeshBuffer* ngMeshLoadFromFile(const char* path, ngJobSystem* jobSystem)
+{
+	NG_TRACE_SCOPE("ngMeshLoadFromFile");
+
+	// the batches are read in order within each job
+	ngMappedFile* file = ngMappedFileOpen(path, false);
+	if (!file)
+	{
+		return nullptr;
+	}
+
+	const uint8_t* data = ngMappedFileData(file);
+	const size_t size = ngMappedFileSize(file);
+
+	const bool isPly = size >= 4 && memcmp(data, "ply", 3) == 0 && (data[3] == '\n' || data[3] == '\r');
+	MeshBuffer* mesh = isPly ? LoadPly(data, size, jobSystem) : LoadObj((const char*)data, size, jobSystem);
+
+	ngMappedFileClose(file);
+	return mesh;
+}
+
+// ----------------------------------------------------------------------------
+
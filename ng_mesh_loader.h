@@ -0,0 +1,42 @@
+#ifndef		HAS_NG_MESH_LOADER_H_BEEN_INCLUDED
+#define		HAS_NG_MESH_LOADER_H_BEEN_INCLUDED
+
+//
+// Binary PLY & OBJ mesh loader
+// Public domain
+//
+// The file is memory mapped and parsed in place. The number of vertices & triangles is
+// found first (from the PLY header, or by counting the lines of an OBJ) so the arrays of
+// the MeshBuffer are allocated once at their final size, then the elements are decoded
+// in batches, each written straight to its final position. With a job system the
+// batches are parsed in parallel, so the load is limited by reading the file rather than
+// by parsing it. The numbers are parsed without strtod, which is slow & locale dependent.
+//
+// Usage:
+//
+//	MeshBuffer* mesh = ngMeshLoadFromFile("scan.ply", jobs);
+//	ngMeshSimplifier(mesh, vec4(0.f), options);
+//	...
+//	free(mesh->vertices);
+//	free(mesh->triangles);
+//	delete mesh;
+//
+
+#include	"ng_mesh_simplify.h"
+
+class ngJobSystem;
+
+// ----------------------------------------------------------------------------
+
+// A file starting with "ply" is read as a binary (little or big endian) PLY, anything
+// else as an OBJ. Polygons are split into triangle fans. The vertex normals are read
+// from a PLY's nx, ny & nz, otherwise (and for OBJs, whose normals belong to the face
+// corners) they're the area weighted average of the triangle normals. Vertex colours
+// are read from a PLY's red, green & blue or the r g b following an OBJ vertex, and are
+// zero otherwise. Returns null if the file can't be mapped, is malformed (e.g. an index
+// out of range, or an ASCII PLY) or has more than INT_MAX vertices or triangles.
+MeshBuffer* ngMeshLoadFromFile(const char* path, ngJobSystem* jobSystem = nullptr);
+
+// ----------------------------------------------------------------------------
+
+#endif	//	HAS_NG_MESH_LOADER_H_BEEN_INCLUDED
@@ -3,12 +3,14 @@
 //
 
 #include	"ng_mesh_simplify.h"
+#include	"ng_trace.h"
 
 #define QEF_INCLUDE_IMPL
 #include	"qef_simd.h"
 
 #include	<stdint.h>
 #include	<algorithm>
+#include	<chrono>
 #include	<random>
 
 // ----------------------------------------------------------------------------
@@ -18,6 +20,13 @@ namespace {
 const int COLLAPSE_MAX_DEGREE = 16;
 const int MAX_TRIANGLES_PER_VERTEX = COLLAPSE_MAX_DEGREE;
 
+// The bytes held by the buffers on this thread, a simplification runs on a single thread
+// so the peak can be tracked for each call
+thread_local size_t scratchBytes = 0;
+thread_local size_t peakScratchBytes = 0;
+
+using Clock = std::chrono::steady_clock;
+
 template <typename T>
 class LinearBuffer
 {
@@ -27,10 +36,14 @@ public:
 	{
 		base_ = static_cast<T*>(ng_alloc(sizeof(T) * capacity));
 		end_ = base_ + capacity;
+
+		scratchBytes += sizeof(T) * capacity;
+		peakScratchBytes = std::max(peakScratchBytes, scratchBytes);
 	}
 
 	~LinearBuffer()
 	{
+		scratchBytes -= sizeof(T) * (end_ - base_);
 		ng_free(base_);
 	}
 
@@ -173,6 +186,11 @@ static inline float vec4_length2(const vec4& x)
 	return vec4_dot(x, x);
 }
 
+static inline double ElapsedMilliseconds(const Clock::time_point& start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
 // ----------------------------------------------------------------------------
 
 static void BuildCandidateEdges(
@@ -180,6 +198,8 @@ static void BuildCandidateEdges(
 	const LinearBuffer<MeshTriangle>& triangles,
 	LinearBuffer<Edge>& edges)
 {
+	NG_TRACE_SCOPE("BuildCandidateEdges");
+
 	for (int i = 0; i < triangles.size(); i++)
 	{
 		const int* indices = triangles[i].indices_;
@@ -243,20 +263,27 @@ static int FindValidCollapses(
 	LinearBuffer<int>& collapseValid, 
 	LinearBuffer<int>& collapseEdgeID, 
 	LinearBuffer<vec4>& collapsePosition,
-	LinearBuffer<vec4>& collapseNormal)
+	LinearBuffer<vec4>& collapseNormal,
+	MeshSimplificationIterationStats& iterationStats,
+	int& qefSolves)
 {
+	NG_TRACE_SCOPE("FindValidCollapses");
+
 	int validCollapses = 0;
 
 	std::mt19937 prng;
 	prng.seed(42);
 
 	const int numRandomEdges = edges.size() * options.edgeFraction;
-	std::uniform_int_distribution<int> distribution(0, (int)(edges.size() - 1));
+	iterationStats.candidates = numRandomEdges;
 
+	// mt19937's output is fully specified but std::uniform_int_distribution's isn't, so 
+	// the 32 bit values are mapped onto the edges directly (by multiplying and keeping 
+	// the high bits) to pick the same edges with every standard library
 	LinearBuffer<int> randomEdges(numRandomEdges);
 	for (int i = 0; i < numRandomEdges; i++)
 	{
-		const int randomIdx = distribution(prng);
+		const int randomIdx = (int)(((uint64_t)(uint32_t)prng() * (uint64_t)edges.size()) >> 32);
 		randomEdges.push_back(randomIdx);
 	}
 
@@ -293,10 +320,11 @@ static int FindValidCollapses(
 			continue;
 		}
 
-		__declspec(align(16)) float pos[4];
+		alignas(16) float pos[4];
 		MeshVertex data[2] = { vMin, vMax };
 
 		float error = qef_solve_from_points_4d_interleaved(&data[0].xyz[0], sizeof(MeshVertex) / sizeof(float), 2, pos);
+		qefSolves++;
 		if (error > 0.f)
 		{
 			error = 1.f / error;
@@ -334,12 +362,14 @@ static int FindValidCollapses(
 		validCollapses++;
 	}
 
+	iterationStats.validCollapses = validCollapses;
 	return validCollapses;
 }
 
 // ----------------------------------------------------------------------------
 
-static void CollapseEdges(
+// Returns the number of edges collapsed
+static int CollapseEdges(
 	const LinearBuffer<int>& collapseValid,
 	const LinearBuffer<Edge>& edges,
 	const LinearBuffer<int>& collapseEdgeID,
@@ -348,6 +378,8 @@ static void CollapseEdges(
 	LinearBuffer<MeshVertex>& vertices,
 	LinearBuffer<int>& collapseTarget)
 {
+	NG_TRACE_SCOPE("CollapseEdges");
+
 	int countCollapsed = 0, countCandidates = 0;
 	for (int i: collapseValid)
 	{
@@ -363,6 +395,8 @@ static void CollapseEdges(
 			vec4_set(vertices[edge.min_].normal, collapseNormal[i]);
 		}
 	}
+
+	return countCollapsed;
 }
 
 // ----------------------------------------------------------------------------
@@ -374,6 +408,8 @@ static int RemoveTriangles(
 	LinearBuffer<MeshTriangle>& triBuffer,
 	LinearBuffer<int>& vertexTriangleCounts)
 {
+	NG_TRACE_SCOPE("RemoveTriangles");
+
 	int removedCount = 0;
 
 	vertexTriangleCounts.clear();
@@ -421,6 +457,8 @@ static void RemoveEdges(
 	LinearBuffer<Edge>& edges,
 	LinearBuffer<Edge>& edgeBuffer)
 {
+	NG_TRACE_SCOPE("RemoveEdges");
+
 	edgeBuffer.clear();
 	for (auto& edge: edges)
 	{
@@ -449,8 +487,11 @@ static void RemoveEdges(
 
 static void CompactVertices(
 	LinearBuffer<MeshVertex>& vertices,
-	MeshBuffer* meshBuffer)
+	MeshBuffer* meshBuffer,
+	int* vertexRemap)
 {
+	NG_TRACE_SCOPE("CompactVertices");
+
 	LinearBuffer<bool> vertexUsed(vertices.size());
 	vertexUsed.resize(vertices.size(), false);
 
@@ -488,6 +529,11 @@ static void CompactVertices(
 		}
 	}
 
+	if (vertexRemap)
+	{
+		memcpy(vertexRemap, &remappedVertexIndices[0], sizeof(int) * vertices.size());
+	}
+
 	vertices.swap(compactVertices);
 }
 
@@ -496,10 +542,29 @@ static void CompactVertices(
 void ngMeshSimplifier(
 	MeshBuffer* mesh,
 	const vec4& worldSpaceOffset,
-	const MeshSimplificationOptions& options)
+	const MeshSimplificationOptions& options,
+	int* vertexRemap,
+	MeshSimplificationStats* stats)
 {
+	NG_TRACE_SCOPE("ngMeshSimplifier");
+
+	MeshSimplificationStats unusedStats;
+	MeshSimplificationStats& simplifyStats = stats ? *stats : unusedStats;
+	simplifyStats = MeshSimplificationStats();
+
+	const auto start = Clock::now();
+	peakScratchBytes = scratchBytes;
+
 	if (mesh->numTriangles < 100 || mesh->numVertices < 100)
 	{
+		if (vertexRemap)
+		{
+			for (int i = 0; i < mesh->numVertices; i++)
+			{
+				vertexRemap[i] = i;
+			}
+		}
+
 		return;
 	}
 
@@ -517,9 +582,13 @@ void ngMeshSimplifier(
 	mesh->numVertices = 0;
 	mesh->numTriangles = 0;
 
+	auto phaseStart = Clock::now();
+
 	LinearBuffer<Edge> edges(triangles.size() * 3);
 	BuildCandidateEdges(vertices, triangles, edges);
 
+	simplifyStats.buildEdgesTime = ElapsedMilliseconds(phaseStart);
+
 	LinearBuffer<vec4> collapsePosition(edges.size());
 	LinearBuffer<vec4> collapseNormal(edges.size());
 	LinearBuffer<int> collapseValid(edges.size());
@@ -556,21 +625,33 @@ void ngMeshSimplifier(
 
 		collapseValid.clear();
 
+		MeshSimplificationIterationStats iterationStats;
+
+		phaseStart = Clock::now();
 		const int countValidCollapse = FindValidCollapses(
 			options,
 			edges, vertices, triangles, vertexTriangleCounts, collapseValid, 
-			collapseEdgeID, collapsePosition, collapseNormal);
+			collapseEdgeID, collapsePosition, collapseNormal, iterationStats, simplifyStats.qefSolves);
+		simplifyStats.findCollapsesTime += ElapsedMilliseconds(phaseStart);
+
 		if (countValidCollapse == 0)
 		{
+			simplifyStats.iterations.push_back(iterationStats);
 			break;
 		}
 
-		CollapseEdges(collapseValid, edges,
+		phaseStart = Clock::now();
+		iterationStats.collapses = CollapseEdges(collapseValid, edges,
 			collapseEdgeID, collapsePosition, collapseNormal, vertices, 
 			collapseTarget);
+		simplifyStats.collapseTime += ElapsedMilliseconds(phaseStart);
 
-		RemoveTriangles(vertices, collapseTarget, triangles, triBuffer, vertexTriangleCounts);
+		phaseStart = Clock::now();
+		iterationStats.removedTriangles = RemoveTriangles(vertices, collapseTarget, triangles, triBuffer, vertexTriangleCounts);
 		RemoveEdges(collapseTarget, edges, edgeBuffer);
+		simplifyStats.removeTime += ElapsedMilliseconds(phaseStart);
+
+		simplifyStats.iterations.push_back(iterationStats);
 	}
 
 	mesh->numTriangles = 0;
@@ -582,7 +663,9 @@ void ngMeshSimplifier(
 		mesh->numTriangles++;
 	}
 
-	CompactVertices(vertices, mesh);
+	phaseStart = Clock::now();
+	CompactVertices(vertices, mesh, vertexRemap);
+	simplifyStats.compactTime = ElapsedMilliseconds(phaseStart);
 
 	mesh->numVertices = vertices.size();
 	for (int i = 0; i < vertices.size(); i++)
@@ -593,5 +676,8 @@ void ngMeshSimplifier(
 		vec4_set(mesh->vertices[i].normal, vertices[i].normal);
 		vec4_set(mesh->vertices[i].colour, vertices[i].colour);
 	}
+
+	simplifyStats.totalTime = ElapsedMilliseconds(start);
+	simplifyStats.peakScratchBytes = peakScratchBytes;
 }
 
@@ -6,6 +6,7 @@
 //
 
 #include <stdlib.h>
+#include <vector>
 #include <glm/glm.hpp>
 
 // ----------------------------------------------------------------------------
@@ -81,11 +82,53 @@ public:
 
 // ----------------------------------------------------------------------------
 
-// The MeshBuffer instance will be edited in place
+struct MeshSimplificationIterationStats
+{
+	// the random edges considered, the ones which passed the error & shape tests, and 
+	// those which were actually collapsed (each vertex only collapses once per iteration)
+	int candidates = 0;
+	int validCollapses = 0;
+	int collapses = 0;
+
+	int removedTriangles = 0;
+
+	float successRate() const 
+	{ 
+		return validCollapses > 0 ? (float)collapses / (float)validCollapses : 0.f; 
+	}
+};
+
+// The time spent in each phase in milliseconds, summed over the iterations
+struct MeshSimplificationStats
+{
+	double buildEdgesTime = 0.0;
+	double findCollapsesTime = 0.0;
+	double collapseTime = 0.0;
+	double removeTime = 0.0;
+	double compactTime = 0.0;
+	double totalTime = 0.0;
+
+	int qefSolves = 0;
+
+	// the most memory held by the simplifier's buffers at once
+	size_t peakScratchBytes = 0;
+
+	std::vector<MeshSimplificationIterationStats> iterations;
+};
+
+// ----------------------------------------------------------------------------
+
+// The MeshBuffer instance will be edited in place. If vertexRemap is not null it must 
+// have space for mesh->numVertices entries and receives the new index of each of the 
+// input vertices, or -1 if the vertex was removed. If stats is not null it's reset and
+// filled in. The edges are picked with a fixed seed so the same input always gives the
+// same output.
 void ngMeshSimplifier(
 	MeshBuffer* mesh,
 	const vec4& worldSpaceOffset,
-	const MeshSimplificationOptions& options);
+	const MeshSimplificationOptions& options,
+	int* vertexRemap = nullptr,
+	MeshSimplificationStats* stats = nullptr);
 
 // ----------------------------------------------------------------------------
 
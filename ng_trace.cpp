@@ -0,0 +1,231 @@
+//
+// Public domain
+//
+
+#include	"ng_trace.h"
+
+#include	<stdio.h>
+#include	<string.h>
+#include	<chrono>
+#include	<mutex>
+#include	<memory>
+#include	<vector>
+
+// ----------------------------------------------------------------------------
+
+std::atomic<bool> g_ngTraceEnabled { false };
+
+namespace {
+
+struct TraceEvent
+{
+	const char* name;
+	int64_t start;
+	int64_t end;
+};
+
+// Single writer: only the owning thread stores events, head is published with a release
+// store so the exporter sees complete events for every index below it
+struct TraceRing
+{
+	int threadId = 0;
+	char threadName[64] = {};
+	std::atomic<uint64_t> head { 0 };
+	TraceEvent events[NG_TRACE_RING_CAPACITY];
+};
+
+// The rings are only added to here, never removed, so the events of a thread which has
+// exited can still be exported. The mutex is taken once per thread on its first event.
+struct TraceRegistry
+{
+	std::mutex mutex;
+	std::vector<std::unique_ptr<TraceRing>> rings;
+};
+
+TraceRegistry& Registry()
+{
+	static TraceRegistry registry;
+	return registry;
+}
+
+thread_local TraceRing* t_ring = nullptr;
+
+// Kept separately so naming a thread doesn't allocate a ring for it
+thread_local char t_threadName[64] = {};
+
+}
+
+// ----------------------------------------------------------------------------
+
+static TraceRing* ThreadRing()
+{
+	if (!t_ring)
+	{
+		TraceRegistry& registry = Registry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+
+		registry.rings.emplace_back(new TraceRing);
+		t_ring = registry.rings.back().get();
+		t_ring->threadId = (int)registry.rings.size();
+		memcpy(t_ring->threadName, t_threadName, sizeof(t_threadName));
+	}
+
+	return t_ring;
+}
+
+// ----------------------------------------------------------------------------
+
+void ngTraceEnable(const bool enable)
+{
+	g_ngTraceEnabled.store(enable, std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+
+bool ngTraceIsEnabled()
+{
+	return g_ngTraceEnabled.load(std::memory_order_relaxed);
+}
+
+// ----------------------------------------------------------------------------
+
+void ngTraceSetThreadName(const char* name)
+{
+	strncpy(t_threadName, name ? name : "", sizeof(t_threadName) - 1);
+	if (t_ring)
+	{
+		memcpy(t_ring->threadName, t_threadName, sizeof(t_threadName));
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+int64_t ngTraceNow()
+{
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// ----------------------------------------------------------------------------
+
+void ngTraceRecord(const char* name, const int64_t startNs, const int64_t endNs)
+{
+	TraceRing* ring = ThreadRing();
+	const uint64_t head = ring->head.load(std::memory_order_relaxed);
+
+	TraceEvent& event = ring->events[head & (NG_TRACE_RING_CAPACITY - 1)];
+	event.name = name;
+	event.start = startNs;
+	event.end = endNs;
+
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+// ----------------------------------------------------------------------------
+
+static void WriteJsonString(FILE* f, const char* str)
+{
+	fputc('"', f);
+	for (const char* c = str; *c; c++)
+	{
+		if (*c == '"' || *c == '\\')
+		{
+			fputc('\\', f);
+			fputc(*c, f);
+		}
+		else if ((unsigned char)*c >= 0x20)
+		{
+			fputc(*c, f);
+		}
+	}
+	fputc('"', f);
+}
+
+// ----------------------------------------------------------------------------
+
+bool ngTraceWriteChromeJson(const char* path)
+{
+	FILE* f = path ? fopen(path, "wb") : nullptr;
+	if (!f)
+	{
+		return false;
+	}
+
+	TraceRegistry& registry = Registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+
+	// only the events still held by each ring are written
+	struct RingRange
+	{
+		const TraceRing* ring;
+		uint64_t begin, end;
+	};
+
+	std::vector<RingRange> ranges;
+	int64_t origin = INT64_MAX;
+	for (const auto& ring: registry.rings)
+	{
+		const uint64_t head = ring->head.load(std::memory_order_acquire);
+		const uint64_t count = head < NG_TRACE_RING_CAPACITY ? head : NG_TRACE_RING_CAPACITY;
+		ranges.push_back({ ring.get(), head - count, head });
+
+		for (uint64_t i = head - count; i < head; i++)
+		{
+			const TraceEvent& event = ring->events[i & (NG_TRACE_RING_CAPACITY - 1)];
+			origin = event.start < origin ? event.start : origin;
+		}
+	}
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	bool first = true;
+	for (const RingRange& range: ranges)
+	{
+		const TraceRing* ring = range.ring;
+
+		fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+			first ? "" : ",\n", ring->threadId);
+		if (ring->threadName[0])
+		{
+			WriteJsonString(f, ring->threadName);
+		}
+		else
+		{
+			fprintf(f, "\"Thread %d\"", ring->threadId);
+		}
+		fprintf(f, "}}");
+		first = false;
+
+		// ts & dur are in microseconds
+		for (uint64_t i = range.begin; i < range.end; i++)
+		{
+			const TraceEvent& event = ring->events[i & (NG_TRACE_RING_CAPACITY - 1)];
+			fprintf(f, ",\n{\"name\":");
+			WriteJsonString(f, event.name);
+			fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				ring->threadId, (event.start - origin) / 1000.0, (event.end - event.start) / 1000.0);
+		}
+	}
+
+	fprintf(f, "\n]}\n");
+
+	const bool ok = ferror(f) == 0;
+	fclose(f);
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+
+void ngTraceClear()
+{
+	TraceRegistry& registry = Registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+
+	for (auto& ring: registry.rings)
+	{
+		ring->head.store(0, std::memory_order_relaxed);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
@@ -0,0 +1,92 @@
+#ifndef		HAS_NG_TRACE_H_BEEN_INCLUDED
+#define		HAS_NG_TRACE_H_BEEN_INCLUDED
+
+//
+// Scoped trace markers exported as Chrome trace events
+// Public domain
+//
+// Each thread writes its events into its own fixed size ring buffer, so recording a
+// marker is a couple of clock reads and a store with no lock or shared cache line. When
+// the ring is full the oldest events are overwritten. The rings can be written out as
+// JSON which chrome://tracing or https://ui.perfetto.dev will load as a per-thread
+// timeline, showing where the workers are idle or waiting on each other.
+//
+// Tracing is off until ngTraceEnable(true) is called, a disabled marker is a single
+// relaxed load. Defining NG_TRACE_DISABLED compiles the markers out entirely.
+//
+// Usage:
+//
+//	ngTraceEnable(true);
+//	{
+//		NG_TRACE_SCOPE("GenerateMesh");
+//		...
+//	}
+//	ngTraceEnable(false);
+//	ngTraceWriteChromeJson("trace.json");
+//
+
+#include	<stdint.h>
+#include	<atomic>
+
+// ----------------------------------------------------------------------------
+
+// Events per thread, must be a power of two
+const int NG_TRACE_RING_CAPACITY = 1 << 16;
+
+extern std::atomic<bool> g_ngTraceEnabled;
+
+void ngTraceEnable(const bool enable);
+bool ngTraceIsEnabled();
+
+// Names the calling thread in the exported timeline, the name is copied
+void ngTraceSetThreadName(const char* name);
+
+// The name must outlive the trace (normally a string literal), only the pointer is stored
+void ngTraceRecord(const char* name, const int64_t startNs, const int64_t endNs);
+int64_t ngTraceNow();
+
+// Neither function is safe to call while other threads are still recording events
+bool ngTraceWriteChromeJson(const char* path);
+void ngTraceClear();
+
+// ----------------------------------------------------------------------------
+
+class ngTraceScope
+{
+public:
+
+	explicit ngTraceScope(const char* name)
+		: name_(g_ngTraceEnabled.load(std::memory_order_relaxed) ? name : nullptr)
+		, start_(name_ ? ngTraceNow() : 0)
+	{
+	}
+
+	~ngTraceScope()
+	{
+		if (name_)
+		{
+			ngTraceRecord(name_, start_, ngTraceNow());
+		}
+	}
+
+	ngTraceScope(const ngTraceScope&) = delete;
+	ngTraceScope& operator=(const ngTraceScope&) = delete;
+
+private:
+
+	const char* name_;
+	int64_t start_;
+};
+
+#define NG_TRACE_CONCAT_(a, b)		a##b
+#define NG_TRACE_CONCAT(a, b)		NG_TRACE_CONCAT_(a, b)
+
+#ifdef NG_TRACE_DISABLED
+#define NG_TRACE_SCOPE(name)
+#else
+#define NG_TRACE_SCOPE(name)		ngTraceScope NG_TRACE_CONCAT(ngTraceScope_, __LINE__)(name)
+#endif
+
+// ----------------------------------------------------------------------------
+
+#endif	//	HAS_NG_TRACE_H_BEEN_INCLUDED
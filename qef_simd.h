@@ -75,6 +75,15 @@ float qef_solve_from_points_3d(
 	const int count,
 	float* solved_position);
 
+// Solves a QEF which was accumulated by the caller (e.g. summed over several voxels when
+// simplifying an octree). ATA is the upper triangle of the symmetric matrix in the order
+// xx, xy, xz, yy, yz, zz and ATb should be relative to the mass point, the solved 3d
+// position is relative to the mass point too. No alignment requirements.
+void qef_solve_from_ata_atb(
+	const float* ATA,
+	const float* ATb,
+	float* solved_position);
+
 
 #ifdef QEF_INCLUDE_IMPL
 
@@ -89,6 +98,16 @@ const float PSUEDO_INVERSE_THRESHOLD = 0.001f;
 
 // ----------------------------------------------------------------------------
 
+// m128_f32 is MSVC only
+static inline float vec4_lane(const __m128& x, const int i)
+{
+	union { __m128 v; float f[4]; } lanes;
+	lanes.v = x;
+	return lanes.f[i];
+}
+
+// ----------------------------------------------------------------------------
+
 static inline __m128 vec4_abs(const __m128& x)
 {
 	static const __m128 mask = _mm_set1_ps(-0.f);
@@ -123,6 +142,8 @@ static inline __m128 vec4_mul_m4x4(const __m128& a, const Mat4x4& B)
 
 // ----------------------------------------------------------------------------
 
+#ifdef __AVX__
+
 static inline __m256 avx_vec4_mul_m4x4(const __m256& a, const Mat4x4& B)
 {
 	__m256 result;
@@ -134,6 +155,8 @@ static inline __m256 avx_vec4_mul_m4x4(const __m256& a, const Mat4x4& B)
 	return result;
 }
 
+#endif
+
 // ----------------------------------------------------------------------------
 
 static void m4x4_mul_m4x4(Mat4x4& out, const Mat4x4& A, const Mat4x4& B)
@@ -151,21 +174,21 @@ static void givens_coeffs_sym(__m128& c_result, __m128& s_result, const Mat4x4&
 {
 	__m128 simd_pp = _mm_set_ps(
 		0.f,
-		vtav.row[a].m128_f32[a],
-		vtav.row[a].m128_f32[a],
-		vtav.row[a].m128_f32[a]);
+		vtav.m[a][a],
+		vtav.m[a][a],
+		vtav.m[a][a]);
 
 	__m128 simd_pq = _mm_set_ps(
 		0.f,
-		vtav.row[a].m128_f32[b],
-		vtav.row[a].m128_f32[b],
-		vtav.row[a].m128_f32[b]);
+		vtav.m[a][b],
+		vtav.m[a][b],
+		vtav.m[a][b]);
 
 	__m128 simd_qq = _mm_set_ps(
 		0.f,
-		vtav.row[b].m128_f32[b],
-		vtav.row[b].m128_f32[b],
-		vtav.row[b].m128_f32[b]);
+		vtav.m[b][b],
+		vtav.m[b][b],
+		vtav.m[b][b]);
 
 	static const __m128 zeros = _mm_set1_ps(0.f);
 	static const __m128 ones  = _mm_set1_ps(1.f);
@@ -216,21 +239,21 @@ static void rotateq_xy(Mat4x4& vtav, const __m128& c, const __m128& s, const int
 {
 	__m128 u = _mm_set_ps(
 		0.f,
-		vtav.row[a].m128_f32[a],
-		vtav.row[a].m128_f32[a],
-		vtav.row[a].m128_f32[a]);
+		vtav.m[a][a],
+		vtav.m[a][a],
+		vtav.m[a][a]);
 
 	__m128 v = _mm_set_ps(
 		0.f,
-		vtav.row[b].m128_f32[b],
-		vtav.row[b].m128_f32[b],
-		vtav.row[b].m128_f32[b]);
+		vtav.m[b][b],
+		vtav.m[b][b],
+		vtav.m[b][b]);
 
 	__m128 A = _mm_set_ps(
 		0.f,
-		vtav.row[a].m128_f32[b],
-		vtav.row[a].m128_f32[b],
-		vtav.row[a].m128_f32[b]);
+		vtav.m[a][b],
+		vtav.m[a][b],
+		vtav.m[a][b]);
 
 	static const __m128 twos = _mm_set1_ps(2.f);
 
@@ -255,8 +278,8 @@ static void rotateq_xy(Mat4x4& vtav, const __m128& c, const __m128& s, const int
 	__m128 y  = _mm_add_ps(y1, y2);
 
 
-	vtav.row[a].m128_f32[a] = x.m128_f32[0];
-	vtav.row[b].m128_f32[b] = y.m128_f32[0];
+	vtav.m[a][a] = _mm_cvtss_f32(x);
+	vtav.m[b][b] = _mm_cvtss_f32(y);
 }
 
 // ----------------------------------------------------------------------------
@@ -264,16 +287,16 @@ static void rotateq_xy(Mat4x4& vtav, const __m128& c, const __m128& s, const int
 static void rotate_xy(Mat4x4& vtav, Mat4x4& v, float c, float s, const int& a, const int& b) 
 {
 	 __m128 simd_u = _mm_set_ps(
-		vtav.row[0].m128_f32[3-b],
-		v.row[2].m128_f32[a],
-		v.row[1].m128_f32[a],
-		v.row[0].m128_f32[a]);
+		vtav.m[0][3-b],
+		v.m[2][a],
+		v.m[1][a],
+		v.m[0][a]);
 
 	__m128 simd_v = _mm_set_ps(
-		vtav.row[1-a].m128_f32[2],
-		v.row[2].m128_f32[b],
-		v.row[1].m128_f32[b],
-		v.row[0].m128_f32[b]);
+		vtav.m[1-a][2],
+		v.m[2][b],
+		v.m[1][b],
+		v.m[0][b]);
 
 	__m128 simd_c = _mm_load1_ps(&c);
 	__m128 simd_s = _mm_load1_ps(&s);
@@ -286,17 +309,17 @@ static void rotate_xy(Mat4x4& vtav, Mat4x4& v, float c, float s, const int& a, c
 	__m128 y1 = _mm_mul_ps(simd_c, simd_v);
 	__m128 y = _mm_add_ps(y0, y1);
 
-	v.row[0].m128_f32[a] = x.m128_f32[0];
-	v.row[1].m128_f32[a] = x.m128_f32[1];
-	v.row[2].m128_f32[a] = x.m128_f32[2];
-	vtav.row[0].m128_f32[3-b] = x.m128_f32[3];
+	v.m[0][a] = vec4_lane(x, 0);
+	v.m[1][a] = vec4_lane(x, 1);
+	v.m[2][a] = vec4_lane(x, 2);
+	vtav.m[0][3-b] = vec4_lane(x, 3);
 
-	v.row[0].m128_f32[b] = y.m128_f32[0];
-	v.row[1].m128_f32[b] = y.m128_f32[1];
-	v.row[2].m128_f32[b] = y.m128_f32[2];
-	vtav.row[1-a].m128_f32[2] = y.m128_f32[3];
+	v.m[0][b] = vec4_lane(y, 0);
+	v.m[1][b] = vec4_lane(y, 1);
+	v.m[2][b] = vec4_lane(y, 2);
+	vtav.m[1-a][2] = vec4_lane(y, 3);
 
-	vtav.row[a].m128_f32[b] = 0.f;
+	vtav.m[a][b] = 0.f;
 }
 
 // ----------------------------------------------------------------------------
@@ -309,36 +332,36 @@ static __m128 svd_solve_sym(Mat4x4& v, const Mat4x4& a)
 	{
 		__m128 c, s;
 
-		if (vtav.row[0].m128_f32[1] != 0.f)
+		if (vtav.m[0][1] != 0.f)
 		{
 			givens_coeffs_sym(c, s, vtav, 0, 1);
 			rotateq_xy(vtav, c, s, 0, 1);
-			rotate_xy(vtav, v, c.m128_f32[1], s.m128_f32[1], 0, 1);
-			vtav.row[0].m128_f32[1] = 0.f;
+			rotate_xy(vtav, v, vec4_lane(c, 1), vec4_lane(s, 1), 0, 1);
+			vtav.m[0][1] = 0.f;
 		}
 
-		if (vtav.row[0].m128_f32[2] != 0.f)
+		if (vtav.m[0][2] != 0.f)
 		{
 			givens_coeffs_sym(c, s, vtav, 0, 2);
 			rotateq_xy(vtav, c, s, 0, 2);
-			rotate_xy(vtav, v, c.m128_f32[1], s.m128_f32[1], 0, 2);
-			vtav.row[0].m128_f32[2] = 0.f;
+			rotate_xy(vtav, v, vec4_lane(c, 1), vec4_lane(s, 1), 0, 2);
+			vtav.m[0][2] = 0.f;
 		}
 
-		if (vtav.row[1].m128_f32[2] != 0.f)
+		if (vtav.m[1][2] != 0.f)
 		{
 			givens_coeffs_sym(c, s, vtav, 1, 2);
 			rotateq_xy(vtav, c, s, 1, 2);
-			rotate_xy(vtav, v, c.m128_f32[2], s.m128_f32[2], 1, 2);
-			vtav.row[1].m128_f32[2] = 0.f;
+			rotate_xy(vtav, v, vec4_lane(c, 2), vec4_lane(s, 2), 1, 2);
+			vtav.m[1][2] = 0.f;
 		}
 	}
 
 	return _mm_set_ps(
 		0.f,
-		vtav.row[2].m128_f32[2],
-		vtav.row[1].m128_f32[1],
-		vtav.row[0].m128_f32[0]);
+		vtav.m[2][2],
+		vtav.m[1][1],
+		vtav.m[0][0]);
 }
 
 // ----------------------------------------------------------------------------
@@ -368,20 +391,20 @@ static void svd_pseudoinverse(Mat4x4& o, const __m128& sigma, const Mat4x4& v)
 	m.row[2] = _mm_mul_ps(v.row[2], invdet);
 	m.row[3] = _mm_set1_ps(0.f);
 
-	o.row[0].m128_f32[0] = vec4_dot(m.row[0], v.row[0]);
-	o.row[0].m128_f32[1] = vec4_dot(m.row[1], v.row[0]);
-	o.row[0].m128_f32[2] = vec4_dot(m.row[2], v.row[0]);
-	o.row[0].m128_f32[3] = 0.f;
+	o.m[0][0] = vec4_dot(m.row[0], v.row[0]);
+	o.m[0][1] = vec4_dot(m.row[1], v.row[0]);
+	o.m[0][2] = vec4_dot(m.row[2], v.row[0]);
+	o.m[0][3] = 0.f;
 
-	o.row[1].m128_f32[0] = vec4_dot(m.row[0], v.row[1]);
-	o.row[1].m128_f32[1] = vec4_dot(m.row[1], v.row[1]);
-	o.row[1].m128_f32[2] = vec4_dot(m.row[2], v.row[1]);
-	o.row[1].m128_f32[3] = 0.f;
+	o.m[1][0] = vec4_dot(m.row[0], v.row[1]);
+	o.m[1][1] = vec4_dot(m.row[1], v.row[1]);
+	o.m[1][2] = vec4_dot(m.row[2], v.row[1]);
+	o.m[1][3] = 0.f;
 
-	o.row[2].m128_f32[0] = vec4_dot(m.row[0], v.row[2]);
-	o.row[2].m128_f32[1] = vec4_dot(m.row[1], v.row[2]);
-	o.row[2].m128_f32[2] = vec4_dot(m.row[2], v.row[2]);
-	o.row[2].m128_f32[3] = 0.f;
+	o.m[2][0] = vec4_dot(m.row[0], v.row[2]);
+	o.m[2][1] = vec4_dot(m.row[1], v.row[2]);
+	o.m[2][2] = vec4_dot(m.row[2], v.row[2]);
+	o.m[2][3] = 0.f;
 
 	o.row[3] = m.row[3];
 }
@@ -447,7 +470,7 @@ float qef_simd_solve(
 	const __m128& pointaccum,
 	__m128& x)
 {
-	const __m128 masspoint = _mm_div_ps(pointaccum, _mm_set1_ps(pointaccum.m128_f32[3]));
+	const __m128 masspoint = _mm_div_ps(pointaccum, _mm_set1_ps(vec4_lane(pointaccum, 3)));
 
 	__m128 p = vec4_mul_m4x4(masspoint, ATA);
 	p = _mm_sub_ps(ATb, p);
@@ -482,7 +505,7 @@ float qef_solve_from_points(
 		qef_simd_add(positions[i], normals[i], ATA, ATb, pointaccum);
 	}
 
-	__declspec(align(16)) float x[4];
+	alignas(16) float x[4];
 	_mm_store_ps(x, ATb);
 	_mm_set_ps(0.f, x[2], x[1], x[0]);
 	
@@ -572,12 +595,35 @@ float qef_solve_from_points_3d(
 	__m128 solved;
 	const float error = qef_solve_from_points(p, n, count, &solved);
 
-	solved_position[0] = solved.m128_f32[0];
-	solved_position[1] = solved.m128_f32[1];
-	solved_position[2] = solved.m128_f32[2];
+	solved_position[0] = vec4_lane(solved, 0);
+	solved_position[1] = vec4_lane(solved, 1);
+	solved_position[2] = vec4_lane(solved, 2);
 	return error;
 }
 
+// ----------------------------------------------------------------------------
+
+void qef_solve_from_ata_atb(
+	const float* ATA,
+	const float* ATb,
+	float* solved_position)
+{
+	Mat4x4 A;
+	A.row[0] = _mm_set_ps(0.f, ATA[2], ATA[1], ATA[0]);
+	A.row[1] = _mm_set_ps(0.f, ATA[4], ATA[3], ATA[1]);
+	A.row[2] = _mm_set_ps(0.f, ATA[5], ATA[4], ATA[2]);
+	A.row[3] = _mm_set1_ps(0.f);
+
+	const __m128 b = _mm_set_ps(0.f, ATb[2], ATb[1], ATb[0]);
+
+	__m128 x;
+	svd_solve_ATA_ATb(A, b, x);
+
+	solved_position[0] = vec4_lane(x, 0);
+	solved_position[1] = vec4_lane(x, 1);
+	solved_position[2] = vec4_lane(x, 2);
+}
+
 
 
 #endif // QEF_INCLUDE_IMPL
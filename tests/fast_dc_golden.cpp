@@ -0,0 +1,578 @@
+//
+// Golden output tests for the contouring
+// Public domain
+//
+// Each shape from ConfigForShape is contoured and compared with the mesh stored in the
+// golden directory. Optimisations are free to change the order of the vertices &
+// triangles (and the last bits of the positions) so none of the checks depend on it:
+//
+//	- every vertex matches a golden vertex within VERTEX_TOLERANCE, one to one
+//	- with the vertices matched the sets of triangles are the same (with the same winding)
+//	- the Hausdorff distance between the surfaces is no more than HAUSDORFF_TOLERANCE
+//	- the mesh is watertight and manifold
+//
+// Usage:
+//
+//	fast_dc_golden <golden dir>				compare with the golden meshes
+//	fast_dc_golden <golden dir> -update		replace the golden meshes
+//
+// Only update the golden meshes for a change which is meant to change the output.
+//
+
+#include "fast_dc.h"
+#include "ng_mesh_simplify.h"
+
+#include <glm/glm.hpp>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+const char* SHAPE_NAMES[] = { "cube", "cylinder", "pill", "corridor", "torus" };
+const int NUM_SHAPES = sizeof(SHAPE_NAMES) / sizeof(SHAPE_NAMES[0]);
+
+// small enough to keep the golden files small, big enough that every shape has curved
+// and flat regions and sharp features
+const int GOLDEN_GRID_SIZE = 32;
+
+// In voxels. Builds with a different instruction set (e.g. FMA contraction in the QEF 
+// solves) move some vertices by up to ~0.01 voxels without moving the surface, the 
+// vertices are roughly a voxel apart so this still matches them unambiguously.
+const float VERTEX_TOLERANCE = 5e-2f;
+const float HAUSDORFF_TOLERANCE = 1e-2f;
+
+// the spatial grids used to find the nearest vertex & triangle only search the cells
+// next to a point's cell so anything further away than this isn't found
+const float SEARCH_CELL_SIZE = 1.f;
+
+struct GoldenMesh
+{
+	std::vector<glm::vec3> positions;
+	std::vector<std::array<int, 3>> triangles;
+};
+
+typedef std::unordered_map<uint64_t, std::vector<int>> CellMap;
+
+}
+
+// ----------------------------------------------------------------------------
+
+static GoldenMesh GenerateGoldenMesh(const int shape)
+{
+	// as the benchmark: the demo's scale relative to the grid, centred in chunk (0, 0, 0)
+	const float scale = GOLDEN_GRID_SIZE * 0.25f;
+	const float centre = GOLDEN_GRID_SIZE * 0.5f;
+
+	CsgScene scene;
+	CsgAddPrimitive(scene, ConfigForShape((SuperPrimitiveConfig::Type)shape),
+		glm::mat4(scale, 0.f, 0.f, 0.f, 0.f, scale, 0.f, 0.f, 0.f, 0.f, scale, 0.f, centre, centre, centre, 1.f));
+	DensityProgram* density = CompileDensityProgram(scene);
+
+	GoldenMesh golden;
+	ChunkMesh chunk = GenerateChunkMesh(*density, glm::ivec3(0), GOLDEN_GRID_SIZE);
+	if (chunk.mesh)
+	{
+		for (int i = 0; i < chunk.mesh->numVertices; i++)
+		{
+			const vec4& p = chunk.mesh->vertices[i].xyz;
+			golden.positions.push_back(glm::vec3(p.x, p.y, p.z));
+		}
+
+		for (int i = 0; i < chunk.mesh->numTriangles; i++)
+		{
+			const int* indices = chunk.mesh->triangles[i].indices_;
+			golden.triangles.push_back({ { indices[0], indices[1], indices[2] } });
+		}
+	}
+
+	FreeChunkMesh(chunk);
+	DestroyDensityProgram(density);
+	return golden;
+}
+
+// ----------------------------------------------------------------------------
+
+static std::string GoldenPath(const char* dir, const int shape)
+{
+	return std::string(dir) + "/" + SHAPE_NAMES[shape] + ".obj";
+}
+
+// ----------------------------------------------------------------------------
+
+// The positions are written with enough digits to read back the same floats
+static bool WriteGoldenMesh(const char* path, const char* shapeName, const GoldenMesh& mesh)
+{
+	FILE* f = fopen(path, "w");
+	if (!f)
+	{
+		return false;
+	}
+
+	fprintf(f, "# fast_dc golden mesh: %s, %d^3 voxels\n", shapeName, GOLDEN_GRID_SIZE);
+	for (const glm::vec3& p: mesh.positions)
+	{
+		fprintf(f, "v %.9g %.9g %.9g\n", p.x, p.y, p.z);
+	}
+
+	for (const auto& t: mesh.triangles)
+	{
+		fprintf(f, "f %d %d %d\n", t[0] + 1, t[1] + 1, t[2] + 1);
+	}
+
+	const bool ok = ferror(f) == 0;
+	fclose(f);
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool ReadGoldenMesh(const char* path, GoldenMesh& mesh)
+{
+	FILE* f = fopen(path, "r");
+	if (!f)
+	{
+		return false;
+	}
+
+	bool ok = true;
+	char line[256];
+	while (ok && fgets(line, sizeof(line), f))
+	{
+		glm::vec3 p;
+		std::array<int, 3> t;
+		if (line[0] == 'v' && line[1] == ' ')
+		{
+			ok = sscanf(line + 2, "%f %f %f", &p.x, &p.y, &p.z) == 3;
+			mesh.positions.push_back(p);
+		}
+		else if (line[0] == 'f' && line[1] == ' ')
+		{
+			ok = sscanf(line + 2, "%d %d %d", &t[0], &t[1], &t[2]) == 3;
+			for (int& index: t)
+			{
+				index--;
+			}
+
+			mesh.triangles.push_back(t);
+		}
+	}
+
+	fclose(f);
+
+	for (const auto& t: mesh.triangles)
+	for (const int index: t)
+	{
+		ok = ok && index >= 0 && index < (int)mesh.positions.size();
+	}
+
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+
+static inline glm::ivec3 SearchCell(const glm::vec3& p)
+{
+	return glm::ivec3(glm::floor(p / SEARCH_CELL_SIZE));
+}
+
+static inline uint64_t SearchCellKey(const glm::ivec3& cell)
+{
+	return
+		((uint64_t)(uint32_t)(cell.x & 0x1fffff) << 42) |
+		((uint64_t)(uint32_t)(cell.y & 0x1fffff) << 21) |
+		(uint64_t)(uint32_t)(cell.z & 0x1fffff);
+}
+
+// ----------------------------------------------------------------------------
+
+// Returns the index of the nearest position within maxDistance, or -1
+static int FindNearestPosition(
+	const GoldenMesh& mesh,
+	const CellMap& cells,
+	const glm::vec3& p,
+	const float maxDistance)
+{
+	const glm::ivec3 cell = SearchCell(p);
+
+	int nearest = -1;
+	float nearestDistance = maxDistance;
+	for (int x = -1; x <= 1; x++)
+	for (int y = -1; y <= 1; y++)
+	for (int z = -1; z <= 1; z++)
+	{
+		const auto iter = cells.find(SearchCellKey(cell + glm::ivec3(x, y, z)));
+		if (iter == cells.end())
+		{
+			continue;
+		}
+
+		for (const int idx: iter->second)
+		{
+			const float d = glm::length(mesh.positions[idx] - p);
+			if (d <= nearestDistance)
+			{
+				nearest = idx;
+				nearestDistance = d;
+			}
+		}
+	}
+
+	return nearest;
+}
+
+// ----------------------------------------------------------------------------
+
+// Maps each of the mesh's vertices to the golden vertex at the same position, returns
+// false if any vertex has no match or two vertices match the same golden vertex
+static bool MatchVertices(const GoldenMesh& mesh, const GoldenMesh& golden, std::vector<int>& goldenIndices)
+{
+	if (mesh.positions.size() != golden.positions.size())
+	{
+		return false;
+	}
+
+	CellMap cells;
+	for (int i = 0; i < (int)golden.positions.size(); i++)
+	{
+		cells[SearchCellKey(SearchCell(golden.positions[i]))].push_back(i);
+	}
+
+	std::vector<bool> used(golden.positions.size(), false);
+	goldenIndices.resize(mesh.positions.size());
+	for (int i = 0; i < (int)mesh.positions.size(); i++)
+	{
+		const int match = FindNearestPosition(golden, cells, mesh.positions[i], VERTEX_TOLERANCE);
+		if (match == -1 || used[match])
+		{
+			return false;
+		}
+
+		used[match] = true;
+		goldenIndices[i] = match;
+	}
+
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+// The triangles rotated to start at their lowest index (keeping the winding) and sorted
+static std::vector<std::array<int, 3>> CanonicalTriangles(
+	const std::vector<std::array<int, 3>>& triangles,
+	const std::vector<int>* remap)
+{
+	std::vector<std::array<int, 3>> canonical;
+	canonical.reserve(triangles.size());
+	for (auto t: triangles)
+	{
+		if (remap)
+		{
+			for (int& index: t)
+			{
+				index = (*remap)[index];
+			}
+		}
+
+		const int first = t[0] < t[1] ? (t[0] < t[2] ? 0 : 2) : (t[1] < t[2] ? 1 : 2);
+		canonical.push_back({ { t[first], t[(first + 1) % 3], t[(first + 2) % 3] } });
+	}
+
+	std::sort(begin(canonical), end(canonical));
+	return canonical;
+}
+
+// ----------------------------------------------------------------------------
+
+// See Ericson, Real-Time Collision Detection 5.1.5
+static glm::vec3 ClosestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+{
+	const glm::vec3 ab = b - a;
+	const glm::vec3 ac = c - a;
+	const glm::vec3 ap = p - a;
+	const float d1 = glm::dot(ab, ap);
+	const float d2 = glm::dot(ac, ap);
+	if (d1 <= 0.f && d2 <= 0.f)
+	{
+		return a;
+	}
+
+	const glm::vec3 bp = p - b;
+	const float d3 = glm::dot(ab, bp);
+	const float d4 = glm::dot(ac, bp);
+	if (d3 >= 0.f && d4 <= d3)
+	{
+		return b;
+	}
+
+	const float vc = (d1 * d4) - (d3 * d2);
+	if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+	{
+		return a + (ab * (d1 / (d1 - d3)));
+	}
+
+	const glm::vec3 cp = p - c;
+	const float d5 = glm::dot(ab, cp);
+	const float d6 = glm::dot(ac, cp);
+	if (d6 >= 0.f && d5 <= d6)
+	{
+		return c;
+	}
+
+	const float vb = (d5 * d2) - (d1 * d6);
+	if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+	{
+		return a + (ac * (d2 / (d2 - d6)));
+	}
+
+	const float va = (d3 * d6) - (d5 * d4);
+	if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f)
+	{
+		return b + ((c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6))));
+	}
+
+	const float denom = 1.f / (va + vb + vc);
+	return a + (ab * (vb * denom)) + (ac * (vc * denom));
+}
+
+// ----------------------------------------------------------------------------
+
+// The furthest any vertex or triangle centre of from is from the surface of to. Distances
+// beyond SEARCH_CELL_SIZE are reported as infinite.
+static float OneSidedHausdorff(const GoldenMesh& from, const GoldenMesh& to)
+{
+	// each triangle is added to every cell its bounds overlap
+	CellMap cells;
+	for (int i = 0; i < (int)to.triangles.size(); i++)
+	{
+		const auto& t = to.triangles[i];
+		const glm::vec3& a = to.positions[t[0]];
+		const glm::vec3& b = to.positions[t[1]];
+		const glm::vec3& c = to.positions[t[2]];
+
+		const glm::ivec3 cellMin = SearchCell(glm::min(a, glm::min(b, c)));
+		const glm::ivec3 cellMax = SearchCell(glm::max(a, glm::max(b, c)));
+		for (int x = cellMin.x; x <= cellMax.x; x++)
+		for (int y = cellMin.y; y <= cellMax.y; y++)
+		for (int z = cellMin.z; z <= cellMax.z; z++)
+		{
+			cells[SearchCellKey(glm::ivec3(x, y, z))].push_back(i);
+		}
+	}
+
+	std::vector<glm::vec3> samples = from.positions;
+	for (const auto& t: from.triangles)
+	{
+		samples.push_back((from.positions[t[0]] + from.positions[t[1]] + from.positions[t[2]]) / 3.f);
+	}
+
+	float maxDistance = 0.f;
+	for (const glm::vec3& p: samples)
+	{
+		const glm::ivec3 cell = SearchCell(p);
+
+		float distance = INFINITY;
+		for (int x = -1; x <= 1; x++)
+		for (int y = -1; y <= 1; y++)
+		for (int z = -1; z <= 1; z++)
+		{
+			const auto iter = cells.find(SearchCellKey(cell + glm::ivec3(x, y, z)));
+			if (iter == cells.end())
+			{
+				continue;
+			}
+
+			for (const int idx: iter->second)
+			{
+				const auto& t = to.triangles[idx];
+				const glm::vec3 closest = ClosestPointOnTriangle(p, to.positions[t[0]], to.positions[t[1]], to.positions[t[2]]);
+				distance = glm::min(distance, glm::length(closest - p));
+			}
+		}
+
+		maxDistance = distance > SEARCH_CELL_SIZE ? INFINITY : glm::max(maxDistance, distance);
+		if (isinf(maxDistance))
+		{
+			break;
+		}
+	}
+
+	return maxDistance;
+}
+
+// ----------------------------------------------------------------------------
+
+// Watertight: every directed edge is used once and its reverse once (which also means
+// the winding is consistent). Manifold: the triangles around each vertex form a single
+// fan, i.e. the surface doesn't touch itself at a vertex. Returns the number of problems.
+static int CountTopologyErrors(const GoldenMesh& mesh, int& numOpenEdges, int& numNonManifoldVertices)
+{
+	const auto edgeKey = [](const int a, const int b)
+	{
+		return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b;
+	};
+
+	std::unordered_map<uint64_t, int> edges;
+	for (const auto& t: mesh.triangles)
+	for (int j = 0; j < 3; j++)
+	{
+		edges[edgeKey(t[j], t[(j + 1) % 3])]++;
+	}
+
+	numOpenEdges = 0;
+	for (const auto& edge: edges)
+	{
+		const auto reverse = edges.find(edgeKey((int)(edge.first & 0xffffffff), (int)(edge.first >> 32)));
+		if (edge.second != 1 || reverse == edges.end() || reverse->second != 1)
+		{
+			numOpenEdges++;
+		}
+	}
+
+	// for each vertex the edge opposite it in each triangle, following them from one
+	// triangle to the next visits the whole fan when there's only one
+	std::vector<std::vector<std::pair<int, int>>> fans(mesh.positions.size());
+	for (const auto& t: mesh.triangles)
+	for (int j = 0; j < 3; j++)
+	{
+		fans[t[j]].push_back(std::make_pair(t[(j + 1) % 3], t[(j + 2) % 3]));
+	}
+
+	numNonManifoldVertices = 0;
+	for (const auto& fan: fans)
+	{
+		if (fan.empty())
+		{
+			continue;
+		}
+
+		std::unordered_map<int, int> next;
+		for (const auto& edge: fan)
+		{
+			next[edge.first] = edge.second;
+		}
+
+		int visited = 1;
+		int current = fan[0].second;
+		while (current != fan[0].first && visited <= (int)fan.size())
+		{
+			const auto iter = next.find(current);
+			if (iter == next.end())
+			{
+				break;
+			}
+
+			current = iter->second;
+			visited++;
+		}
+
+		if (current != fan[0].first || visited != (int)fan.size())
+		{
+			numNonManifoldVertices++;
+		}
+	}
+
+	return numOpenEdges + numNonManifoldVertices;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool CompareWithGolden(const int shape, const GoldenMesh& mesh, const GoldenMesh& golden)
+{
+	const char* name = SHAPE_NAMES[shape];
+	bool ok = true;
+
+	if (mesh.positions.size() != golden.positions.size() || mesh.triangles.size() != golden.triangles.size())
+	{
+		printf("%s: %d vertices & %d triangles, golden has %d & %d\n", name,
+			(int)mesh.positions.size(), (int)mesh.triangles.size(),
+			(int)golden.positions.size(), (int)golden.triangles.size());
+		ok = false;
+	}
+
+	std::vector<int> goldenIndices;
+	if (!MatchVertices(mesh, golden, goldenIndices))
+	{
+		printf("%s: the vertices don't match the golden vertices within %g\n", name, VERTEX_TOLERANCE);
+		ok = false;
+	}
+	else if (CanonicalTriangles(mesh.triangles, &goldenIndices) != CanonicalTriangles(golden.triangles, nullptr))
+	{
+		printf("%s: the triangles don't match the golden triangles\n", name);
+		ok = false;
+	}
+
+	const float hausdorff = glm::max(OneSidedHausdorff(mesh, golden), OneSidedHausdorff(golden, mesh));
+	if (hausdorff > HAUSDORFF_TOLERANCE)
+	{
+		printf("%s: Hausdorff distance %g is more than %g\n", name, hausdorff, HAUSDORFF_TOLERANCE);
+		ok = false;
+	}
+
+	int numOpenEdges = 0, numNonManifoldVertices = 0;
+	if (CountTopologyErrors(mesh, numOpenEdges, numNonManifoldVertices) > 0)
+	{
+		printf("%s: %d open edges, %d non-manifold vertices\n", name, numOpenEdges, numNonManifoldVertices);
+		ok = false;
+	}
+
+	printf("%s: %s (%d triangles, Hausdorff distance %g)\n", name, ok ? "ok" : "FAILED",
+		(int)mesh.triangles.size(), hausdorff);
+	return ok;
+}
+
+// ----------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("Usage: fast_dc_golden <golden dir> [-update]\n");
+		return EXIT_FAILURE;
+	}
+
+	const char* goldenDir = argv[1];
+	const bool update = argc > 2 && strcmp(argv[2], "-update") == 0;
+
+	int numFailures = 0;
+	for (int shape = 0; shape < NUM_SHAPES; shape++)
+	{
+		const GoldenMesh mesh = GenerateGoldenMesh(shape);
+		const std::string path = GoldenPath(goldenDir, shape);
+
+		if (update)
+		{
+			if (!WriteGoldenMesh(path.c_str(), SHAPE_NAMES[shape], mesh))
+			{
+				printf("Error: failed to write '%s'\n", path.c_str());
+				numFailures++;
+			}
+
+			continue;
+		}
+
+		GoldenMesh golden;
+		if (!ReadGoldenMesh(path.c_str(), golden))
+		{
+			printf("Error: failed to read '%s'\n", path.c_str());
+			numFailures++;
+			continue;
+		}
+
+		numFailures += CompareWithGolden(shape, mesh, golden) ? 0 : 1;
+	}
+
+	return numFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// ----------------------------------------------------------------------------
+
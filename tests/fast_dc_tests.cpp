@@ -0,0 +1,1615 @@
+//
+// Correctness tests for the contouring & simplification pipeline
+// Public domain
+//
+// Each test checks properties every mesh should have rather than exact output: the
+// indices are in range, the vertices are finite and the surface of a closed shape is
+// watertight with consistent winding. The exception is determinism, the output of a 
+// build must not change with the number of threads. Returns non-zero if any check fails.
+//
+
+#include "fast_dc.h"
+#include "ng_job_system.h"
+#include "ng_mesh_loader.h"
+#include "ng_mesh_simplify.h"
+#include "ng_trace.h"
+
+#include <glm/glm.hpp>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+const char* SHAPE_NAMES[] = { "cube", "cylinder", "pill", "corridor", "torus" };
+const int NUM_SHAPES = sizeof(SHAPE_NAMES) / sizeof(SHAPE_NAMES[0]);
+
+int g_numChecks = 0;
+int g_numFailures = 0;
+
+}
+
+#define CHECK(condition, ...)									\
+	do															\
+	{															\
+		g_numChecks++;											\
+		if (!(condition))										\
+		{														\
+			g_numFailures++;									\
+			printf("%s:%d: FAILED: %s: ", __FILE__, __LINE__, #condition);	\
+			printf(__VA_ARGS__);								\
+			printf("\n");										\
+		}														\
+	} while (0)
+
+// ----------------------------------------------------------------------------
+
+static bool IsMeshValid(const MeshBuffer* mesh)
+{
+	for (int i = 0; i < mesh->numVertices; i++)
+	{
+		const vec4& p = mesh->vertices[i].xyz;
+		if (!isfinite(p.x) || !isfinite(p.y) || !isfinite(p.z))
+		{
+			return false;
+		}
+	}
+
+	for (int i = 0; i < mesh->numTriangles; i++)
+	{
+		const int* indices = mesh->triangles[i].indices_;
+		for (int j = 0; j < 3; j++)
+		{
+			if (indices[j] < 0 || indices[j] >= mesh->numVertices)
+			{
+				return false;
+			}
+		}
+
+		if (indices[0] == indices[1] || indices[1] == indices[2] || indices[0] == indices[2])
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+// A closed, consistently wound surface uses every directed edge exactly once and its
+// reverse exactly once. Returns the number of directed edges which don't.
+static int CountBoundaryEdges(const MeshBuffer* mesh)
+{
+	std::unordered_map<uint64_t, int> edges;
+	const auto edgeKey = [](const int a, const int b)
+	{
+		return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b;
+	};
+
+	for (int i = 0; i < mesh->numTriangles; i++)
+	{
+		const int* indices = mesh->triangles[i].indices_;
+		for (int j = 0; j < 3; j++)
+		{
+			edges[edgeKey(indices[j], indices[(j + 1) % 3])]++;
+		}
+	}
+
+	int count = 0;
+	for (const auto& edge: edges)
+	{
+		const auto reverse = edges.find(edgeKey((int)(edge.first & 0xffffffff), (int)(edge.first >> 32)));
+		if (edge.second != 1 || reverse == edges.end() || reverse->second != 1)
+		{
+			count++;
+		}
+	}
+
+	return count;
+}
+
+// ----------------------------------------------------------------------------
+
+// Bit for bit comparison of the vertex & triangle buffers
+static bool MeshesAreIdentical(const MeshBuffer* a, const MeshBuffer* b)
+{
+	return 
+		a->numVertices == b->numVertices && a->numTriangles == b->numTriangles &&
+		memcmp(a->vertices, b->vertices, sizeof(MeshVertex) * a->numVertices) == 0 &&
+		memcmp(a->triangles, b->triangles, sizeof(MeshTriangle) * a->numTriangles) == 0;
+}
+
+// ----------------------------------------------------------------------------
+
+// A transform from a shape's space to voxels, a shape is 2 * scale voxels across
+static glm::mat4 ShapeTransform(const float scale, const glm::vec3& centre)
+{
+	return glm::mat4(scale, 0.f, 0.f, 0.f, 0.f, scale, 0.f, 0.f, 0.f, 0.f, scale, 0.f, centre.x, centre.y, centre.z, 1.f);
+}
+
+// ----------------------------------------------------------------------------
+
+// A scene using each kind of operation, inside the 96^3 voxels centred on the origin: a
+// cube & a torus smoothly joined, a cylinder drilled through the cube, a separate pill and
+// a rod along x too thin to be sampled by voxels twice the size
+static CsgScene CreateTestScene()
+{
+	SuperPrimitiveConfig rodConfig = ConfigForShape(SuperPrimitiveConfig::Cube);
+	rodConfig.s = glm::vec4(40.f, 0.7f, 0.7f, 1.f);
+
+	CsgScene scene;
+	const int cube = CsgAddPrimitive(scene, ConfigForShape(SuperPrimitiveConfig::Cube), ShapeTransform(12.f, glm::vec3(-10.f, 0.f, 0.f)));
+	const int torus = CsgAddPrimitive(scene, ConfigForShape(SuperPrimitiveConfig::Torus), ShapeTransform(10.f, glm::vec3(14.f, 3.f, 1.f)));
+	const int joined = CsgAddOperation(scene, CsgNode::SmoothUnion, cube, torus, 4.f);
+	const int cylinder = CsgAddPrimitive(scene, ConfigForShape(SuperPrimitiveConfig::Cylinder), ShapeTransform(5.f, glm::vec3(-10.f, 0.f, 0.f)));
+	const int drilled = CsgAddOperation(scene, CsgNode::Subtract, joined, cylinder);
+	const int pill = CsgAddPrimitive(scene, ConfigForShape(SuperPrimitiveConfig::Pill), ShapeTransform(7.f, glm::vec3(5.f, -28.f, 20.f)));
+	const int shapes = CsgAddOperation(scene, CsgNode::Union, drilled, pill);
+	const int rod = CsgAddPrimitive(scene, rodConfig, ShapeTransform(1.f, glm::vec3(0.f, 25.f, -25.f)));
+	CsgAddOperation(scene, CsgNode::Union, shapes, rod);
+
+	return scene;
+}
+
+// ----------------------------------------------------------------------------
+
+static DensityProgram* CompileTestScene()
+{
+	return CompileDensityProgram(CreateTestScene());
+}
+
+// ----------------------------------------------------------------------------
+
+// The chunks covering the 96^3 voxels of the test scene
+static std::vector<glm::ivec3> TestSceneChunks(const int chunkSize)
+{
+	std::vector<glm::ivec3> chunkCoords;
+	const int count = (48 + chunkSize - 1) / chunkSize;
+	for (int z = -count; z < count; z++)
+	for (int y = -count; y < count; y++)
+	for (int x = -count; x < count; x++)
+	{
+		chunkCoords.push_back(glm::ivec3(x, y, z));
+	}
+
+	return chunkCoords;
+}
+
+// ----------------------------------------------------------------------------
+
+static MeshBuffer* GenerateWeldedChunks(
+	ngJobSystem* jobSystem,
+	const DensityProgram& density,
+	const std::vector<glm::ivec3>& chunkCoords,
+	const int chunkSize)
+{
+	std::vector<ChunkMesh> chunks(chunkCoords.size());
+	GenerateChunkMeshes(jobSystem, density, chunkCoords.data(), (int)chunkCoords.size(), chunkSize, nullptr, chunks.data());
+
+	MeshBuffer* welded = WeldChunkMeshes(chunks.data(), (int)chunks.size());
+	for (ChunkMesh& chunk: chunks)
+	{
+		FreeChunkMesh(chunk);
+	}
+
+	return welded;
+}
+
+// ----------------------------------------------------------------------------
+
+// The triangles by the positions of their vertices, each starting from its smallest 
+// vertex (keeping the winding) and sorted, so meshes which only differ in the order of
+// their vertices & triangles compare equal
+static std::vector<std::array<float, 9>> SortedTriangles(const MeshBuffer* mesh)
+{
+	const auto less = [](const vec4& a, const vec4& b)
+	{
+		return a.x != b.x ? a.x < b.x : a.y != b.y ? a.y < b.y : a.z < b.z;
+	};
+
+	std::vector<std::array<float, 9>> triangles(mesh->numTriangles);
+	for (int i = 0; i < mesh->numTriangles; i++)
+	{
+		const int* indices = mesh->triangles[i].indices_;
+		int first = 0;
+		for (int j = 1; j < 3; j++)
+		{
+			first = less(mesh->vertices[indices[j]].xyz, mesh->vertices[indices[first]].xyz) ? j : first;
+		}
+
+		for (int j = 0; j < 3; j++)
+		{
+			const vec4& p = mesh->vertices[indices[(first + j) % 3]].xyz;
+			triangles[i][(j * 3) + 0] = p.x;
+			triangles[i][(j * 3) + 1] = p.y;
+			triangles[i][(j * 3) + 2] = p.z;
+		}
+	}
+
+	std::sort(begin(triangles), end(triangles));
+	return triangles;
+}
+
+// ----------------------------------------------------------------------------
+
+// The triangles by the voxels of their vertices, sorted as SortedTriangles
+static std::vector<std::array<int, 9>> SortedVoxelTriangles(const ChunkMesh& chunk)
+{
+	std::vector<std::array<int, 9>> triangles;
+	for (int i = 0; chunk.mesh && i < chunk.mesh->numTriangles; i++)
+	{
+		std::array<int, 9> voxels;
+		const int* indices = chunk.mesh->triangles[i].indices_;
+		for (int j = 0; j < 3; j++)
+		{
+			const glm::ivec4& voxel = chunk.vertexVoxels[indices[j]];
+			voxels[(j * 3) + 0] = voxel.x;
+			voxels[(j * 3) + 1] = voxel.y;
+			voxels[(j * 3) + 2] = voxel.z;
+		}
+
+		int first = 0;
+		for (int j = 1; j < 3; j++)
+		{
+			first = std::lexicographical_compare(&voxels[j * 3], &voxels[(j * 3) + 3], &voxels[first * 3], &voxels[(first * 3) + 3]) ? j : first;
+		}
+
+		std::rotate(begin(voxels), begin(voxels) + (first * 3), end(voxels));
+		triangles.push_back(voxels);
+	}
+
+	std::sort(begin(triangles), end(triangles));
+	return triangles;
+}
+
+// ----------------------------------------------------------------------------
+
+static std::vector<uint8_t> ReadBinaryFile(const char* path)
+{
+	std::vector<uint8_t> bytes;
+	FILE* f = fopen(path, "rb");
+	if (f)
+	{
+		uint8_t buffer[4096];
+		size_t count = 0;
+		while ((count = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		{
+			bytes.insert(end(bytes), buffer, buffer + count);
+		}
+
+		fclose(f);
+	}
+
+	return bytes;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool WriteBinaryFile(const char* path, const void* data, const size_t size)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f)
+	{
+		return false;
+	}
+
+	const bool ok = size == 0 || fwrite(data, size, 1, f) == 1;
+	return (fclose(f) == 0) && ok;
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestShapesAreWatertight()
+{
+	for (int shape = 0; shape < NUM_SHAPES; shape++)
+	{
+		DensityProgram* density = CompileSuperPrimitive(ConfigForShape((SuperPrimitiveConfig::Type)shape));
+		MeshBuffer* mesh = GenerateMesh(*density);
+
+		CHECK(mesh && mesh->numTriangles > 0, "%s", SHAPE_NAMES[shape]);
+		if (mesh)
+		{
+			CHECK(IsMeshValid(mesh), "%s", SHAPE_NAMES[shape]);
+
+			const int boundary = CountBoundaryEdges(mesh);
+			CHECK(boundary == 0, "%s has %d boundary edges", SHAPE_NAMES[shape], boundary);
+		}
+
+		// the config overload compiles the same program
+		MeshBuffer* fromConfig = GenerateMesh(ConfigForShape((SuperPrimitiveConfig::Type)shape));
+		CHECK(mesh && fromConfig && MeshesAreIdentical(mesh, fromConfig), "%s", SHAPE_NAMES[shape]);
+
+		FreeMeshBuffer(fromConfig);
+		FreeMeshBuffer(mesh);
+		DestroyDensityProgram(density);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+// The output is emitted in Morton order rather than the order the jobs finish in (or 
+// the order of any hash table) so every thread count must produce exactly the same mesh
+static void TestOutputIsDeterministic()
+{
+	const int threadCounts[] = { 1, 2, 3, 8 };
+	const int numThreadCounts = sizeof(threadCounts) / sizeof(threadCounts[0]);
+
+	ngJobSystem* jobSystems[numThreadCounts];
+	for (int i = 0; i < numThreadCounts; i++)
+	{
+		jobSystems[i] = ngJobSystemCreate(threadCounts[i]);
+	}
+
+	std::vector<glm::ivec3> chunkCoords;
+	for (int x = -2; x < 2; x++)
+	for (int y = -2; y < 2; y++)
+	for (int z = -2; z < 2; z++)
+	{
+		chunkCoords.push_back(glm::ivec3(x, y, z));
+	}
+
+	for (int shape = 0; shape < NUM_SHAPES; shape++)
+	{
+		DensityProgram* density = CompileSuperPrimitive(ConfigForShape((SuperPrimitiveConfig::Type)shape));
+		MeshBuffer* serial = GenerateMesh(*density);
+
+		std::vector<ChunkMesh> serialChunks(chunkCoords.size());
+		GenerateChunkMeshes(nullptr, *density, chunkCoords.data(), (int)chunkCoords.size(), 32, nullptr, serialChunks.data());
+		MeshBuffer* serialWelded = WeldChunkMeshes(serialChunks.data(), (int)serialChunks.size());
+
+		MeshSimplificationOptions options;
+		options.maxEdgeSize = 2.5f;
+		MeshBuffer* serialSimplified = GenerateMesh(*density);
+		ngMeshSimplifier(serialSimplified, vec4(0.f), options);
+
+		for (int i = 0; i < numThreadCounts; i++)
+		{
+			MeshBuffer* parallel = GenerateMesh(*density, jobSystems[i]);
+			CHECK(MeshesAreIdentical(serial, parallel), "%s: mesh differs with %d threads", 
+				SHAPE_NAMES[shape], threadCounts[i]);
+			FreeMeshBuffer(parallel);
+
+			std::vector<ChunkMesh> chunks(chunkCoords.size());
+			GenerateChunkMeshes(jobSystems[i], *density, chunkCoords.data(), (int)chunkCoords.size(), 32, nullptr, chunks.data());
+			MeshBuffer* welded = WeldChunkMeshes(chunks.data(), (int)chunks.size());
+			CHECK(MeshesAreIdentical(serialWelded, welded), "%s: welded chunks differ with %d threads", 
+				SHAPE_NAMES[shape], threadCounts[i]);
+			FreeMeshBuffer(welded);
+			for (ChunkMesh& chunk: chunks)
+			{
+				FreeChunkMesh(chunk);
+			}
+		}
+
+		// the simplifier's random edge selection is seeded so it's repeatable too
+		MeshBuffer* simplified = GenerateMesh(*density, jobSystems[numThreadCounts - 1]);
+		ngMeshSimplifier(simplified, vec4(0.f), options);
+		CHECK(MeshesAreIdentical(serialSimplified, simplified), "%s: simplified mesh differs", SHAPE_NAMES[shape]);
+		FreeMeshBuffer(simplified);
+
+		FreeMeshBuffer(serialSimplified);
+		FreeMeshBuffer(serialWelded);
+		for (ChunkMesh& chunk: serialChunks)
+		{
+			FreeChunkMesh(chunk);
+		}
+		FreeMeshBuffer(serial);
+		DestroyDensityProgram(density);
+	}
+
+	for (int i = 0; i < numThreadCounts; i++)
+	{
+		ngJobSystemDestroy(jobSystems[i]);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestChunkSeamsWeld(ngJobSystem* jobSystem)
+{
+	// 4^3 chunks of 32 voxels cover the demo shapes, which are centred on the origin
+	const int chunkSize = 32;
+	std::vector<glm::ivec3> chunkCoords;
+	for (int x = -2; x < 2; x++)
+	for (int y = -2; y < 2; y++)
+	for (int z = -2; z < 2; z++)
+	{
+		chunkCoords.push_back(glm::ivec3(x, y, z));
+	}
+
+	DensityProgram* density = CompileSuperPrimitive(ConfigForShape(SuperPrimitiveConfig::Torus));
+	MeshBuffer* reference = GenerateMesh(*density);
+
+	std::vector<ChunkMesh> chunks(chunkCoords.size());
+	GenerateChunkMeshes(jobSystem, *density, chunkCoords.data(), (int)chunkCoords.size(), chunkSize, nullptr, chunks.data());
+
+	MeshBuffer* welded = WeldChunkMeshes(chunks.data(), (int)chunks.size());
+	CHECK(welded && IsMeshValid(welded), "welded chunks");
+	if (welded)
+	{
+		const int boundary = CountBoundaryEdges(welded);
+		CHECK(boundary == 0, "welded chunks have %d boundary edges", boundary);
+		CHECK(welded->numTriangles == reference->numTriangles, "%d triangles, expected %d",
+			welded->numTriangles, reference->numTriangles);
+	}
+
+	for (ChunkMesh& chunk: chunks)
+	{
+		FreeChunkMesh(chunk);
+	}
+
+	FreeMeshBuffer(welded);
+	FreeMeshBuffer(reference);
+	DestroyDensityProgram(density);
+}
+
+// ----------------------------------------------------------------------------
+
+namespace {
+
+// Collects the output of GenerateMeshStreaming
+struct StreamedMesh
+{
+	std::vector<MeshVertex> vertices;
+	std::vector<MeshTriangle> triangles;
+	MeshBuffer mesh;
+
+	static void AddVertices(void* userData, const MeshVertex* vertices, const int count)
+	{
+		StreamedMesh* streamed = (StreamedMesh*)userData;
+		streamed->vertices.insert(end(streamed->vertices), vertices, vertices + count);
+	}
+
+	static void AddTriangles(void* userData, const MeshTriangle* triangles, const int count)
+	{
+		StreamedMesh* streamed = (StreamedMesh*)userData;
+		streamed->triangles.insert(end(streamed->triangles), triangles, triangles + count);
+	}
+};
+
+}
+
+// ----------------------------------------------------------------------------
+
+static const MeshBuffer* GenerateStreamedMesh(
+	const DensityProgram& density, 
+	const glm::ivec3& gridMin, 
+	const glm::ivec3& gridSize, 
+	StreamedMesh& streamed)
+{
+	MeshStream stream;
+	stream.userData = &streamed;
+	stream.addVertices = StreamedMesh::AddVertices;
+	stream.addTriangles = StreamedMesh::AddTriangles;
+	GenerateMeshStreaming(density, gridMin, gridSize, stream);
+
+	streamed.mesh.vertices = streamed.vertices.data();
+	streamed.mesh.numVertices = (int)streamed.vertices.size();
+	streamed.mesh.triangles = streamed.triangles.data();
+	streamed.mesh.numTriangles = (int)streamed.triangles.size();
+	return &streamed.mesh;
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestMeshStreaming(ngJobSystem* jobSystem)
+{
+	// the grid GenerateMesh contours
+	DensityProgram* torus = CompileSuperPrimitive(ConfigForShape(SuperPrimitiveConfig::Torus));
+	MeshBuffer* reference = GenerateMesh(*torus);
+
+	StreamedMesh streamed;
+	const MeshBuffer* mesh = GenerateStreamedMesh(*torus, glm::ivec3(-MESH_GRID_SIZE / 2), glm::ivec3(MESH_GRID_SIZE), streamed);
+	CHECK(IsMeshValid(mesh), "streamed torus");
+	CHECK(CountBoundaryEdges(mesh) == 0, "streamed torus has boundary edges");
+	CHECK(mesh->numTriangles > 0 && SortedTriangles(mesh) == SortedTriangles(reference), 
+		"streamed torus has %d triangles, expected %d", mesh->numTriangles, reference->numTriangles);
+
+	FreeMeshBuffer(reference);
+	DestroyDensityProgram(torus);
+
+	// and the chunks covering the test scene
+	DensityProgram* scene = CompileTestScene();
+	MeshBuffer* welded = GenerateWeldedChunks(jobSystem, *scene, TestSceneChunks(48), 48);
+
+	StreamedMesh streamedScene;
+	mesh = GenerateStreamedMesh(*scene, glm::ivec3(-48), glm::ivec3(96), streamedScene);
+	CHECK(IsMeshValid(mesh), "streamed scene");
+	CHECK(CountBoundaryEdges(mesh) == 0, "streamed scene has boundary edges");
+	CHECK(mesh->numTriangles > 0 && SortedTriangles(mesh) == SortedTriangles(welded), 
+		"streamed scene has %d triangles, expected %d", mesh->numTriangles, welded->numTriangles);
+
+	FreeMeshBuffer(welded);
+	DestroyDensityProgram(scene);
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestSeededChunks(ngJobSystem* jobSystem)
+{
+	DensityProgram* scene = CompileTestScene();
+	const std::vector<glm::ivec3> chunkCoords = TestSceneChunks(48);
+
+	for (const glm::ivec3& chunkCoord: chunkCoords)
+	{
+		ChunkMesh chunk = GenerateChunkMesh(*scene, chunkCoord, 48, jobSystem);
+		CHECK(chunk.mesh && chunk.mesh->numVertices > 0, "chunk (%d %d %d)", chunkCoord.x, chunkCoord.y, chunkCoord.z);
+		if (!chunk.mesh)
+		{
+			continue;
+		}
+
+		// following the surface from the chunk's own vertices finds every active voxel
+		ChunkMesh seeded = GenerateChunkMeshFromSeeds(*scene, chunkCoord, 48, chunk.vertexVoxels, chunk.mesh->numVertices, jobSystem);
+		CHECK(seeded.mesh && MeshesAreIdentical(seeded.mesh, chunk.mesh) &&
+			memcmp(seeded.vertexVoxels, chunk.vertexVoxels, sizeof(glm::ivec4) * chunk.mesh->numVertices) == 0,
+			"chunk (%d %d %d) from its own vertices", chunkCoord.x, chunkCoord.y, chunkCoord.z);
+		FreeChunkMesh(seeded);
+
+		// the chunk's far corner is empty space, so the whole chunk is scanned
+		const glm::ivec3 corner = (chunkCoord * 48) + glm::ivec3(
+			chunkCoord.x < 0 ? 1 : 46, chunkCoord.y < 0 ? 1 : 46, chunkCoord.z < 0 ? 1 : 46);
+		const glm::ivec4 farSeed(corner, 0);
+		ChunkMesh fallback = GenerateChunkMeshFromSeeds(*scene, chunkCoord, 48, &farSeed, 1, jobSystem);
+		CHECK(fallback.mesh && MeshesAreIdentical(fallback.mesh, chunk.mesh),
+			"chunk (%d %d %d) from a seed far from the surface", chunkCoord.x, chunkCoord.y, chunkCoord.z);
+		FreeChunkMesh(fallback);
+
+		FreeChunkMesh(chunk);
+	}
+
+	DestroyDensityProgram(scene);
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestMeshingState(ngJobSystem* jobSystem)
+{
+	// 6^3 chunks of 16 voxels cover the test scene
+	const glm::ivec3 firstChunk(-3);
+	const glm::ivec3 numChunks(6);
+	const int chunkSize = 16;
+
+	DensityProgram* scene = CompileTestScene();
+	MeshingState* state = CreateMeshingState(*scene, firstChunk, numChunks, chunkSize);
+	CHECK(UpdateMeshingState(state, jobSystem) == 6 * 6 * 6, "first update generates every chunk");
+	const std::vector<std::array<float, 9>> original = SortedTriangles(GetMeshingStateMesh(state));
+
+	// a pill subtracted from the corner of the cube, the density only changes within a
+	// voxel of the brush's bounds
+	CsgScene editedScene = CreateTestScene();
+	const int sceneRoot = editedScene.root;
+	const glm::vec3 brushCentre(-10.f, 8.f, 12.f);
+	const int brush = CsgAddPrimitive(editedScene, ConfigForShape(SuperPrimitiveConfig::Pill), ShapeTransform(5.f, brushCentre));
+	CsgAddOperation(editedScene, CsgNode::Subtract, sceneRoot, brush);
+	DensityProgram* edited = CompileDensityProgram(editedScene);
+
+	const glm::ivec3 brushMin = glm::ivec3(brushCentre - glm::vec3(5.f, 5.f, 10.f)) - glm::ivec3(1);
+	const glm::ivec3 brushMax = glm::ivec3(brushCentre + glm::vec3(5.f, 5.f, 10.f)) + glm::ivec3(1);
+	UpdateMeshingStateDensity(state, *edited, brushMin, brushMax);
+
+	// with the padding for the aprons the region (-18, 0, -1) to (-2, 16, 25) touches 2 
+	// chunks along x, 3 along y & 3 along z
+	const int regenerated = UpdateMeshingState(state, jobSystem);
+	CHECK(regenerated == 2 * 3 * 3, "%d chunks regenerated, expected %d", regenerated, 2 * 3 * 3);
+	CHECK(UpdateMeshingState(state, jobSystem) == 0, "nothing is dirty");
+
+	MeshingState* fresh = CreateMeshingState(*edited, firstChunk, numChunks, chunkSize);
+	UpdateMeshingState(fresh, jobSystem);
+
+	const MeshBuffer* mesh = GetMeshingStateMesh(state);
+	const MeshBuffer* freshMesh = GetMeshingStateMesh(fresh);
+	CHECK(mesh->numTriangles > 0 && SortedTriangles(mesh) == SortedTriangles(freshMesh), 
+		"%d triangles, a fresh state has %d", mesh->numTriangles, freshMesh->numTriangles);
+	CHECK(SortedTriangles(mesh) != original, "the brush didn't change the mesh");
+
+	const int boundary = CountBoundaryEdges(mesh);
+	CHECK(boundary == 0, "edited state has %d boundary edges", boundary);
+
+	DestroyMeshingState(fresh);
+	DestroyMeshingState(state);
+	DestroyDensityProgram(edited);
+	DestroyDensityProgram(scene);
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestSpecialisedScene(ngJobSystem* jobSystem)
+{
+	DensityProgram* scene = CompileTestScene();
+	const int sceneSize = DensityProgramSize(*scene);
+
+	// every block of 8^3 voxels specialised as the lattice & edge stages do: with no 
+	// margin the signs must match the whole scene, with a margin the values within it
+	// must be exact too. The points are the lattice and the centres of its cells.
+	int numPruned = 0;
+	int numCombined = 0;
+	int numSignErrors = 0;
+	int numValueErrors = 0;
+	std::vector<glm::vec4> points;
+	std::vector<float> expected, densities;
+
+	for (int bz = -48; bz < 48; bz += 8)
+	for (int by = -48; by < 48; by += 8)
+	for (int bx = -48; bx < 48; bx += 8)
+	{
+		const glm::vec3 boxMin((float)bx, (float)by, (float)bz);
+		const glm::vec3 boxMax = boxMin + glm::vec3(8.f);
+
+		points.clear();
+		for (int z = 0; z <= 16; z++)
+		for (int y = 0; y <= 16; y++)
+		for (int x = 0; x <= 16; x++)
+		{
+			if ((x & 1) == (y & 1) && (y & 1) == (z & 1))
+			{
+				points.push_back(glm::vec4(boxMin + (glm::vec3((float)x, (float)y, (float)z) * 0.5f), 1.f));
+			}
+		}
+
+		expected.resize(points.size());
+		densities.resize(points.size());
+		EvaluateDensity(*scene, points.data(), (int)points.size(), expected.data());
+
+		for (int m = 0; m < 2; m++)
+		{
+			const float margin = (float)m;
+			DensityProgram* specialised = SpecialiseDensityProgram(*scene, boxMin, boxMax, margin);
+			EvaluateDensity(*specialised, points.data(), (int)points.size(), densities.data());
+
+			const int size = DensityProgramSize(*specialised);
+			numPruned += size < sceneSize ? 1 : 0;
+			numCombined += size > 1 ? 1 : 0;
+
+			for (size_t i = 0; i < points.size(); i++)
+			{
+				numSignErrors += (densities[i] < 0.f) != (expected[i] < 0.f) ? 1 : 0;
+				numValueErrors += glm::abs(expected[i]) <= margin && densities[i] != expected[i] ? 1 : 0;
+			}
+
+			DestroyDensityProgram(specialised);
+		}
+	}
+
+	CHECK(numPruned > 0 && numCombined > 0, "%d blocks pruned, %d with several primitives", numPruned, numCombined);
+	CHECK(numSignErrors == 0, "%d specialised densities have the wrong sign", numSignErrors);
+	CHECK(numValueErrors == 0, "%d specialised densities within the margin differ", numValueErrors);
+
+	// the scene's densities written as a raw volume, which is evaluated as is, so meshing
+	// it finds the same active voxels & quads as the specialised blocks of the scene
+	const char* path = "fast_dc_tests_scene.raw";
+	const int volumeSize = 101;
+	const glm::ivec3 volumeOrigin(-50);
+
+	points.clear();
+	for (int z = 0; z < volumeSize; z++)
+	for (int y = 0; y < volumeSize; y++)
+	for (int x = 0; x < volumeSize; x++)
+	{
+		points.push_back(glm::vec4(glm::vec3(volumeOrigin + glm::ivec3(x, y, z)), 1.f));
+	}
+
+	densities.resize(points.size());
+	EvaluateDensity(*scene, points.data(), (int)points.size(), densities.data());
+	WriteBinaryFile(path, densities.data(), densities.size() * sizeof(float));
+
+	DenseVolumeDesc desc;
+	desc.path = path;
+	desc.size = glm::ivec3(volumeSize);
+	desc.origin = volumeOrigin;
+	DenseVolume* volume = OpenDenseVolume(desc);
+	CHECK(volume, "scene volume");
+
+	DensityProgram* sampled = volume ? CompileVolumeDensity(*volume) : nullptr;
+	for (int i = 0; sampled && i < 8; i++)
+	{
+		const glm::ivec3 chunkCoord(-(i & 1), -((i >> 1) & 1), -((i >> 2) & 1));
+		ChunkMesh fromScene = GenerateChunkMesh(*scene, chunkCoord, 48, jobSystem);
+		ChunkMesh fromVolume = GenerateChunkMesh(*sampled, chunkCoord, 48, jobSystem);
+
+		CHECK(fromScene.mesh && fromScene.mesh->numTriangles > 0, "chunk %d", i);
+		CHECK(SortedVoxelTriangles(fromScene) == SortedVoxelTriangles(fromVolume), "chunk %d: %d triangles, %d from the volume",
+			i, fromScene.mesh ? fromScene.mesh->numTriangles : 0, fromVolume.mesh ? fromVolume.mesh->numTriangles : 0);
+
+		FreeChunkMesh(fromVolume);
+		FreeChunkMesh(fromScene);
+	}
+
+	DestroyDensityProgram(sampled);
+	CloseDenseVolume(volume);
+	remove(path);
+
+	DestroyDensityProgram(scene);
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestDenseVolume(ngJobSystem* jobSystem)
+{
+	const char* path = "fast_dc_tests.raw";
+	const int volumeSize = 101;
+	const glm::ivec3 volumeOrigin(-50);
+	const size_t numSamples = (size_t)volumeSize * volumeSize * volumeSize;
+
+	DensityProgram* scene = CompileTestScene();
+	const std::vector<glm::ivec3> chunkCoords = TestSceneChunks(48);
+	MeshBuffer* reference = GenerateWeldedChunks(jobSystem, *scene, chunkCoords, 48);
+
+	std::vector<glm::vec4> points;
+	for (int z = 0; z < volumeSize; z++)
+	for (int y = 0; y < volumeSize; y++)
+	for (int x = 0; x < volumeSize; x++)
+	{
+		points.push_back(glm::vec4(glm::vec3(volumeOrigin + glm::ivec3(x, y, z)), 1.f));
+	}
+
+	std::vector<float> densities(numSamples);
+	EvaluateDensity(*scene, points.data(), (int)numSamples, densities.data());
+
+	// float32 as is, uint16 quantised around 32768 (keeping the signs) after a header
+	const float quantise = 4096.f;
+	const size_t headerSize = 16;
+	std::vector<uint8_t> uint16File(headerSize + (numSamples * sizeof(uint16_t)));
+	for (size_t i = 0; i < numSamples; i++)
+	{
+		const float value = glm::round(glm::clamp((densities[i] * quantise) + 32768.f, 0.f, 65535.f));
+		const uint16_t sample = (uint16_t)(densities[i] < 0.f ? glm::min(value, 32767.f) : glm::max(value, 32768.f));
+		memcpy(&uint16File[headerSize + (i * sizeof(uint16_t))], &sample, sizeof(sample));
+	}
+
+	const char* formatNames[] = { "float32", "uint16" };
+	for (int i = 0; i < 2; i++)
+	{
+		DenseVolumeDesc desc;
+		desc.path = path;
+		desc.size = glm::ivec3(volumeSize);
+		desc.origin = volumeOrigin;
+
+		if (i == 0)
+		{
+			WriteBinaryFile(path, densities.data(), numSamples * sizeof(float));
+		}
+		else
+		{
+			WriteBinaryFile(path, uint16File.data(), uint16File.size());
+			desc.format = DenseVolumeDesc::UInt16;
+			desc.headerSize = headerSize;
+			desc.isoValue = 32768.f;
+			desc.scale = 1.f / quantise;
+		}
+
+		DenseVolume* volume = OpenDenseVolume(desc);
+		CHECK(volume, "%s", formatNames[i]);
+		if (!volume)
+		{
+			continue;
+		}
+
+		// the samples have the scene's signs so the topology is the same
+		DensityProgram* density = CompileVolumeDensity(*volume);
+		MeshBuffer* mesh = GenerateWeldedChunks(jobSystem, *density, chunkCoords, 48);
+		CHECK(mesh && IsMeshValid(mesh), "%s", formatNames[i]);
+		if (mesh)
+		{
+			const int boundary = CountBoundaryEdges(mesh);
+			CHECK(boundary == 0, "%s: %d boundary edges", formatNames[i], boundary);
+			CHECK(mesh->numTriangles == reference->numTriangles, "%s: %d triangles, expected %d",
+				formatNames[i], mesh->numTriangles, reference->numTriangles);
+		}
+
+		FreeMeshBuffer(mesh);
+		DestroyDensityProgram(density);
+		CloseDenseVolume(volume);
+
+		// a file too small for the size, format & header
+		DenseVolumeDesc undersized = desc;
+		undersized.size.z++;
+		volume = OpenDenseVolume(undersized);
+		CHECK(!volume, "%s: undersized file", formatNames[i]);
+		CloseDenseVolume(volume);
+
+		undersized = desc;
+		undersized.headerSize += 2;
+		volume = OpenDenseVolume(undersized);
+		CHECK(!volume, "%s: header too large", formatNames[i]);
+		CloseDenseVolume(volume);
+	}
+
+	remove(path);
+	FreeMeshBuffer(reference);
+	DestroyDensityProgram(scene);
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestSparseVolume(ngJobSystem* jobSystem)
+{
+	const char* path = "fast_dc_tests.ngsv";
+	const int gridSize = 96;
+	const int chunkSize = 32;
+
+	DensityProgram* scene = CompileTestScene();
+	const std::vector<glm::ivec3> sceneChunks = TestSceneChunks(chunkSize);
+	MeshBuffer* reference = GenerateWeldedChunks(jobSystem, *scene, sceneChunks, chunkSize);
+
+	const DenseVolumeDesc::Format formats[] = { DenseVolumeDesc::Float32, DenseVolumeDesc::UInt16 };
+	const char* formatNames[] = { "float32", "uint16" };
+
+	for (int i = 0; i < 2; i++)
+	{
+		CHECK(WriteSparseVolume(path, *scene, glm::ivec3(-gridSize / 2), glm::ivec3(gridSize), formats[i], 4.f), "%s", formatNames[i]);
+		SparseVolume* volume = OpenSparseVolume(path);
+		CHECK(volume, "%s", formatNames[i]);
+		if (!volume)
+		{
+			continue;
+		}
+
+		// most of the grid is empty space, which takes no space in the file & is never read
+		const size_t denseBytes = (size_t)gridSize * gridSize * gridSize * (i == 0 ? sizeof(float) : sizeof(uint16_t));
+		const size_t fileBytes = ReadBinaryFile(path).size();
+		CHECK(fileBytes < denseBytes / 2, "%s: %d bytes, the dense volume is %d", formatNames[i], (int)fileBytes, (int)denseBytes);
+
+		std::vector<glm::ivec3> chunkCoords;
+		FindSparseVolumeChunks(*volume, chunkSize, chunkCoords);
+		CHECK(!chunkCoords.empty() && chunkCoords.size() < sceneChunks.size(), "%s: %d of %d chunks", 
+			formatNames[i], (int)chunkCoords.size(), (int)sceneChunks.size());
+
+		float d = 0.f;
+		CHECK(IsSparseVolumeUniform(*volume, glm::vec3(-46.f), glm::vec3(-38.f), &d) && d > 0.f, "%s: corner", formatNames[i]);
+		CHECK(!IsSparseVolumeUniform(*volume, glm::vec3(-24.f), glm::vec3(-16.f, 0.f, 0.f), &d), "%s: surface", formatNames[i]);
+
+		// the samples keep their signs so meshing only the chunks found gives the same
+		// topology as meshing the scene everywhere
+		DensityProgram* density = CompileSparseVolumeDensity(*volume);
+		MeshBuffer* mesh = GenerateWeldedChunks(jobSystem, *density, chunkCoords, chunkSize);
+		CHECK(mesh && IsMeshValid(mesh), "%s", formatNames[i]);
+		if (mesh)
+		{
+			const int boundary = CountBoundaryEdges(mesh);
+			CHECK(boundary == 0, "%s: %d boundary edges", formatNames[i], boundary);
+			CHECK(mesh->numTriangles == reference->numTriangles, "%s: %d triangles, expected %d",
+				formatNames[i], mesh->numTriangles, reference->numTriangles);
+		}
+
+		FreeMeshBuffer(mesh);
+		DestroyDensityProgram(density);
+		CloseSparseVolume(volume);
+	}
+
+	// the header starts with the brick data, page table & brick tables offsets (uint64),
+	// then the magic, version & format, the origin and the number of bricks (int32)
+	const std::vector<uint8_t> bytes = ReadBinaryFile(path);
+	const auto opens = [path](const std::vector<uint8_t>& modified)
+	{
+		WriteBinaryFile(path, modified.data(), modified.size());
+		SparseVolume* volume = OpenSparseVolume(path);
+		CloseSparseVolume(volume);
+		return volume != nullptr;
+	};
+
+	CHECK(opens(bytes), "unmodified");
+	CHECK(!opens(std::vector<uint8_t>(begin(bytes), begin(bytes) + 40)), "truncated header");
+	CHECK(!opens(std::vector<uint8_t>(begin(bytes), end(bytes) - 4)), "truncated tables");
+
+	std::vector<uint8_t> corrupt = bytes;
+	corrupt[24] ^= 0xff;
+	CHECK(!opens(corrupt), "bad magic");
+
+	// an offset where offset + size wraps around to inside the file
+	corrupt = bytes;
+	const uint64_t wrappingOffset = ~(uint64_t)0 - 3;
+	memcpy(&corrupt[8], &wrappingOffset, sizeof(wrappingOffset));
+	CHECK(!opens(corrupt), "wrapping page table offset");
+
+	corrupt = bytes;
+	const int32_t numBricks[3] = { 0x7fffffff, 0x7fffffff, 0x7fffffff };
+	memcpy(&corrupt[48], numBricks, sizeof(numBricks));
+	CHECK(!opens(corrupt), "huge number of bricks");
+
+	corrupt = bytes;
+	uint64_t pageTableOffset = 0;
+	memcpy(&pageTableOffset, &corrupt[8], sizeof(pageTableOffset));
+	const uint32_t badEntry = 0xffffffff;
+	memcpy(&corrupt[(size_t)pageTableOffset], &badEntry, sizeof(badEntry));
+	CHECK(!opens(corrupt), "page table entry out of range");
+
+	remove(path);
+
+	FreeMeshBuffer(reference);
+	DestroyDensityProgram(scene);
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestHermiteData(ngJobSystem* jobSystem)
+{
+	const char* path = "fast_dc_tests.nghd";
+	DensityProgram* scene = CompileTestScene();
+
+	// the mesh regenerated from the file has the same triangles as the chunk, with its
+	// vertices in a different order
+	for (const glm::ivec3& chunkCoord: TestSceneChunks(48))
+	{
+		HermiteData* generated = GenerateChunkHermiteData(*scene, chunkCoord, 48, jobSystem);
+		CHECK(generated && WriteHermiteData(path, *generated), "chunk (%d %d %d)", chunkCoord.x, chunkCoord.y, chunkCoord.z);
+		DestroyHermiteData(generated);
+
+		HermiteData* data = OpenHermiteData(path);
+		CHECK(data, "chunk (%d %d %d)", chunkCoord.x, chunkCoord.y, chunkCoord.z);
+		if (!data)
+		{
+			continue;
+		}
+
+		ChunkMesh chunk = GenerateChunkMesh(*scene, chunkCoord, 48, jobSystem);
+		ChunkMesh regenerated = GenerateChunkMeshFromHermiteData(*data, nullptr, jobSystem);
+		CHECK(chunk.mesh && regenerated.mesh && chunk.mesh->numTriangles > 0 && 
+			SortedTriangles(regenerated.mesh) == SortedTriangles(chunk.mesh) &&
+			SortedVoxelTriangles(regenerated) == SortedVoxelTriangles(chunk),
+			"chunk (%d %d %d) regenerated from its Hermite data differs", chunkCoord.x, chunkCoord.y, chunkCoord.z);
+
+		FreeChunkMesh(regenerated);
+		FreeChunkMesh(chunk);
+		DestroyHermiteData(data);
+	}
+
+	// the header starts with the magic, and is followed by 12 bytes per edge
+	const std::vector<uint8_t> bytes = ReadBinaryFile(path);
+	const auto opens = [path](const std::vector<uint8_t>& modified)
+	{
+		WriteBinaryFile(path, modified.data(), modified.size());
+		HermiteData* data = OpenHermiteData(path);
+		DestroyHermiteData(data);
+		return data != nullptr;
+	};
+
+	CHECK(opens(bytes), "unmodified");
+	CHECK(!opens(std::vector<uint8_t>(begin(bytes), end(bytes) - 12)), "missing an edge");
+	CHECK(!opens(std::vector<uint8_t>(begin(bytes), begin(bytes) + 16)), "truncated header");
+
+	std::vector<uint8_t> corrupt = bytes;
+	corrupt[0] ^= 0xff;
+	CHECK(!opens(corrupt), "bad magic");
+
+	remove(path);
+	DestroyDensityProgram(scene);
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestPlacementModes()
+{
+	const VertexPlacement::Mode modes[] = { VertexPlacement::MassPoint, VertexPlacement::Auto };
+	const char* modeNames[] = { "mass point", "auto" };
+
+	DensityProgram* density = CompileSuperPrimitive(ConfigForShape(SuperPrimitiveConfig::Cylinder));
+	MeshBuffer* reference = GenerateMesh(*density);
+
+	for (int i = 0; i < 2; i++)
+	{
+		VertexPlacement placement;
+		placement.mode = modes[i];
+
+		// the placement only moves the vertices, the topology is the same
+		MeshBuffer* mesh = GenerateMesh(*density, nullptr, placement);
+		CHECK(IsMeshValid(mesh), "%s", modeNames[i]);
+		CHECK(mesh->numTriangles == reference->numTriangles, "%s: %d triangles, expected %d",
+			modeNames[i], mesh->numTriangles, reference->numTriangles);
+		CHECK(CountBoundaryEdges(mesh) == 0, "%s", modeNames[i]);
+		FreeMeshBuffer(mesh);
+	}
+
+	FreeMeshBuffer(reference);
+	DestroyDensityProgram(density);
+}
+
+// ----------------------------------------------------------------------------
+
+// Merge the meshes into one, welding each vertex to a vertex of an earlier mesh with
+// exactly the same position. The vertices within a mesh are never welded, at a sharp
+// corner separate voxels can solve to the same point.
+static MeshBuffer* WeldByPosition(const std::vector<const MeshBuffer*>& meshes)
+{
+	struct PositionHash
+	{
+		size_t operator()(const glm::vec3& p) const
+		{
+			uint32_t bits[3];
+			memcpy(bits, &p, sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+
+	std::unordered_map<glm::vec3, int, PositionHash> lookup;
+	std::vector<MeshVertex> vertices;
+	std::vector<MeshTriangle> triangles;
+
+	for (const MeshBuffer* mesh: meshes)
+	{
+		const int firstVertex = (int)vertices.size();
+		std::vector<int> remap(mesh->numVertices);
+		for (int i = 0; i < mesh->numVertices; i++)
+		{
+			const auto iter = lookup.find(glm::vec3(mesh->vertices[i].xyz));
+			if (iter != end(lookup))
+			{
+				remap[i] = iter->second;
+			}
+			else
+			{
+				remap[i] = (int)vertices.size();
+				vertices.push_back(mesh->vertices[i]);
+			}
+		}
+
+		for (int i = firstVertex; i < (int)vertices.size(); i++)
+		{
+			lookup.insert(std::make_pair(glm::vec3(vertices[i].xyz), i));
+		}
+
+		for (int i = 0; i < mesh->numTriangles; i++)
+		{
+			MeshTriangle tri;
+			for (int j = 0; j < 3; j++)
+			{
+				tri.indices_[j] = remap[mesh->triangles[i].indices_[j]];
+			}
+
+			triangles.push_back(tri);
+		}
+	}
+
+	MeshBuffer* welded = new MeshBuffer;
+	welded->numVertices = (int)vertices.size();
+	welded->vertices = (MeshVertex*)malloc(sizeof(MeshVertex) * (vertices.size() + 1));
+	memcpy(welded->vertices, vertices.data(), sizeof(MeshVertex) * vertices.size());
+	welded->numTriangles = (int)triangles.size();
+	welded->triangles = (MeshTriangle*)malloc(sizeof(MeshTriangle) * (triangles.size() + 1));
+	memcpy(welded->triangles, triangles.data(), sizeof(MeshTriangle) * triangles.size());
+	return welded;
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestLodClipmap(ngJobSystem* jobSystem)
+{
+	// three levels of 8^3 chunks of 8 voxels, so the seams cut through the test scene and
+	// the outermost box (256 voxels across) contains all of it. The rod only exists in 
+	// level 0 and its ends are closed by the seam.
+	const int numLevels = 3;
+	DensityProgram* scene = CompileTestScene();
+	LodClipmap* clipmap = CreateLodClipmap(*scene, numLevels, 8, 8);
+	CHECK(clipmap, "clipmap");
+
+	// the first update builds every level. Moving the focus by less than a chunk of level
+	// 1 only moves level 0, which moves level 1's hole, and not moving rebuilds nothing.
+	const glm::vec3 focuses[] = { glm::vec3(0.f), glm::vec3(10.f, 0.f, 0.f), glm::vec3(10.f, 0.f, 0.f), glm::vec3(-20.f, 30.f, 5.f) };
+	const int expectedRebuilt[] = { 3, 2, 0, 3 };
+
+	for (int i = 0; clipmap && i < 4; i++)
+	{
+		const int rebuilt = UpdateLodClipmap(clipmap, focuses[i], jobSystem);
+		CHECK(rebuilt == expectedRebuilt[i], "focus %d: %d levels rebuilt, expected %d", i, rebuilt, expectedRebuilt[i]);
+
+		std::vector<const MeshBuffer*> levels;
+		int numTriangles = 0;
+		for (int level = 0; level < numLevels; level++)
+		{
+			levels.push_back(GetLodClipmapMesh(clipmap, level));
+			numTriangles += levels.back()->numTriangles;
+		}
+
+		// the levels & seams meet without cracks
+		MeshBuffer* welded = WeldByPosition(levels);
+		const int boundary = CountBoundaryEdges(welded);
+		CHECK(numTriangles > 0 && boundary == 0, "focus %d: %d boundary edges", i, boundary);
+		FreeMeshBuffer(welded);
+	}
+
+	DestroyLodClipmap(clipmap);
+	DestroyDensityProgram(scene);
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestOctreeMesh()
+{
+	DensityProgram* density = CompileSuperPrimitive(ConfigForShape(SuperPrimitiveConfig::Pill));
+	MeshBuffer* reference = GenerateMesh(*density);
+
+	// a negative threshold merges nothing
+	MeshBuffer* unmerged = GenerateOctreeMesh(*density, -1.f);
+	CHECK(unmerged->numVertices == reference->numVertices && unmerged->numTriangles == reference->numTriangles,
+		"%d/%d vertices, %d/%d triangles", unmerged->numVertices, reference->numVertices,
+		unmerged->numTriangles, reference->numTriangles);
+
+	MeshBuffer* merged = GenerateOctreeMesh(*density, 0.1f);
+	CHECK(IsMeshValid(merged), "merged octree");
+	CHECK(merged->numTriangles < reference->numTriangles, "%d triangles, expected fewer than %d",
+		merged->numTriangles, reference->numTriangles);
+
+	const int boundary = CountBoundaryEdges(merged);
+	CHECK(boundary == 0, "merged octree has %d boundary edges", boundary);
+
+	FreeMeshBuffer(merged);
+	FreeMeshBuffer(unmerged);
+	FreeMeshBuffer(reference);
+	DestroyDensityProgram(density);
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestTraceExport()
+{
+	const char* path = "fast_dc_tests.json";
+	const char* quotedName = "a \"quoted\" \\ name\n";
+	const int numOverwritten = 100;
+
+	ngTraceClear();
+	ngTraceSetThreadName("main");
+
+	// the ring wraps around and keeps the newest events, 1us apart from the first one kept
+	const int64_t base = ngTraceNow();
+	for (int i = 0; i < NG_TRACE_RING_CAPACITY + numOverwritten; i++)
+	{
+		const int64_t start = base + ((int64_t)i * 1000);
+		ngTraceRecord(i < numOverwritten ? "overwritten" : "kept", start, start + 500);
+	}
+
+	std::thread worker([quotedName, base]()
+	{
+		ngTraceSetThreadName("worker");
+		for (int i = 0; i < 3; i++)
+		{
+			ngTraceRecord("worker event", base + 1000000, base + 2000000);
+		}
+
+		ngTraceRecord(quotedName, base + 1000000, base + 2000000);
+	});
+	worker.join();
+
+	CHECK(ngTraceWriteChromeJson(path), "write");
+	const std::vector<uint8_t> bytes = ReadBinaryFile(path);
+	const std::string json(begin(bytes), end(bytes));
+	remove(path);
+	ngTraceClear();
+
+	// every event is on its own line
+	const auto field = [](const std::string& line, const char* name)
+	{
+		const size_t pos = line.find(name);
+		return pos == std::string::npos ? -1.0 : atof(line.c_str() + pos + strlen(name));
+	};
+
+	int mainTid = -1, workerTid = -1;
+	int numKept = 0, numOverwrittenFound = 0, numWorkerEvents = 0, numEscaped = 0, numWrongTid = 0;
+	double firstKept = -1.0, lastKept = -1.0;
+
+	size_t begin = 0;
+	while (begin < json.size())
+	{
+		size_t end = json.find('\n', begin);
+		end = end == std::string::npos ? json.size() : end;
+		const std::string line = json.substr(begin, end - begin);
+		begin = end + 1;
+
+		const int tid = (int)field(line, "\"tid\":");
+		if (line.find("\"thread_name\"") != std::string::npos)
+		{
+			mainTid = line.find("{\"name\":\"main\"}") != std::string::npos ? tid : mainTid;
+			workerTid = line.find("{\"name\":\"worker\"}") != std::string::npos ? tid : workerTid;
+		}
+		else if (line.find("\"name\":\"kept\"") != std::string::npos)
+		{
+			const double ts = field(line, "\"ts\":");
+			firstKept = numKept == 0 ? ts : firstKept;
+			lastKept = ts;
+			numKept++;
+			numWrongTid += tid != mainTid ? 1 : 0;
+		}
+		else if (line.find("\"name\":\"overwritten\"") != std::string::npos)
+		{
+			numOverwrittenFound++;
+		}
+		else if (line.find("\"name\":\"worker event\"") != std::string::npos)
+		{
+			numWorkerEvents++;
+			numWrongTid += tid != workerTid ? 1 : 0;
+		}
+		else if (line.find("\"name\":\"a \\\"quoted\\\" \\\\ name\"") != std::string::npos)
+		{
+			numEscaped++;
+			numWrongTid += tid != workerTid ? 1 : 0;
+		}
+	}
+
+	CHECK(mainTid != -1 && workerTid != -1 && mainTid != workerTid, "thread names: main %d, worker %d", mainTid, workerTid);
+	CHECK(numKept == NG_TRACE_RING_CAPACITY && numOverwrittenFound == 0, "%d events kept, %d overwritten events found", 
+		numKept, numOverwrittenFound);
+	CHECK(firstKept == 0.0 && lastKept == NG_TRACE_RING_CAPACITY - 1.0, "kept events from %.3fus to %.3fus", firstKept, lastKept);
+	CHECK(numWorkerEvents == 3 && numEscaped == 1, "%d worker events, %d escaped names", numWorkerEvents, numEscaped);
+	CHECK(numWrongTid == 0, "%d events on the wrong thread", numWrongTid);
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestSimplifier()
+{
+	for (int shape = 0; shape < NUM_SHAPES; shape++)
+	{
+		DensityProgram* density = CompileSuperPrimitive(ConfigForShape((SuperPrimitiveConfig::Type)shape));
+		MeshBuffer* mesh = GenerateMesh(*density);
+		const int numTriangles = mesh->numTriangles;
+		const int numVertices = mesh->numVertices;
+
+		MeshSimplificationOptions options;
+		options.maxEdgeSize = 2.5f;
+
+		std::vector<int> remap(numVertices);
+		ngMeshSimplifier(mesh, vec4(0.f), options, remap.data());
+
+		CHECK(IsMeshValid(mesh), "%s", SHAPE_NAMES[shape]);
+		CHECK(mesh->numTriangles < numTriangles, "%s: %d triangles, expected fewer than %d",
+			SHAPE_NAMES[shape], mesh->numTriangles, numTriangles);
+
+		bool remapValid = true;
+		for (const int index: remap)
+		{
+			remapValid = remapValid && index >= -1 && index < mesh->numVertices;
+		}
+		CHECK(remapValid, "%s", SHAPE_NAMES[shape]);
+
+		FreeMeshBuffer(mesh);
+		DestroyDensityProgram(density);
+	}
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestMeshCache()
+{
+	MeshSimplificationOptions options;
+	options.maxEdgeSize = 2.5f;
+
+	MeshCacheRequest requests[2];
+	requests[0].config = ConfigForShape(SuperPrimitiveConfig::Cube);
+	requests[1].config = ConfigForShape(SuperPrimitiveConfig::Torus);
+	requests[1].options = &options;
+
+	// the files are written to the working directory and removed at the end
+	char paths[2][32];
+	for (int i = 0; i < 2; i++)
+	{
+		snprintf(paths[i], sizeof(paths[i]), "%016llx.mesh", (unsigned long long)MeshCacheKey(requests[i]));
+		remove(paths[i]);
+	}
+
+	CHECK(MeshCacheKey(requests[0]) != MeshCacheKey(requests[1]), "keys");
+
+	DensityProgram* cubeDensity = CompileSuperPrimitive(requests[0].config);
+	DensityProgram* torusDensity = CompileSuperPrimitive(requests[1].config);
+	MeshBuffer* cubeReference = GenerateMesh(*cubeDensity);
+	MeshBuffer* reference = GenerateMesh(*torusDensity);
+	ngMeshSimplifier(reference, vec4(0.f), options);
+
+	// room for either mesh but not both, so the second request evicts the first
+	const auto meshBytes = [](const MeshBuffer* mesh)
+	{
+		return (mesh->numVertices * sizeof(MeshVertex)) + (mesh->numTriangles * sizeof(MeshTriangle));
+	};
+
+	MeshCache* cache = CreateMeshCache(meshBytes(cubeReference) + meshBytes(reference) - 1, ".");
+	MeshCacheResult cube = GetMeshCacheMesh(cache, requests[0]);
+	MeshCacheResult torus = GetMeshCacheMesh(cache, requests[1]);
+	CHECK(cube && MeshesAreIdentical(cube.get(), cubeReference), "cached cube differs");
+	CHECK(torus && MeshesAreIdentical(torus.get(), reference), "cached torus differs");
+	CHECK(GetMeshCacheMesh(cache, requests[1]) == torus, "expected the same buffer");
+
+	MeshCacheStats stats;
+	GetMeshCacheStats(cache, &stats);
+	CHECK(stats.misses == 2 && stats.memoryHits == 1 && stats.evictions == 1 && stats.numEntries == 1,
+		"%d misses, %d memory hits, %d evictions, %d entries", 
+		(int)stats.misses, (int)stats.memoryHits, (int)stats.evictions, stats.numEntries);
+
+	// the evicted mesh is still valid & comes back from its file
+	MeshCacheResult cubeFromDisk = GetMeshCacheMesh(cache, requests[0]);
+	CHECK(cubeFromDisk && MeshesAreIdentical(cube.get(), cubeFromDisk.get()), "cube from disk differs");
+	DestroyMeshCache(cache);
+
+	// a new cache (e.g. the next run) finds the files
+	cache = CreateMeshCache(64 << 20, ".");
+	MeshCacheResult torusFromDisk = GetMeshCacheMesh(cache, requests[1]);
+	CHECK(torusFromDisk && MeshesAreIdentical(torusFromDisk.get(), reference), "torus from disk differs");
+
+	GetMeshCacheStats(cache, &stats);
+	CHECK(stats.diskHits == 1 && stats.misses == 0, "%d disk hits, %d misses", (int)stats.diskHits, (int)stats.misses);
+	DestroyMeshCache(cache);
+
+	cubeFromDisk.reset();
+	torusFromDisk.reset();
+	remove(paths[0]);
+
+	// concurrent misses on the same key, each thread with its own cache (like separate
+	// processes) so every one of them generates & writes the file
+	const int numWriters = 4;
+	MeshCacheResult written[numWriters];
+	std::vector<std::thread> writers;
+	for (int i = 0; i < numWriters; i++)
+	{
+		writers.emplace_back([&requests, &written, i]()
+		{
+			MeshCache* writerCache = CreateMeshCache(64 << 20, ".");
+			written[i] = GetMeshCacheMesh(writerCache, requests[0]);
+			DestroyMeshCache(writerCache);
+		});
+	}
+
+	for (std::thread& writer: writers)
+	{
+		writer.join();
+	}
+
+	for (int i = 0; i < numWriters; i++)
+	{
+		CHECK(written[i] && MeshesAreIdentical(written[i].get(), cubeReference), "concurrent miss %d differs", i);
+	}
+
+	cache = CreateMeshCache(64 << 20, ".");
+	cubeFromDisk = GetMeshCacheMesh(cache, requests[0]);
+	GetMeshCacheStats(cache, &stats);
+	CHECK(stats.diskHits == 1 && cubeFromDisk && MeshesAreIdentical(cubeFromDisk.get(), cubeReference),
+		"file written by concurrent misses differs");
+	DestroyMeshCache(cache);
+
+	cubeFromDisk.reset();
+	for (int i = 0; i < 2; i++)
+	{
+		remove(paths[i]);
+	}
+
+	FreeMeshBuffer(reference);
+	FreeMeshBuffer(cubeReference);
+	DestroyDensityProgram(torusDensity);
+	DestroyDensityProgram(cubeDensity);
+}
+
+// ----------------------------------------------------------------------------
+
+static bool WriteTextFile(const char* path, const char* text)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f)
+	{
+		return false;
+	}
+
+	fputs(text, f);
+	return fclose(f) == 0;
+}
+
+// ----------------------------------------------------------------------------
+
+// The vertices as float x, y & z then the triangles as a uchar count and int indices
+static bool WritePly(const char* path, const MeshBuffer* mesh)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f)
+	{
+		return false;
+	}
+
+	fprintf(f, "ply\nformat binary_little_endian 1.0\ncomment fast_dc_tests\n");
+	fprintf(f, "element vertex %d\nproperty float x\nproperty float y\nproperty float z\n", mesh->numVertices);
+	fprintf(f, "element face %d\nproperty list uchar int vertex_indices\nend_header\n", mesh->numTriangles);
+
+	for (int i = 0; i < mesh->numVertices; i++)
+	{
+		fwrite(&mesh->vertices[i].xyz, sizeof(float), 3, f);
+	}
+
+	for (int i = 0; i < mesh->numTriangles; i++)
+	{
+		const uint8_t count = 3;
+		fwrite(&count, 1, 1, f);
+		fwrite(mesh->triangles[i].indices_, sizeof(int), 3, f);
+	}
+
+	return fclose(f) == 0;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool WriteObj(const char* path, const MeshBuffer* mesh)
+{
+	FILE* f = fopen(path, "wb");
+	if (!f)
+	{
+		return false;
+	}
+
+	for (int i = 0; i < mesh->numVertices; i++)
+	{
+		const vec4& p = mesh->vertices[i].xyz;
+		fprintf(f, "v %.9g %.9g %.9g\n", p.x, p.y, p.z);
+	}
+
+	for (int i = 0; i < mesh->numTriangles; i++)
+	{
+		const int* indices = mesh->triangles[i].indices_;
+		fprintf(f, "f %d %d %d\n", indices[0] + 1, indices[1] + 1, indices[2] + 1);
+	}
+
+	return fclose(f) == 0;
+}
+
+// ----------------------------------------------------------------------------
+
+static bool SameGeometry(const MeshBuffer* a, const MeshBuffer* b)
+{
+	if (a->numVertices != b->numVertices || a->numTriangles != b->numTriangles ||
+		memcmp(a->triangles, b->triangles, sizeof(MeshTriangle) * a->numTriangles) != 0)
+	{
+		return false;
+	}
+
+	for (int i = 0; i < a->numVertices; i++)
+	{
+		if (glm::vec3(a->vertices[i].xyz) != glm::vec3(b->vertices[i].xyz))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// ----------------------------------------------------------------------------
+
+static void TestMeshLoader(ngJobSystem* jobSystem)
+{
+	const char* objPath = "fast_dc_tests.obj";
+	const char* plyPath = "fast_dc_tests.ply";
+
+	// a quad (with the texture & normal indices ignored) split into a fan, a relative
+	// index, a vertex colour, comments and a CRLF line
+	WriteTextFile(objPath,
+		"# test\n"
+		"v 0 0 0\n"
+		"v 1 0 0 1 0.5 0.25\n"
+		"v 1 1 0\r\n"
+		"  v 0 1 0\n"
+		"vt 0 0\n"
+		"vn 0 0 1\n"
+		"\n"
+		"f 1/1/1 2/1/1 3//1 4/1\n"
+		"v 0.5 0.5 1e0\n"
+		"f -1 1 2 # relative\n");
+
+	MeshBuffer* mesh = ngMeshLoadFromFile(objPath);
+	CHECK(mesh && mesh->numVertices == 5 && mesh->numTriangles == 3, "obj");
+	if (mesh)
+	{
+		const int expected[3][3] = { { 0, 1, 2 }, { 0, 2, 3 }, { 4, 0, 1 } };
+		CHECK(memcmp(mesh->triangles, expected, sizeof(expected)) == 0, "obj triangles");
+		CHECK(mesh->vertices[4].xyz == vec4(0.5f, 0.5f, 1.f, 1.f), "obj vertex");
+		CHECK(mesh->vertices[1].colour == vec4(1.f, 0.5f, 0.25f, 1.f), "obj colour");
+		CHECK(mesh->vertices[3].normal == vec4(0.f, 0.f, 1.f, 0.f), "obj normal");
+	}
+	FreeMeshBuffer(mesh);
+
+	WriteTextFile(objPath, "v 0 0 0\nv 1 0 0\nv 1 1 0\nf 1 2 4\n");
+	CHECK(!ngMeshLoadFromFile(objPath), "obj index out of range");
+
+	WriteTextFile(plyPath, "ply\nformat ascii 1.0\nelement vertex 0\nend_header\n");
+	CHECK(!ngMeshLoadFromFile(plyPath), "ascii ply");
+
+	// a big endian quad & triangle with a property after the indices, so the faces can't
+	// be read as a triangle list
+	{
+		FILE* f = fopen(plyPath, "wb");
+		fprintf(f, "ply\nformat binary_big_endian 1.0\nelement vertex 5\nproperty double x\nproperty double y\n"
+			"property double z\nproperty uchar red\nproperty uchar green\nproperty uchar blue\n"
+			"element face 2\nproperty list uchar uint vertex_indices\nproperty uchar flags\nend_header\n");
+
+		const double positions[5][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 }, { 0.5, 0.5, 1 } };
+		for (int i = 0; i < 5; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				uint8_t bytes[8];
+				memcpy(bytes, &positions[i][j], 8);
+				std::reverse(bytes, bytes + 8);
+				fwrite(bytes, 8, 1, f);
+			}
+
+			const uint8_t colour[3] = { 255, 0, 51 };
+			fwrite(colour, 3, 1, f);
+		}
+
+		const uint8_t faces[] = { 4, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 3, 7, 3, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 1, 7 };
+		fwrite(faces, sizeof(faces), 1, f);
+		fclose(f);
+	}
+
+	mesh = ngMeshLoadFromFile(plyPath, jobSystem);
+	CHECK(mesh && mesh->numVertices == 5 && mesh->numTriangles == 3, "big endian ply");
+	if (mesh)
+	{
+		const int expected[3][3] = { { 0, 1, 2 }, { 0, 2, 3 }, { 4, 0, 1 } };
+		CHECK(memcmp(mesh->triangles, expected, sizeof(expected)) == 0, "ply triangles");
+		CHECK(mesh->vertices[4].xyz == vec4(0.5f, 0.5f, 1.f, 1.f), "ply vertex");
+		CHECK(mesh->vertices[2].colour == vec4(1.f, 0.f, 0.2f, 1.f), "ply colour");
+	}
+	FreeMeshBuffer(mesh);
+
+	// the meshes written by the library load back unchanged, with & without jobs
+	DensityProgram* density = CompileSuperPrimitive(ConfigForShape(SuperPrimitiveConfig::Torus));
+	MeshBuffer* reference = GenerateMesh(*density);
+
+	WritePly(plyPath, reference);
+	WriteObj(objPath, reference);
+	for (int i = 0; i < 2; i++)
+	{
+		ngJobSystem* jobs = i == 0 ? nullptr : jobSystem;
+
+		MeshBuffer* ply = ngMeshLoadFromFile(plyPath, jobs);
+		CHECK(ply && SameGeometry(ply, reference), "ply round trip");
+		CHECK(ply && CountBoundaryEdges(ply) == 0, "ply round trip");
+		FreeMeshBuffer(ply);
+
+		MeshBuffer* obj = ngMeshLoadFromFile(objPath, jobs);
+		CHECK(obj && SameGeometry(obj, reference), "obj round trip");
+		FreeMeshBuffer(obj);
+	}
+
+	remove(objPath);
+	remove(plyPath);
+
+	FreeMeshBuffer(reference);
+	DestroyDensityProgram(density);
+}
+
+// ----------------------------------------------------------------------------
+
+int main()
+{
+	ngJobSystem* jobSystem = ngJobSystemCreate(4);
+
+	TestShapesAreWatertight();
+	TestOutputIsDeterministic();
+	TestChunkSeamsWeld(jobSystem);
+	TestMeshStreaming(jobSystem);
+	TestSeededChunks(jobSystem);
+	TestMeshingState(jobSystem);
+	TestSpecialisedScene(jobSystem);
+	TestDenseVolume(jobSystem);
+	TestSparseVolume(jobSystem);
+	TestHermiteData(jobSystem);
+	TestPlacementModes();
+	TestLodClipmap(jobSystem);
+	TestOctreeMesh();
+	TestTraceExport();
+	TestSimplifier();
+	TestMeshCache();
+	TestMeshLoader(jobSystem);
+
+	ngJobSystemDestroy(jobSystem);
+
+	printf("%d checks, %d failed\n", g_numChecks, g_numFailures);
+	return g_numFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// ----------------------------------------------------------------------------
+